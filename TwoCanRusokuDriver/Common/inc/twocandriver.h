@@ -41,6 +41,9 @@ typedef unsigned char byte;
 // Length of a CAN v2.0 header
 #define CONST_HEADER_LENGTH 4
 
+// Length of a TwoCan frame, header followed by 8 data bytes
+#define CONST_FRAME_LENGTH 12
+
 // Length of an array 
 #define COUNT(x)  (sizeof(x) / sizeof((x)[0]))
 
@@ -20,8 +20,7 @@
 #ifndef TWOCAN_ERROR_H
 #define TWOCAN_ERROR_H
 
-#define WINDOWS_LEAN_AND_MEAN
-#include <windows.h>
+#include "twocanplatform.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -116,4 +115,6 @@ char *GetErrorMessage(int win32ErrorCode);
 #define TWOCAN_ERROR_SOCKET_BIND 42
 #define TWOCAN_ERROR_SOCKET_FLAGS 43
 #define TWOCAN_ERROR_SOCKET_READ 44
+#define TWOCAN_ERROR_TRANSMIT_WOULD_BLOCK 45
+#define TWOCAN_ERROR_INVALID_ARGUMENT 46
 #endif
\ No newline at end of file
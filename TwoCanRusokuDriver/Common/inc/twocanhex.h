@@ -0,0 +1,53 @@
+// Copyright(C) 2018 by Steven Adler
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef TWOCAN_HEX_H
+#define TWOCAN_HEX_H
+
+#include "twocanplatform.h"
+
+// Hexadecimal text conversion for log files and serial adapters. Long strings are converted
+// 16 or 32 characters at a time with SSE2, AVX2 or NEON where the processor has them.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Decode hexadecimal digits, two per byte, the first digit of each pair is the high nibble
+// [in] hex, digits, upper or lower case, need not be terminated
+// [in] digits, number of digits
+// [out] bytes, receives digits / 2 bytes
+// returns digits if every digit was valid, otherwise the position of the first invalid digit,
+// or of the last digit if there is an odd number of them. Bytes before that position are decoded.
+size_t DecodeHexString(const char *hex, size_t digits, UINT8 *bytes);
+
+// Decode at most 8 hexadecimal digits as a single value, for example a CAN identifier
+// returns digits if every digit was valid, otherwise the position of the first invalid digit
+size_t DecodeHexValue(const char *hex, size_t digits, UINT32 *value);
+
+// Encode bytes as upper case hexadecimal, two digits per byte
+// [out] hex, receives count * 2 digits, not terminated
+void EncodeHexString(const UINT8 *bytes, size_t count, char *hex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+// Copyright(C) 2018 by Steven Adler
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef TWOCAN_PLATFORM_H
+#define TWOCAN_PLATFORM_H
+
+// Platform neutral modules (queues, decoders, filters, the instance core) use the Win32 integer
+// types, the Interlocked primitives, and the Win32 events, threads and slim reader/writer locks.
+// On Windows these come from windows.h. Elsewhere the types and Interlocked primitives are mapped
+// onto the C runtime and the GCC/Clang atomic builtins, and the events, threads and locks onto
+// POSIX threads in twocanplatform.c.
+
+#if defined(_WIN32)
+
+#define WINDOWS_LEAN_AND_MEAN
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+#include <pthread.h>
+
+typedef int BOOL;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef unsigned int UINT;
+typedef unsigned char UCHAR;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef void *HANDLE;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define InterlockedIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, v, c) __sync_val_compare_and_swap((p), (c), (v))
+#define MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define ReadAcquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WriteRelease(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ReadNoFence(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define WriteNoFence(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define ReadNoFence64(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define WriteNoFence64(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define InterlockedExchangePointer(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define ReadPointerAcquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+#if defined(__i386__) || defined(__x86_64__)
+#define YieldProcessor() __builtin_ia32_pause()
+#else
+#define YieldProcessor() ((void)0)
+#endif
+
+#define WINAPI
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID parameter);
+
+// Slim reader/writer lock, not recursive, released by the thread that acquired it
+typedef pthread_rwlock_t SRWLOCK;
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+#define InitializeSRWLock(l) pthread_rwlock_init((l), NULL)
+#define AcquireSRWLockShared(l) pthread_rwlock_rdlock(l)
+#define ReleaseSRWLockShared(l) pthread_rwlock_unlock(l)
+#define AcquireSRWLockExclusive(l) pthread_rwlock_wrlock(l)
+#define ReleaseSRWLockExclusive(l) pthread_rwlock_unlock(l)
+
+// Unnamed events and threads only, a handle is closed with CloseHandle
+HANDLE	CreateEvent(void *attributes, BOOL manualReset, BOOL initialState, const wchar_t *name);
+BOOL	SetEvent(HANDLE event);
+BOOL	ResetEvent(HANDLE event);
+HANDLE	CreateThread(void *attributes, size_t stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags, DWORD *threadId);
+DWORD	WaitForSingleObject(HANDLE handle, DWORD timeout);
+BOOL	CloseHandle(HANDLE handle);
+void	Sleep(DWORD milliseconds);
+ULONGLONG	GetTickCount64(void);
+DWORD	GetLastError(void);
+
+#endif
+
+// Byte order conversion, compiled to a single byte swap instruction
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#define TWOCAN_BSWAP32(x) _byteswap_ulong(x)
+#else
+#define TWOCAN_BSWAP32(x) __builtin_bswap32(x)
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define TWOCAN_FROM_BE32(x) (x)
+#define TWOCAN_TO_LE32(x) TWOCAN_BSWAP32(x)
+#else
+#define TWOCAN_FROM_BE32(x) TWOCAN_BSWAP32(x)
+#define TWOCAN_TO_LE32(x) (x)
+#endif
+
+#endif
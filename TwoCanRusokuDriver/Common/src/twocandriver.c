@@ -28,6 +28,7 @@
 
 
 #include "..\inc\twocandriver.h"
+#include "..\inc\twocanhex.h"
 
 //
 // Reverse the 4 byte header as Cantact device seems to present the header as Big Endian
@@ -47,28 +48,16 @@ void ReverseHeader(byte* buf)
 //
 // Convert hexadecimal string to byte array
 // [in]hexstr, pointer to array of hexadecimal characters
-// [in]len, number of hexadecimal characters
+// [in]len, number of bytes, twice as many hexadecimal characters are read
 // [out] buf, pointer to byte array
-// returns error code
+// returns TRUE, or FALSE if any of the characters is not a hexadecimal digit
 //
 
 int ConvertHexStringToByteArray(const byte *hexstr, const unsigned int len, byte *buf) {
-	// Must be a even number of hexadecimal characters
-	// BUG BUG Another check is to perform an isxdigit on each character
-	if ((len % 2 == 0) && (hexstr != NULL) && (buf != NULL)) {
-		byte val;
-		byte pair[2];
-		for (unsigned int i = 0; i < len; i++) {
-			pair[0] = hexstr[i * 2];
-			pair[1] = hexstr[(i * 2) + 1];
-			val = (byte)strtoul((char *)pair, NULL, 16);
-			buf[i] = val;
-		}
-		return TRUE;
-	}
-	else	{
+	if ((hexstr == NULL) || (buf == NULL)) {
 		return FALSE;
 	}
+	return (DecodeHexString((const char *)hexstr, (size_t)len * 2, buf) == (size_t)len * 2) ? TRUE : FALSE;
 }
 
 //
@@ -0,0 +1,323 @@
+// Copyright(C) 2018 by Steven Adler
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Project: TwoCan
+// Project Description: NMEA2000 Plugin for OpenCPN
+// Unit: TwoCanHex
+// Unit Description: Validated hexadecimal decoding and encoding
+// Function: Converts between hexadecimal text and bytes with a lookup table, and 16 or 32
+// characters at a time with SSE2, AVX2 or NEON, reporting where invalid text starts
+//
+
+#include "../inc/twocanhex.h"
+
+// TWOCAN_HEX_NO_SIMD builds only the lookup table, and TWOCAN_HEX_NO_AVX2 leaves out AVX2, so
+// the tests can hold each kernel to the same results
+#if defined(TWOCAN_HEX_NO_SIMD)
+#elif defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#define TWOCAN_HEX_SSE2
+#include <emmintrin.h>
+#if (defined(_MSC_VER) || defined(__GNUC__)) && !defined(TWOCAN_HEX_NO_AVX2)
+// AVX2 is used only when the processor and operating system support it
+#define TWOCAN_HEX_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TWOCAN_TARGET_AVX2
+#else
+#define TWOCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define TWOCAN_HEX_NEON
+#include <arm_neon.h>
+#endif
+
+// Value of each hexadecimal digit, 0xFF for every other character
+static const UINT8 hexValues[256] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const char hexDigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+//
+// Decode pairs of digits with the lookup table
+// returns digits, or the position of the first invalid digit, or of an odd last digit
+//
+
+static size_t DecodeScalar(const char *hex, size_t digits, UINT8 *bytes) {
+	UINT8 high;
+	UINT8 low;
+	size_t i;
+
+	for (i = 0; i + 1 < digits; i += 2) {
+		high = hexValues[(UINT8)hex[i]];
+		low = hexValues[(UINT8)hex[i + 1]];
+		if (((high | low) & 0xF0) != 0) {
+			return (high > 0x0F) ? i : i + 1;
+		}
+		bytes[i / 2] = (UINT8)((high << 4) | low);
+	}
+	return (i < digits) ? i : digits;
+}
+
+#if defined(TWOCAN_HEX_SSE2)
+
+//
+// Decode 16 digits at a time. A digit is c - '0' when that is below 10, a letter is
+// (c | 0x20) - 'a' + 10 when (c | 0x20) - 'a' is below 6. Unsigned comparisons are made
+// as signed comparisons with the sign bit flipped.
+// returns the digits decoded, stopping before the first block containing an invalid digit
+//
+
+static size_t DecodeSse2(const char *hex, size_t digits, UINT8 *bytes) {
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i digitLimit = _mm_set1_epi8((char)(10 ^ 0x80));
+	const __m128i letterLimit = _mm_set1_epi8((char)(6 ^ 0x80));
+	__m128i text, digit, letter, isDigit, isLetter, value, pairs;
+	size_t done;
+
+	for (done = 0; done + 16 <= digits; done += 16) {
+		text = _mm_loadu_si128((const __m128i *)&hex[done]);
+		digit = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+		letter = _mm_sub_epi8(_mm_or_si128(text, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		isDigit = _mm_cmplt_epi8(_mm_xor_si128(digit, bias), digitLimit);
+		isLetter = _mm_cmplt_epi8(_mm_xor_si128(letter, bias), letterLimit);
+
+		if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF) {
+			break;
+		}
+
+		// Each 16 bit lane holds a pair, the high nibble in its low byte
+		value = _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+		pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(value, 8));
+		_mm_storel_epi64((__m128i *)&bytes[done / 2], _mm_packus_epi16(pairs, pairs));
+	}
+	return done;
+}
+
+static size_t EncodeSse2(const UINT8 *bytes, size_t count, char *hex) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i data, high, low, first, second;
+	size_t done;
+
+	for (done = 0; done + 16 <= count; done += 16) {
+		data = _mm_loadu_si128((const __m128i *)&bytes[done]);
+		high = _mm_and_si128(_mm_srli_epi16(data, 4), nibble);
+		low = _mm_and_si128(data, nibble);
+		first = _mm_unpacklo_epi8(high, low);
+		second = _mm_unpackhi_epi8(high, low);
+
+		// '0' to '9', and 'A' to 'F' 7 characters further on
+		first = _mm_add_epi8(_mm_add_epi8(first, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(first, _mm_set1_epi8(9)), _mm_set1_epi8(7)));
+		second = _mm_add_epi8(_mm_add_epi8(second, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(second, _mm_set1_epi8(9)), _mm_set1_epi8(7)));
+		_mm_storeu_si128((__m128i *)&hex[done * 2], first);
+		_mm_storeu_si128((__m128i *)&hex[(done * 2) + 16], second);
+	}
+	return done;
+}
+
+#endif
+
+#if defined(TWOCAN_HEX_AVX2)
+
+static BOOL HasAvx2(void) {
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return FALSE;
+	}
+
+	// AVX and OSXSAVE, and the operating system saves the YMM registers
+	__cpuid(info, 1);
+	if (((info[2] & (1 << 27)) == 0) || ((info[2] & (1 << 28)) == 0) || ((_xgetbv(0) & 0x06) != 0x06)) {
+		return FALSE;
+	}
+
+	__cpuidex(info, 7, 0);
+	return ((info[1] & (1 << 5)) != 0);
+#else
+	__builtin_cpu_init();
+	return (__builtin_cpu_supports("avx2") != 0);
+#endif
+}
+
+//
+// As DecodeSse2, 32 digits at a time
+//
+
+TWOCAN_TARGET_AVX2 static size_t DecodeAvx2(const char *hex, size_t digits, UINT8 *bytes) {
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const __m256i digitLimit = _mm256_set1_epi8((char)(10 ^ 0x80));
+	const __m256i letterLimit = _mm256_set1_epi8((char)(6 ^ 0x80));
+	__m256i text, digit, letter, isDigit, isLetter, value, pairs;
+	size_t done;
+
+	for (done = 0; done + 32 <= digits; done += 32) {
+		text = _mm256_loadu_si256((const __m256i *)&hex[done]);
+		digit = _mm256_sub_epi8(text, _mm256_set1_epi8('0'));
+		letter = _mm256_sub_epi8(_mm256_or_si256(text, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+		isDigit = _mm256_cmpgt_epi8(digitLimit, _mm256_xor_si256(digit, bias));
+		isLetter = _mm256_cmpgt_epi8(letterLimit, _mm256_xor_si256(letter, bias));
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter)) != -1) {
+			break;
+		}
+
+		value = _mm256_or_si256(_mm256_and_si256(isDigit, digit), _mm256_and_si256(isLetter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+		pairs = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(value, _mm256_set1_epi16(0x00FF)), 4), _mm256_srli_epi16(value, 8));
+
+		// Packing works within each 128 bit half, gather the two low quarters
+		pairs = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0xD8);
+		_mm_storeu_si128((__m128i *)&bytes[done / 2], _mm256_castsi256_si128(pairs));
+	}
+	return done;
+}
+
+#endif
+
+#if defined(TWOCAN_HEX_NEON)
+
+//
+// Decode 16 digits at a time, with the same classification as DecodeSse2
+//
+
+static size_t DecodeNeon(const char *hex, size_t digits, UINT8 *bytes) {
+	uint8x16_t text, digit, letter, isDigit, isLetter, value;
+	uint8x16x2_t pairs;
+	size_t done;
+
+	for (done = 0; done + 16 <= digits; done += 16) {
+		text = vld1q_u8((const uint8_t *)&hex[done]);
+		digit = vsubq_u8(text, vdupq_n_u8('0'));
+		letter = vsubq_u8(vorrq_u8(text, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+		isDigit = vcltq_u8(digit, vdupq_n_u8(10));
+		isLetter = vcltq_u8(letter, vdupq_n_u8(6));
+
+		if (vminvq_u8(vorrq_u8(isDigit, isLetter)) != 0xFF) {
+			break;
+		}
+
+		value = vorrq_u8(vandq_u8(isDigit, digit), vandq_u8(isLetter, vaddq_u8(letter, vdupq_n_u8(10))));
+
+		// High nibbles are the even digits, low nibbles the odd ones
+		pairs = vuzpq_u8(value, value);
+		vst1_u8(&bytes[done / 2], vorr_u8(vshl_n_u8(vget_low_u8(pairs.val[0]), 4), vget_low_u8(pairs.val[1])));
+	}
+	return done;
+}
+
+static size_t EncodeNeon(const UINT8 *bytes, size_t count, char *hex) {
+	uint8x16_t data;
+	uint8x16x2_t nibbles;
+	size_t done;
+
+	for (done = 0; done + 16 <= count; done += 16) {
+		data = vld1q_u8(&bytes[done]);
+		nibbles = vzipq_u8(vshrq_n_u8(data, 4), vandq_u8(data, vdupq_n_u8(0x0F)));
+
+		for (int i = 0; i < 2; i++) {
+			nibbles.val[i] = vaddq_u8(vaddq_u8(nibbles.val[i], vdupq_n_u8('0')), vandq_u8(vcgtq_u8(nibbles.val[i], vdupq_n_u8(9)), vdupq_n_u8(7)));
+			vst1q_u8((uint8_t *)&hex[(done * 2) + (i * 16)], nibbles.val[i]);
+		}
+	}
+	return done;
+}
+
+#endif
+
+size_t DecodeHexString(const char *hex, size_t digits, UINT8 *bytes) {
+	size_t done = 0;
+	size_t position;
+
+#if defined(TWOCAN_HEX_AVX2)
+	static volatile LONG avx2 = -1;
+
+	if (ReadNoFence(&avx2) < 0) {
+		WriteNoFence(&avx2, HasAvx2());
+	}
+	if (ReadNoFence(&avx2) > 0) {
+		done = DecodeAvx2(hex, digits, bytes);
+	}
+#endif
+
+#if defined(TWOCAN_HEX_SSE2)
+	done += DecodeSse2(&hex[done], digits - done, &bytes[done / 2]);
+#elif defined(TWOCAN_HEX_NEON)
+	done += DecodeNeon(&hex[done], digits - done, &bytes[done / 2]);
+#endif
+
+	// The remainder, or the block holding the first invalid digit
+	position = DecodeScalar(&hex[done], digits - done, &bytes[done / 2]);
+	return done + position;
+}
+
+size_t DecodeHexValue(const char *hex, size_t digits, UINT32 *value) {
+	UINT32 result = 0;
+	UINT8 digit;
+
+	if (digits > 8) {
+		digits = 8;
+	}
+
+	for (size_t i = 0; i < digits; i++) {
+		digit = hexValues[(UINT8)hex[i]];
+		if (digit > 0x0F) {
+			*value = result;
+			return i;
+		}
+		result = (result << 4) | digit;
+	}
+
+	*value = result;
+	return digits;
+}
+
+void EncodeHexString(const UINT8 *bytes, size_t count, char *hex) {
+	size_t done = 0;
+
+#if defined(TWOCAN_HEX_SSE2)
+	done = EncodeSse2(bytes, count, hex);
+#elif defined(TWOCAN_HEX_NEON)
+	done = EncodeNeon(bytes, count, hex);
+#endif
+
+	for (; done < count; done++) {
+		hex[done * 2] = hexDigits[bytes[done] >> 4];
+		hex[(done * 2) + 1] = hexDigits[bytes[done] & 0x0F];
+	}
+}
@@ -0,0 +1,262 @@
+// Copyright(C) 2018 by Steven Adler
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Project: TwoCan
+// Project Description: NMEA2000 Plugin for OpenCPN
+// Unit: TwoCanPlatform
+// Unit Description: Win32 events, threads and debug output on POSIX threads
+// Function: Lets the platform neutral modules wait on events and join threads through the
+// Win32 calls they use on Windows. Not built on Windows.
+//
+
+#if !defined(_WIN32)
+
+#include "../inc/twocanplatform.h"
+#include "../inc/twocanerror.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef enum _TWOCAN_HANDLE_KIND {
+	TWOCAN_HANDLE_EVENT,
+	TWOCAN_HANDLE_THREAD
+} TWOCAN_HANDLE_KIND;
+
+// An event, or a thread whose handle is signalled once it has returned. A thread holds a
+// reference to its own handle, so the handle may be closed before the thread has finished.
+typedef struct _TWOCAN_HANDLE {
+	TWOCAN_HANDLE_KIND	kind;
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+	BOOL	manualReset;
+	BOOL	signalled;
+	LONG	references;
+	pthread_t	thread;
+	LPTHREAD_START_ROUTINE	start;
+	LPVOID	parameter;
+} TWOCAN_HANDLE;
+
+static TWOCAN_HANDLE *NewHandle(TWOCAN_HANDLE_KIND kind, BOOL manualReset, BOOL signalled, LONG references) {
+	TWOCAN_HANDLE *handle;
+	pthread_condattr_t attributes;
+
+	handle = (TWOCAN_HANDLE *)calloc(1, sizeof(TWOCAN_HANDLE));
+	if (handle == NULL) {
+		return NULL;
+	}
+
+	// Timed waits are measured on the monotonic clock, as the Win32 waits are
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&handle->changed, &attributes);
+	pthread_condattr_destroy(&attributes);
+	pthread_mutex_init(&handle->lock, NULL);
+
+	handle->kind = kind;
+	handle->manualReset = manualReset;
+	handle->signalled = signalled;
+	handle->references = references;
+	return handle;
+}
+
+static void ReleaseHandle(TWOCAN_HANDLE *handle) {
+	if (InterlockedDecrement(&handle->references) == 0) {
+		pthread_cond_destroy(&handle->changed);
+		pthread_mutex_destroy(&handle->lock);
+		free(handle);
+	}
+}
+
+static void Signal(TWOCAN_HANDLE *handle) {
+	pthread_mutex_lock(&handle->lock);
+	handle->signalled = TRUE;
+	pthread_cond_broadcast(&handle->changed);
+	pthread_mutex_unlock(&handle->lock);
+}
+
+static void *ThreadMain(void *parameter) {
+	TWOCAN_HANDLE *handle = (TWOCAN_HANDLE *)parameter;
+
+	handle->start(handle->parameter);
+	Signal(handle);
+	ReleaseHandle(handle);
+	return NULL;
+}
+
+//
+// Create an unnamed event
+// [in] manualReset, FALSE for an event a successful wait resets
+// [in] initialState, TRUE to create the event signalled
+// [in] name, must be NULL, named events are not supported
+// returns the event, NULL on failure
+//
+
+HANDLE CreateEvent(void *attributes, BOOL manualReset, BOOL initialState, const wchar_t *name) {
+	(void)attributes;
+
+	if (name != NULL) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+	return NewHandle(TWOCAN_HANDLE_EVENT, manualReset, initialState, 1);
+}
+
+BOOL SetEvent(HANDLE event) {
+	Signal((TWOCAN_HANDLE *)event);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event) {
+	TWOCAN_HANDLE *handle = (TWOCAN_HANDLE *)event;
+
+	pthread_mutex_lock(&handle->lock);
+	handle->signalled = FALSE;
+	pthread_mutex_unlock(&handle->lock);
+	return TRUE;
+}
+
+//
+// Start a thread, its handle is signalled once start has returned
+// returns the thread's handle, NULL on failure
+//
+
+HANDLE CreateThread(void *attributes, size_t stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags, DWORD *threadId) {
+	TWOCAN_HANDLE *handle;
+	int result;
+
+	(void)attributes;
+	(void)stackSize;
+	(void)flags;
+
+	handle = NewHandle(TWOCAN_HANDLE_THREAD, TRUE, FALSE, 2);
+	if (handle == NULL) {
+		return NULL;
+	}
+
+	handle->start = start;
+	handle->parameter = parameter;
+	result = pthread_create(&handle->thread, NULL, ThreadMain, handle);
+	if (result != 0) {
+		free(handle);
+		errno = result;
+		return NULL;
+	}
+
+	if (threadId != NULL) {
+		*threadId = 0;
+	}
+	return handle;
+}
+
+//
+// Wait for an event to be signalled or a thread to return
+// [in] timeout, milliseconds, or INFINITE
+// returns WAIT_OBJECT_0, or WAIT_TIMEOUT
+//
+
+DWORD WaitForSingleObject(HANDLE object, DWORD timeout) {
+	TWOCAN_HANDLE *handle = (TWOCAN_HANDLE *)object;
+	struct timespec deadline;
+	DWORD result = WAIT_OBJECT_0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&handle->lock);
+	while (handle->signalled == FALSE) {
+		if (timeout == INFINITE) {
+			pthread_cond_wait(&handle->changed, &handle->lock);
+		}
+		else if (pthread_cond_timedwait(&handle->changed, &handle->lock, &deadline) == ETIMEDOUT) {
+			result = WAIT_TIMEOUT;
+			break;
+		}
+	}
+
+	if ((result == WAIT_OBJECT_0) && (handle->manualReset == FALSE)) {
+		handle->signalled = FALSE;
+	}
+	pthread_mutex_unlock(&handle->lock);
+	return result;
+}
+
+//
+// Close an event, or the handle of a thread, which keeps running if it has not yet returned
+//
+
+BOOL CloseHandle(HANDLE object) {
+	TWOCAN_HANDLE *handle = (TWOCAN_HANDLE *)object;
+
+	if (handle == NULL) {
+		return FALSE;
+	}
+
+	if (handle->kind == TWOCAN_HANDLE_THREAD) {
+		pthread_detach(handle->thread);
+	}
+	ReleaseHandle(handle);
+	return TRUE;
+}
+
+void Sleep(DWORD milliseconds) {
+	struct timespec interval;
+
+	interval.tv_sec = (time_t)(milliseconds / 1000);
+	interval.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+	while ((nanosleep(&interval, &interval) != 0) && (errno == EINTR)) {
+	}
+}
+
+ULONGLONG GetTickCount64(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((ULONGLONG)now.tv_sec * 1000) + ((ULONGLONG)now.tv_nsec / 1000000);
+}
+
+DWORD GetLastError(void) {
+	return (DWORD)errno;
+}
+
+// Formatted debug output, there is no debugger output so it goes to stderr when TWOCAN_DEBUG is set
+void DebugPrintf(wchar_t *fmt, ...)
+{
+	va_list argp;
+	wchar_t dbg_out[8192];
+
+	if (getenv("TWOCAN_DEBUG") == NULL) {
+		return;
+	}
+
+	va_start(argp, fmt);
+	vswprintf(dbg_out, sizeof(dbg_out) / sizeof(wchar_t), fmt, argp);
+	va_end(argp);
+	fprintf(stderr, "%ls", dbg_out);
+}
+
+#endif
@@ -26,6 +26,25 @@
 
 #include "..\common\inc\twocandriver.h"
 #include "..\inc\toucan_hardware.h"
+#include "..\inc\toucan_adapter.h"
+#include "..\inc\toucan_capture.h"
+#include "..\inc\toucan_channel.h"
+#include "..\inc\toucan_clock.h"
+#include "..\inc\toucan_decode.h"
+#include "..\inc\toucan_fastpacket.h"
+#include "..\inc\toucan_filter.h"
+#include "..\inc\toucan_header.h"
+#include "..\inc\toucan_health.h"
+#include "..\inc\toucan_instance.h"
+#include "..\inc\toucan_latency.h"
+#include "..\inc\toucan_merge.h"
+#include "..\inc\toucan_replay.h"
+#include "..\inc\toucan_ring.h"
+#include "..\inc\toucan_simusb.h"
+#include "..\inc\toucan_stats.h"
+#include "..\inc\toucan_trace.h"
+#include "..\inc\toucan_subscription.h"
+#include "..\inc\toucan_txqueue.h"
 
 // Win32 functions
 #define WINDOWS_LEAN_AND_MEAN
@@ -36,6 +55,37 @@
 
 #define DllExport __declspec( dllexport )
 
+// Frame timestamp sources, see SetTimestampMode
+#define TOUCAN_TIMESTAMP_MODE_HOST 0
+#define TOUCAN_TIMESTAMP_MODE_DEVICE 1
+
+// SetTimestampMode options
+#define TOUCAN_TIMESTAMP_OPTION_DELAY 0x00000001
+
+// Number of values per rule passed to SetFilterRules: action, pgn, source, destination and priority
+#define TOUCAN_FILTER_RULE_FIELDS 5
+
+// Transmit modes, see SetTransmitMode
+#define TOUCAN_TRANSMIT_MODE_DIRECT 0
+#define TOUCAN_TRANSMIT_MODE_QUEUED 1
+
+// Longest coalescing deadline accepted by SetTransmitCoalescing, in milliseconds
+#define TOUCAN_MAX_TRANSMIT_DEADLINE 100
+
+// Number of frames WriteAdapterBatch encodes per pass
+#define TOUCAN_WRITE_BATCH 48
+
+// Number of frames DrainAdapter copies out of the receive queue per pass
+#define TOUCAN_DRAIN_BATCH 64
+
+// Longest notification deadline accepted by SetNotificationModeration, in microseconds
+#define TOUCAN_MAX_NOTIFY_DEADLINE 1000000
+
+// Called by the bus monitor thread when the bus condition changes, see SetBusHealthCallback
+// [in] condition, previous, TOUCAN_BUS_xxx
+// [in] errorCode, HAL_CAN_ERROR_xxx bits of the last poll, state bits may remain from earlier polls
+typedef void (*BusHealthCallback)(void* context, int handle, int condition, int previous, unsigned int errorCode);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,11 +97,80 @@ extern "C" {
 	DllExport int CloseAdapter(void);
 	DllExport int ReadAdapter(byte* frame);
 	DllExport int WriteAdapter(const unsigned int id, const int dataLength, byte* data);
+	DllExport int WriteAdapterBatch(const unsigned int* ids, const int* dataLengths, byte* data, const int count);
+	DllExport int SetTransmitCoalescing(const unsigned int deadline);
+	DllExport int SetTransmitMode(const int mode, const unsigned int laneDepth);
+	DllExport int SetReadPipeline(const unsigned int queueDepth, const unsigned int bufferSize);
+	DllExport int SetReceiveMode(const int mode, const unsigned int depth);
+	DllExport int DrainAdapter(byte* frames, const int maxFrames, int* frameCount);
+	DllExport int GetStatistics(TOUCAN_STATISTICS* statistics);
+	DllExport int GetTransferHistogram(unsigned int* counts, const int size, int* buckets);
+	DllExport int GetLatencyHistogram(unsigned int* counts, unsigned int* bounds, const int size, int* buckets);
+	DllExport int ClearDeviceStatistics(void);
+	DllExport int SetTimestampMode(const int mode, const unsigned int options);
+	DllExport int DrainAdapterTimestamped(byte* frames, long long* hostTimes, unsigned int* deviceTimes, const int maxFrames, int* frameCount);
+	DllExport int SetPgnFilter(const unsigned int* pgns, const byte* sources, const int count);
+	DllExport int SetFilterRules(const unsigned int* rules, const int count, const int defaultAction);
+	DllExport int ReadMessage(unsigned int* id, byte* payload, int* length, long long* hostTime);
+	DllExport int SetFastPacketPgns(const unsigned int* pgns, const int count);
+	DllExport int WriteMessage(const unsigned int pgn, const int priority, const int source, const int destination, byte* payload, const int length);
+	DllExport int DecodeHeader(const byte* frame, CanHeader* header);
+	DllExport int DecodeHeaders(const byte* frames, const int count, unsigned int* pgns, byte* priorities, byte* sources, byte* destinations);
+	DllExport int SetAdapterSimulation(const int mode, const unsigned int busLoad, const unsigned int burstFrames, const unsigned int burstPeriod, const unsigned int seed);
+	DllExport int GetPerformanceReport(char* report, const int size);
+	DllExport int SetNotificationModeration(const unsigned int frames, const unsigned int deadline);
+	DllExport int SetSharedChannel(const int enable, const char* name, const unsigned int slots);
+	DllExport int OpenSharedChannel(const char* name);
+	DllExport int ReadSharedChannel(byte* frames, long long* hostTimes, const int maxFrames, int* frameCount, unsigned int* lost);
+	DllExport int CloseSharedChannel(void);
+	DllExport int StartCapture(const char* path, const unsigned int blockRecords);
+	DllExport int StopCapture(void);
+	DllExport int GetCaptureStatistics(unsigned int* records, unsigned int* dropped, unsigned int* writeErrors);
+	DllExport int OpenCapture(const char* path, unsigned long long* records, long long* startTime);
+	DllExport int SeekCapture(const long long hostTime, unsigned long long* position);
+	DllExport int ReadCapture(byte* frames, long long* hostTimes, unsigned int* deviceTimes, byte* directions, const int maxFrames, int* frameCount);
+	DllExport int CloseCapture(void);
+	DllExport int SetAdapterReplay(const char* path, const int format, const unsigned int speed, const int loop);
+	DllExport int GetReplayStatistics(unsigned int* frames, unsigned int* rejected, unsigned int* passes, int* finished);
+	DllExport int GetAdapterCount(int* count);
+	DllExport int OpenAdapterInstance(const int index, const unsigned int serialNumber, int* handle);
+	DllExport int CloseAdapterInstance(const int handle);
+	DllExport int GetAdapterInstanceInfo(const int handle, int* index, unsigned int* serialNumber);
+	DllExport int WaitAdapterInstances(const int* handles, const int count, const unsigned int timeout, int* ready);
+	DllExport int DrainAdapterInstance(const int handle, byte* frames, long long* hostTimes, unsigned int* deviceTimes, const int maxFrames, int* frameCount);
+	DllExport int WriteAdapterInstance(const int handle, const unsigned int id, const int dataLength, byte* data);
+	DllExport int GetAdapterInstanceStatistics(const int handle, unsigned int* frames, unsigned int* overflows, unsigned int* errors, unsigned int* transmitted, unsigned int* transmitFailures);
+	DllExport int SetInstanceMerge(const int* handles, const int count, const unsigned int window);
+	DllExport int DrainMerged(byte* frames, long long* hostTimes, unsigned int* deviceTimes, int* handles, const int maxFrames, int* frameCount);
+	DllExport int GetMergeStatistics(unsigned int* merged, unsigned int* late, unsigned int* overflows);
+	DllExport int StartTraceOutput(const unsigned int interval);
+	DllExport int StopTraceOutput(void);
+	DllExport int DumpTrace(const char* path);
+	DllExport int GetTraceStatistics(unsigned int* recorded, unsigned int* dropped);
+	DllExport int StartBusMonitor(const unsigned int interval);
+	DllExport int StopBusMonitor(void);
+	DllExport int SetBusHealthCallback(BusHealthCallback callback, void* context);
+	DllExport int GetBusHealth(int* condition, int* state, unsigned int* errorCode);
+	DllExport int GetAdapterInstanceHealth(const int handle, int* condition, int* state, unsigned int* errorCode);
 
 #ifdef __cplusplus
 }
 #endif
 
-DWORD WINAPI ReadThread(LPVOID lParam);
+DWORD WINAPI CaptureThread(LPVOID lParam);
+DWORD WINAPI TraceThread(LPVOID lParam);
+DWORD WINAPI BusMonitorThread(LPVOID lParam);
+void CaptureFrames(void* context, const TOUCAN_FRAME* frames, UINT32 count, UINT8 direction);
+void ConvertToTwoCanFrame(const TOUCAN_FRAME* frame, byte* buf);
+UINT32 FrameId(const byte* buf);
+TOUCAN_INSTANCE* AcquireInstance(int handle);
+void ReleaseInstance(int handle);
+void TransmitCounters(UINT32* frames, UINT32* transfers);
+BOOL DeliverFrame(void* context, const TOUCAN_FRAME* frame);
+void PublishFrame(void* context, const TOUCAN_FRAME* frame);
+void PaceSimulation(void* context, LONGLONG now);
+BOOL PollHealth(TOUCAN_HEALTH* health, TOUCAN_BACKEND* backend, LONG* condition, LONG* previous, UINT32* errorCode);
+void ReportHealth(int handle, LONG condition, LONG previous, UINT32 errorCode);
+void CloseChannelWriter(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_ADAPTER
+#define _TWOCAN_TOUCAN_ADAPTER
+
+#include "../inc/toucan_backend.h"
+#include "../inc/toucan_replay.h"
+#include "../inc/toucan_simusb.h"
+#include "../inc/toucan_usb.h"
+#if defined(__linux__)
+#include "../inc/toucan_socketcan.h"
+#endif
+#if defined(TOUCAN_LIBUSB)
+#include "../inc/toucan_libusb.h"
+#endif
+
+// Adapters OpenAdapter connects to, see SetAdapterSimulation
+#define TOUCAN_ADAPTER_HARDWARE 0			// The TouCAN adapter, through WinUSB on Windows and libusb elsewhere
+#define TOUCAN_ADAPTER_SIMULATED 1
+#define TOUCAN_ADAPTER_SIMULATED_REAL_TIME 2
+#define TOUCAN_ADAPTER_REPLAY 3
+#define TOUCAN_ADAPTER_SOCKETCAN 4			// A SocketCAN interface, Linux only
+
+// Which transport an adapter is reached through, with the state of each kind of backend.
+// Set kind and the settings of that kind, then TouCAN_adapter_backend fills in the backend
+// an instance is opened on.
+typedef struct _TOUCAN_ADAPTER {
+	int		kind;					// TOUCAN_ADAPTER_xxx
+	TOUCAN_BACKEND	backend;
+
+	// TOUCAN_ADAPTER_SIMULATED and TOUCAN_ADAPTER_SIMULATED_REAL_TIME, the caller sets the Pace function
+	// of a real time simulation
+	TOUCAN_SIM_CONFIG	simulationConfig;
+	TOUCAN_SIM_USB	simulated;
+
+	// TOUCAN_ADAPTER_REPLAY
+	TOUCAN_REPLAY_CONFIG	replayConfig;
+	TOUCAN_REPLAY	replay;
+
+	// USB device of a simulated adapter, or of the adapter on libusb
+	TOUCAN_USB_DEVICE	device;
+	TOUCAN_USB_BACKEND	usb;
+#if defined(TOUCAN_LIBUSB)
+	TOUCAN_LIBUSB_DEVICE	libusb;
+#endif
+
+#if defined(__linux__)
+	// TOUCAN_ADAPTER_SOCKETCAN, an empty name selects TOUCAN_SOCKETCAN_DEFAULT_INTERFACE
+	char	interfaceName[IFNAMSIZ];
+	TOUCAN_SOCKETCAN	socketcan;
+#endif
+} TOUCAN_ADAPTER;
+
+BOOL	TouCAN_adapter_backend(TOUCAN_ADAPTER *adapter);
+
+#endif
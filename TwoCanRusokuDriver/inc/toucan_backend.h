@@ -0,0 +1,59 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_BACKEND
+#define _TWOCAN_TOUCAN_BACKEND
+
+#include "../inc/toucan_frame.h"
+#include "../inc/toucan_transport.h"
+
+// Most frames a single ReadBatch call returns
+#define TOUCAN_MAX_READ_BATCH 32
+
+// Transfers a backend sent on its bulk OUT endpoint, or the interface it stands in for, and the
+// frames they carried. Kept in each backend's state, so adapters open together count their own.
+typedef struct _TOUCAN_TRANSMIT_COUNTERS {
+	volatile LONG	transfers;
+	volatile LONG	frames;
+} TOUCAN_TRANSMIT_COUNTERS;
+
+// Transport backend, the only way the driver reaches the adapter.
+// Control requests are TouCAN class requests (toucan_protocol.h), described by the bmRequestType
+// and bRequest of their USB setup packet. USB backends pass them to the device, other backends
+// emulate the requests the driver issues so the same core runs unchanged.
+// WinUSB is implemented in toucan_hardware.c, SocketCAN in toucan_socketcan.c, and toucan_adapter.c
+// selects the one an adapter is reached through.
+typedef struct _TOUCAN_BACKEND {
+	const char	*name;
+	void	*context;
+	int		(*Open)(void *context);
+	void	(*Close)(void *context);
+	BOOL	(*Control)(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred);
+	BOOL	(*ReadOpen)(void *context, UINT32 queueDepth, UINT32 bufferSize);
+	TOUCAN_TRANSFER_RESULT	(*ReadBatch)(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count);
+	void	(*ReadClose)(void *context);
+	BOOL	(*WriteBatch)(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written);
+	TOUCAN_TRANSMIT_COUNTERS	*transmitted;	// Counted by WriteBatch, in the backend's state
+	SRWLOCK	*requestLock;		// Held over a class request and the last error code read confirming it, in the backend's state
+	UINT32	filterBanks;		// Extended acceptance filters, zero for the adapter's one, which each list / mask request replaces.
+								// With several, each request adds a filter and a reject all clears them.
+} TOUCAN_BACKEND;
+
+#endif
@@ -0,0 +1,149 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+#ifndef _TWOCAN_TOUCAN_CAPTURE
+#define _TWOCAN_TOUCAN_CAPTURE
+
+#include "../inc/toucan_frame.h"
+
+// Identifies a capture file and the layout of its records
+#define TOUCAN_CAPTURE_MAGIC 0x50414354
+#define TOUCAN_CAPTURE_LAYOUT 1
+
+// Records per block, each of the two capture buffers holds one block
+#define TOUCAN_CAPTURE_MIN_BLOCK 64
+#define TOUCAN_CAPTURE_MAX_BLOCK 65536
+#define TOUCAN_CAPTURE_DEFAULT_BLOCK 2048
+
+// Longest a record may wait in a partly filled buffer before it is written, in milliseconds
+#define TOUCAN_CAPTURE_FLUSH_INTERVAL 1000
+
+// Direction of a captured frame
+#define TOUCAN_CAPTURE_RECEIVED 0
+#define TOUCAN_CAPTURE_TRANSMITTED 1
+
+// Outcome of mapping a capture file
+typedef enum {
+	TOUCAN_CAPTURE_MAPPED = 0,
+	TOUCAN_CAPTURE_UNREADABLE = 1,	// Missing, or could not be opened or mapped
+	TOUCAN_CAPTURE_INVALID = 2		// Not a capture file, or written with another record layout
+} TOUCAN_CAPTURE_MAP_RESULT;
+
+// File header. The records follow it, the index follows the records. indexOffset stays zero
+// until the capture is closed, a reader then takes the record count from the file size.
+typedef struct _TOUCAN_CAPTURE_HEADER {
+	UINT32	magic;
+	UINT32	layout;
+	UINT32	recordSize;
+	UINT32	blockRecords;
+	LONGLONG	startTime;		// Host time the capture was opened, in microseconds
+	ULONGLONG	records;
+	ULONGLONG	indexOffset;
+	UINT32	indexEntries;
+	UINT8	reserved[20];
+} TOUCAN_CAPTURE_HEADER;
+
+// Fixed size record, a frame and its device timestamp as they crossed USB
+typedef struct _TOUCAN_CAPTURE_RECORD {
+	LONGLONG	hostTime;
+	UINT32	id;
+	UINT32	timestamp;
+	UINT8	flags;
+	UINT8	length;
+	UINT8	direction;		// TOUCAN_CAPTURE_RECEIVED or TOUCAN_CAPTURE_TRANSMITTED
+	UINT8	reserved0;
+	UINT8	data[TOUCAN_FRAME_DATA_LENGTH];
+	UINT32	reserved1;
+} TOUCAN_CAPTURE_RECORD;
+
+// One entry per block written, the host time of its first record and the file offset of that record
+typedef struct _TOUCAN_CAPTURE_INDEX {
+	LONGLONG	hostTime;
+	ULONGLONG	offset;
+} TOUCAN_CAPTURE_INDEX;
+
+// Writer side. The read thread and the transmit paths append records to the filling buffer,
+// a full or stale buffer is handed to the capture thread, which writes it while the other
+// buffer fills. A frame arriving while both buffers are waiting to be written is dropped
+// rather than holding up the caller. Records keep the order they were appended in, a frame
+// stamped before the previous record, such as a received frame mapped from the adapter's clock
+// after a transmitted one, takes that record's host time, so the host times never decrease
+// and the index can be searched.
+typedef struct _TOUCAN_CAPTURE {
+	TOUCAN_CAPTURE_RECORD	*buffers[2];
+	UINT32	blockRecords;
+	UINT32	filling;				// Buffer records are appended to
+	UINT32	used;					// Records in the filling buffer
+	UINT32	writing;				// Next buffer the capture thread writes
+	UINT32	lengths[2];				// Records in each full buffer
+	volatile LONG	full[2];
+	SRWLOCK	lock;
+	LONGLONG	lastHostTime;		// Host time of the latest record appended
+	ULONGLONG	offset;				// File offset of the next block
+	TOUCAN_CAPTURE_INDEX	*index;
+	UINT32	indexEntries;
+	UINT32	indexCapacity;
+	LONGLONG	startTime;
+	volatile LONG	records;
+	volatile LONG	dropped;
+	volatile LONG	writeErrors;
+#if defined(_WIN32)
+	HANDLE	file;
+#else
+	int		descriptor;
+#endif
+} TOUCAN_CAPTURE;
+
+// Bytes of a capture file mapped at a time, a multiple of the mapping granularity that holds
+// the largest block, so a seek narrowed to one block by the index maps a single window
+#define TOUCAN_CAPTURE_WINDOW 0x400000
+#define TOUCAN_CAPTURE_GRANULARITY 0x10000
+
+// Reader side, a capture file complete or still being written. The header and index are read,
+// the records are mapped read only a window at a time around the position being read.
+typedef struct _TOUCAN_CAPTURE_READER {
+	TOUCAN_CAPTURE_HEADER	header;
+	TOUCAN_CAPTURE_INDEX	*index;
+	ULONGLONG	count;
+	UINT32	indexEntries;
+	ULONGLONG	cursor;				// Next record TouCAN_capture_next returns
+	ULONGLONG	size;				// File size when it was mapped
+	const UINT8	*view;				// Current window, NULL until a record is read
+	ULONGLONG	viewOffset;			// File offset of the window
+	size_t	viewLength;
+#if defined(_WIN32)
+	HANDLE	file;
+	HANDLE	mapping;
+#else
+	int		descriptor;
+#endif
+} TOUCAN_CAPTURE_READER;
+
+BOOL	TouCAN_capture_open(TOUCAN_CAPTURE *capture, const char *path, UINT32 blockRecords, LONGLONG startTime);
+BOOL	TouCAN_capture_append(TOUCAN_CAPTURE *capture, const TOUCAN_FRAME *frames, UINT32 count, UINT8 direction);
+BOOL	TouCAN_capture_rotate(TOUCAN_CAPTURE *capture);
+BOOL	TouCAN_capture_write(TOUCAN_CAPTURE *capture);
+BOOL	TouCAN_capture_close(TOUCAN_CAPTURE *capture);
+
+TOUCAN_CAPTURE_MAP_RESULT	TouCAN_capture_map(TOUCAN_CAPTURE_READER *reader, const char *path);
+void	TouCAN_capture_unmap(TOUCAN_CAPTURE_READER *reader);
+ULONGLONG	TouCAN_capture_seek(TOUCAN_CAPTURE_READER *reader, LONGLONG hostTime);
+UINT32	TouCAN_capture_next(TOUCAN_CAPTURE_READER *reader, TOUCAN_FRAME *frames, UINT8 *directions, UINT32 maxFrames);
+
+#endif
@@ -0,0 +1,88 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_CHANNEL
+#define _TWOCAN_TOUCAN_CHANNEL
+
+#include "../inc/toucan_ring.h"
+
+// Identifies a frame channel and the layout of its shared memory
+#define TOUCAN_CHANNEL_MAGIC 0x52464354
+#define TOUCAN_CHANNEL_LAYOUT 1
+
+// Channel depth limits, depth is always rounded up to a power of two
+#define TOUCAN_CHANNEL_MIN_SLOTS 64
+#define TOUCAN_CHANNEL_MAX_SLOTS 65536
+#define TOUCAN_CHANNEL_DEFAULT_SLOTS 4096
+
+// Longest channel name, including the terminator
+#define TOUCAN_CHANNEL_MAX_NAME 64
+
+// Name used when none is given, a file mapping name on Windows and a POSIX shared memory name elsewhere
+#if defined(_WIN32)
+#define TOUCAN_CHANNEL_DEFAULT_NAME "Local\\TwoCanFrames"
+#else
+#define TOUCAN_CHANNEL_DEFAULT_NAME "/twocan-frames"
+#endif
+
+// Shared header. published counts the frames ever written, the frame with sequence s
+// lives in slot s & (slots - 1) until it is overwritten slots frames later.
+typedef struct _TOUCAN_CHANNEL_HEADER {
+	UINT32	magic;
+	UINT32	layout;
+	UINT32	slots;
+	UINT32	slotSize;
+	UINT8	padding0[TOUCAN_CACHE_LINE - 16];
+	volatile LONG	published;
+	UINT8	padding1[TOUCAN_CACHE_LINE - sizeof(LONG)];
+} TOUCAN_CHANNEL_HEADER;
+
+// A slot is stamped with twice the sequence of its frame, plus one while the frame is being written
+typedef struct _TOUCAN_CHANNEL_SLOT {
+	volatile LONG	version;
+	UINT32	reserved;
+	TOUCAN_FRAME	frame;
+} TOUCAN_CHANNEL_SLOT;
+
+// One process's view of a channel. The read thread is the only writer, any number of readers
+// in any number of processes follow it at their own pace without locks. A reader the writer
+// laps skips ahead to the oldest frame still held and counts the frames it missed.
+typedef struct _TOUCAN_CHANNEL {
+	TOUCAN_CHANNEL_HEADER	*header;
+	TOUCAN_CHANNEL_SLOT	*slots;
+	UINT32	mask;
+	UINT32	cursor;			// Sequence of the next frame this reader reads
+	UINT32	lost;			// Frames this reader missed because it was lapped
+	BOOL	writer;
+	size_t	size;
+#if defined(_WIN32)
+	HANDLE	mapping;
+#else
+	int		descriptor;
+#endif
+} TOUCAN_CHANNEL;
+
+BOOL	TouCAN_channel_create(TOUCAN_CHANNEL *channel, const char *name, UINT32 slots);
+BOOL	TouCAN_channel_open(TOUCAN_CHANNEL *channel, const char *name);
+void	TouCAN_channel_close(TOUCAN_CHANNEL *channel);
+void	TouCAN_channel_publish(TOUCAN_CHANNEL *channel, const TOUCAN_FRAME *frames, UINT32 count);
+UINT32	TouCAN_channel_read(TOUCAN_CHANNEL *channel, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *lost);
+
+#endif
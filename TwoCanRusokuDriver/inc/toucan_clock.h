@@ -0,0 +1,66 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_CLOCK
+#define _TWOCAN_TOUCAN_CLOCK
+
+#include "../Common/inc/twocanplatform.h"
+
+// Nominal rate of the timestamp in the TouCAN USB records, one tick per microsecond
+#define TOUCAN_TIMESTAMP_FREQUENCY 1000000
+
+// Length of a correlation window in host microseconds. The least delayed packet of each
+// window anchors the mapping, successive anchors give the drift between the two clocks.
+#define TOUCAN_CLOCK_WINDOW 1000000
+
+// Weight given to each new drift measurement, 1 / TOUCAN_CLOCK_SMOOTHING
+#define TOUCAN_CLOCK_SMOOTHING 8
+
+// Drift measurements beyond this are treated as outliers, in parts per million
+#define TOUCAN_CLOCK_MAX_DRIFT 1000
+
+// Maps the 32 bit device timestamp onto the host's monotonic clock.
+// Host times are in microseconds, device times in device ticks. Only the read thread updates it.
+typedef struct _TOUCAN_CLOCK {
+	double		tickPeriod;			// Nominal microseconds per device tick
+	double		rate;				// Host microseconds per nominal device microsecond
+	BOOL		started;
+	UINT32		lastTicks;			// Raw timestamp of the latest sample
+	LONGLONG	deviceTime;			// lastTicks with the wraparounds added back
+	LONGLONG	deviceBase;			// Reference point of the mapping
+	LONGLONG	hostBase;
+	LONGLONG	windowStart;		// Host time the current window opened
+	LONGLONG	windowDevice;		// Least delayed sample of the current window
+	LONGLONG	windowHost;
+	LONGLONG	windowResidual;
+	BOOL		anchored;			// anchorDevice and anchorHost hold the previous window's sample
+	LONGLONG	anchorDevice;
+	LONGLONG	anchorHost;
+	volatile LONG	synchronised;	// TRUE once a drift measurement has been made
+	volatile LONG	drift;			// Estimated drift in parts per billion, positive if the device clock runs slow
+	volatile LONG	resets;			// Device clock restarts detected
+} TOUCAN_CLOCK;
+
+void		TouCAN_clock_init(TOUCAN_CLOCK *clock, UINT32 tickFrequency);
+void		TouCAN_clock_update(TOUCAN_CLOCK *clock, UINT32 deviceTicks, LONGLONG hostTime);
+LONGLONG	TouCAN_clock_to_host(const TOUCAN_CLOCK *clock, UINT32 deviceTicks);
+LONGLONG	HostMicroseconds(void);
+
+#endif
@@ -0,0 +1,40 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_DECODE
+#define _TWOCAN_TOUCAN_DECODE
+
+#include "../inc/toucan_frame.h"
+
+// Offsets of the fields of an 18 byte USB record, multi byte fields are big endian
+#define TOUCAN_RECORD_FLAGS 0
+#define TOUCAN_RECORD_ID 1
+#define TOUCAN_RECORD_LENGTH_CODE 5
+#define TOUCAN_RECORD_DATA 6
+#define TOUCAN_RECORD_TIMESTAMP 14
+
+// Define TOUCAN_DECODE_SIMD to decode records with SSSE3 or NEON byte shuffles
+// where the compiler targets them, the scalar decoder is used everywhere else.
+// MSVC builds without /arch:AVX check the processor for SSSE3 before using the shuffles.
+
+BOOL	TouCAN_decode_packet(const UINT8 *packet, ULONG length, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count);
+UINT32	TouCAN_encode_record(const TOUCAN_FRAME *frame, UINT8 *record);
+
+#endif
@@ -0,0 +1,62 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_FAKEUSB
+#define _TWOCAN_TOUCAN_FAKEUSB
+
+#include "../inc/toucan_protocol.h"
+#include "../inc/toucan_usb.h"
+
+// Class requests remembered for inspection
+#define TOUCAN_FAKE_USB_MAX_REQUESTS 64
+
+// One bulk IN packet of a script, replayed as the completion of the next read
+typedef struct _TOUCAN_FAKE_PACKET {
+	const UINT8	*data;
+	UINT32	length;
+	TOUCAN_TRANSFER_RESULT	result;		// TOUCAN_TRANSFER_COMPLETE, or TOUCAN_TRANSFER_FAILED to inject a transfer error
+} TOUCAN_FAKE_PACKET;
+
+// A TouCAN USB device without hardware. Reads complete, in submission order, with the packets
+// of the script, an exhausted script behaves like an idle bus. Class requests are logged and
+// bulk OUT transfers are appended to an optional capture buffer. Nothing waits, so a
+// recorded session replays as fast as the driver consumes it.
+typedef struct _TOUCAN_FAKE_USB {
+	const TOUCAN_FAKE_PACKET	*script;
+	UINT32	scriptLength;
+	UINT32	position;					// Next packet to replay
+	BOOL	open;
+	UINT8	*buffers[TOUCAN_MAX_READ_QUEUE_DEPTH];
+	UINT32	bufferLengths[TOUCAN_MAX_READ_QUEUE_DEPTH];
+	UINT8	status;						// Answer to TouCAN_GET_LAST_ERROR_CODE
+	UINT32	serialNumber;				// Answer to TouCAN_GET_SERIAL_NUMBER
+	TOUCAN_DEVICE_STATISTICS	statistics;	// Answer to TouCAN_GET_STATISTICS
+	UINT8	requests[TOUCAN_FAKE_USB_MAX_REQUESTS];
+	UINT32	requestCount;
+	UINT8	*capture;
+	UINT32	captureCapacity;
+	UINT32	captureLength;
+	UINT32	bulkOutTransfers;
+} TOUCAN_FAKE_USB;
+
+void	TouCAN_fakeusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_FAKE_USB *fake, const TOUCAN_FAKE_PACKET *script, UINT32 count);
+void	TouCAN_fakeusb_capture(TOUCAN_FAKE_USB *fake, UINT8 *buffer, UINT32 capacity);
+
+#endif
@@ -0,0 +1,117 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_FASTPACKET
+#define _TWOCAN_TOUCAN_FASTPACKET
+
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_ring.h"
+
+// A fast packet message is at most 32 frames, 6 data bytes in the first and 7 in each of the others
+#define TOUCAN_FAST_PACKET_MAX_FRAMES 32
+#define TOUCAN_FAST_PACKET_MAX_LENGTH 223
+
+// Messages that can be reassembled at the same time
+#define TOUCAN_FAST_PACKET_POOL 32
+
+// Longest gap allowed between the frames of a message, in host microseconds
+#define TOUCAN_FAST_PACKET_TIMEOUT 750000
+
+// Number of PGNs SetFastPacketPgns accepts
+#define TOUCAN_MAX_FAST_PACKET_PGNS 256
+
+// Number of entries in the fast packet PGN bitmap, one bit per 18 bit PGN
+#define TOUCAN_FAST_PACKET_BITMAP ((0x3FFFF + 1) / 32)
+
+// Transmit sequence ids are kept per PGN in a hashed table, PGNs sharing an entry share a sequence
+#define TOUCAN_FAST_PACKET_SEQUENCES 256
+
+// Marks an unused reassembly slot
+#define TOUCAN_FAST_PACKET_FREE 0xFFFFFFFF
+
+// A complete message, a single frame or a reassembled fast packet
+typedef struct _TOUCAN_MESSAGE {
+	UINT32		id;				// 29 bit CAN identifier of the first frame
+	UINT32		timestamp;		// Device timestamp of the first frame
+	LONGLONG	hostTime;		// Host time of the first frame
+	UINT32		length;
+	UINT8		data[TOUCAN_FAST_PACKET_MAX_LENGTH];
+} TOUCAN_MESSAGE;
+
+// Outcome of adding a frame to the reassembler
+typedef enum {
+	TOUCAN_FAST_PACKET_SINGLE = 0,		// Not a fast packet PGN, the frame is a message by itself
+	TOUCAN_FAST_PACKET_PENDING = 1,		// Added to a message still being reassembled
+	TOUCAN_FAST_PACKET_COMPLETE = 2,	// The frame completed a message
+	TOUCAN_FAST_PACKET_DISCARDED = 3	// Out of sequence, orphaned, or no free slot
+} TOUCAN_FAST_PACKET_RESULT;
+
+// A message being reassembled, keyed by its identifier without the priority and its sequence id
+typedef struct _TOUCAN_FAST_PACKET_SLOT {
+	UINT32		key;
+	UINT32		nextFrame;
+	UINT32		received;
+	LONGLONG	lastTime;
+	TOUCAN_MESSAGE	message;
+} TOUCAN_FAST_PACKET_SLOT;
+
+// Fixed pool of reassembly slots, only used by the read thread
+typedef struct _TOUCAN_REASSEMBLER {
+	UINT32	fastPgns[TOUCAN_FAST_PACKET_BITMAP];
+	UINT32	active;
+	TOUCAN_FAST_PACKET_SLOT	slots[TOUCAN_FAST_PACKET_POOL];
+	volatile LONG	completed;		// Messages reassembled
+	volatile LONG	timeouts;		// Messages abandoned when a frame did not arrive in time
+	volatile LONG	sequenceErrors;	// Frames out of sequence, or without a first frame
+	volatile LONG	bufferFull;		// Messages lost because every slot was in use
+} TOUCAN_REASSEMBLER;
+
+// Splits outgoing messages into frames, may be shared by several writing threads
+typedef struct _TOUCAN_SEGMENTER {
+	UINT32	fastPgns[TOUCAN_FAST_PACKET_BITMAP];
+	volatile LONG	sequence[TOUCAN_FAST_PACKET_SEQUENCES];
+} TOUCAN_SEGMENTER;
+
+// Single producer, single consumer queue of complete messages, the counterpart of TOUCAN_RING
+typedef struct _TOUCAN_MESSAGE_QUEUE {
+	TOUCAN_MESSAGE	*messages;
+	UINT32			mask;
+	UINT8			padding0[TOUCAN_CACHE_LINE];
+	volatile LONG	head;
+	volatile LONG	overflows;
+	UINT8			padding1[TOUCAN_CACHE_LINE];
+	volatile LONG	tail;
+	UINT8			padding2[TOUCAN_CACHE_LINE];
+} TOUCAN_MESSAGE_QUEUE;
+
+void	TouCAN_fastpacket_init(TOUCAN_REASSEMBLER *reassembler, const UINT32 *pgns, UINT32 count);
+BOOL	TouCAN_fastpacket_is_fast(const TOUCAN_REASSEMBLER *reassembler, UINT32 pgn);
+TOUCAN_FAST_PACKET_RESULT	TouCAN_fastpacket_add(TOUCAN_REASSEMBLER *reassembler, const TOUCAN_FRAME *frame, TOUCAN_MESSAGE **message);
+void	TouCAN_fastpacket_expire(TOUCAN_REASSEMBLER *reassembler, LONGLONG now);
+
+void	TouCAN_segmenter_init(TOUCAN_SEGMENTER *segmenter, const UINT32 *pgns, UINT32 count);
+UINT32	TouCAN_fastpacket_segment(TOUCAN_SEGMENTER *segmenter, UINT32 id, const UINT8 *payload, UINT32 length, TOUCAN_FRAME *frames);
+
+BOOL	TouCAN_msgqueue_init(TOUCAN_MESSAGE_QUEUE *queue, UINT32 depth);
+void	TouCAN_msgqueue_free(TOUCAN_MESSAGE_QUEUE *queue);
+BOOL	TouCAN_msgqueue_push(TOUCAN_MESSAGE_QUEUE *queue, const TOUCAN_MESSAGE *message);
+BOOL	TouCAN_msgqueue_pop(TOUCAN_MESSAGE_QUEUE *queue, TOUCAN_MESSAGE *message);
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_FILTER
+#define _TWOCAN_TOUCAN_FILTER
+
+#include "../inc/toucan_header.h"
+
+// Rules are evaluated in order, the first rule matching a frame decides.
+// Each rule is one bit of a 64 bit set, so at most 64 rules can be compiled.
+#define TOUCAN_MAX_FILTER_RULES 64
+
+// Rule field value matching every PGN, address or priority
+#define TOUCAN_FILTER_ANY 0xFFFFFFFF
+
+// Rule actions
+#define TOUCAN_FILTER_DENY 0
+#define TOUCAN_FILTER_ALLOW 1
+
+typedef struct _TOUCAN_FILTER_RULE {
+	UINT32	action;
+	UINT32	pgn;
+	UINT32	source;
+	UINT32	destination;
+	UINT32	priority;
+} TOUCAN_FILTER_RULE;
+
+// Perfect hash slot, the rules that can match one of the PGNs named by the rules
+typedef struct _TOUCAN_FILTER_PGN {
+	UINT32	pgn;
+	UINT64	rules;
+} TOUCAN_FILTER_PGN;
+
+// Compiled rules. For every field value a bit set of the rules it satisfies, so a frame's
+// decision is four table lookups, an AND and the action of the lowest set bit.
+typedef struct _TOUCAN_FILTER {
+	UINT32	count;
+	UINT64	allow;				// Rules whose action is TOUCAN_FILTER_ALLOW
+	BOOL	defaultAllow;		// Decision when no rule matches
+	UINT32	multiplier;			// Perfect hash of the PGNs named by the rules
+	UINT32	shift;
+	TOUCAN_FILTER_PGN	*pgns;
+	UINT64	anyPgn;				// Rules matching a PGN none of the rules names
+	UINT64	source[256];
+	UINT64	destination[256];
+	UINT64	priority[8];
+	struct _TOUCAN_FILTER	*retiredNext;	// Retire list of the instance that replaced a filter still in use
+	LONG	retiredEpoch;			// Filter epoch the read thread must reach before the filter is freed
+} TOUCAN_FILTER;
+
+TOUCAN_FILTER	*TouCAN_filter_compile(const TOUCAN_FILTER_RULE *rules, UINT32 count, BOOL defaultAllow);
+void	TouCAN_filter_free(TOUCAN_FILTER *filter);
+BOOL	TouCAN_filter_accept(const TOUCAN_FILTER *filter, UINT32 id);
+
+#endif
@@ -0,0 +1,47 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_FRAME
+#define _TWOCAN_TOUCAN_FRAME
+
+#include "../Common/inc/twocanplatform.h"
+
+// Length of the data field of a classic CAN frame
+#define TOUCAN_FRAME_DATA_LENGTH 8
+
+// Every frame crosses USB as an 18 byte record: flags, id, length, data and timestamp.
+// The firmware packs up to three records into one bulk transfer.
+#define TOUCAN_RECORD_LENGTH 18
+#define TOUCAN_MAX_RECORDS_PER_TRANSFER 3
+
+// CANAL_IDFLAG_EXTENDED, for the modules that do not include the hardware header
+#define TOUCAN_FRAME_EXTENDED 0x01
+
+// A decoded CAN frame as it travels through the driver's internal queues
+typedef struct _TOUCAN_FRAME {
+	UINT32	id;					// 29 bit CAN identifier
+	UINT32	timestamp;			// Device timestamp taken from the USB record
+	UINT8	flags;				// CANAL_IDFLAG_xxx
+	UINT8	length;				// Data length code
+	UINT8	data[TOUCAN_FRAME_DATA_LENGTH];
+	LONGLONG	hostTime;		// Host monotonic time in microseconds, set by the read thread
+} TOUCAN_FRAME;
+
+#endif
@@ -0,0 +1,106 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_HEADER
+#define _TWOCAN_TOUCAN_HEADER
+
+#include "../Common/inc/twocanplatform.h"
+
+// PDU1 PGNs, PDU format below 240, carry the destination address in the PDU specific field
+#define TOUCAN_PDU2_FORMAT 240
+
+// Largest parameter group number, 18 bits
+#define TOUCAN_MAX_PGN 0x3FFFF
+
+// Destination of PDU2 (broadcast only) PGNs
+#define TOUCAN_GLOBAL_ADDRESS 0xFF
+
+// Identifiers known when compiling, the arguments must be in range
+#define TOUCAN_PDU2_ID(priority, pgn, source) (((UINT32)(priority) << 26) | ((UINT32)(pgn) << 8) | (UINT32)(source))
+#define TOUCAN_PDU1_ID(priority, pgn, destination, source) (((UINT32)(priority) << 26) | (((UINT32)(pgn) & 0x3FF00) << 8) | ((UINT32)(destination) << 8) | (UINT32)(source))
+
+// Fields of a 29 bit NMEA 2000 identifier
+typedef struct _TOUCAN_HEADER {
+	UINT32	pgn;			// For PDU1 PGNs without the destination address
+	UINT8	priority;
+	UINT8	source;
+	UINT8	destination;	// TOUCAN_GLOBAL_ADDRESS for PDU2 PGNs
+} TOUCAN_HEADER;
+
+// Decoded fields of many identifiers, one array per field, any array may be NULL
+typedef struct _TOUCAN_HEADERS {
+	UINT32	*pgns;
+	UINT8	*priorities;
+	UINT8	*sources;
+	UINT8	*destinations;
+} TOUCAN_HEADERS;
+
+static __inline BOOL TouCAN_header_is_pdu1(UINT32 pgn) {
+	return (((pgn >> 8) & 0xFF) < TOUCAN_PDU2_FORMAT);
+}
+
+//
+// PGN of an identifier, without the destination address of PDU1 PGNs
+//
+
+static __inline UINT32 TouCAN_header_pgn(UINT32 id) {
+	UINT32 pgn = (id >> 8) & TOUCAN_MAX_PGN;
+	UINT32 pdu1 = 0 - (UINT32)TouCAN_header_is_pdu1(pgn);
+
+	return pgn & ~(pdu1 & 0xFF);
+}
+
+static __inline UINT8 TouCAN_header_destination(UINT32 id) {
+	UINT32 pdu1 = 0 - (UINT32)TouCAN_header_is_pdu1(id >> 8);
+
+	return (UINT8)((id >> 8) | ~pdu1);
+}
+
+static __inline UINT8 TouCAN_header_priority(UINT32 id) {
+	return (UINT8)((id >> 26) & 0x07);
+}
+
+static __inline UINT8 TouCAN_header_source(UINT32 id) {
+	return (UINT8)id;
+}
+
+static __inline void TouCAN_header_decode(UINT32 id, TOUCAN_HEADER *header) {
+	header->pgn = TouCAN_header_pgn(id);
+	header->priority = TouCAN_header_priority(id);
+	header->source = TouCAN_header_source(id);
+	header->destination = TouCAN_header_destination(id);
+}
+
+//
+// Build an identifier, the destination is only used by PDU1 PGNs
+//
+
+static __inline UINT32 TouCAN_header_encode(const TOUCAN_HEADER *header) {
+	UINT32 pgn = header->pgn & TOUCAN_MAX_PGN;
+
+	if (TouCAN_header_is_pdu1(pgn)) {
+		pgn = (pgn & 0x3FF00) | header->destination;
+	}
+	return ((UINT32)(header->priority & 0x07) << 26) | (pgn << 8) | header->source;
+}
+
+void	TouCAN_header_decode_batch(const UINT32 *ids, UINT32 count, const TOUCAN_HEADERS *headers);
+
+#endif
@@ -0,0 +1,90 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_HEALTH
+#define _TWOCAN_TOUCAN_HEALTH
+
+#include "../inc/toucan_protocol.h"
+
+// Polls the rolling counters cover
+#define TOUCAN_HEALTH_WINDOW 60
+
+// Milliseconds between polls unless the monitor is started with another interval
+#define TOUCAN_HEALTH_DEFAULT_INTERVAL 1000
+
+// Protocol errors on the bus, as opposed to the interface's own conditions
+#define TOUCAN_HEALTH_BUS_ERRORS (HAL_CAN_ERROR_STF | HAL_CAN_ERROR_FOR | HAL_CAN_ERROR_ACK | HAL_CAN_ERROR_BR | HAL_CAN_ERROR_BD | HAL_CAN_ERROR_CRC)
+
+// Receive FIFO overruns, frames lost in the adapter before they reached USB
+#define TOUCAN_HEALTH_FIFO_OVERRUNS (HAL_CAN_ERROR_RX_FOV0 | HAL_CAN_ERROR_RX_FOV1)
+
+// Bits raised by single events, counted by the poll that sees them, after which the error code is cleared
+#define TOUCAN_HEALTH_EVENTS (TOUCAN_HEALTH_BUS_ERRORS | TOUCAN_HEALTH_FIFO_OVERRUNS)
+
+// Bits raised when the interface enters a state. The adapter can only clear its whole error code,
+// so these are latched here until the adapter's error status shows the state has gone.
+#define TOUCAN_HEALTH_STATES (HAL_CAN_ERROR_EWG | HAL_CAN_ERROR_EPV | HAL_CAN_ERROR_BOF)
+
+// Condition of the bus as seen by the adapter, in increasing severity up to TOUCAN_BUS_OFF
+typedef enum {
+	TOUCAN_BUS_UNKNOWN = 0,		// Not polled yet, or the adapter did not answer
+	TOUCAN_BUS_STOPPED = 1,		// The interface is not listening
+	TOUCAN_BUS_ACTIVE = 2,
+	TOUCAN_BUS_WARNING = 3,		// Error counters reached the warning level
+	TOUCAN_BUS_PASSIVE = 4,		// Error passive, the adapter no longer signals errors on the bus
+	TOUCAN_BUS_OFF = 5			// Bus off, nothing is received or transmitted
+} TOUCAN_BUS_CONDITION;
+
+// One poll, the error bits are those raised since the previous poll
+typedef struct _TOUCAN_HEALTH_SAMPLE {
+	UINT32	busErrors;			// Polls with protocol errors, 0 or 1
+	UINT32	fifoOverruns;		// Polls with a receive FIFO overrun, 0 or 1
+	UINT32	overrunFrames;		// Frames the adapter counted as lost in its FIFO
+} TOUCAN_HEALTH_SAMPLE;
+
+// Bus health built from the interface state, error code and counters the monitor polls.
+// Only the monitor thread updates it, any thread may read the counters without a lock.
+typedef struct _TOUCAN_HEALTH {
+	volatile LONG	condition;		// TOUCAN_BUS_CONDITION
+	volatile LONG	state;			// HAL_CAN_STATE_xxx of the last poll
+	volatile LONG	errorCode;		// HAL_CAN_ERROR_xxx bits of the last poll
+	UINT32	latched;				// TOUCAN_HEALTH_STATES bits held until the error status no longer shows them
+	UINT32	remaining;				// TOUCAN_HEALTH_STATES bits left in the adapter's error code by the last poll
+	TOUCAN_HEALTH_SAMPLE	samples[TOUCAN_HEALTH_WINDOW];
+	UINT32	position;
+	UINT32	filled;
+	BOOL	hasOverruns;
+	UINT32	lastOverruns;			// Adapter overrun counter at the previous poll
+	volatile LONG	busErrors;		// Sums over the window
+	volatile LONG	fifoOverruns;
+	volatile LONG	overrunFrames;
+	volatile LONG	polls;			// Totals since the monitor started
+	volatile LONG	failures;
+	volatile LONG	busOffEvents;
+	volatile LONG	changes;
+} TOUCAN_HEALTH;
+
+void	TouCAN_health_init(TOUCAN_HEALTH *health);
+BOOL	TouCAN_health_update(TOUCAN_HEALTH *health, UINT8 state, UINT32 errorCode, const UINT32 *errorStatus, BOOL cleared, const TOUCAN_DEVICE_STATISTICS *statistics);
+BOOL	TouCAN_health_failed(TOUCAN_HEALTH *health);
+BOOL	TouCAN_health_poll(TOUCAN_HEALTH *health, TOUCAN_BACKEND *adapter);
+TOUCAN_BUS_CONDITION	TouCAN_health_condition(UINT8 state, UINT32 latched);
+
+#endif
@@ -0,0 +1,169 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_INSTANCE
+#define _TWOCAN_TOUCAN_INSTANCE
+
+#include "../inc/toucan_backend.h"
+#include "../inc/toucan_clock.h"
+#include "../inc/toucan_fastpacket.h"
+#include "../inc/toucan_filter.h"
+#include "../inc/toucan_health.h"
+#include "../inc/toucan_latency.h"
+#include "../inc/toucan_ring.h"
+#include "../inc/toucan_stats.h"
+#include "../inc/toucan_subscription.h"
+#include "../inc/toucan_txqueue.h"
+
+// Adapters one process can have open at the same time through the instance API
+#define TOUCAN_MAX_INSTANCES 8
+
+// Open the adapter with this serial number rather than by its index
+#define TOUCAN_INSTANCE_ANY_INDEX 0xFFFFFFFF
+
+// Receive delivery modes, see SetReceiveMode
+#define TOUCAN_RECEIVE_MODE_LEGACY 0
+#define TOUCAN_RECEIVE_MODE_QUEUED 1
+#define TOUCAN_RECEIVE_MODE_MESSAGES 2
+
+// Default depth of the receive queue, roughly a second of a fully loaded 250 kbit/s bus
+#define TOUCAN_DEFAULT_RECEIVE_DEPTH 2048
+
+// Default depth of the message queue, messages are far larger than frames
+#define TOUCAN_DEFAULT_MESSAGE_DEPTH 256
+
+// How long a filter update waits for the read thread to stop using the filter it replaced, in milliseconds
+#define TOUCAN_FILTER_GRACE_PERIOD 1000
+
+// Frames of a more urgent NMEA 2000 priority are never held back for coalescing
+#define TOUCAN_TX_URGENT_PRIORITY 3
+
+// Called by the read thread, the context is the one given in the hooks
+typedef struct _TOUCAN_INSTANCE_HOOKS {
+	void	*context;
+	BOOL	(*Deliver)(void *context, const TOUCAN_FRAME *frame);	// TOUCAN_RECEIVE_MODE_LEGACY, hand one frame to the caller and signal it, FALSE if the caller's buffer could not be locked
+	void	(*Publish)(void *context, const TOUCAN_FRAME *frame);	// Every extended frame received, before the filters
+	void	(*Capture)(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT8 direction);	// Every frame received, and every frame transmitted, also from the writer thread
+} TOUCAN_INSTANCE_HOOKS;
+
+// How an instance is opened and started. Set before TouCAN_instance_open, the receive settings
+// before TouCAN_instance_start.
+typedef struct _TOUCAN_INSTANCE_CONFIG {
+	UINT32	options;			// TouCAN_ENABLE_xxx init flags
+	BOOL	deviceTime;			// Stamp frames with the adapter's timestamp mapped onto the host clock
+	int		receiveMode;		// TOUCAN_RECEIVE_MODE_xxx
+	UINT32	receiveDepth;		// Frames, or messages, the receive queue holds
+	UINT32	readQueueDepth;		// Reads kept in flight on the bulk IN endpoint
+	UINT32	readBufferSize;
+	UINT32	transmitLaneDepth;	// Frames each priority lane of the transmit queue holds, zero writes from the caller's thread
+	DWORD	transmitDeadline;	// Milliseconds the writer thread may hold a partially filled transfer of non urgent frames
+	UINT32	notifyFrames;		// Frames to collect before signalling the caller
+	UINT32	notifyDeadline;		// Longest wait in microseconds before waiting frames are signalled
+	const UINT32	*fastPacketPgns;	// Fast packet PGNs, NULL for the built in list, must stay valid while the instance is open
+	UINT32	fastPacketPgnCount;
+	HANDLE	frameReceivedEvent;	// Auto reset event signalling the caller, NULL for one owned by the instance
+	TOUCAN_INSTANCE_HOOKS	hooks;
+} TOUCAN_INSTANCE_CONFIG;
+
+// One adapter reached through a backend, with its own read thread, receive queue, filters, clock
+// and statistics, and optionally its own writer thread draining a transmit queue. The single adapter
+// API and every adapter opened with the instance API are driven through one of these.
+// The read thread is the receive queue's only producer, one caller thread its only consumer.
+typedef struct _TOUCAN_INSTANCE {
+	UINT32	index;				// Position in the device interface list
+	UINT32	serialNumber;		// Zero if the backend does not report one
+	TOUCAN_INSTANCE_CONFIG	config;
+	TOUCAN_BACKEND	*backend;	// NULL while the instance is closed
+	HANDLE	frameReceivedEvent;
+	BOOL	ownsEvent;
+
+	// Receive path, the queues are allocated by TouCAN_instance_start
+	TOUCAN_RING	receiveRing;
+	TOUCAN_REASSEMBLER	reassembler;
+	TOUCAN_MESSAGE_QUEUE	messageQueue;
+	LONG	messagesLostReported;
+	TOUCAN_CLOCK	clock;
+	HANDLE	threadHandle;
+	volatile LONG	running;
+
+	// Notification moderation, see SetNotificationModeration. Only the read thread counts the
+	// frames not yet signalled, the caller clears notificationPending when it drains.
+	UINT32	unsignalledFrames;
+	LONGLONG	unsignalledSince;
+	volatile LONG	notificationPending;
+	volatile LONG	notificationsSent;
+	volatile LONG	notificationsCoalesced;
+
+	// PGN subscriptions compiled into the adapter's acceptance filter, see SetPgnFilter. The read thread
+	// holds the lock shared per packet, the update lock serialises reprogramming the adapter.
+	TOUCAN_SUBSCRIPTION	subscription;
+	SRWLOCK	subscriptionLock;
+	SRWLOCK	subscriptionUpdateLock;
+	BOOL	subscriptionPostFilter;
+	volatile LONG	subscriptionRejected;
+
+	// Host side filter rules. The read thread uses the published filter without locking, a replaced
+	// filter is only freed once the read thread has started a new packet (a quiescent point).
+	// Filters replaced while the read thread was stalled wait on the retire list for the next update or the stop.
+	TOUCAN_FILTER * volatile	receiveFilter;
+	TOUCAN_FILTER	*retiredFilters;
+	volatile LONG	filterEpoch;
+	volatile LONG	readerEpoch;
+	volatile LONG	readerActive;
+	SRWLOCK	filterUpdateLock;
+	volatile LONG	filterRejected;
+
+	// Counters of one run of the read thread
+	volatile LONG	receiveFrames;
+	volatile LONG	receiveTransfers;
+	volatile LONG	receiveMalformed;
+	volatile LONG	receiveFailures;
+	LONGLONG	receiveStarted;
+	TOUCAN_LATENCY	deliveryLatency;
+	TOUCAN_RECEIVE_STATISTICS	receiveStatistics;
+
+	// Transmit path
+	TOUCAN_SEGMENTER	segmenter;
+	TOUCAN_TX_QUEUE	transmitQueue;
+	HANDLE	transmitPendingEvent;	// Auto reset, signalled when a frame is queued while the queue is empty
+	HANDLE	writerHandle;		// NULL when frames are written from the caller's thread
+	volatile LONG	transmitting;
+	SRWLOCK	writeLock;			// Keeps the frames of concurrent writers in order
+	volatile LONG	transmitFailures;
+	volatile LONG	transmitRetries;
+
+	// Bus health, updated by the bus monitor thread while it runs
+	TOUCAN_HEALTH	health;
+} TOUCAN_INSTANCE;
+
+void	TouCAN_instance_init(TOUCAN_INSTANCE *instance);
+int		TouCAN_instance_open(TOUCAN_INSTANCE *instance, TOUCAN_BACKEND *backend, const UINT32 *serialNumber);
+int		TouCAN_instance_start(TOUCAN_INSTANCE *instance);
+BOOL	TouCAN_instance_stop(TOUCAN_INSTANCE *instance);
+BOOL	TouCAN_instance_close(TOUCAN_INSTANCE *instance);
+UINT32	TouCAN_instance_drain(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 maxFrames);
+BOOL	TouCAN_instance_read_message(TOUCAN_INSTANCE *instance, TOUCAN_MESSAGE *message, BOOL *lost);
+BOOL	TouCAN_instance_write(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 count, UINT32 *written);
+BOOL	TouCAN_instance_queue(TOUCAN_INSTANCE *instance, const TOUCAN_FRAME *frames, UINT32 count);
+BOOL	TouCAN_instance_subscribe(TOUCAN_INSTANCE *instance, const TOUCAN_SUBSCRIPTION *compiled);
+void	TouCAN_instance_set_filter(TOUCAN_INSTANCE *instance, TOUCAN_FILTER *filter);
+void	TouCAN_instance_statistics(TOUCAN_INSTANCE *instance, TOUCAN_STATISTICS *statistics);
+
+#endif
@@ -0,0 +1,44 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_LATENCY
+#define _TWOCAN_TOUCAN_LATENCY
+
+#include "../Common/inc/twocanplatform.h"
+
+// Latencies below 2^TOUCAN_LATENCY_LINEAR_BITS microseconds have a bucket each, every larger
+// power of two is split into 2^TOUCAN_LATENCY_SUB_BITS buckets, so a percentile is exact to 12.5 %
+#define TOUCAN_LATENCY_LINEAR_BITS 4
+#define TOUCAN_LATENCY_SUB_BITS 3
+#define TOUCAN_LATENCY_BUCKETS ((1 << TOUCAN_LATENCY_LINEAR_BITS) + ((32 - TOUCAN_LATENCY_LINEAR_BITS) << TOUCAN_LATENCY_SUB_BITS))
+
+// Log linear histogram of latencies in microseconds, recorded without locking from any thread
+typedef struct _TOUCAN_LATENCY {
+	volatile LONG	counts[TOUCAN_LATENCY_BUCKETS];
+	volatile LONG	samples;
+	volatile LONG	maximum;
+} TOUCAN_LATENCY;
+
+void	TouCAN_latency_reset(TOUCAN_LATENCY *latency);
+void	TouCAN_latency_record(TOUCAN_LATENCY *latency, LONGLONG microseconds, UINT32 count);
+UINT32	TouCAN_latency_percentile(const TOUCAN_LATENCY *latency, UINT32 perMille);
+UINT32	TouCAN_latency_bound(UINT32 bucket);
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_LIBUSB
+#define _TWOCAN_TOUCAN_LIBUSB
+
+#include "../inc/toucan_usb.h"
+
+// Define TOUCAN_LIBUSB, and add libusb-1.0 and pthreads to the build, to reach the adapter through libusb
+#if defined(TOUCAN_LIBUSB)
+
+#include <libusb.h>
+#include <pthread.h>
+
+// USB identifiers of the TouCAN adapter
+#define TOUCAN_USB_VENDOR_ID 0x16D0
+#define TOUCAN_USB_PRODUCT_ID 0x0EAC
+
+// Control and bulk timeouts in milliseconds, the same as the WinUSB pipe policies
+#define TOUCAN_LIBUSB_TIMEOUT 500
+
+// How often the event thread checks whether it should exit, in milliseconds
+#define TOUCAN_LIBUSB_EVENT_INTERVAL 100
+
+// An asynchronous bulk IN transfer, completed by the event thread
+typedef struct _TOUCAN_LIBUSB_SLOT {
+	struct _TOUCAN_LIBUSB_DEVICE	*owner;
+	struct libusb_transfer	*transfer;
+	BOOL	inFlight;					// Submitted and not yet completed
+	BOOL	done;						// Completed and not yet collected by WaitRead
+	TOUCAN_TRANSFER_RESULT	result;
+	ULONG	length;
+} TOUCAN_LIBUSB_SLOT;
+
+typedef struct _TOUCAN_LIBUSB_DEVICE {
+	UINT16	vendorId;
+	UINT16	productId;
+	libusb_context	*usb;
+	libusb_device_handle	*handle;
+	pthread_t	eventThread;
+	volatile LONG	eventsRunning;
+	pthread_mutex_t	lock;
+	pthread_cond_t	completed;
+	UINT32	slotCount;
+	TOUCAN_LIBUSB_SLOT	slots[TOUCAN_MAX_READ_QUEUE_DEPTH];
+} TOUCAN_LIBUSB_DEVICE;
+
+void	TouCAN_libusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_LIBUSB_DEVICE *libusb, UINT16 vendorId, UINT16 productId);
+
+#endif
+
+#endif
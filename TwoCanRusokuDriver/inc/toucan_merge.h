@@ -0,0 +1,70 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_MERGE
+#define _TWOCAN_TOUCAN_MERGE
+
+#include "../inc/toucan_ring.h"
+
+// Sources one merge can combine, adapters or recordings
+#define TOUCAN_MERGE_MAX_SOURCES 16
+
+// Default reorder window in microseconds, how far a source may lag the newest frame
+// before its frames are no longer waited for
+#define TOUCAN_MERGE_DEFAULT_WINDOW 50000
+
+// Frames waiting in one source, the earliest of them held apart so it can be compared
+typedef struct _TOUCAN_MERGE_SOURCE {
+	TOUCAN_RING		queue;
+	TOUCAN_FRAME	head;
+	BOOL			hasHead;
+	BOOL			seen;			// A frame has been pushed, latest is valid
+	BOOL			closed;			// No more frames will be pushed
+	LONGLONG		latest;			// Newest time pushed
+} TOUCAN_MERGE_SOURCE;
+
+// Merges per source queues into one stream ordered by frame time (hostTime, which is the
+// device timestamp mapped onto the host clock in the device timestamp mode).
+// A min heap of the sources' earliest frames picks the next frame. A frame is only released
+// once the watermark passes it: the time every open source has reached, but never more than
+// the reorder window behind the newest frame, so a silent or late source cannot stall the output.
+// Used by a single thread.
+typedef struct _TOUCAN_MERGE {
+	UINT32		count;
+	LONGLONG	window;
+	LONGLONG	newest;				// Newest time pushed by any source
+	LONGLONG	released;			// Time of the latest frame released
+	BOOL		started;
+	UINT32		heap[TOUCAN_MERGE_MAX_SOURCES];
+	UINT32		heapSize;
+	TOUCAN_MERGE_SOURCE	sources[TOUCAN_MERGE_MAX_SOURCES];
+	UINT32		merged;				// Frames released
+	UINT32		late;				// Frames released after a later frame, their source lagged beyond the window
+	UINT32		overflows;			// Frames refused because their source queue was full
+} TOUCAN_MERGE;
+
+BOOL	TouCAN_merge_init(TOUCAN_MERGE *merge, UINT32 sources, UINT32 depth, LONGLONG window);
+void	TouCAN_merge_free(TOUCAN_MERGE *merge);
+UINT32	TouCAN_merge_push(TOUCAN_MERGE *merge, UINT32 source, const TOUCAN_FRAME *frames, UINT32 count);
+UINT32	TouCAN_merge_space(TOUCAN_MERGE *merge, UINT32 source);
+void	TouCAN_merge_close_source(TOUCAN_MERGE *merge, UINT32 source);
+UINT32	TouCAN_merge_pop(TOUCAN_MERGE *merge, LONGLONG now, TOUCAN_FRAME *frames, UINT8 *sources, UINT32 maxFrames);
+
+#endif
@@ -0,0 +1,93 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+#ifndef _TWOCAN_TOUCAN_REPLAY
+#define _TWOCAN_TOUCAN_REPLAY
+
+#include "../inc/toucan_backend.h"
+#include "../inc/toucan_capture.h"
+
+#include <stdio.h>
+
+// Recording formats
+#define TOUCAN_REPLAY_FORMAT_AUTO 0			// Chosen from the start of the file
+#define TOUCAN_REPLAY_FORMAT_BINARY 1		// Capture written by StartCapture, its received frames are replayed
+#define TOUCAN_REPLAY_FORMAT_CANDUMP 2		// candump -l log, "(seconds.micros) interface id#data" per line
+#define TOUCAN_REPLAY_FORMAT_TWOCAN 3		// TwoCan raw log, twelve comma separated 0xNN bytes per line, without timestamps
+
+// Replay speed in percent of the recorded pace, zero replays frames as fast as they are read
+#define TOUCAN_REPLAY_REAL_TIME 100
+#define TOUCAN_REPLAY_MAX_SPEED 100000
+
+// Longest recording path, including the terminator
+#define TOUCAN_REPLAY_MAX_PATH 260
+
+// Text recordings are parsed from a buffer refilled a block at a time, a line must fit in it
+#define TOUCAN_REPLAY_BUFFER 65536
+
+typedef struct _TOUCAN_REPLAY_CONFIG {
+	char	path[TOUCAN_REPLAY_MAX_PATH];
+	UINT32	format;
+	UINT32	speed;
+	BOOL	loop;			// Start again from the beginning once the recording is exhausted
+} TOUCAN_REPLAY_CONFIG;
+
+typedef struct _TOUCAN_REPLAY_STATISTICS {
+	UINT32	frames;			// Frames delivered
+	UINT32	rejected;		// Lines or records that are not a frame
+	UINT32	passes;			// Times the recording was read to the end
+	BOOL	finished;		// Every frame has been delivered and the recording does not loop
+} TOUCAN_REPLAY_STATISTICS;
+
+// A recording replayed as the bus an adapter receives. Frames are released when their recorded
+// time, scaled by the speed, has passed since the first frame, and the adapter's extended
+// acceptance filter is applied to them. Transmitted frames are accepted and discarded.
+typedef struct _TOUCAN_REPLAY {
+	TOUCAN_REPLAY_CONFIG	config;
+	UINT32	format;			// Format of the open recording
+	FILE	*file;
+	char	*buffer;
+	UINT32	start;			// Unparsed text is buffer[start, end)
+	UINT32	end;
+	BOOL	endOfFile;
+	TOUCAN_CAPTURE_READER	capture;
+	BOOL	mapped;
+	TOUCAN_FRAME	next;		// Next frame to deliver and its recorded time
+	LONGLONG	nextTime;
+	BOOL	hasNext;
+	BOOL	paced;			// firstTime and startClock are set for this pass
+	LONGLONG	firstTime;
+	LONGLONG	startClock;
+	BOOL	started;
+	UINT8	filterType;		// Filter_Type_TypeDef of the extended acceptance filter
+	UINT32	filterList;
+	UINT32	filterMask;
+	UINT8	lastError;		// HAL status of the last emulated request
+	volatile LONG	frames;
+	volatile LONG	rejected;
+	volatile LONG	passes;
+	volatile LONG	finished;
+	TOUCAN_TRANSMIT_COUNTERS	transmitted;
+	SRWLOCK	requestLock;
+} TOUCAN_REPLAY;
+
+void	TouCAN_replay_backend(TOUCAN_BACKEND *backend, TOUCAN_REPLAY *replay, const TOUCAN_REPLAY_CONFIG *config);
+void	TouCAN_replay_statistics(TOUCAN_REPLAY *replay, TOUCAN_REPLAY_STATISTICS *statistics);
+
+#endif
@@ -0,0 +1,56 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_RING
+#define _TWOCAN_TOUCAN_RING
+
+#include "../inc/toucan_frame.h"
+
+// Size used to keep the producer and consumer indices on separate cache lines
+#define TOUCAN_CACHE_LINE 64
+
+// Ring depth limits, depth is always rounded up to a power of two
+#define TOUCAN_RING_MIN_DEPTH 4
+#define TOUCAN_RING_MAX_DEPTH 65536
+
+// Single producer, single consumer lock free ring of decoded frames.
+// The read thread is the only producer, the plugin's thread draining the
+// ring is the only consumer. Head and tail are free running counters.
+typedef struct _TOUCAN_RING {
+	TOUCAN_FRAME	*frames;
+	UINT32			mask;
+	UINT8			padding0[TOUCAN_CACHE_LINE];
+	volatile LONG	head;		// Next slot to be written, owned by the producer
+	volatile LONG	overflows;	// Frames dropped because the ring was full
+	volatile LONG	highWater;	// Largest number of frames ever queued
+	UINT8			padding1[TOUCAN_CACHE_LINE];
+	volatile LONG	tail;		// Next slot to be read, owned by the consumer
+	UINT8			padding2[TOUCAN_CACHE_LINE];
+} TOUCAN_RING;
+
+BOOL	TouCAN_ring_init(TOUCAN_RING *ring, UINT32 depth);
+void	TouCAN_ring_free(TOUCAN_RING *ring);
+void	TouCAN_ring_reset(TOUCAN_RING *ring);
+BOOL	TouCAN_ring_push(TOUCAN_RING *ring, const TOUCAN_FRAME *frame);
+BOOL	TouCAN_ring_pop(TOUCAN_RING *ring, TOUCAN_FRAME *frame);
+UINT32	TouCAN_ring_drain(TOUCAN_RING *ring, TOUCAN_FRAME *frames, UINT32 maxFrames);
+UINT32	TouCAN_ring_count(TOUCAN_RING *ring);
+
+#endif
@@ -0,0 +1,133 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_SIMUSB
+#define _TWOCAN_TOUCAN_SIMUSB
+
+#include "../inc/toucan_usb.h"
+
+// Bit rate of the simulated bus when the configuration leaves it 0, the NMEA 2000 rate
+#define TOUCAN_SIM_DEFAULT_BITRATE 250000
+
+// Bits an extended frame occupies besides its data: 67 frame bits, the 3 bit interframe
+// space and an allowance for bit stuffing
+#define TOUCAN_SIM_FRAME_OVERHEAD 80
+
+// Full speed USB frame. The host polls the bulk IN endpoint once per frame, so records
+// reaching an empty adapter FIFO wait for the next frame boundary and may be coalesced.
+#define TOUCAN_SIM_USB_FRAME 1000
+
+// Frames the adapter buffers before it reports an overrun
+#define TOUCAN_SIM_FIFO_DEPTH 64
+
+// Transmitted frames waiting to be looped back in loopback mode
+#define TOUCAN_SIM_LOOPBACK_DEPTH 16
+
+// Identifiers the background traffic can cycle through
+#define TOUCAN_SIM_MAX_IDS 64
+
+// Error rates are given in parts per million
+#define TOUCAN_SIM_RATE_SCALE 1000000
+
+// Time of an event that will never happen
+#define TOUCAN_SIM_NEVER 0x7FFFFFFFFFFFFFFFLL
+
+// Traffic and faults of a simulated adapter. Every random choice is drawn from a generator
+// seeded with seed, so the same configuration always produces the same session.
+typedef struct _TOUCAN_SIM_CONFIG {
+	UINT32	seed;
+	UINT32	bitrate;			// Bits per second, 0 for TOUCAN_SIM_DEFAULT_BITRATE
+	UINT32	busLoad;			// Percentage of the bus used by background traffic, 0 for none
+	UINT32	burstFrames;		// Frames queued together at the start of every burst period, 0 for none
+	UINT32	burstPeriod;		// Microseconds between bursts
+	UINT32	maxCoalesce;		// Records per bulk IN packet, 1 to TOUCAN_MAX_RECORDS_PER_TRANSFER, 0 for the maximum
+	LONG	drift;				// Error of the adapter's timestamp clock in parts per million
+	UINT32	transferErrorRate;	// Bulk IN packets completing with an error
+	UINT32	malformedRate;		// Bulk IN packets cut short in the middle of a record
+	UINT32	requestErrorRate;	// Host to device requests failing with HAL_ERROR
+	const UINT32	*ids;		// Identifiers of the background traffic, NULL for a mix of NMEA 2000 PGNs
+	UINT32	idCount;
+	void	(*Pace)(void *context, LONGLONG now);	// Optional, called with the virtual time every read completes at,
+	void	*paceContext;							// so the caller can hold the simulation to a real clock
+} TOUCAN_SIM_CONFIG;
+
+// What happened during a simulated session
+typedef struct _TOUCAN_SIM_STATISTICS {
+	UINT32	generated;			// Frames put on the bus by the simulated nodes
+	UINT32	transmitted;		// Frames written to the bulk OUT endpoint
+	UINT32	received;			// Frames stored in the adapter FIFO
+	UINT32	filtered;			// Frames rejected by the acceptance filter
+	UINT32	overruns;			// Frames lost because the FIFO was full
+	UINT32	packets;			// Bulk IN packets completed
+	UINT32	delivered;			// Records carried by the packets that completed normally
+	UINT32	lost;				// Records carried by failed or malformed packets
+	UINT32	transferErrors;
+	UINT32	malformedPackets;
+	UINT32	requestErrors;
+	UINT32	receiveData;		// Data bytes of the received frames
+	UINT32	transmitData;		// Data bytes of the transmitted frames
+} TOUCAN_SIM_STATISTICS;
+
+// A TouCAN adapter on a simulated bus, driven by a virtual clock instead of the host's.
+// Reads never sleep: waiting for traffic moves the virtual clock to the next frame, and an
+// idle wait moves it by the whole timeout, so a session runs as fast as the driver consumes it
+// unless the configuration's Pace function holds it to a real clock.
+// The class requests follow the firmware's state machine and the records carry the adapter's
+// timestamps, taken from the virtual clock. Writes from one thread and reads from another are safe.
+typedef struct _TOUCAN_SIM_USB {
+	TOUCAN_SIM_CONFIG	config;
+	UINT32	ids[TOUCAN_SIM_MAX_IDS];
+	volatile LONG	lock;
+	BOOL	open;
+	UINT32	random;
+	LONGLONG	now;				// Virtual time in microseconds
+	UINT8	state;					// HAL_CAN_STATE_xxx
+	UINT8	status;					// Answer to TouCAN_GET_LAST_ERROR_CODE
+	UINT32	errorCode;				// HAL_CAN_ERROR_xxx
+	BOOL	loopback;
+	UINT8	filterType;
+	UINT32	filterList;
+	UINT32	filterMask;
+	LONGLONG	busFree;			// When the bus is free of every frame but next
+	LONGLONG	backgroundTime;		// When the next background frame is queued
+	LONGLONG	burstTime;			// Start of the current burst
+	UINT32	burstRemaining;
+	UINT32	sequence;
+	TOUCAN_FRAME	next;			// Next generated frame, on the bus from nextStart to nextTime
+	LONGLONG	nextStart;
+	LONGLONG	nextTime;
+	TOUCAN_FRAME	loopbackFrames[TOUCAN_SIM_LOOPBACK_DEPTH];
+	LONGLONG	loopbackTimes[TOUCAN_SIM_LOOPBACK_DEPTH];
+	UINT32	loopbackHead;
+	UINT32	loopbackCount;
+	TOUCAN_FRAME	fifo[TOUCAN_SIM_FIFO_DEPTH];
+	UINT32	fifoHead;
+	UINT32	fifoCount;
+	UINT8	*buffers[TOUCAN_MAX_READ_QUEUE_DEPTH];
+	UINT32	bufferLengths[TOUCAN_MAX_READ_QUEUE_DEPTH];
+	TOUCAN_SIM_STATISTICS	statistics;
+} TOUCAN_SIM_USB;
+
+void	TouCAN_simusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_SIM_USB *sim, const TOUCAN_SIM_CONFIG *config);
+LONGLONG	TouCAN_simusb_now(TOUCAN_SIM_USB *sim);
+void	TouCAN_simusb_advance(TOUCAN_SIM_USB *sim, LONGLONG microseconds);
+void	TouCAN_simusb_statistics(TOUCAN_SIM_USB *sim, TOUCAN_SIM_STATISTICS *statistics);
+
+#endif
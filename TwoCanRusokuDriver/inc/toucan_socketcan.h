@@ -0,0 +1,59 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_SOCKETCAN
+#define _TWOCAN_TOUCAN_SOCKETCAN
+
+#include "../inc/toucan_backend.h"
+
+#if defined(__linux__)
+
+#include <net/if.h>
+#include <linux/can.h>
+
+// Interface used when the caller does not name one
+#define TOUCAN_SOCKETCAN_DEFAULT_INTERFACE "can0"
+
+// How long a transmit may wait for room in the interface queue, in milliseconds
+#define TOUCAN_SOCKETCAN_SEND_TIMEOUT 500
+
+// Acceptance filters the socket holds, as TOUCAN_BACKEND filterBanks
+#define TOUCAN_SOCKETCAN_FILTER_BANKS 16
+
+// A CAN_RAW socket bound to one interface. Frames are read and written in batches with
+// recvmmsg and sendmmsg, each received frame carries its kernel receive time.
+typedef struct _TOUCAN_SOCKETCAN {
+	char	interfaceName[IFNAMSIZ];
+	int		socket;
+	BOOL	started;
+	UINT8	lastError;			// HAL status of the last emulated request
+	struct _TOUCAN_SOCKETCAN_BATCH	*batch;		// recvmmsg / sendmmsg buffers, allocated by Open
+	TOUCAN_TRANSMIT_COUNTERS	transmitted;	// A sendmmsg call counts as one transfer
+	volatile LONG	malformed;	// Messages received that were not a classic CAN frame, left out of their batch
+	struct can_filter	filters[TOUCAN_SOCKETCAN_FILTER_BANKS];	// Set by list / mask requests since the last accept or reject all
+	UINT32	filterCount;
+	SRWLOCK	requestLock;
+} TOUCAN_SOCKETCAN;
+
+void	TouCAN_socketcan_backend(TOUCAN_BACKEND *backend, TOUCAN_SOCKETCAN *socketcan, const char *interfaceName);
+
+#endif
+
+#endif
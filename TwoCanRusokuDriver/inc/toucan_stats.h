@@ -0,0 +1,108 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_STATS
+#define _TWOCAN_TOUCAN_STATS
+
+#include "../inc/toucan_backend.h"
+#include "../inc/toucan_protocol.h"
+
+// Counters of one read thread. The read thread is their only writer, so a counter is advanced
+// with a relaxed load and store rather than an interlocked operation, and other threads read
+// them at any time without a lock. A reader may see one counter a packet ahead of another.
+// The counters cover one run of the read thread and only grow while it runs, a reader wanting
+// rates takes the difference between two snapshots.
+typedef struct _TOUCAN_RECEIVE_STATISTICS {
+	volatile LONG	transfers[TOUCAN_MAX_READ_BATCH + 1];	// Reads by the number of records they carried
+	volatile LONG	notExtended;		// Standard and remote frames dropped
+	volatile LONG	mutexTimeouts;		// Frames the single frame buffer could not be locked for
+	volatile LONGLONG	bytes;			// Data bytes of the frames received
+} TOUCAN_RECEIVE_STATISTICS;
+
+// Snapshot of an adapter's counters, the host's and the adapter firmware's together, see GetStatistics.
+// Each counter is read once without a lock, so the snapshot is not atomic as a whole.
+typedef struct _TOUCAN_STATISTICS {
+	// Receive path, since the read thread was started
+	ULONGLONG	receiveBytes;			// Data bytes of the frames received
+	UINT32	receiveFrames;			// Frames received, before extended frames are selected
+	UINT32	receiveTransfers;		// Reads that carried frames
+	UINT32	receiveMalformed;		// Packets that could not be decoded
+	UINT32	receiveFailures;		// Failed reads
+	UINT32	receiveQueued;			// Frames waiting to be drained
+	UINT32	receiveOverflows;		// Frames dropped because the receive queue was full
+	UINT32	receiveHighWater;		// Largest number of frames ever queued
+	UINT32	notExtended;			// Standard and remote frames dropped
+	UINT32	mutexTimeouts;			// Frames the single frame buffer could not be locked for
+	UINT32	notificationsSent;		// Times the frame received event was signalled
+	UINT32	notificationsCoalesced;	// Signals not raised because the caller had not drained the previous one
+
+	// Filters
+	UINT32	subscriptionBanks;		// Acceptance filters the PGN subscriptions were compiled into
+	UINT32	subscriptionRejected;	// Frames the adapter passed and the subscription post filter discarded
+	UINT32	filterRules;			// Host side filter rules installed
+	UINT32	filterRejected;			// Frames the rules discarded
+
+	// Fast packet reassembly
+	UINT32	fastPacketCompleted;
+	UINT32	fastPacketTimeouts;
+	UINT32	fastPacketSequenceErrors;
+	UINT32	fastPacketBufferFull;	// Messages lost to a full reassembler or message queue
+
+	// Transmit path
+	UINT32	transmitFrames;			// Frames handed to the adapter
+	UINT32	transmitTransfers;		// Transfers used to carry them
+	UINT32	transmitFailures;		// Queued frames that could not be transmitted
+	UINT32	transmitQueued;			// Frames waiting for the writer thread
+	UINT32	transmitHighWater;		// Largest number of frames ever waiting
+	UINT32	transmitDrops;			// Frames refused because their priority lane was full
+	UINT32	transmitRetries;		// Transfers the writer thread repeated
+
+	// Correlation of the adapter's timestamp with the host clock
+	LONG	clockSynchronised;		// Non zero once the drift has been measured
+	LONG	clockDrift;				// Parts per billion, positive if the adapter's clock runs slow
+	UINT32	clockResets;			// Restarts of the adapter's clock
+
+	// Bus health, sums over the monitor's window and totals since it started
+	UINT32	busErrors;
+	UINT32	fifoOverruns;
+	UINT32	overrunFrames;
+	UINT32	healthWindow;			// Milliseconds the sums cover
+	UINT32	busOffEvents;
+
+	// Counters kept by the adapter firmware, valid only if the adapter is open and answered
+	BOOL	deviceValid;
+	TOUCAN_DEVICE_STATISTICS	device;
+} TOUCAN_STATISTICS;
+
+// Advance a counter that has a single writer
+static __inline void TouCAN_stats_add(volatile LONG *counter, LONG value) {
+	WriteNoFence(counter, ReadNoFence(counter) + value);
+}
+
+static __inline void TouCAN_stats_add64(volatile LONGLONG *counter, LONGLONG value) {
+	WriteNoFence64(counter, ReadNoFence64(counter) + value);
+}
+
+// Count a read and the records it carried
+static __inline void TouCAN_stats_transfer(TOUCAN_RECEIVE_STATISTICS *statistics, UINT32 records) {
+	TouCAN_stats_add(&statistics->transfers[(records < TOUCAN_MAX_READ_BATCH) ? records : TOUCAN_MAX_READ_BATCH], 1);
+}
+
+#endif
@@ -0,0 +1,50 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_SUBSCRIPTION
+#define _TWOCAN_TOUCAN_SUBSCRIPTION
+
+#include "../inc/toucan_header.h"
+
+// Largest number of PGN / source address pairs that can be subscribed to
+#define TOUCAN_MAX_SUBSCRIPTIONS 64
+
+// Subscribe to a PGN from every source
+#define TOUCAN_ANY_SOURCE 0xFF
+
+// Identifier and mask of an extended acceptance filter, a frame passes if ((id ^ bank.id) & bank.mask) == 0
+typedef struct _TOUCAN_FILTER_BANK {
+	UINT32	id;
+	UINT32	mask;
+} TOUCAN_FILTER_BANK;
+
+// A subscription list compiled into at most maxBanks acceptance filters
+typedef struct _TOUCAN_SUBSCRIPTION {
+	UINT32	count;			// Distinct subscriptions, zero accepts everything
+	TOUCAN_FILTER_BANK	entries[TOUCAN_MAX_SUBSCRIPTIONS];
+	UINT32	banks;			// Filters needed to pass every subscription
+	TOUCAN_FILTER_BANK	bank[TOUCAN_MAX_SUBSCRIPTIONS];
+	BOOL	exact;			// The banks pass nothing but the subscriptions, no post filter is needed
+} TOUCAN_SUBSCRIPTION;
+
+BOOL	TouCAN_subscription_compile(TOUCAN_SUBSCRIPTION *subscription, const UINT32 *pgns, const UINT8 *sources, UINT32 count, UINT32 maxBanks);
+BOOL	TouCAN_subscription_match(const TOUCAN_SUBSCRIPTION *subscription, UINT32 id);
+
+#endif
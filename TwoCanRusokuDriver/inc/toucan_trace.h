@@ -0,0 +1,118 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_TRACE
+#define _TWOCAN_TOUCAN_TRACE
+
+#include "../inc/toucan_ring.h"
+
+// Trace levels, an event is compiled in only if its level is at most TOUCAN_TRACE_LEVEL
+#define TOUCAN_TRACE_LEVEL_NONE 0
+#define TOUCAN_TRACE_LEVEL_ERROR 1
+#define TOUCAN_TRACE_LEVEL_WARNING 2
+#define TOUCAN_TRACE_LEVEL_INFO 3
+#define TOUCAN_TRACE_LEVEL_DEBUG 4
+
+#if !defined(TOUCAN_TRACE_LEVEL)
+#if defined(_DEBUG)
+#define TOUCAN_TRACE_LEVEL TOUCAN_TRACE_LEVEL_DEBUG
+#else
+#define TOUCAN_TRACE_LEVEL TOUCAN_TRACE_LEVEL_INFO
+#endif
+#endif
+
+// Threads that can record events at the same time, each has a ring of its own
+#define TOUCAN_TRACE_MAX_THREADS 16
+
+// Events each ring holds until they are drained, a power of two
+#define TOUCAN_TRACE_RING_DEPTH 512
+
+// Events, the comment lists the two arguments recorded with each
+typedef enum {
+	TOUCAN_TRACE_PACKET = 0,				// Frames read, frames queued
+	TOUCAN_TRACE_MALFORMED_PACKET = 1,
+	TOUCAN_TRACE_MUTEX_TIMEOUT = 2,			// Wait result, last error
+	TOUCAN_TRACE_SET_EVENT_FAILED = 3,		// Last error
+	TOUCAN_TRACE_TRANSMIT_FAILED = 4,		// Frames, frames written
+	TOUCAN_TRACE_MESSAGE_FAILED = 5,		// PGN, frames written
+	TOUCAN_TRACE_READ_SUBMIT_FAILED = 6,	// Last error
+	TOUCAN_TRACE_WRITE_FAILED = 7,			// Last error
+	TOUCAN_TRACE_BUS_CONDITION = 8,			// TOUCAN_BUS_xxx, error code
+	TOUCAN_TRACE_EVENTS = 9
+} TOUCAN_TRACE_EVENT;
+
+// A recorded event, formatted only when it is drained
+typedef struct _TOUCAN_TRACE_RECORD {
+	LONGLONG	time;			// Performance counter ticks, see TouCAN_trace_format
+	UINT32		thread;			// Recording thread
+	UINT16		event;			// TOUCAN_TRACE_EVENT
+	UINT8		level;
+	UINT8		reserved;
+	UINT32		args[2];
+} TOUCAN_TRACE_RECORD;
+
+// Single producer, single consumer ring of one thread's events. A thread claims a free ring
+// the first time it records and releases it when it exits, a later thread continues where it stopped.
+// Events are dropped rather than overwritten when the ring is full.
+typedef struct _TOUCAN_TRACE_RING {
+	volatile LONG	owned;
+	UINT32			thread;
+	UINT8			padding0[TOUCAN_CACHE_LINE];
+	volatile LONG	head;		// Next slot to be written, owned by the recording thread
+	volatile LONG	dropped;	// Events lost because the ring was full
+	UINT8			padding1[TOUCAN_CACHE_LINE];
+	volatile LONG	tail;		// Next slot to be drained
+	UINT8			padding2[TOUCAN_CACHE_LINE];
+	TOUCAN_TRACE_RECORD	records[TOUCAN_TRACE_RING_DEPTH];
+} TOUCAN_TRACE_RING;
+
+void	TouCAN_trace_record(UINT8 level, UINT16 event, UINT32 arg0, UINT32 arg1);
+void	TouCAN_trace_release(void);
+UINT32	TouCAN_trace_drain(TOUCAN_TRACE_RECORD *records, UINT32 maxRecords);
+UINT32	TouCAN_trace_format(const TOUCAN_TRACE_RECORD *record, char *text, UINT32 size);
+BOOL	TouCAN_trace_dump(const char *path);
+void	TouCAN_trace_statistics(UINT32 *recorded, UINT32 *dropped);
+
+// Record an event, the calls below the configured level compile to nothing
+#if TOUCAN_TRACE_LEVEL >= TOUCAN_TRACE_LEVEL_ERROR
+#define TOUCAN_TRACE_ERROR(event, arg0, arg1) TouCAN_trace_record(TOUCAN_TRACE_LEVEL_ERROR, (event), (UINT32)(arg0), (UINT32)(arg1))
+#else
+#define TOUCAN_TRACE_ERROR(event, arg0, arg1) ((void)0)
+#endif
+
+#if TOUCAN_TRACE_LEVEL >= TOUCAN_TRACE_LEVEL_WARNING
+#define TOUCAN_TRACE_WARNING(event, arg0, arg1) TouCAN_trace_record(TOUCAN_TRACE_LEVEL_WARNING, (event), (UINT32)(arg0), (UINT32)(arg1))
+#else
+#define TOUCAN_TRACE_WARNING(event, arg0, arg1) ((void)0)
+#endif
+
+#if TOUCAN_TRACE_LEVEL >= TOUCAN_TRACE_LEVEL_INFO
+#define TOUCAN_TRACE_INFO(event, arg0, arg1) TouCAN_trace_record(TOUCAN_TRACE_LEVEL_INFO, (event), (UINT32)(arg0), (UINT32)(arg1))
+#else
+#define TOUCAN_TRACE_INFO(event, arg0, arg1) ((void)0)
+#endif
+
+#if TOUCAN_TRACE_LEVEL >= TOUCAN_TRACE_LEVEL_DEBUG
+#define TOUCAN_TRACE_DEBUG(event, arg0, arg1) TouCAN_trace_record(TOUCAN_TRACE_LEVEL_DEBUG, (event), (UINT32)(arg0), (UINT32)(arg1))
+#else
+#define TOUCAN_TRACE_DEBUG(event, arg0, arg1) ((void)0)
+#endif
+
+#endif
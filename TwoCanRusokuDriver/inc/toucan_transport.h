@@ -0,0 +1,79 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_TRANSPORT
+#define _TWOCAN_TOUCAN_TRANSPORT
+
+#include "../inc/toucan_frame.h"
+
+// Number of bulk IN reads kept in flight and the size of each read buffer
+#define TOUCAN_DEFAULT_READ_QUEUE_DEPTH 4
+#define TOUCAN_MAX_READ_QUEUE_DEPTH 32
+#define TOUCAN_DEFAULT_READ_BUFFER_SIZE 64
+#define TOUCAN_MAX_READ_BUFFER_SIZE 4096
+
+// Read buffers must be a whole number of full speed bulk packets
+#define TOUCAN_USB_MAX_PACKET_SIZE 64
+
+// How long the read thread waits for the oldest read before checking whether it should exit
+#define TOUCAN_READ_WAIT_TIMEOUT 100
+
+// Outcome of waiting for a submitted transfer
+typedef enum {
+	TOUCAN_TRANSFER_COMPLETE = 0,	// Data is available
+	TOUCAN_TRANSFER_PENDING = 1,	// Still in flight after the wait timed out
+	TOUCAN_TRANSFER_FAILED = 2,		// Completed with an error, or could not be submitted
+	TOUCAN_TRANSFER_MALFORMED = 3	// Completed, but the data was not a whole number of valid records
+} TOUCAN_TRANSFER_RESULT;
+
+// Bulk IN endpoint operations. Slots are submitted and completed in FIFO order.
+// The WinUSB implementation lives in toucan_hardware.c, simulated endpoints implement
+// the same operations in process so the pipeline can run without an adapter.
+typedef struct _TOUCAN_READ_ENDPOINT {
+	void	*context;
+	BOOL	(*Open)(void *context, UINT32 queueDepth);
+	void	(*Close)(void *context);
+	BOOL	(*SubmitRead)(void *context, UINT32 slot, UINT8 *buffer, UINT32 length);
+	TOUCAN_TRANSFER_RESULT	(*WaitRead)(void *context, UINT32 slot, DWORD timeout, ULONG *transferred);
+	void	(*CancelReads)(void *context);
+} TOUCAN_READ_ENDPOINT;
+
+// Keeps queueDepth reads posted on the endpoint, each with its own buffer from the pool.
+// The buffer returned by TouCAN_pipeline_read is recycled on the following call, so
+// the endpoint is never left without a read posted while a packet is being decoded.
+typedef struct _TOUCAN_READ_PIPELINE {
+	TOUCAN_READ_ENDPOINT	*endpoint;
+	UINT32	queueDepth;
+	UINT32	bufferSize;
+	UINT8	*pool;
+	BOOL	pending[TOUCAN_MAX_READ_QUEUE_DEPTH];
+	UINT32	next;			// Oldest slot, the next one to complete
+	BOOL	held;			// Slot next has been handed to the caller and must be resubmitted
+	volatile LONG	packets;
+	volatile LONG	bytes;
+	volatile LONG	failures;
+} TOUCAN_READ_PIPELINE;
+
+BOOL	TouCAN_pipeline_open(TOUCAN_READ_PIPELINE *pipeline, TOUCAN_READ_ENDPOINT *endpoint, UINT32 queueDepth, UINT32 bufferSize);
+void	TouCAN_pipeline_close(TOUCAN_READ_PIPELINE *pipeline);
+TOUCAN_TRANSFER_RESULT	TouCAN_pipeline_read(TOUCAN_READ_PIPELINE *pipeline, DWORD timeout, UINT8 **data, ULONG *length);
+TOUCAN_TRANSFER_RESULT	TouCAN_pipeline_read_frames(TOUCAN_READ_PIPELINE *pipeline, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count);
+
+#endif
@@ -0,0 +1,70 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_TXQUEUE
+#define _TWOCAN_TOUCAN_TXQUEUE
+
+#include "../inc/toucan_ring.h"
+
+// One lane per NMEA 2000 priority, lane 0 is the most urgent
+#define TOUCAN_TX_LANES 8
+
+// Frames each lane can hold, rounded up to a power of two
+#define TOUCAN_DEFAULT_TX_LANE_DEPTH 128
+#define TOUCAN_MAX_TX_LANE_DEPTH 4096
+
+// NMEA 2000 priority, the top 3 bits of the 29 bit identifier
+#define TOUCAN_TX_PRIORITY(id) (((id) >> 26) & 0x07)
+
+// A slot carries a sequence number so producers and the consumer can claim it without locks
+typedef struct _TOUCAN_TX_SLOT {
+	volatile LONG	sequence;
+	TOUCAN_FRAME	frame;
+} TOUCAN_TX_SLOT;
+
+// Bounded multiple producer, single consumer queue for one priority
+typedef struct _TOUCAN_TX_LANE {
+	TOUCAN_TX_SLOT	*slots;
+	UINT32			mask;
+	UINT8			padding0[TOUCAN_CACHE_LINE];
+	volatile LONG	enqueuePosition;	// Claimed by producers with a compare and swap
+	UINT8			padding1[TOUCAN_CACHE_LINE];
+	volatile LONG	dequeuePosition;	// Owned by the writer thread
+	UINT8			padding2[TOUCAN_CACHE_LINE];
+} TOUCAN_TX_LANE;
+
+// Transmit queue drained by the writer thread, highest priority lane first
+typedef struct _TOUCAN_TX_QUEUE {
+	TOUCAN_TX_LANE	lanes[TOUCAN_TX_LANES];
+	volatile LONG	queued;			// Frames currently waiting, all lanes
+	volatile LONG	highWater;		// Largest number of frames ever waiting
+	volatile LONG	enqueued;		// Frames accepted
+	volatile LONG	drops;			// Frames refused because their lane was full
+	volatile LONG	laneDrops[TOUCAN_TX_LANES];
+} TOUCAN_TX_QUEUE;
+
+BOOL	TouCAN_txqueue_init(TOUCAN_TX_QUEUE *queue, UINT32 laneDepth);
+void	TouCAN_txqueue_free(TOUCAN_TX_QUEUE *queue);
+BOOL	TouCAN_txqueue_push(TOUCAN_TX_QUEUE *queue, const TOUCAN_FRAME *frame, BOOL *wasEmpty);
+BOOL	TouCAN_txqueue_push_batch(TOUCAN_TX_QUEUE *queue, const TOUCAN_FRAME *frames, UINT32 count, BOOL *wasEmpty);
+UINT32	TouCAN_txqueue_pop(TOUCAN_TX_QUEUE *queue, TOUCAN_FRAME *frames, UINT32 maxFrames);
+UINT32	TouCAN_txqueue_waiting(TOUCAN_TX_QUEUE *queue, UINT32 lanes);
+
+#endif
@@ -0,0 +1,51 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_USB
+#define _TWOCAN_TOUCAN_USB
+
+#include "../inc/toucan_backend.h"
+
+// TouCAN endpoints, 18 byte records are written to the bulk OUT and read from the bulk IN endpoint
+#define TOUCAN_USB_BULK_OUT 0x01
+#define TOUCAN_USB_BULK_IN 0x81
+
+// A USB device speaking the TouCAN vendor protocol, reduced to the transfers the driver needs.
+// libusb implements it in toucan_libusb.c, toucan_fakeusb.c replays scripted packets instead.
+typedef struct _TOUCAN_USB_DEVICE {
+	void	*context;
+	int		(*Open)(void *context);
+	void	(*Close)(void *context);
+	BOOL	(*Control)(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred);
+	BOOL	(*BulkOut)(void *context, const UINT8 *data, UINT32 length);
+	TOUCAN_READ_ENDPOINT	bulkIn;
+} TOUCAN_USB_DEVICE;
+
+// Transport backend over any TOUCAN_USB_DEVICE, records are read through the multi buffer pipeline
+typedef struct _TOUCAN_USB_BACKEND {
+	TOUCAN_USB_DEVICE	*device;
+	TOUCAN_READ_PIPELINE	pipeline;
+	TOUCAN_TRANSMIT_COUNTERS	transmitted;
+	SRWLOCK	requestLock;
+} TOUCAN_USB_BACKEND;
+
+void	TouCAN_usb_backend(TOUCAN_BACKEND *backend, TOUCAN_USB_BACKEND *usb, TOUCAN_USB_DEVICE *device);
+
+#endif
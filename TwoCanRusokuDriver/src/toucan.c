@@ -23,28 +23,89 @@
 #include "..\common\inc\twocanerror.h"
 
 
-// Separate thread to read data from the CAN device
-HANDLE threadHandle;
-
-// The thread id.
-DWORD threadId;
+// The adapter OpenAdapter, ReadAdapter and WriteAdapter drive, with its read and writer threads,
+// queues, filters and counters. The Set functions configure it before it is opened or started.
+TOUCAN_INSTANCE adapterInstance;
 
 // Event signalled when valid CAN Frame is received
 HANDLE frameReceivedEvent;
 
-// Signal that the thread has terminated
-HANDLE threadFinishedEvent;
-
 // Mutex used to synchronize access to the CAN Frame buffer
 HANDLE frameReceivedMutex;
 
 // Pointer to the caller's CAN Frame buffer
 byte *canFramePtr;
 
-// Variable to indicate RX thread state
-BOOL	isRunning = FALSE;
-UINT8	RxFrame[64];
-ULONG   RxFrameTransferd;
+// Fast packet PGNs set with SetFastPacketPgns, the instances use the built in list until then
+UINT32 fastPacketPgns[TOUCAN_MAX_FAST_PACKET_PGNS];
+
+// Transport the adapter is reached through, selected with SetAdapterSimulation or SetAdapterReplay
+TOUCAN_ADAPTER adapterTransport;
+
+// Held exclusive while OpenAdapter and CloseAdapter open or close the adapter,
+// and shared by the monitor thread while it polls the adapter
+SRWLOCK adapterLock = SRWLOCK_INIT;
+
+// Host time the virtual clock of a simulated adapter started
+LONGLONG simulationStart;
+
+// Shared memory channel the read thread publishes every received frame to, for consumers in other processes
+BOOL sharedChannelEnabled = FALSE;
+char sharedChannelName[TOUCAN_CHANNEL_MAX_NAME] = TOUCAN_CHANNEL_DEFAULT_NAME;
+UINT32 sharedChannelSlots = TOUCAN_CHANNEL_DEFAULT_SLOTS;
+TOUCAN_CHANNEL sharedChannel;
+BOOL sharedChannelOpen = FALSE;
+
+// This process's reader of a channel published by a driver instance, possibly in another process
+TOUCAN_CHANNEL channelReader;
+BOOL channelReaderOpen = FALSE;
+
+// Binary capture of received and transmitted frames, written by the capture thread.
+// Appending holds the lock shared, StopCapture takes it exclusive before closing the file.
+TOUCAN_CAPTURE capture;
+SRWLOCK captureLock = SRWLOCK_INIT;
+BOOL isCapturing = FALSE;
+volatile LONG captureRunning;
+HANDLE captureReadyEvent;
+HANDLE captureThreadHandle;
+
+// Trace events formatted to the debugger output by the trace thread
+volatile LONG traceRunning;
+HANDLE traceStopEvent;
+HANDLE traceThreadHandle;
+DWORD traceInterval;
+
+// Bus health of the adapter and of every open instance, polled by the monitor thread.
+// The callback is called with its lock held shared.
+volatile LONG monitorRunning;
+HANDLE monitorStopEvent;
+HANDLE monitorThreadHandle;
+DWORD monitorInterval;
+BusHealthCallback healthCallback = NULL;
+void* healthContext = NULL;
+SRWLOCK healthCallbackLock = SRWLOCK_INIT;
+
+// This process's reader of a capture file
+TOUCAN_CAPTURE_READER captureReader;
+BOOL captureReaderOpen = FALSE;
+
+// Adapters opened with OpenAdapterInstance, the handle is the slot plus one.
+// A slot is reserved under the lock before its adapter is opened, and published once it is.
+// Each call using an instance holds a reference, CloseAdapterInstance unpublishes the instance
+// and waits on the slot's release event, signalled as the last reference is released, before closing it.
+TOUCAN_INSTANCE instanceStates[TOUCAN_MAX_INSTANCES];
+WINUSB_ADAPTER instanceAdapters[TOUCAN_MAX_INSTANCES];
+TOUCAN_BACKEND instanceBackends[TOUCAN_MAX_INSTANCES];
+TOUCAN_INSTANCE* instances[TOUCAN_MAX_INSTANCES];
+BOOL instanceOpen[TOUCAN_MAX_INSTANCES];
+volatile LONG instanceReferences[TOUCAN_MAX_INSTANCES];
+HANDLE instanceReleased[TOUCAN_MAX_INSTANCES];
+SRWLOCK instanceLock = SRWLOCK_INIT;
+
+// Instances combined by DrainMerged, in time order, source i of the merge is mergeHandles[i]
+TOUCAN_MERGE instanceMerge;
+int mergeHandles[TOUCAN_MAX_INSTANCES];
+BOOL mergeActive = FALSE;
 
 // CANAL variables
 long status;
@@ -54,12 +115,18 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 	switch (fdwReason) {
 	case DLL_PROCESS_ATTACH:
 		DebugPrintf(L"TouCAN DLL Process Attach\n");
+		TouCAN_instance_init(&adapterInstance);
+		adapterInstance.config.hooks.Deliver = DeliverFrame;
+		adapterInstance.config.hooks.Publish = PublishFrame;
+		adapterInstance.config.hooks.Capture = CaptureFrames;
 		break;
 	case DLL_THREAD_ATTACH:
 		DebugPrintf(L"TouCAN DLL Thread Attach\n");
 		break;
 	case DLL_THREAD_DETACH:
 		DebugPrintf(L"TouCAN DLL Thread Detach\n");
+		// The thread's trace ring can be claimed by another thread
+		TouCAN_trace_release();
 		break;
 	case DLL_PROCESS_DETACH:
 		DebugPrintf(L"TouCAN DLL Process Detach\n");
@@ -106,6 +173,17 @@ DllExport char* ManufacturerName(void) {
 //
 
 DllExport int OpenAdapter(void) {
+	int result;
+
+	// Any adapter still open from an earlier OpenAdapter is closed first
+	AcquireSRWLockExclusive(&adapterLock);
+	result = (TouCAN_instance_close(&adapterInstance)) ? TWOCAN_RESULT_SUCCESS : TWOCAN_RESULT_FATAL;
+	ReleaseSRWLockExclusive(&adapterLock);
+	if (result != TWOCAN_RESULT_SUCCESS) {
+		DebugPrintf(L"TouCAN adapter still in use\n");
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
 	// Create an event that is used to notify the caller of a received frame
 	frameReceivedEvent = CreateEvent(NULL, FALSE, FALSE, CONST_DATARX_EVENT);
 
@@ -116,16 +194,6 @@ DllExport int OpenAdapter(void) {
 		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_FRAME_RECEIVED_EVENT);
 	}
 
-	// Create an event that is used to notify the close method that the thread has ended
-	threadFinishedEvent = CreateEvent(NULL, FALSE, FALSE, CONST_EVENT_THREAD_ENDED);
-
-	if (threadFinishedEvent == NULL)
-	{
-		// Fatal Error
-		DebugPrintf(L"Create ThreadFinished Event failed (%d)\n", GetLastError());
-		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_COMPLETE_EVENT);
-	}
-
 	// Open the mutex that is used to synchronize access to the Can Frame buffer
 	// Initial state set to true, meaning we "own" the initial state of the mutex
 	frameReceivedMutex = OpenMutex(SYNCHRONIZE, TRUE, CONST_MUTEX_NAME);
@@ -137,218 +205,2070 @@ DllExport int OpenAdapter(void) {
 		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_FRAME_RECEIVED_MUTEX);
 	}
 
-	Toucan_winusb_deinit(&deviceData);
-
 	Sleep(100);
 
-	hr = Toucan_winusb_init(&deviceData, &noDevice);
-
-	if (FAILED(hr)) {
-		DebugPrintf(L"Toucan_winusb_init failed\n");
-		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
-	}
-
-	if(TouCAN_init() == FALSE )
-	{
-		DebugPrintf(L"Toucan_init failed\n");
-		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	// The virtual clock of a simulation starts now, a real time simulation is paced against the host clock from here
+	simulationStart = HostMicroseconds();
+	adapterTransport.simulationConfig.Pace = (adapterTransport.kind == TOUCAN_ADAPTER_SIMULATED_REAL_TIME) ? PaceSimulation : NULL;
+	if (TouCAN_adapter_backend(&adapterTransport) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
 	}
 
-	if (TouCAN_start() == FALSE)
-	{
-		DebugPrintf(L"Toucan_start failed\n");
-		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	// Opens, initialises and starts the adapter, and the writer thread in the queued transmit mode
+	adapterInstance.config.frameReceivedEvent = frameReceivedEvent;
+	AcquireSRWLockExclusive(&adapterLock);
+	result = TouCAN_instance_open(&adapterInstance, &adapterTransport.backend, NULL);
+	ReleaseSRWLockExclusive(&adapterLock);
 
+	if (result != TWOCAN_RESULT_SUCCESS) {
+		DebugPrintf(L"TouCAN_instance_open failed: %S\n", adapterTransport.backend.name);
+		return result;
 	}
 
 	return TWOCAN_RESULT_SUCCESS;
 }
 
 DllExport int CloseAdapter(void) {
-	DebugPrintf(L"TouCAN CloseAdapter\n");
+	BOOL closed;
 
-	// Terminate the read thread
-	isRunning = FALSE;
+	DebugPrintf(L"TouCAN CloseAdapter\n");
 
-	// Wait for the thread to exit
-	int waitResult;
-	waitResult = WaitForSingleObject(threadFinishedEvent, 1000);
-	if (waitResult == WAIT_TIMEOUT) {
-		DebugPrintf(L"Wait for threadFinishedEVent timed out");
-	}
-	if (waitResult == WAIT_ABANDONED) {
-		DebugPrintf(L"Wait for threadFinishedEVent abandoned");
-	}
-	if (waitResult == WAIT_FAILED) {
-		DebugPrintf(L"Wait for threadFinishedEVent Error: %d", GetLastError());
+	// Terminate the read thread, the shared channel may only be released once it has exited
+	if (TouCAN_instance_stop(&adapterInstance)) {
+		CloseChannelWriter();
 	}
 
-	// Close all the handles
-	int closeResult;
+	// The writer thread sends whatever is still queued, then the adapter is closed.
+	// The monitor keeps polling the instances, it skips the adapter once it is closed.
+	AcquireSRWLockExclusive(&adapterLock);
+	closed = TouCAN_instance_close(&adapterInstance);
+	ReleaseSRWLockExclusive(&adapterLock);
 
-	closeResult = CloseHandle(threadFinishedEvent);
-	if (closeResult == 0) {
-		DebugPrintf(L"Close threadFinsishedEvent Error: %d", GetLastError());
+	// Index and close a capture still in progress, nothing is received or transmitted any more
+	if (isCapturing) {
+		StopCapture();
 	}
 
-	closeResult = CloseHandle(frameReceivedEvent);
-	if (closeResult == 0) {
-		DebugPrintf(L"Close frameReceivedEvent Error: %d", GetLastError());
-	}
-	closeResult = CloseHandle(threadHandle);
-	if (closeResult == 0) {
-		DebugPrintf(L"Close threadHandle Error: %d", GetLastError());
+	if (closed == FALSE) {
+		// A thread is still running, it keeps the adapter and the event until a later close
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_DELETE_THREAD_HANDLE);
 	}
 
-	TouCAN_deinit();
-	Sleep(50);
-	Toucan_winusb_deinit(&deviceData);
+	if (CloseHandle(frameReceivedEvent) == 0) {
+		DebugPrintf(L"Close frameReceivedEvent Error: %d", GetLastError());
+	}
+	frameReceivedEvent = NULL;
 
 	return TWOCAN_RESULT_SUCCESS;
 }
 
 DllExport int ReadAdapter(byte* frame) {
+	int result;
+
 	DebugPrintf(L"TouCAN ReadAdapter\n");
 	// Save the pointer to the Can Frame buffer
 	canFramePtr = frame;
 
-	// Indicate thread is in running state
-	isRunning = TRUE;
-
-	// Start the read thread
-	threadHandle = CreateThread(NULL, 0, ReadThread, NULL, 0, &threadId);
+	if ((sharedChannelEnabled) && (sharedChannelOpen == FALSE)) {
+		if (TouCAN_channel_create(&sharedChannel, sharedChannelName, sharedChannelSlots) == FALSE) {
+			DebugPrintf(L"Shared channel failed: %S (%d)\n", sharedChannelName, GetLastError());
+			return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+		}
+		sharedChannelOpen = TRUE;
+	}
 
-	if (threadHandle != NULL) {
-		return TWOCAN_RESULT_SUCCESS;
+	// Allocates the receive queue, posts the reads and starts the read thread
+	result = TouCAN_instance_start(&adapterInstance);
+	if (result != TWOCAN_RESULT_SUCCESS) {
+		CloseChannelWriter();
 	}
-	// Fatal Error
-	isRunning = FALSE;
-	DebugPrintf(L"Read thread failed: %d (%d)\n", threadId, GetLastError());
-	return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	return result;
 }
 
 DllExport int WriteAdapter(const unsigned int id, const int dataLength, byte* data) {
 	//DebugPrintf(L"TouCAN WriteAdapter\n");
 
-	BOOL status;
+	UINT32 written;
+	TOUCAN_FRAME frame;
 
-	status = TouCAN_write(id, dataLength, data);
-	if (status == TRUE) {
+	if ((data == NULL) || (dataLength < 0) || (dataLength > TOUCAN_FRAME_DATA_LENGTH)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
+
+	frame.flags = (UINT8)CANAL_IDFLAG_EXTENDED;
+	frame.id = id;
+	frame.length = (UINT8)dataLength;
+	frame.timestamp = 0;
+	memcpy(frame.data, data, TOUCAN_FRAME_DATA_LENGTH);
+
+	if (adapterInstance.writerHandle != NULL) {
+		// Never blocks, a full lane is reported so the caller can retry or shed the frame
+		if (TouCAN_instance_queue(&adapterInstance, &frame, 1) == FALSE) {
+			return SET_ERROR(TWOCAN_RESULT_WARNING, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_WOULD_BLOCK);
+		}
+		return TWOCAN_RESULT_SUCCESS;
+	}
+
+	if (TouCAN_instance_write(&adapterInstance, &frame, 1, &written) == TRUE) {
 		return TWOCAN_RESULT_SUCCESS;
 	}
 	else {
-		DebugPrintf(L"Transmit frame failed: %d\n", status);
+		TOUCAN_TRACE_ERROR(TOUCAN_TRACE_TRANSMIT_FAILED, 1, written);
 		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
 	}
 }
 
 //
-// Read thread, reads CAN Frames from Rusoku Toucan device, if a valid frame is received,
-// parse the frame into the correct format and notify the caller
-// Upon exit, returns TWOCAN_RESULT_SUCCESS as Thread Exit Code
+// Select how received frames are delivered, must be called before ReadAdapter
+// [in] mode, TOUCAN_RECEIVE_MODE_LEGACY copies each frame into the ReadAdapter buffer and signals the event per frame,
+// TOUCAN_RECEIVE_MODE_QUEUED signals the event once per batch (see SetNotificationModeration) and frames are collected with DrainAdapter,
+// TOUCAN_RECEIVE_MODE_MESSAGES reassembles fast packets and complete messages are collected with ReadMessage
+// [in] depth, number of frames or messages the receive queue can hold, zero selects the default
+// returns TWOCAN_RESULT_SUCCESS if the mode was accepted
 //
 
-DWORD WINAPI ReadThread(LPVOID lParam){
+DllExport int SetReceiveMode(const int mode, const unsigned int depth) {
+	DebugPrintf(L"TouCAN SetReceiveMode: %d (%d)\n", mode, depth);
+
+	if ((adapterInstance.threadHandle != NULL) || ((mode != TOUCAN_RECEIVE_MODE_LEGACY) && (mode != TOUCAN_RECEIVE_MODE_QUEUED) && (mode != TOUCAN_RECEIVE_MODE_MESSAGES))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
 
-	DebugPrintf(L"TouCAN ReadThread\n");
+	if (depth > TOUCAN_RING_MAX_DEPTH) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
 
-	UINT8	index = 0;
-	UINT8	FrameCounter = 0;
+	adapterInstance.config.receiveMode = mode;
+	if (depth == 0) {
+		adapterInstance.config.receiveDepth = (mode == TOUCAN_RECEIVE_MODE_MESSAGES) ? TOUCAN_DEFAULT_MESSAGE_DEPTH : TOUCAN_DEFAULT_RECEIVE_DEPTH;
+	}
+	else {
+		adapterInstance.config.receiveDepth = depth;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
 
-	struct _CAN_MSG
-	{
-		UINT32  flags;
-		UINT32  id;
-		UINT8	sizeData;
-		UINT8   data[64];
-		UINT32	timestamp;
-	}msg;
-
-	DWORD   mutexResult;
-
-	while (isRunning) {		
-		if (TouCAN_read(RxFrame, sizeof(RxFrame), &RxFrameTransferd) == TRUE) {
-			//DebugPrintf(L"Received total bytes: %d\n", RxFrameTransferd);
-
-			// Check FrameCounter number from total USB length
-			switch (RxFrameTransferd)
-			{
-			case	18:
-				FrameCounter = 1;
-				break;
-			case	36:
-				FrameCounter = 2;
-				break;
-			case	54:
-				FrameCounter = 3;
-				break;
-			default:
-				FrameCounter = 0;
-				break;
+//
+// Write several frames, packed up to three per USB transfer
+// [in] ids, 29 bit CAN identifier of each frame
+// [in] dataLengths, data length of each frame, 0 to 8
+// [in] data, count * 8 bytes of CAN data
+// [in] count, number of frames
+// returns TWOCAN_RESULT_SUCCESS if every frame was handed to the adapter, nothing is sent if a length is out of range
+//
+
+DllExport int WriteAdapterBatch(const unsigned int* ids, const int* dataLengths, byte* data, const int count) {
+	TOUCAN_FRAME frames[TOUCAN_WRITE_BATCH];
+	UINT32 chunk;
+	UINT32 written;
+	BOOL status = TRUE;
+
+	if ((ids == NULL) || (dataLengths == NULL) || (data == NULL) || (count < 0)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
+
+	// Checked before anything is sent, so a bad length never leaves part of a batch on the bus
+	for (int i = 0; i < count; i++) {
+		if ((dataLengths[i] < 0) || (dataLengths[i] > TOUCAN_FRAME_DATA_LENGTH)) {
+			return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+		}
+	}
+
+	for (int sent = 0; (sent < count) && (status == TRUE); sent += chunk) {
+		chunk = (UINT32)(count - sent);
+		if (chunk > TOUCAN_WRITE_BATCH) {
+			chunk = TOUCAN_WRITE_BATCH;
+		}
+
+		for (UINT32 i = 0; i < chunk; i++) {
+			frames[i].flags = (UINT8)CANAL_IDFLAG_EXTENDED;
+			frames[i].id = ids[sent + i];
+			frames[i].length = (UINT8)dataLengths[sent + i];
+			frames[i].timestamp = 0;
+			memcpy(frames[i].data, &data[(sent + i) * TOUCAN_FRAME_DATA_LENGTH], TOUCAN_FRAME_DATA_LENGTH);
+		}
+
+		if (adapterInstance.writerHandle != NULL) {
+			// The frames of a batch are queued in order, a full lane rejects the rest of the batch
+			if (TouCAN_instance_queue(&adapterInstance, frames, chunk) == FALSE) {
+				return SET_ERROR(TWOCAN_RESULT_WARNING, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_WOULD_BLOCK);
 			}
-			//DebugPrintf(L"Received frames: %d\n", FrameCounter);
+		}
+		else {
+			status = TouCAN_instance_write(&adapterInstance, frames, chunk, &written);
+		}
+	}
 
-			if (FrameCounter == 0)
-				continue;
+	if (status == TRUE) {
+		return TWOCAN_RESULT_SUCCESS;
+	}
+	TOUCAN_TRACE_ERROR(TOUCAN_TRACE_TRANSMIT_FAILED, count, written);
+	return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+}
+
+//
+// Write a message, a fast packet PGN is split into frames that are submitted together
+// [in] pgn, parameter group number, for PDU1 PGNs without the destination address
+// [in] priority, 0 (highest) to 7
+// [in] source, source address
+// [in] destination, destination address, only used by PDU1 PGNs
+// [in] payload, message data
+// [in] length, at most 8 bytes, or TOUCAN_FAST_PACKET_MAX_LENGTH bytes for a fast packet PGN
+// returns TWOCAN_RESULT_SUCCESS if every frame was handed to the adapter or queued
+//
+
+DllExport int WriteMessage(const unsigned int pgn, const int priority, const int source, const int destination, byte* payload, const int length) {
+	TOUCAN_FRAME frames[TOUCAN_FAST_PACKET_MAX_FRAMES];
+	TOUCAN_HEADER header;
+	UINT32 id;
+	UINT32 count;
+	UINT32 written;
 
-			index = 0;
-			for (UINT8 x = 0; x < FrameCounter; x++)
-			{
-				msg.flags = (((UINT32)RxFrame[index++]) & 0x000000ff);
+	if ((pgn > TOUCAN_MAX_PGN) || (priority < 0) || (priority > 7) || (source < 0) || (source > 0xFF) ||
+		(destination < 0) || (destination > 0xFF) || (length < 0) || ((payload == NULL) && (length > 0))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
 
-				msg.id = (((UINT32)RxFrame[index++] << 24) & 0x1f000000);
-				msg.id |= (((UINT32)RxFrame[index++] << 16) & 0x00ff0000);
-				msg.id |= (((UINT32)RxFrame[index++] << 8) & 0x0000ff00);
-				msg.id |= (((UINT32)RxFrame[index++]) & 0x000000ff);
+	header.pgn = pgn;
+	header.priority = (UINT8)priority;
+	header.source = (UINT8)source;
+	header.destination = (UINT8)destination;
+	id = TouCAN_header_encode(&header);
 
-				msg.sizeData = RxFrame[index++];
-				memcpy_s((UINT8*)msg.data, 8, &RxFrame[index], 8);
-				index += 8;
+	count = TouCAN_fastpacket_segment(&adapterInstance.segmenter, id, payload, (UINT32)length, frames);
+	if (count == 0) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
 
-				msg.timestamp = (((UINT32)RxFrame[index++] << 24) & 0xff000000);
-				msg.timestamp |= (((UINT32)RxFrame[index++] << 16) & 0x00ff0000);
-				msg.timestamp |= (((UINT32)RxFrame[index++] << 8) & 0x0000ff00);
-				msg.timestamp |= (((UINT32)RxFrame[index++]) & 0x000000ff);
+	if (adapterInstance.writerHandle != NULL) {
+		// Every frame shares the priority, so the message is queued whole or not at all
+		if (TouCAN_instance_queue(&adapterInstance, frames, count) == FALSE) {
+			return SET_ERROR(TWOCAN_RESULT_WARNING, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_WOULD_BLOCK);
+		}
+		return TWOCAN_RESULT_SUCCESS;
+	}
 
-				// We are interested in CAN Extended frames only
-				if (msg.flags != CANAL_IDFLAG_EXTENDED) {
-					continue;
-				}
-			
-				// Make sure we can get a lock on the buffer
-				mutexResult = WaitForSingleObject(frameReceivedMutex, 200);
+	if (TouCAN_instance_write(&adapterInstance, frames, count, &written) == TRUE) {
+		return TWOCAN_RESULT_SUCCESS;
+	}
+	TOUCAN_TRACE_ERROR(TOUCAN_TRACE_MESSAGE_FAILED, pgn, written);
+	return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+}
+
+//
+// Decode the header of a TwoCan frame, as returned by ReadAdapter or DrainAdapter
+// [in] frame, TwoCan frame, the little endian 29 bit id followed by the data
+// [out] header, for PDU1 PGNs the PGN without the destination address, for PDU2 PGNs the destination is 255
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int DecodeHeader(const byte* frame, CanHeader* header) {
+	TOUCAN_HEADER decoded;
+
+	if ((frame == NULL) || (header == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
 
-				if (mutexResult == WAIT_OBJECT_0) {
+	TouCAN_header_decode(FrameId(frame), &decoded);
+	header->pgn = decoded.pgn;
+	header->priority = decoded.priority;
+	header->source = decoded.source;
+	header->destination = decoded.destination;
+	return TWOCAN_RESULT_SUCCESS;
+}
 
-					// Convert id (long) to TwoCan header format (byte array)
-					canFramePtr[3] = (msg.id >> 24) & 0xFF;
-					canFramePtr[2] = (msg.id >> 16) & 0xFF;
-					canFramePtr[1] = (msg.id >> 8) & 0xFF;
-					canFramePtr[0] =  msg.id & 0xFF;
+//
+// Decode the headers of an array of TwoCan frames into one array per field
+// [in] frames, count * CONST_FRAME_LENGTH bytes in TwoCan frame format
+// [in] count, number of frames
+// [out] pgns, priorities, sources, destinations, count entries each, any may be NULL
+// returns TWOCAN_RESULT_SUCCESS
+//
 
-					// Copy the CAN data
-					memcpy(&canFramePtr[4], msg.data, msg.sizeData);
+DllExport int DecodeHeaders(const byte* frames, const int count, unsigned int* pgns, byte* priorities, byte* sources, byte* destinations) {
+	UINT32 ids[TOUCAN_DRAIN_BATCH];
+	TOUCAN_HEADERS headers;
+	UINT32 chunk;
 
-					// Release the lock
-					ReleaseMutex(frameReceivedMutex);
+	if ((count < 0) || ((count > 0) && (frames == NULL))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
 
-					// Notify the caller
-					if (!SetEvent(frameReceivedEvent)) {						
-						// Non fatal error
-						DebugPrintf(L"Set Event Error: %d\n", GetLastError());
-					}
-				}
-				else {
-					// Non fatal error
-					DebugPrintf(L"Adapter Mutex: %d -->%d\n", mutexResult, GetLastError());
-				}
+	for (UINT32 done = 0; done < (UINT32)count; done += chunk) {
+		chunk = (((UINT32)count - done) < TOUCAN_DRAIN_BATCH) ? ((UINT32)count - done) : TOUCAN_DRAIN_BATCH;
+		for (UINT32 i = 0; i < chunk; i++) {
+			ids[i] = FrameId(&frames[(done + i) * CONST_FRAME_LENGTH]);
+		}
+
+		headers.pgns = (pgns != NULL) ? &pgns[done] : NULL;
+		headers.priorities = (priorities != NULL) ? &priorities[done] : NULL;
+		headers.sources = (sources != NULL) ? &sources[done] : NULL;
+		headers.destinations = (destinations != NULL) ? &destinations[done] : NULL;
+		TouCAN_header_decode_batch(ids, chunk, &headers);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Coalesce queued frames into shared USB transfers, must be called before OpenAdapter
+// [in] deadline, milliseconds a partially filled transfer of non urgent frames may wait for further frames,
+// zero disables coalescing. A non zero deadline selects the queued transmit mode.
+// Transmit errors of queued frames are only counted, as WriteAdapter has already returned.
+// returns TWOCAN_RESULT_SUCCESS if the deadline was accepted
+//
+
+DllExport int SetTransmitCoalescing(const unsigned int deadline) {
+	DebugPrintf(L"TouCAN SetTransmitCoalescing: %d\n", deadline);
+
+	if ((adapterInstance.writerHandle != NULL) || (deadline > TOUCAN_MAX_TRANSMIT_DEADLINE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	adapterInstance.config.transmitDeadline = deadline;
+	if ((deadline > 0) && (adapterInstance.config.transmitLaneDepth == 0)) {
+		adapterInstance.config.transmitLaneDepth = TOUCAN_DEFAULT_TX_LANE_DEPTH;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Select how frames are transmitted, must be called before OpenAdapter
+// [in] mode, TOUCAN_TRANSMIT_MODE_DIRECT writes each frame on the caller's thread and reports transmit errors,
+// TOUCAN_TRANSMIT_MODE_QUEUED queues frames without blocking for the writer thread, most urgent priority first
+// [in] laneDepth, frames each priority lane can hold, zero selects the default
+// returns TWOCAN_RESULT_SUCCESS if the mode was accepted
+//
+
+DllExport int SetTransmitMode(const int mode, const unsigned int laneDepth) {
+	DebugPrintf(L"TouCAN SetTransmitMode: %d (%d)\n", mode, laneDepth);
+
+	if ((adapterInstance.writerHandle != NULL) || ((mode != TOUCAN_TRANSMIT_MODE_DIRECT) && (mode != TOUCAN_TRANSMIT_MODE_QUEUED))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	if (laneDepth > TOUCAN_MAX_TX_LANE_DEPTH) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	// A lane depth of zero in the configuration writes frames from the caller's thread
+	if (mode == TOUCAN_TRANSMIT_MODE_DIRECT) {
+		adapterInstance.config.transmitLaneDepth = 0;
+	}
+	else {
+		adapterInstance.config.transmitLaneDepth = (laneDepth == 0) ? TOUCAN_DEFAULT_TX_LANE_DEPTH : laneDepth;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Configure the reads kept in flight on the bulk IN endpoint, must be called before ReadAdapter
+// [in] queueDepth, number of reads posted at any time, zero selects the default
+// [in] bufferSize, bytes per read, rounded up to a multiple of the 64 byte USB packet, zero selects the default
+// returns TWOCAN_RESULT_SUCCESS if the configuration was accepted
+//
 
+DllExport int SetReadPipeline(const unsigned int queueDepth, const unsigned int bufferSize) {
+	DebugPrintf(L"TouCAN SetReadPipeline: %d (%d)\n", queueDepth, bufferSize);
+
+	if ((adapterInstance.threadHandle != NULL) || (queueDepth > TOUCAN_MAX_READ_QUEUE_DEPTH) || (bufferSize > TOUCAN_MAX_READ_BUFFER_SIZE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	adapterInstance.config.readQueueDepth = (queueDepth == 0) ? TOUCAN_DEFAULT_READ_QUEUE_DEPTH : queueDepth;
+	adapterInstance.config.readBufferSize = (bufferSize == 0) ? TOUCAN_DEFAULT_READ_BUFFER_SIZE : bufferSize;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Drain. Copy all queued frames, oldest first, into the caller's buffer in TwoCan frame format
+// Only one thread may drain the queue, normally the thread waiting on the frame received event
+// [out] frames, buffer of maxFrames * CONST_FRAME_LENGTH bytes
+// [in] maxFrames, capacity of frames
+// [out] frameCount, number of frames copied
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int DrainAdapter(byte* frames, const int maxFrames, int* frameCount) {
+	return DrainAdapterTimestamped(frames, NULL, NULL, maxFrames, frameCount);
+}
+
+//
+// Drain, as DrainAdapter, also returning the timestamp of every frame
+// [out] frames, buffer of maxFrames * CONST_FRAME_LENGTH bytes
+// [out] hostTimes, optional, when each frame was received in host monotonic microseconds (QueryPerformanceCounter).
+// With TOUCAN_TIMESTAMP_MODE_DEVICE this is the adapter's timestamp mapped onto the host clock.
+// [out] deviceTimes, optional, the adapter's raw 32 bit timestamp of each frame
+// [in] maxFrames, capacity of frames, hostTimes and deviceTimes
+// [out] frameCount, number of frames copied
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int DrainAdapterTimestamped(byte* frames, long long* hostTimes, unsigned int* deviceTimes, const int maxFrames, int* frameCount) {
+	TOUCAN_FRAME batch[TOUCAN_DRAIN_BATCH];
+	UINT32 count;
+	int total = 0;
+
+	if ((frames == NULL) || (frameCount == NULL) || (maxFrames < 0) || (adapterInstance.receiveRing.frames == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	do {
+		count = (UINT32)(maxFrames - total);
+		if (count > TOUCAN_DRAIN_BATCH) {
+			count = TOUCAN_DRAIN_BATCH;
+		}
+
+		count = TouCAN_instance_drain(&adapterInstance, batch, count);
+
+		for (UINT32 i = 0; i < count; i++, total++) {
+			ConvertToTwoCanFrame(&batch[i], &frames[total * CONST_FRAME_LENGTH]);
+			if (hostTimes != NULL) {
+				hostTimes[total] = batch[i].hostTime;
 			}
+			if (deviceTimes != NULL) {
+				deviceTimes[total] = batch[i].timestamp;
+			}
+		}
+	} while ((count == TOUCAN_DRAIN_BATCH) && (total < maxFrames));
+
+	*frameCount = total;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Select the source of the frame timestamps, must be called before OpenAdapter
+// [in] mode, TOUCAN_TIMESTAMP_MODE_HOST stamps frames when their USB packet arrives,
+// TOUCAN_TIMESTAMP_MODE_DEVICE maps the adapter's own timestamp onto the host clock, correcting for offset and drift
+// [in] options, TOUCAN_TIMESTAMP_OPTION_DELAY initialises the adapter with TouCAN_ENABLE_TIMESTAMP_DELAY
+// returns TWOCAN_RESULT_SUCCESS if the mode was accepted
+//
+
+DllExport int SetTimestampMode(const int mode, const unsigned int options) {
+	DebugPrintf(L"TouCAN SetTimestampMode: %d (%d)\n", mode, options);
+
+	// TouCAN_ENABLE_TIMESTAMP_DELAY is sent when OpenAdapter initialises the adapter
+	if ((adapterInstance.backend != NULL) || ((mode != TOUCAN_TIMESTAMP_MODE_HOST) && (mode != TOUCAN_TIMESTAMP_MODE_DEVICE))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	if ((options & ~TOUCAN_TIMESTAMP_OPTION_DELAY) != 0) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	adapterInstance.config.deviceTime = (mode == TOUCAN_TIMESTAMP_MODE_DEVICE);
+	if (options & TOUCAN_TIMESTAMP_OPTION_DELAY) {
+		adapterInstance.config.options |= TouCAN_ENABLE_TIMESTAMP_DELAY;
+	}
+	else {
+		adapterInstance.config.options &= ~TouCAN_ENABLE_TIMESTAMP_DELAY;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Receive only the listed PGNs, may be called at any time, the adapter keeps running
+// The list is compiled into the adapter's acceptance filters so unwanted frames never cross USB.
+// When the subscriptions do not fit the filters, the nearest filter is used and the rest are discarded here.
+// [in] pgns, parameter group numbers to receive
+// [in] sources, optional, source address of each PGN or TOUCAN_ANY_SOURCE
+// [in] count, number of PGNs, zero receives every frame
+// returns TWOCAN_RESULT_SUCCESS if the subscriptions were accepted
+//
+
+DllExport int SetPgnFilter(const unsigned int* pgns, const byte* sources, const int count) {
+	TOUCAN_SUBSCRIPTION compiled;
+
+	DebugPrintf(L"TouCAN SetPgnFilter: %d\n", count);
+
+	if ((count < 0) || ((count > 0) && (pgns == NULL))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	if (TouCAN_subscription_compile(&compiled, pgns, sources, (UINT32)count, TouCAN_EXT_FILTER_BANKS) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	// Program the adapter first, the read thread keeps filtering with the old subscription meanwhile
+	if (TouCAN_instance_subscribe(&adapterInstance, &compiled) == FALSE) {
+		// Non fatal, the post filter still discards the frames
+		DebugPrintf(L"Acceptance filter failed\n");
+	}
+
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Filter received frames on the host, may be called at any time without pausing reception
+// [in] rules, count * TOUCAN_FILTER_RULE_FIELDS values: action (TOUCAN_FILTER_ALLOW or TOUCAN_FILTER_DENY),
+// pgn, source, destination and priority, each field may be TOUCAN_FILTER_ANY. The first matching rule decides.
+// [in] count, number of rules, zero with a default action of TOUCAN_FILTER_ALLOW removes the filter
+// [in] defaultAction, decision for frames no rule matches
+// returns TWOCAN_RESULT_SUCCESS if the rules were compiled and installed
+//
+
+DllExport int SetFilterRules(const unsigned int* rules, const int count, const int defaultAction) {
+	TOUCAN_FILTER_RULE compiled[TOUCAN_MAX_FILTER_RULES];
+	TOUCAN_FILTER* replacement = NULL;
+
+	DebugPrintf(L"TouCAN SetFilterRules: %d (%d)\n", count, defaultAction);
+
+	if ((count < 0) || (count > TOUCAN_MAX_FILTER_RULES) || ((count > 0) && (rules == NULL)) ||
+		((defaultAction != TOUCAN_FILTER_ALLOW) && (defaultAction != TOUCAN_FILTER_DENY))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	if ((count > 0) || (defaultAction == TOUCAN_FILTER_DENY)) {
+		for (int i = 0; i < count; i++) {
+			compiled[i].action = rules[(i * TOUCAN_FILTER_RULE_FIELDS) + 0];
+			compiled[i].pgn = rules[(i * TOUCAN_FILTER_RULE_FIELDS) + 1];
+			compiled[i].source = rules[(i * TOUCAN_FILTER_RULE_FIELDS) + 2];
+			compiled[i].destination = rules[(i * TOUCAN_FILTER_RULE_FIELDS) + 3];
+			compiled[i].priority = rules[(i * TOUCAN_FILTER_RULE_FIELDS) + 4];
+		}
+
+		replacement = TouCAN_filter_compile(compiled, (UINT32)count, (defaultAction == TOUCAN_FILTER_ALLOW));
+		if (replacement == NULL) {
+			return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+		}
+	}
+
+	TouCAN_instance_set_filter(&adapterInstance, replacement);
+
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Read a complete message, a single frame or a reassembled fast packet, in TOUCAN_RECEIVE_MODE_MESSAGES
+// Only one thread may read messages, normally the thread waiting on the frame received event
+// [out] id, 29 bit CAN identifier of the message's first frame
+// [out] payload, buffer of at least TOUCAN_FAST_PACKET_MAX_LENGTH bytes
+// [out] length, number of payload bytes, zero if no message was waiting
+// [out] hostTime, optional, host time of the message's first frame in microseconds
+// returns TWOCAN_RESULT_SUCCESS, or a TWOCAN_ERROR_FAST_MESSAGE_BUFFER_FULL warning, still with any message
+// read, when messages have been lost since the previous call
+//
+
+DllExport int ReadMessage(unsigned int* id, byte* payload, int* length, long long* hostTime) {
+	TOUCAN_MESSAGE message;
+	BOOL lost;
+
+	if ((id == NULL) || (payload == NULL) || (length == NULL) || (adapterInstance.messageQueue.messages == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	*length = 0;
+	if (TouCAN_instance_read_message(&adapterInstance, &message, &lost) == TRUE) {
+		*id = message.id;
+		*length = (int)message.length;
+		memcpy(payload, message.data, message.length);
+		if (hostTime != NULL) {
+			*hostTime = message.hostTime;
+		}
+	}
+
+	if (lost) {
+		return SET_ERROR(TWOCAN_RESULT_WARNING, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_FAST_MESSAGE_BUFFER_FULL);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Select the PGNs reassembled and segmented as fast packets, must be called before OpenAdapter
+// [in] pgns, fast packet PGNs, NULL restores the built in list
+// [in] count, number of PGNs
+// returns TWOCAN_RESULT_SUCCESS if the list was accepted
+//
+
+DllExport int SetFastPacketPgns(const unsigned int* pgns, const int count) {
+	DebugPrintf(L"TouCAN SetFastPacketPgns: %d\n", count);
+
+	if ((adapterInstance.threadHandle != NULL) || (count < 0) || (count > TOUCAN_MAX_FAST_PACKET_PGNS)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	adapterInstance.config.fastPacketPgns = (pgns != NULL) ? fastPacketPgns : NULL;
+	adapterInstance.config.fastPacketPgnCount = (pgns != NULL) ? (UINT32)count : 0;
+	for (UINT32 i = 0; i < adapterInstance.config.fastPacketPgnCount; i++) {
+		fastPacketPgns[i] = pgns[i];
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Counters of the adapter, the read thread, the transmit path, the filters and the bus monitor in one
+// snapshot, read without stopping any thread. The adapter firmware's counters are included while
+// the adapter is open, in the device member, and deviceValid is set when they were read.
+// [out] statistics, receives the snapshot
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetStatistics(TOUCAN_STATISTICS* statistics) {
+	UINT32 polls;
+
+	if (statistics == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	TouCAN_instance_statistics(&adapterInstance, statistics);
+
+	// The backend outlives the instance's hold on it, its transmit counters stay readable after CloseAdapter
+	TransmitCounters(&statistics->transmitFrames, &statistics->transmitTransfers);
+
+	polls = (UINT32)ReadNoFence(&adapterInstance.health.polls);
+	statistics->healthWindow = ((polls < TOUCAN_HEALTH_WINDOW) ? polls : TOUCAN_HEALTH_WINDOW) * monitorInterval;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// USB reads since ReadAdapter by the number of records they carried, to size the read pipeline
+// [out] counts, counts[n] is the number of reads carrying n records, the last entry also counts larger reads
+// [in] size, capacity of counts
+// [out] buckets, number of entries written, at most TOUCAN_MAX_READ_BATCH + 1
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetTransferHistogram(unsigned int* counts, const int size, int* buckets) {
+	int count = TOUCAN_MAX_READ_BATCH + 1;
+
+	if ((counts == NULL) || (buckets == NULL) || (size <= 0)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if (count > size) {
+		count = size;
+	}
+
+	for (int i = 0; i < count; i++) {
+		counts[i] = (unsigned int)ReadNoFence(&adapterInstance.receiveStatistics.transfers[i]);
+	}
+	*buckets = count;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Time from receipt to delivery to the caller since ReadAdapter, the histogram behind the percentiles
+// of GetPerformanceReport
+// [out] counts, frames in each bucket
+// [out] bounds, optional, largest latency in microseconds counted in each bucket
+// [in] size, capacity of counts and bounds
+// [out] buckets, number of entries written, at most TOUCAN_LATENCY_BUCKETS
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetLatencyHistogram(unsigned int* counts, unsigned int* bounds, const int size, int* buckets) {
+	int count = TOUCAN_LATENCY_BUCKETS;
+
+	if ((counts == NULL) || (buckets == NULL) || (size <= 0)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if (count > size) {
+		count = size;
+	}
+
+	for (int i = 0; i < count; i++) {
+		counts[i] = (unsigned int)ReadNoFence(&adapterInstance.deliveryLatency.counts[i]);
+		if (bounds != NULL) {
+			bounds[i] = TouCAN_latency_bound((UINT32)i);
 		}
 	}
+	*buckets = count;
+	return TWOCAN_RESULT_SUCCESS;
+}
 
-	SetEvent(threadFinishedEvent);
-	DebugPrintf(L"TouCAN ReadThread exit\n");
-	ExitThread(TWOCAN_RESULT_SUCCESS);
+//
+// Reset the counters kept by the adapter firmware, the host's counters are unchanged
+// returns TWOCAN_RESULT_SUCCESS if the adapter answered
+//
+
+DllExport int ClearDeviceStatistics(void) {
+	if (adapterInstance.backend == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	if (TouCAN_backend_clear_statistics(adapterInstance.backend) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Select the adapter OpenAdapter connects to, must be called before OpenAdapter
+// [in] mode, TOUCAN_ADAPTER_HARDWARE for the TouCAN adapter, TOUCAN_ADAPTER_SIMULATED for a simulated adapter
+// that delivers frames as fast as they are read, or TOUCAN_ADAPTER_SIMULATED_REAL_TIME for one paced by the host clock
+// [in] busLoad, percentage of the simulated 250 kbit/s bus used by background traffic
+// [in] burstFrames, frames queued together every burstPeriod microseconds, zero for no bursts
+// [in] burstPeriod, microseconds between bursts
+// [in] seed, the same seed always produces the same traffic
+// returns TWOCAN_RESULT_SUCCESS if the configuration was accepted
+//
+
+DllExport int SetAdapterSimulation(const int mode, const unsigned int busLoad, const unsigned int burstFrames, const unsigned int burstPeriod, const unsigned int seed) {
+	DebugPrintf(L"TouCAN SetAdapterSimulation: %d (%d)\n", mode, busLoad);
+
+	if ((adapterInstance.backend != NULL) || (mode < TOUCAN_ADAPTER_HARDWARE) || (mode > TOUCAN_ADAPTER_SIMULATED_REAL_TIME) ||
+		(busLoad > 100) || ((burstFrames > 0) && (burstPeriod == 0))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	memset(&adapterTransport.simulationConfig, 0, sizeof(TOUCAN_SIM_CONFIG));
+	adapterTransport.simulationConfig.seed = seed;
+	adapterTransport.simulationConfig.busLoad = busLoad;
+	adapterTransport.simulationConfig.burstFrames = burstFrames;
+	adapterTransport.simulationConfig.burstPeriod = burstPeriod;
+	adapterTransport.kind = mode;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Replay a recording in place of the adapter, must be called before OpenAdapter. Frames are delivered
+// through the same receive path as the adapter's, in every receive mode. SetAdapterSimulation
+// with TOUCAN_ADAPTER_HARDWARE selects the adapter again.
+// [in] path, binary capture, candump -l log or TwoCan raw log
+// [in] format, TOUCAN_REPLAY_FORMAT_xxx, TOUCAN_REPLAY_FORMAT_AUTO to recognise it from its first bytes
+// [in] speed, percent of the recorded pace, 100 for real time, 1000 for ten times as fast, zero for as fast as possible
+// [in] loop, TRUE to start again from the beginning at the end of the recording
+// returns TWOCAN_RESULT_SUCCESS if the configuration was accepted, the recording is opened by OpenAdapter
+//
+
+DllExport int SetAdapterReplay(const char* path, const int format, const unsigned int speed, const int loop) {
+	DebugPrintf(L"TouCAN SetAdapterReplay: %S (%d, %d)\n", (path != NULL) ? path : "", format, speed);
+
+	if ((adapterInstance.backend != NULL) || (path == NULL) || (strlen(path) >= TOUCAN_REPLAY_MAX_PATH) ||
+		(format < TOUCAN_REPLAY_FORMAT_AUTO) || (format > TOUCAN_REPLAY_FORMAT_TWOCAN) || (speed > TOUCAN_REPLAY_MAX_SPEED)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	memset(&adapterTransport.replayConfig, 0, sizeof(TOUCAN_REPLAY_CONFIG));
+	strcpy_s(adapterTransport.replayConfig.path, sizeof(adapterTransport.replayConfig.path), path);
+	adapterTransport.replayConfig.format = (UINT32)format;
+	adapterTransport.replayConfig.speed = speed;
+	adapterTransport.replayConfig.loop = (loop != FALSE);
+	adapterTransport.kind = TOUCAN_ADAPTER_REPLAY;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Progress of the replay since OpenAdapter
+// [out] frames, frames delivered to the receive path
+// [out] rejected, lines or records that were not a frame
+// [out] passes, times the recording was read to its end
+// [out] finished, TRUE once every frame has been delivered and the recording does not loop
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetReplayStatistics(unsigned int* frames, unsigned int* rejected, unsigned int* passes, int* finished) {
+	TOUCAN_REPLAY_STATISTICS statistics;
+
+	TouCAN_replay_statistics(&adapterTransport.replay, &statistics);
+	if (frames != NULL) {
+		*frames = statistics.frames;
+	}
+	if (rejected != NULL) {
+		*rejected = statistics.rejected;
+	}
+	if (passes != NULL) {
+		*passes = statistics.passes;
+	}
+	if (finished != NULL) {
+		*finished = statistics.finished;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Performance of the receive path since ReadAdapter, as a JSON object. Call before CloseAdapter,
+// which releases the read thread the CPU time is taken from.
+// [out] report, receives the null terminated JSON text
+// [in] size, capacity of report in bytes
+// returns TWOCAN_RESULT_SUCCESS, or an error if report is too small
+//
+
+DllExport int GetPerformanceReport(char* report, const int size) {
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	ULARGE_INTEGER kernel, user;
+	LONGLONG elapsed;
+	LONGLONG cpu = 0;
+	UINT32 frames;
+	UINT32 transfers;
+	UINT32 transmittedFrames;
+	UINT32 transmittedTransfers;
+	TOUCAN_SIM_STATISTICS adapter;
+	TOUCAN_REPLAY_STATISTICS replay;
+	TOUCAN_DEVICE_STATISTICS device;
+	char simulation[128];
+	char firmware[192];
+	int length;
+
+	if ((report == NULL) || (size <= 0)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if ((adapterInstance.threadHandle != NULL) && (GetThreadTimes(adapterInstance.threadHandle, &creationTime, &exitTime, &kernelTime, &userTime))) {
+		kernel.LowPart = kernelTime.dwLowDateTime;
+		kernel.HighPart = kernelTime.dwHighDateTime;
+		user.LowPart = userTime.dwLowDateTime;
+		user.HighPart = userTime.dwHighDateTime;
+		// 100 ns units
+		cpu = (LONGLONG)((kernel.QuadPart + user.QuadPart) / 10);
+	}
+
+	elapsed = (adapterInstance.receiveStarted > 0) ? HostMicroseconds() - adapterInstance.receiveStarted : 0;
+	frames = (UINT32)adapterInstance.receiveFrames;
+	transfers = (UINT32)adapterInstance.receiveTransfers;
+	TransmitCounters(&transmittedFrames, &transmittedTransfers);
+
+	if (adapterTransport.kind == TOUCAN_ADAPTER_HARDWARE) {
+		strcpy_s(simulation, sizeof(simulation), "null");
+	}
+	else if (adapterTransport.kind == TOUCAN_ADAPTER_REPLAY) {
+		TouCAN_replay_statistics(&adapterTransport.replay, &replay);
+		sprintf_s(simulation, sizeof(simulation), "{\"replayed\":%u,\"rejected\":%u,\"passes\":%u,\"finished\":%s}",
+			replay.frames, replay.rejected, replay.passes, (replay.finished) ? "true" : "false");
+	}
+	else {
+		TouCAN_simusb_statistics(&adapterTransport.simulated, &adapter);
+		sprintf_s(simulation, sizeof(simulation), "{\"virtualTime\":%lld,\"generated\":%u,\"overruns\":%u,\"lost\":%u}",
+			TouCAN_simusb_now(&adapterTransport.simulated), adapter.generated, adapter.overruns, adapter.lost);
+	}
+
+	// The adapter's own counters, a control request that does not involve the read thread
+	if ((adapterInstance.backend != NULL) && (TouCAN_backend_get_statistics(adapterInstance.backend, &device))) {
+		sprintf_s(firmware, sizeof(firmware), "{\"received\":%u,\"transmitted\":%u,\"receiveBytes\":%u,\"transmitBytes\":%u,\"overruns\":%u,\"busWarnings\":%u,\"busOff\":%u}",
+			device.receiveFrames, device.transmitFrames, device.receiveData, device.transmitData, device.overruns, device.busWarnings, device.busOff);
+	}
+	else {
+		strcpy_s(firmware, sizeof(firmware), "null");
+	}
+
+	length = _snprintf_s(report, size, _TRUNCATE,
+		"{\"adapter\":\"%s\",\"elapsed\":%lld,"
+		"\"receive\":{\"frames\":%u,\"transfers\":%u,\"bytes\":%lld,\"framesPerSecond\":%.1f,\"framesPerTransfer\":%.3f},"
+		"\"latency\":{\"samples\":%u,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},"
+		"\"dropped\":{\"queueOverflows\":%u,\"messagesLost\":%u,\"malformedPackets\":%u,\"notExtended\":%u,\"mutexTimeouts\":%u},"
+		"\"filtered\":{\"subscription\":%u,\"rules\":%u},"
+		"\"notifications\":{\"signals\":%u,\"coalesced\":%u},"
+		"\"transmit\":{\"frames\":%u,\"transfers\":%u,\"retries\":%u,\"failures\":%u},"
+		"\"cpu\":{\"readThread\":%lld,\"perFrame\":%.3f},"
+		"\"device\":%s,"
+		"\"simulation\":%s}",
+		(adapterTransport.backend.name != NULL) ? adapterTransport.backend.name : "none", elapsed,
+		frames, transfers, (LONGLONG)ReadNoFence64(&adapterInstance.receiveStatistics.bytes), (elapsed > 0) ? (frames * 1000000.0) / elapsed : 0.0, (transfers > 0) ? (double)frames / transfers : 0.0,
+		(UINT32)adapterInstance.deliveryLatency.samples, TouCAN_latency_percentile(&adapterInstance.deliveryLatency, 500), TouCAN_latency_percentile(&adapterInstance.deliveryLatency, 990),
+		TouCAN_latency_percentile(&adapterInstance.deliveryLatency, 999), (UINT32)adapterInstance.deliveryLatency.maximum,
+		(UINT32)adapterInstance.receiveRing.overflows, (UINT32)(adapterInstance.reassembler.bufferFull + adapterInstance.messageQueue.overflows), (UINT32)adapterInstance.receiveMalformed,
+		(UINT32)adapterInstance.receiveStatistics.notExtended, (UINT32)adapterInstance.receiveStatistics.mutexTimeouts,
+		(UINT32)adapterInstance.subscriptionRejected, (UINT32)adapterInstance.filterRejected,
+		(UINT32)adapterInstance.notificationsSent, (UINT32)adapterInstance.notificationsCoalesced,
+		transmittedFrames, transmittedTransfers, (UINT32)adapterInstance.transmitRetries, (UINT32)adapterInstance.transmitFailures,
+		cpu, (frames > 0) ? (double)cpu / frames : 0.0,
+		firmware, simulation);
+
+	if (length < 0) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Moderate the frame received event in TOUCAN_RECEIVE_MODE_QUEUED and TOUCAN_RECEIVE_MODE_MESSAGES.
+// The caller is signalled once frames frames (or messages) are waiting, or once the oldest has waited
+// deadline microseconds. While a signal is outstanding no further signal is raised, every
+// DrainAdapter or ReadMessage call rearms it, so the caller should drain until nothing is returned.
+// [in] frames, frames to collect before signalling, 1 signals after every USB packet
+// [in] deadline, longest wait in microseconds before waiting frames are signalled, required when frames > 1
+// returns TWOCAN_RESULT_SUCCESS if the moderation was accepted
+//
+
+DllExport int SetNotificationModeration(const unsigned int frames, const unsigned int deadline) {
+	DebugPrintf(L"TouCAN SetNotificationModeration: %d (%d)\n", frames, deadline);
+
+	if ((frames == 0) || ((frames > 1) && (deadline == 0)) || (deadline > TOUCAN_MAX_NOTIFY_DEADLINE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	adapterInstance.config.notifyFrames = frames;
+	adapterInstance.config.notifyDeadline = deadline;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Publish received frames to a shared memory channel, must be called before ReadAdapter.
+// Loggers and other applications follow the channel with OpenSharedChannel and ReadSharedChannel
+// without opening the adapter, each at its own pace.
+// [in] enable, TRUE to publish frames
+// [in] name, file mapping name, for example "Local\\TwoCanFrames" or "Global\\TwoCanFrames", NULL for the default
+// [in] slots, frames the channel holds before a slow reader is overrun, zero for the default
+// returns TWOCAN_RESULT_SUCCESS if the configuration was accepted
+//
+
+DllExport int SetSharedChannel(const int enable, const char* name, const unsigned int slots) {
+	DebugPrintf(L"TouCAN SetSharedChannel: %d (%d)\n", enable, slots);
+
+	if ((adapterInstance.threadHandle != NULL) || (slots > TOUCAN_CHANNEL_MAX_SLOTS) || ((name != NULL) && (strlen(name) >= TOUCAN_CHANNEL_MAX_NAME))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CONFIGURE_ADAPTER);
+	}
+
+	strcpy_s(sharedChannelName, sizeof(sharedChannelName), (name != NULL) ? name : TOUCAN_CHANNEL_DEFAULT_NAME);
+	sharedChannelSlots = (slots == 0) ? TOUCAN_CHANNEL_DEFAULT_SLOTS : slots;
+	sharedChannelEnabled = (enable != FALSE);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Attach this process to a shared channel as a reader, starting with the next frame published
+// [in] name, the name given to SetSharedChannel, NULL for the default
+// returns TWOCAN_RESULT_SUCCESS, or an error if no driver is publishing under that name
+//
+
+DllExport int OpenSharedChannel(const char* name) {
+	CloseSharedChannel();
+
+	if (TouCAN_channel_open(&channelReader, name) == FALSE) {
+		DebugPrintf(L"Open shared channel failed (%d)\n", GetLastError());
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_FILE_NOT_FOUND);
+	}
+	channelReaderOpen = TRUE;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Read the frames published since the previous call, oldest first. Never blocks, a reader polls.
+// [out] frames, buffer of maxFrames * CONST_FRAME_LENGTH bytes in TwoCan frame format
+// [out] hostTimes, optional, host time of each frame in microseconds
+// [in] maxFrames, capacity of frames and hostTimes
+// [out] frameCount, number of frames read
+// [out] lost, optional, frames this reader has missed because the writer overran it
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int ReadSharedChannel(byte* frames, long long* hostTimes, const int maxFrames, int* frameCount, unsigned int* lost) {
+	TOUCAN_FRAME batch[TOUCAN_DRAIN_BATCH];
+	UINT32 count;
+	UINT32 missed;
+	int total = 0;
+
+	if ((frames == NULL) || (frameCount == NULL) || (maxFrames < 0) || (channelReaderOpen == FALSE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	do {
+		count = (UINT32)(maxFrames - total);
+		if (count > TOUCAN_DRAIN_BATCH) {
+			count = TOUCAN_DRAIN_BATCH;
+		}
+
+		count = TouCAN_channel_read(&channelReader, batch, count, &missed);
+
+		for (UINT32 i = 0; i < count; i++, total++) {
+			ConvertToTwoCanFrame(&batch[i], &frames[total * CONST_FRAME_LENGTH]);
+			if (hostTimes != NULL) {
+				hostTimes[total] = batch[i].hostTime;
+			}
+		}
+	} while ((count == TOUCAN_DRAIN_BATCH) && (total < maxFrames));
+
+	*frameCount = total;
+	if (lost != NULL) {
+		*lost = missed;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+DllExport int CloseSharedChannel(void) {
+	if (channelReaderOpen) {
+		TouCAN_channel_close(&channelReader);
+		channelReaderOpen = FALSE;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Record received and transmitted frames to a binary capture file, replacing any file of that name.
+// Frames are written in blocks by a background thread and the file is indexed by host time when the
+// capture stops, so a capture of any length can be mapped and seeked with OpenCapture and SeekCapture.
+// [in] path, capture file
+// [in] blockRecords, records per block, zero for the default. Each of the two buffers holds one block.
+// returns TWOCAN_RESULT_SUCCESS if the file was created and the capture thread started
+//
+
+DllExport int StartCapture(const char* path, const unsigned int blockRecords) {
+	DebugPrintf(L"TouCAN StartCapture: %S (%d)\n", (path != NULL) ? path : "", blockRecords);
+
+	if (isCapturing) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_OPEN_LOGFILE);
+	}
+
+	if (TouCAN_capture_open(&capture, path, blockRecords, HostMicroseconds()) == FALSE) {
+		DebugPrintf(L"Open capture failed (%d)\n", GetLastError());
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_OPEN_LOGFILE);
+	}
+
+	captureReadyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (captureReadyEvent == NULL) {
+		TouCAN_capture_close(&capture);
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_FRAME_RECEIVED_EVENT);
+	}
+
+	WriteRelease(&captureRunning, TRUE);
+	captureThreadHandle = CreateThread(NULL, 0, CaptureThread, NULL, 0, NULL);
+	if (captureThreadHandle == NULL) {
+		WriteRelease(&captureRunning, FALSE);
+		CloseHandle(captureReadyEvent);
+		TouCAN_capture_close(&capture);
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	AcquireSRWLockExclusive(&captureLock);
+	isCapturing = TRUE;
+	ReleaseSRWLockExclusive(&captureLock);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Stop capturing, write the remaining records and the index, and close the file
+// returns TWOCAN_RESULT_SUCCESS if every record captured was written
+//
+
+DllExport int StopCapture(void) {
+	BOOL status;
+
+	if (isCapturing == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CLOSE_LOGFILE);
+	}
+
+	// Once held exclusive, no thread is appending and none will
+	AcquireSRWLockExclusive(&captureLock);
+	isCapturing = FALSE;
+	ReleaseSRWLockExclusive(&captureLock);
+
+	WriteRelease(&captureRunning, FALSE);
+	SetEvent(captureReadyEvent);
+	WaitForSingleObject(captureThreadHandle, INFINITE);
+	CloseHandle(captureThreadHandle);
+	CloseHandle(captureReadyEvent);
+
+	status = (TouCAN_capture_close(&capture) == TRUE) && (capture.writeErrors == 0);
+	DebugPrintf(L"TouCAN StopCapture: %d (%d dropped)\n", capture.records, capture.dropped);
+
+	if (status == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CLOSE_LOGFILE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Capture counters, valid during and after a capture
+// [out] records, frames captured
+// [out] dropped, frames dropped because both buffers were waiting to be written
+// [out] writeErrors, frames captured but lost to a failed write
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetCaptureStatistics(unsigned int* records, unsigned int* dropped, unsigned int* writeErrors) {
+	if (records != NULL) {
+		*records = (unsigned int)ReadAcquire(&capture.records);
+	}
+	if (dropped != NULL) {
+		*dropped = (unsigned int)ReadAcquire(&capture.dropped);
+	}
+	if (writeErrors != NULL) {
+		*writeErrors = (unsigned int)ReadAcquire(&capture.writeErrors);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Map a capture file for reading, positioned at its first record. A capture still being
+// written, or one that was never stopped, is read up to its last whole record and seeked without an index.
+// [in] path, capture file
+// [out] records, optional, number of records
+// [out] startTime, optional, host time in microseconds the capture started
+// returns TWOCAN_RESULT_SUCCESS, or an error if the file cannot be read or is not a capture
+//
+
+DllExport int OpenCapture(const char* path, unsigned long long* records, long long* startTime) {
+	TOUCAN_CAPTURE_MAP_RESULT result;
+
+	CloseCapture();
+
+	result = TouCAN_capture_map(&captureReader, path);
+	if (result == TOUCAN_CAPTURE_INVALID) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_LOGFILE_FORMAT);
+	}
+	if (result != TOUCAN_CAPTURE_MAPPED) {
+		DebugPrintf(L"Open capture failed (%d)\n", GetLastError());
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_FILE_NOT_FOUND);
+	}
+
+	captureReaderOpen = TRUE;
+	if (records != NULL) {
+		*records = captureReader.count;
+	}
+	if (startTime != NULL) {
+		*startTime = captureReader.header.startTime;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Position the capture reader at the first record at or after a host time
+// [in] hostTime, microseconds, on the clock of the recorded host times
+// [out] position, optional, the record the reader now points at
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int SeekCapture(const long long hostTime, unsigned long long* position) {
+	ULONGLONG record;
+
+	if (captureReaderOpen == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	record = TouCAN_capture_seek(&captureReader, hostTime);
+	if (position != NULL) {
+		*position = record;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Read the records following the reader's position
+// [out] frames, buffer of maxFrames * CONST_FRAME_LENGTH bytes in TwoCan frame format
+// [out] hostTimes, optional, host time of each frame in microseconds
+// [out] deviceTimes, optional, adapter timestamp of each received frame
+// [out] directions, optional, TOUCAN_CAPTURE_RECEIVED or TOUCAN_CAPTURE_TRANSMITTED for each frame
+// [in] maxFrames, capacity of the buffers
+// [out] frameCount, number of frames read, zero at the end of the capture
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int ReadCapture(byte* frames, long long* hostTimes, unsigned int* deviceTimes, byte* directions, const int maxFrames, int* frameCount) {
+	TOUCAN_FRAME batch[TOUCAN_DRAIN_BATCH];
+	UINT8 batchDirections[TOUCAN_DRAIN_BATCH];
+	UINT32 count;
+	int total = 0;
+
+	if ((frames == NULL) || (frameCount == NULL) || (maxFrames < 0) || (captureReaderOpen == FALSE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	do {
+		count = (UINT32)(maxFrames - total);
+		if (count > TOUCAN_DRAIN_BATCH) {
+			count = TOUCAN_DRAIN_BATCH;
+		}
+
+		count = TouCAN_capture_next(&captureReader, batch, batchDirections, count);
+
+		for (UINT32 i = 0; i < count; i++, total++) {
+			ConvertToTwoCanFrame(&batch[i], &frames[total * CONST_FRAME_LENGTH]);
+			if (hostTimes != NULL) {
+				hostTimes[total] = batch[i].hostTime;
+			}
+			if (deviceTimes != NULL) {
+				deviceTimes[total] = batch[i].timestamp;
+			}
+			if (directions != NULL) {
+				directions[total] = batchDirections[i];
+			}
+		}
+	} while ((count == TOUCAN_DRAIN_BATCH) && (total < maxFrames));
+
+	*frameCount = total;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+DllExport int CloseCapture(void) {
+	if (captureReaderOpen) {
+		TouCAN_capture_unmap(&captureReader);
+		captureReaderOpen = FALSE;
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Number of TouCAN adapters present, the indices OpenAdapterInstance accepts
+// [out] count, number of adapters
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetAdapterCount(int* count) {
+	if (count == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	*count = (int)CountDevicePaths();
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Open one of several adapters, each with its own read thread and receive queue.
+// Independent of OpenAdapter, an adapter can only be opened once. SetTimestampMode,
+// SetReceiveMode's depth and SetReadPipeline apply to the instances opened after them.
+// [in] index, position of the adapter, or -1 to select the adapter by serial number
+// [in] serialNumber, serial number of the adapter, only used when index is -1
+// [out] handle, identifies the instance in the other instance functions
+// returns TWOCAN_RESULT_SUCCESS, or adapter not found if no adapter matches or it is already open
+//
+
+DllExport int OpenAdapterInstance(const int index, const unsigned int serialNumber, int* handle) {
+	TOUCAN_INSTANCE *instance;
+	UINT32 serial = serialNumber;
+	ULONG count;
+	int slot = -1;
+	int result;
+
+	DebugPrintf(L"TouCAN OpenAdapterInstance: %d (%u)\n", index, serialNumber);
+
+	if (handle == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	// Reserve a free handle, the adapter is opened without holding the lock
+	AcquireSRWLockExclusive(&instanceLock);
+	for (int i = 0; (i < TOUCAN_MAX_INSTANCES) && (slot < 0); i++) {
+		if (instanceOpen[i] == FALSE) {
+			instanceOpen[i] = TRUE;
+			slot = i;
+		}
+	}
+
+	// Signalled as the last reference to the slot's instance is released
+	if ((slot >= 0) && (instanceReleased[slot] == NULL)) {
+		instanceReleased[slot] = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (instanceReleased[slot] == NULL) {
+			instanceOpen[slot] = FALSE;
+			slot = -1;
+		}
+	}
+	ReleaseSRWLockExclusive(&instanceLock);
+
+	if (slot < 0) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	// The instances take the single adapter's settings, but always queue received frames
+	instance = &instanceStates[slot];
+	TouCAN_instance_init(instance);
+	instance->config = adapterInstance.config;
+	instance->config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+	if (adapterInstance.config.receiveMode != TOUCAN_RECEIVE_MODE_QUEUED) {
+		instance->config.receiveDepth = TOUCAN_DEFAULT_RECEIVE_DEPTH;
+	}
+	instance->config.frameReceivedEvent = NULL;
+	memset(&instance->config.hooks, 0, sizeof(TOUCAN_INSTANCE_HOOKS));
+
+	if (index >= 0) {
+		TouCAN_winusb_adapter_backend(&instanceBackends[slot], &instanceAdapters[slot], (ULONG)index);
+		instance->index = (UINT32)index;
+		result = TouCAN_instance_open(instance, &instanceBackends[slot], NULL);
+	}
+	else {
+		// Try each adapter in turn, the ones with another serial number are closed again
+		result = SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+		count = CountDevicePaths();
+		for (ULONG i = 0; (i < count) && (result != TWOCAN_RESULT_SUCCESS); i++) {
+			TouCAN_winusb_adapter_backend(&instanceBackends[slot], &instanceAdapters[slot], i);
+			instance->index = (UINT32)i;
+			result = TouCAN_instance_open(instance, &instanceBackends[slot], &serial);
+		}
+	}
+
+	if (result == TWOCAN_RESULT_SUCCESS) {
+		result = TouCAN_instance_start(instance);
+		if (result != TWOCAN_RESULT_SUCCESS) {
+			TouCAN_instance_close(instance);
+		}
+	}
+
+	if (result != TWOCAN_RESULT_SUCCESS) {
+		AcquireSRWLockExclusive(&instanceLock);
+		instanceOpen[slot] = FALSE;
+		ReleaseSRWLockExclusive(&instanceLock);
+		return result;
+	}
+
+	AcquireSRWLockExclusive(&instanceLock);
+	instances[slot] = instance;
+	ReleaseSRWLockExclusive(&instanceLock);
+
+	*handle = slot + 1;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Close an instance once the calls using it have returned. A WaitAdapterInstances
+// waiting on it returns its handle, it is then no longer valid.
+// returns TWOCAN_RESULT_SUCCESS, or an error if the instance's threads did not exit,
+// its handle then stays reserved
+//
+
+DllExport int CloseAdapterInstance(const int handle) {
+	TOUCAN_INSTANCE *instance = NULL;
+
+	// Unpublish the instance, no further call can take a reference to it
+	if ((handle > 0) && (handle <= TOUCAN_MAX_INSTANCES)) {
+		AcquireSRWLockExclusive(&instanceLock);
+		instance = instances[handle - 1];
+		instances[handle - 1] = NULL;
+		ReleaseSRWLockExclusive(&instanceLock);
+	}
+
+	if (instance == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_CLOSE_FUNCTION);
+	}
+
+	// Wake a WaitAdapterInstances holding a reference, until ReleaseInstance drops the last one
+	while (ReadAcquire(&instanceReferences[handle - 1]) > 0) {
+		SetEvent(instance->frameReceivedEvent);
+		WaitForSingleObject(instanceReleased[handle - 1], TOUCAN_READ_WAIT_TIMEOUT);
+	}
+
+	if (TouCAN_instance_close(instance) == FALSE) {
+		// The slot keeps the instance, its threads and backend, a later OpenAdapterInstance does not reuse it
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_DELETE_THREAD_HANDLE);
+	}
+
+	AcquireSRWLockExclusive(&instanceLock);
+	instanceOpen[handle - 1] = FALSE;
+	ReleaseSRWLockExclusive(&instanceLock);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Which adapter an instance drives
+// [out] index, position of the adapter when it was opened
+// [out] serialNumber, the adapter's serial number
+//
+
+DllExport int GetAdapterInstanceInfo(const int handle, int* index, unsigned int* serialNumber) {
+	TOUCAN_INSTANCE *instance;
+
+	if ((index == NULL) || (serialNumber == NULL) || ((instance = AcquireInstance(handle)) == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	*index = (int)instance->index;
+	*serialNumber = instance->serialNumber;
+	ReleaseInstance(handle);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Wait until any of several instances has received frames
+// [in] handles, instances to wait for, at most TOUCAN_MAX_INSTANCES
+// [in] timeout, milliseconds to wait
+// [out] ready, handle of an instance with frames waiting, zero if the wait timed out
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int WaitAdapterInstances(const int* handles, const int count, const unsigned int timeout, int* ready) {
+	HANDLE events[TOUCAN_MAX_INSTANCES];
+	TOUCAN_INSTANCE *instance;
+	DWORD waitResult;
+
+	if ((handles == NULL) || (ready == NULL) || (count <= 0) || (count > TOUCAN_MAX_INSTANCES)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	// The events stay valid while the references are held
+	for (int i = 0; i < count; i++) {
+		instance = AcquireInstance(handles[i]);
+		if (instance == NULL) {
+			while (i-- > 0) {
+				ReleaseInstance(handles[i]);
+			}
+			return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+		}
+		events[i] = instance->frameReceivedEvent;
+	}
+
+	*ready = 0;
+	waitResult = WaitForMultipleObjects((DWORD)count, events, FALSE, timeout);
+	if (waitResult < (WAIT_OBJECT_0 + (DWORD)count)) {
+		*ready = handles[waitResult - WAIT_OBJECT_0];
+	}
+
+	for (int i = 0; i < count; i++) {
+		ReleaseInstance(handles[i]);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Drain an instance, as DrainAdapterTimestamped
+// Only one thread may drain an instance
+//
+
+DllExport int DrainAdapterInstance(const int handle, byte* frames, long long* hostTimes, unsigned int* deviceTimes, const int maxFrames, int* frameCount) {
+	TOUCAN_INSTANCE *instance;
+	TOUCAN_FRAME batch[TOUCAN_DRAIN_BATCH];
+	UINT32 count;
+	int total = 0;
+
+	if ((frames == NULL) || (frameCount == NULL) || (maxFrames < 0) || ((instance = AcquireInstance(handle)) == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	do {
+		count = (UINT32)(maxFrames - total);
+		if (count > TOUCAN_DRAIN_BATCH) {
+			count = TOUCAN_DRAIN_BATCH;
+		}
+
+		count = TouCAN_instance_drain(instance, batch, count);
+		for (UINT32 i = 0; i < count; i++, total++) {
+			ConvertToTwoCanFrame(&batch[i], &frames[total * CONST_FRAME_LENGTH]);
+			if (hostTimes != NULL) {
+				hostTimes[total] = batch[i].hostTime;
+			}
+			if (deviceTimes != NULL) {
+				deviceTimes[total] = batch[i].timestamp;
+			}
+		}
+	} while ((count == TOUCAN_DRAIN_BATCH) && (total < maxFrames));
+
+	ReleaseInstance(handle);
+	*frameCount = total;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Transmit a frame on an instance, as WriteAdapter. An instance opened in the queued transmit
+// mode queues the frame for its writer thread and reports a full lane rather than blocking.
+//
+
+DllExport int WriteAdapterInstance(const int handle, const unsigned int id, const int dataLength, byte* data) {
+	TOUCAN_INSTANCE *instance;
+	TOUCAN_FRAME frame;
+	UINT32 written;
+	int result = TWOCAN_RESULT_SUCCESS;
+
+	if ((data == NULL) || (dataLength < 0) || (dataLength > TOUCAN_FRAME_DATA_LENGTH) || ((instance = AcquireInstance(handle)) == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
+
+	frame.flags = (UINT8)CANAL_IDFLAG_EXTENDED;
+	frame.id = id;
+	frame.length = (UINT8)dataLength;
+	frame.timestamp = 0;
+	memcpy(frame.data, data, TOUCAN_FRAME_DATA_LENGTH);
+
+	if (instance->writerHandle != NULL) {
+		if (TouCAN_instance_queue(instance, &frame, 1) == FALSE) {
+			result = SET_ERROR(TWOCAN_RESULT_WARNING, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_WOULD_BLOCK);
+		}
+	}
+	else if (TouCAN_instance_write(instance, &frame, 1, &written) == FALSE) {
+		result = SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
+
+	ReleaseInstance(handle);
+	return result;
+}
+
+//
+// Counters of one instance since it was opened
+// [out] frames, frames received, before extended frames are selected
+// [out] overflows, frames lost because the receive queue was full
+// [out] errors, malformed packets and failed reads
+// [out] transmitted, frames handed to the adapter, counted by the instance's own backend
+// [out] transmitFailures, queued frames the writer thread failed to transmit, and frames refused by a full lane
+//
+
+DllExport int GetAdapterInstanceStatistics(const int handle, unsigned int* frames, unsigned int* overflows, unsigned int* errors, unsigned int* transmitted, unsigned int* transmitFailures) {
+	TOUCAN_INSTANCE *instance;
+
+	if ((frames == NULL) || (overflows == NULL) || (errors == NULL) || (transmitted == NULL) || (transmitFailures == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if ((instance = AcquireInstance(handle)) == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
+
+	*frames = (unsigned int)ReadNoFence(&instance->receiveFrames);
+	*overflows = (unsigned int)ReadNoFence(&instance->receiveRing.overflows);
+	*errors = (unsigned int)(ReadNoFence(&instance->receiveMalformed) + ReadNoFence(&instance->receiveFailures));
+	*transmitted = ((instance->backend != NULL) && (instance->backend->transmitted != NULL)) ? (unsigned int)ReadNoFence(&instance->backend->transmitted->frames) : 0;
+	*transmitFailures = (unsigned int)(ReadNoFence(&instance->transmitFailures) + ReadNoFence(&instance->transmitQueue.drops));
+	ReleaseInstance(handle);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Format the trace events to the debugger output from a background thread, so the threads
+// recording them only copy a few words to their trace ring.
+// Without it the events stay in the rings, the most recent ones dropped once a ring is full, until DumpTrace.
+// [in] interval, milliseconds between passes over the rings, zero for 100
+// returns TWOCAN_RESULT_SUCCESS if the trace thread was started
+//
+
+DllExport int StartTraceOutput(const unsigned int interval) {
+	DebugPrintf(L"TouCAN StartTraceOutput: %u\n", interval);
+
+	if (ReadAcquire(&traceRunning)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	traceInterval = (interval > 0) ? interval : 100;
+	traceStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (traceStopEvent == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_COMPLETE_EVENT);
+	}
+
+	WriteRelease(&traceRunning, TRUE);
+	traceThreadHandle = CreateThread(NULL, 0, TraceThread, NULL, 0, NULL);
+	if (traceThreadHandle == NULL) {
+		WriteRelease(&traceRunning, FALSE);
+		CloseHandle(traceStopEvent);
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Stop the trace thread once it has formatted the events already recorded
+//
+
+DllExport int StopTraceOutput(void) {
+	if (ReadAcquire(&traceRunning) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_DELETE_THREAD_HANDLE);
+	}
+
+	WriteRelease(&traceRunning, FALSE);
+	SetEvent(traceStopEvent);
+	WaitForSingleObject(traceThreadHandle, INFINITE);
+	CloseHandle(traceThreadHandle);
+	CloseHandle(traceStopEvent);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Take every trace event not yet formatted and write them, in time order, to a text file
+// [in] path, file to create
+// returns TWOCAN_RESULT_SUCCESS if the file was written
+//
+
+DllExport int DumpTrace(const char* path) {
+	if ((path == NULL) || (TouCAN_trace_dump(path) == FALSE)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_OPEN_LOGFILE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// [out] recorded, trace events recorded since the driver was loaded
+// [out] dropped, events lost because a thread's trace ring was full
+//
+
+DllExport int GetTraceStatistics(unsigned int* recorded, unsigned int* dropped) {
+	UINT32 events;
+	UINT32 lost;
+
+	if ((recorded == NULL) || (dropped == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	TouCAN_trace_statistics(&events, &lost);
+	*recorded = events;
+	*dropped = lost;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Poll the CAN interface state and error code of the adapter and of every open instance from a low
+// rate background thread, so a bus off or error passive interface can be told apart from a quiet bus,
+// and frames lost in an adapter's receive FIFO apart from frames lost in the host's receive queue.
+// The polls are control requests, the read threads and the bulk endpoints are not involved.
+// The monitor runs until StopBusMonitor, adapters and instances opened meanwhile are polled too.
+// [in] interval, milliseconds between polls, zero for TOUCAN_HEALTH_DEFAULT_INTERVAL
+// returns TWOCAN_RESULT_SUCCESS if the monitor thread was started
+//
+
+DllExport int StartBusMonitor(const unsigned int interval) {
+	TOUCAN_INSTANCE *instance;
+
+	DebugPrintf(L"TouCAN StartBusMonitor: %u\n", interval);
+
+	if (ReadAcquire(&monitorRunning)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	monitorInterval = (interval > 0) ? interval : TOUCAN_HEALTH_DEFAULT_INTERVAL;
+	TouCAN_health_init(&adapterInstance.health);
+	for (int handle = 1; handle <= TOUCAN_MAX_INSTANCES; handle++) {
+		if ((instance = AcquireInstance(handle)) != NULL) {
+			TouCAN_health_init(&instance->health);
+			ReleaseInstance(handle);
+		}
+	}
+
+	monitorStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (monitorStopEvent == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_COMPLETE_EVENT);
+	}
+
+	WriteRelease(&monitorRunning, TRUE);
+	monitorThreadHandle = CreateThread(NULL, 0, BusMonitorThread, NULL, 0, NULL);
+	if (monitorThreadHandle == NULL) {
+		WriteRelease(&monitorRunning, FALSE);
+		CloseHandle(monitorStopEvent);
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+DllExport int StopBusMonitor(void) {
+	if (ReadAcquire(&monitorRunning) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_DELETE_THREAD_HANDLE);
+	}
+
+	WriteRelease(&monitorRunning, FALSE);
+	SetEvent(monitorStopEvent);
+	WaitForSingleObject(monitorThreadHandle, INFINITE);
+	CloseHandle(monitorThreadHandle);
+	CloseHandle(monitorStopEvent);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Be called when the bus condition changes, from the monitor thread
+// [in] callback, NULL for no callback
+// [in] context, passed to the callback
+// The callback is given the handle of the instance, zero for the adapter opened with OpenAdapter.
+// Once this returns, the callback it replaced is no longer running and will not be called.
+// The callback must not call SetBusHealthCallback or StopBusMonitor.
+//
+
+DllExport int SetBusHealthCallback(BusHealthCallback callback, void* context) {
+	AcquireSRWLockExclusive(&healthCallbackLock);
+	healthCallback = callback;
+	healthContext = context;
+	ReleaseSRWLockExclusive(&healthCallbackLock);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Bus health of the adapter opened with OpenAdapter at the last poll
+// [out] condition, TOUCAN_BUS_xxx
+// [out] state, the interface's HAL_CAN_STATE_xxx
+// [out] errorCode, HAL_CAN_ERROR_xxx bits of the last poll, state bits may remain from earlier polls
+// returns TWOCAN_RESULT_SUCCESS
+//
+
+DllExport int GetBusHealth(int* condition, int* state, unsigned int* errorCode) {
+	if ((condition == NULL) || (state == NULL) || (errorCode == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	*condition = (int)ReadNoFence(&adapterInstance.health.condition);
+	*state = (int)ReadNoFence(&adapterInstance.health.state);
+	*errorCode = (unsigned int)ReadNoFence(&adapterInstance.health.errorCode);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Bus health of an instance at the last poll, as GetBusHealth
+//
+
+DllExport int GetAdapterInstanceHealth(const int handle, int* condition, int* state, unsigned int* errorCode) {
+	TOUCAN_INSTANCE *instance;
+
+	if ((condition == NULL) || (state == NULL) || (errorCode == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if ((instance = AcquireInstance(handle)) == NULL) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	*condition = (int)ReadNoFence(&instance->health.condition);
+	*state = (int)ReadNoFence(&instance->health.state);
+	*errorCode = (unsigned int)ReadNoFence(&instance->health.errorCode);
+	ReleaseInstance(handle);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Combine several instances into one stream ordered by host time, drained with DrainMerged.
+// In the device timestamp mode host time is each adapter's timestamp mapped onto the host clock,
+// as the adapters' own clocks cannot be compared.
+// [in] handles, instances to merge, at most TOUCAN_MAX_INSTANCES, a count of zero stops merging
+// [in] window, reorder window in microseconds, how long frames wait for a lagging adapter,
+// zero selects TOUCAN_MERGE_DEFAULT_WINDOW
+// Only the thread calling DrainMerged may change the merge
+//
+
+DllExport int SetInstanceMerge(const int* handles, const int count, const unsigned int window) {
+	DebugPrintf(L"TouCAN SetInstanceMerge: %d (%u)\n", count, window);
+
+	if ((count < 0) || (count > TOUCAN_MAX_INSTANCES) || ((count > 0) && (handles == NULL))) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (AcquireInstance(handles[i]) == NULL) {
+			return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+		}
+		ReleaseInstance(handles[i]);
+	}
+
+	if (mergeActive) {
+		TouCAN_merge_free(&instanceMerge);
+		mergeActive = FALSE;
+	}
+
+	if (count == 0) {
+		return TWOCAN_RESULT_SUCCESS;
+	}
+
+	if (TouCAN_merge_init(&instanceMerge, (UINT32)count, adapterInstance.config.receiveDepth, window) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
+
+	memcpy(mergeHandles, handles, count * sizeof(int));
+	mergeActive = TRUE;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Drain the merged instances, earliest frame first, as DrainAdapterTimestamped.
+// A frame is held until every instance has caught up with it, or it is older than the window.
+// [out] handles, optional, the instance each frame was received by
+//
+
+DllExport int DrainMerged(byte* frames, long long* hostTimes, unsigned int* deviceTimes, int* handles, const int maxFrames, int* frameCount) {
+	TOUCAN_INSTANCE *instance;
+	TOUCAN_FRAME batch[TOUCAN_DRAIN_BATCH];
+	UINT8 sources[TOUCAN_DRAIN_BATCH];
+	UINT32 count;
+	UINT32 space;
+	int total = 0;
+
+	if ((mergeActive == FALSE) || (frames == NULL) || (frameCount == NULL) || (maxFrames < 0)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_READ_FUNCTION);
+	}
+
+	// Move what each instance has received into its merge source, a closed instance no longer holds the others back
+	for (UINT32 i = 0; i < instanceMerge.count; i++) {
+		instance = AcquireInstance(mergeHandles[i]);
+		if (instance == NULL) {
+			TouCAN_merge_close_source(&instanceMerge, i);
+			continue;
+		}
+
+		// No more than the merge source can take, the rest stay queued in the instance until it has room
+		do {
+			space = TouCAN_merge_space(&instanceMerge, i);
+			count = TouCAN_instance_drain(instance, batch, (space < TOUCAN_DRAIN_BATCH) ? space : TOUCAN_DRAIN_BATCH);
+			TouCAN_merge_push(&instanceMerge, i, batch, count);
+		} while (count == TOUCAN_DRAIN_BATCH);
+		ReleaseInstance(mergeHandles[i]);
+	}
+
+	do {
+		count = (UINT32)(maxFrames - total);
+		if (count > TOUCAN_DRAIN_BATCH) {
+			count = TOUCAN_DRAIN_BATCH;
+		}
+
+		count = TouCAN_merge_pop(&instanceMerge, HostMicroseconds(), batch, sources, count);
+		for (UINT32 i = 0; i < count; i++, total++) {
+			ConvertToTwoCanFrame(&batch[i], &frames[total * CONST_FRAME_LENGTH]);
+			if (hostTimes != NULL) {
+				hostTimes[total] = batch[i].hostTime;
+			}
+			if (deviceTimes != NULL) {
+				deviceTimes[total] = batch[i].timestamp;
+			}
+			if (handles != NULL) {
+				handles[total] = mergeHandles[sources[i]];
+			}
+		}
+	} while ((count == TOUCAN_DRAIN_BATCH) && (total < maxFrames));
+
+	*frameCount = total;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Counters of the merge since SetInstanceMerge
+// [out] merged, frames released in time order
+// [out] late, frames released after a later frame, their adapter lagged by more than the window
+// [out] overflows, frames lost because a merge source was full
+//
+
+DllExport int GetMergeStatistics(unsigned int* merged, unsigned int* late, unsigned int* overflows) {
+	if ((merged == NULL) || (late == NULL) || (overflows == NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_INVALID_ARGUMENT);
+	}
+
+	if (mergeActive == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_ERROR, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
+
+	*merged = instanceMerge.merged;
+	*late = instanceMerge.late;
+	*overflows = instanceMerge.overflows;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Release the shared channel the read thread published to, once the read thread has exited
+//
+
+void CloseChannelWriter(void) {
+	if (sharedChannelOpen) {
+		TouCAN_channel_close(&sharedChannel);
+		sharedChannelOpen = FALSE;
+	}
+}
+
+//
+// Convert a decoded frame to the TwoCan frame format,
+// the 29 bit id as a little endian 4 byte header followed by the CAN data
+//
+
+void ConvertToTwoCanFrame(const TOUCAN_FRAME* frame, byte* buf) {
+	UINT32 header = TWOCAN_TO_LE32(frame->id);
+
+	memcpy(buf, &header, CONST_HEADER_LENGTH);
+	memcpy(&buf[CONST_HEADER_LENGTH], frame->data, TOUCAN_FRAME_DATA_LENGTH);
+}
+
+//
+// The 29 bit id of a frame in the TwoCan frame format
+//
+
+UINT32 FrameId(const byte* buf) {
+	return (UINT32)buf[0] | ((UINT32)buf[1] << 8) | ((UINT32)buf[2] << 16) | ((UINT32)buf[3] << 24);
+}
+
+//
+// Frames and transfers sent by the backend the adapter was last opened with,
+// the instances' backends count their own
+//
+
+void TransmitCounters(UINT32* frames, UINT32* transfers) {
+	*frames = 0;
+	*transfers = 0;
+	if (adapterTransport.backend.transmitted != NULL) {
+		*frames = (UINT32)ReadNoFence(&adapterTransport.backend.transmitted->frames);
+		*transfers = (UINT32)ReadNoFence(&adapterTransport.backend.transmitted->transfers);
+	}
+}
+
+//
+// Take a reference to the open instance a handle refers to, it is not closed until ReleaseInstance
+// returns the instance, NULL for an invalid handle
+//
+
+TOUCAN_INSTANCE* AcquireInstance(int handle) {
+	TOUCAN_INSTANCE* instance = NULL;
+
+	if ((handle > 0) && (handle <= TOUCAN_MAX_INSTANCES)) {
+		AcquireSRWLockShared(&instanceLock);
+		instance = instances[handle - 1];
+		if (instance != NULL) {
+			InterlockedIncrement(&instanceReferences[handle - 1]);
+		}
+		ReleaseSRWLockShared(&instanceLock);
+	}
+	return instance;
+}
+
+void ReleaseInstance(int handle) {
+	if (InterlockedDecrement(&instanceReferences[handle - 1]) == 0) {
+		SetEvent(instanceReleased[handle - 1]);
+	}
+}
+
+//
+// Hold a real time simulation to the host clock, a simulated read does not complete
+// before its virtual time has passed since OpenAdapter
+//
+
+void PaceSimulation(void* context, LONGLONG now) {
+	LONGLONG ahead = now - (HostMicroseconds() - simulationStart);
+
+	if (ahead >= 1000) {
+		Sleep((DWORD)(ahead / 1000));
+	}
+}
+
+//
+// Legacy delivery, copy a single frame into the caller's ReadAdapter buffer and signal the caller
+// returns FALSE if the buffer could not be locked, the instance counts it
+//
+
+BOOL DeliverFrame(void* context, const TOUCAN_FRAME* frame) {
+	DWORD mutexResult;
+
+	// Make sure we can get a lock on the buffer
+	mutexResult = WaitForSingleObject(frameReceivedMutex, 200);
+
+	if (mutexResult == WAIT_OBJECT_0) {
+
+		// Convert id (long) to TwoCan header format (byte array) and copy the CAN data
+		ConvertToTwoCanFrame(frame, canFramePtr);
+
+		// Release the lock
+		ReleaseMutex(frameReceivedMutex);
+
+		// Notify the caller
+		if (!SetEvent(frameReceivedEvent)) {
+			// Non fatal error
+			TOUCAN_TRACE_WARNING(TOUCAN_TRACE_SET_EVENT_FAILED, GetLastError(), 0);
+		}
+		return TRUE;
+	}
+
+	// Non fatal error, DeliverFrame is only called by the read thread
+	TOUCAN_TRACE_WARNING(TOUCAN_TRACE_MUTEX_TIMEOUT, mutexResult, GetLastError());
+	return FALSE;
+}
+
+//
+// Publish a received frame to the shared channel, if one is open
+//
+
+void PublishFrame(void* context, const TOUCAN_FRAME* frame) {
+	if (sharedChannelOpen) {
+		TouCAN_channel_publish(&sharedChannel, frame, 1);
+	}
+}
+
+//
+// Append frames to the capture in progress, waking the capture thread when a block is ready
+//
+
+void CaptureFrames(void* context, const TOUCAN_FRAME* frames, UINT32 count, UINT8 direction) {
+	AcquireSRWLockShared(&captureLock);
+	if ((isCapturing) && (TouCAN_capture_append(&capture, frames, count, direction) == TRUE)) {
+		SetEvent(captureReadyEvent);
+	}
+	ReleaseSRWLockShared(&captureLock);
+}
+
+//
+// Capture thread, writes each block as it fills. A block still filling after the flush
+// interval is written as it is, so a quiet bus does not hold records back.
+//
+
+DWORD WINAPI CaptureThread(LPVOID lParam) {
+	DebugPrintf(L"TouCAN CaptureThread\n");
+
+	while (ReadAcquire(&captureRunning)) {
+		if (WaitForSingleObject(captureReadyEvent, TOUCAN_CAPTURE_FLUSH_INTERVAL) == WAIT_TIMEOUT) {
+			TouCAN_capture_rotate(&capture);
+		}
+		TouCAN_capture_write(&capture);
+	}
+
+	DebugPrintf(L"TouCAN CaptureThread exit\n");
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Poll the health of one adapter
+// [out] condition, previous, errorCode, the change to report, copied while the adapter is held
+// returns TRUE if the bus condition changed
+//
+
+BOOL PollHealth(TOUCAN_HEALTH* health, TOUCAN_BACKEND* backend, LONG* condition, LONG* previous, UINT32* errorCode) {
+	*previous = health->condition;
+	if (TouCAN_health_poll(health, backend) == FALSE) {
+		return FALSE;
+	}
+
+	*condition = health->condition;
+	*errorCode = (*condition == TOUCAN_BUS_UNKNOWN) ? HAL_CAN_ERROR_NONE : (UINT32)health->errorCode;
+	TOUCAN_TRACE_INFO(TOUCAN_TRACE_BUS_CONDITION, *condition, *errorCode);
+	return TRUE;
+}
+
+//
+// Report a changed bus condition, the callback is not called with the adapter or an instance held
+// [in] handle, the instance's handle, zero for the adapter opened with OpenAdapter
+//
+
+void ReportHealth(int handle, LONG condition, LONG previous, UINT32 errorCode) {
+	AcquireSRWLockShared(&healthCallbackLock);
+	if (healthCallback != NULL) {
+		healthCallback(healthContext, handle, (int)condition, (int)previous, errorCode);
+	}
+	ReleaseSRWLockShared(&healthCallbackLock);
+}
+
+//
+// Bus monitor thread, polls the adapter and every open instance each interval, see TouCAN_health_poll
+//
+
+DWORD WINAPI BusMonitorThread(LPVOID lParam) {
+	TOUCAN_INSTANCE* instance;
+	LONG condition;
+	LONG previous;
+	UINT32 errorCode;
+	BOOL changed;
+
+	DebugPrintf(L"TouCAN BusMonitorThread\n");
+
+	while (ReadAcquire(&monitorRunning)) {
+		// OpenAdapter and CloseAdapter wait for the poll, the adapter is skipped while closed
+		changed = FALSE;
+		AcquireSRWLockShared(&adapterLock);
+		if (adapterInstance.backend != NULL) {
+			changed = PollHealth(&adapterInstance.health, adapterInstance.backend, &condition, &previous, &errorCode);
+		}
+		ReleaseSRWLockShared(&adapterLock);
+		if (changed) {
+			ReportHealth(0, condition, previous, errorCode);
+		}
+
+		// The reference keeps an instance open over its poll
+		for (int handle = 1; handle <= TOUCAN_MAX_INSTANCES; handle++) {
+			if ((instance = AcquireInstance(handle)) != NULL) {
+				changed = PollHealth(&instance->health, instance->backend, &condition, &previous, &errorCode);
+				ReleaseInstance(handle);
+				if (changed) {
+					ReportHealth(handle, condition, previous, errorCode);
+				}
+			}
+		}
+
+		WaitForSingleObject(monitorStopEvent, monitorInterval);
+	}
+
+	DebugPrintf(L"TouCAN BusMonitorThread exit\n");
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Trace thread, formats the recorded trace events to the debugger output every interval
+//
+
+DWORD WINAPI TraceThread(LPVOID lParam) {
+	TOUCAN_TRACE_RECORD records[TOUCAN_DRAIN_BATCH];
+	char line[256];
+	UINT32 count;
+
+	DebugPrintf(L"TouCAN TraceThread\n");
+
+	while (ReadAcquire(&traceRunning)) {
+		WaitForSingleObject(traceStopEvent, traceInterval);
+		do {
+			count = TouCAN_trace_drain(records, TOUCAN_DRAIN_BATCH);
+			for (UINT32 i = 0; i < count; i++) {
+				if (TouCAN_trace_format(&records[i], line, sizeof(line)) > 0) {
+					DebugPrintf(L"%S\n", line);
+				}
+			}
+		} while (count == TOUCAN_DRAIN_BATCH);
+	}
+
+	DebugPrintf(L"TouCAN TraceThread exit\n");
+	return TWOCAN_RESULT_SUCCESS;
 }
 
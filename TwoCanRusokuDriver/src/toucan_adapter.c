@@ -0,0 +1,78 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Adapter
+// Unit Description: Selects the transport an adapter is reached through
+// Function: Fills in the backend of the TouCAN adapter on WinUSB or libusb, of a simulated adapter,
+// of a replayed recording or of a SocketCAN interface, so the driver opens each of them the same way
+//
+
+#include "../inc/toucan_adapter.h"
+#if defined(_WIN32)
+#include "../inc/toucan_hardware.h"
+#endif
+
+#include <string.h>
+
+//
+// Fill in the backend of the selected adapter, it is opened with TouCAN_instance_open
+// [in] adapter, kind and its settings, holds the backend's state so must outlive it
+// returns FALSE if this kind of adapter is not available on this platform, or in this build
+//
+
+BOOL TouCAN_adapter_backend(TOUCAN_ADAPTER *adapter) {
+	memset(&adapter->backend, 0, sizeof(TOUCAN_BACKEND));
+
+	switch (adapter->kind) {
+	case TOUCAN_ADAPTER_HARDWARE:
+#if defined(_WIN32)
+		TouCAN_winusb_backend(&adapter->backend);
+		return TRUE;
+#elif defined(TOUCAN_LIBUSB)
+		TouCAN_libusb_device(&adapter->device, &adapter->libusb, TOUCAN_USB_VENDOR_ID, TOUCAN_USB_PRODUCT_ID);
+		TouCAN_usb_backend(&adapter->backend, &adapter->usb, &adapter->device);
+		return TRUE;
+#else
+		return FALSE;
+#endif
+
+	case TOUCAN_ADAPTER_SIMULATED:
+	case TOUCAN_ADAPTER_SIMULATED_REAL_TIME:
+		TouCAN_simusb_device(&adapter->device, &adapter->simulated, &adapter->simulationConfig);
+		TouCAN_usb_backend(&adapter->backend, &adapter->usb, &adapter->device);
+		return TRUE;
+
+	case TOUCAN_ADAPTER_REPLAY:
+		TouCAN_replay_backend(&adapter->backend, &adapter->replay, &adapter->replayConfig);
+		return TRUE;
+
+	case TOUCAN_ADAPTER_SOCKETCAN:
+#if defined(__linux__)
+		TouCAN_socketcan_backend(&adapter->backend, &adapter->socketcan, (adapter->interfaceName[0] != '\0') ? adapter->interfaceName : NULL);
+		return TRUE;
+#else
+		return FALSE;
+#endif
+
+	default:
+		return FALSE;
+	}
+}
@@ -0,0 +1,603 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+//
+// Unit: TouCAN Capture
+// Unit Description: Binary capture of received and transmitted frames
+// Function: Appends fixed size records to double buffered blocks written by a background thread,
+// followed by a time to offset index so long captures can be mapped and seeked directly
+//
+
+#if !defined(_WIN32)
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Index entries allocated at a time, one entry per block written
+#define INDEX_GROWTH 1024
+
+//
+// Write to the capture file at an absolute offset
+// returns FALSE if not every byte could be written
+//
+
+static BOOL WriteAt(TOUCAN_CAPTURE *capture, ULONGLONG offset, const void *data, size_t length) {
+	const UINT8 *bytes = (const UINT8 *)data;
+#if defined(_WIN32)
+	OVERLAPPED position;
+	DWORD written;
+
+	while (length > 0) {
+		memset(&position, 0, sizeof(position));
+		position.Offset = (DWORD)offset;
+		position.OffsetHigh = (DWORD)(offset >> 32);
+
+		if ((WriteFile(capture->file, bytes, (length > 0x100000) ? 0x100000 : (DWORD)length, &written, &position) == FALSE) || (written == 0)) {
+			return FALSE;
+		}
+		bytes += written;
+		offset += written;
+		length -= written;
+	}
+#else
+	ssize_t written;
+
+	while (length > 0) {
+		written = pwrite(capture->descriptor, bytes, length, (off_t)offset);
+		if (written <= 0) {
+			return FALSE;
+		}
+		bytes += written;
+		offset += (ULONGLONG)written;
+		length -= (size_t)written;
+	}
+#endif
+	return TRUE;
+}
+
+//
+// Hand the filling buffer to the capture thread, must be called with the lock held
+// returns FALSE if the other buffer has not been written yet
+//
+
+static BOOL HandOver(TOUCAN_CAPTURE *capture) {
+	UINT32 other = capture->filling ^ 1;
+
+	if (ReadAcquire(&capture->full[other])) {
+		return FALSE;
+	}
+
+	capture->lengths[capture->filling] = capture->used;
+	WriteRelease(&capture->full[capture->filling], TRUE);
+	capture->filling = other;
+	capture->used = 0;
+	return TRUE;
+}
+
+//
+// Create a capture file, replacing any file of the same name
+// [in] blockRecords, records per block, zero for the default
+// [in] startTime, host time in microseconds recorded in the header
+// returns FALSE if the block size is invalid, or the file or its buffers could not be created
+//
+
+BOOL TouCAN_capture_open(TOUCAN_CAPTURE *capture, const char *path, UINT32 blockRecords, LONGLONG startTime) {
+	TOUCAN_CAPTURE_HEADER header;
+
+	memset(capture, 0, sizeof(TOUCAN_CAPTURE));
+	InitializeSRWLock(&capture->lock);
+#if !defined(_WIN32)
+	capture->descriptor = -1;
+#endif
+	if (blockRecords == 0) {
+		blockRecords = TOUCAN_CAPTURE_DEFAULT_BLOCK;
+	}
+	if ((path == NULL) || (blockRecords < TOUCAN_CAPTURE_MIN_BLOCK) || (blockRecords > TOUCAN_CAPTURE_MAX_BLOCK)) {
+		return FALSE;
+	}
+
+	capture->blockRecords = blockRecords;
+	capture->startTime = startTime;
+	capture->buffers[0] = (TOUCAN_CAPTURE_RECORD *)calloc(blockRecords, sizeof(TOUCAN_CAPTURE_RECORD));
+	capture->buffers[1] = (TOUCAN_CAPTURE_RECORD *)calloc(blockRecords, sizeof(TOUCAN_CAPTURE_RECORD));
+	if ((capture->buffers[0] == NULL) || (capture->buffers[1] == NULL)) {
+		TouCAN_capture_close(capture);
+		return FALSE;
+	}
+
+#if defined(_WIN32)
+	capture->file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (capture->file == INVALID_HANDLE_VALUE) {
+#else
+	capture->descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (capture->descriptor < 0) {
+#endif
+		TouCAN_capture_close(capture);
+		return FALSE;
+	}
+
+	// Until the capture is closed the header says there is no index
+	memset(&header, 0, sizeof(header));
+	header.magic = TOUCAN_CAPTURE_MAGIC;
+	header.layout = TOUCAN_CAPTURE_LAYOUT;
+	header.recordSize = sizeof(TOUCAN_CAPTURE_RECORD);
+	header.blockRecords = blockRecords;
+	header.startTime = startTime;
+	capture->offset = sizeof(TOUCAN_CAPTURE_HEADER);
+
+	if (WriteAt(capture, 0, &header, sizeof(header)) == FALSE) {
+		TouCAN_capture_close(capture);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Append frames, called by the read thread and the transmit paths
+// Records are stamped in the order they are appended, never before the previous record
+// [in] direction, TOUCAN_CAPTURE_RECEIVED or TOUCAN_CAPTURE_TRANSMITTED
+// returns TRUE if a full buffer is waiting for the capture thread
+//
+
+BOOL TouCAN_capture_append(TOUCAN_CAPTURE *capture, const TOUCAN_FRAME *frames, UINT32 count, UINT8 direction) {
+	TOUCAN_CAPTURE_RECORD *record;
+	BOOL handed = FALSE;
+	UINT32 i;
+
+	AcquireSRWLockExclusive(&capture->lock);
+	for (i = 0; i < count; i++) {
+		if ((capture->used == capture->blockRecords) && (HandOver(capture) == FALSE)) {
+			break;
+		}
+
+		record = &capture->buffers[capture->filling][capture->used++];
+		if (frames[i].hostTime > capture->lastHostTime) {
+			capture->lastHostTime = frames[i].hostTime;
+		}
+		record->hostTime = capture->lastHostTime;
+		record->id = frames[i].id;
+		record->timestamp = frames[i].timestamp;
+		record->flags = frames[i].flags;
+		record->length = frames[i].length;
+		record->direction = direction;
+		memcpy(record->data, frames[i].data, TOUCAN_FRAME_DATA_LENGTH);
+
+		// Start writing a block as soon as it is complete
+		if (capture->used == capture->blockRecords) {
+			handed |= HandOver(capture);
+		}
+	}
+	ReleaseSRWLockExclusive(&capture->lock);
+
+	InterlockedExchangeAdd(&capture->records, (LONG)i);
+	if (i < count) {
+		InterlockedExchangeAdd(&capture->dropped, (LONG)(count - i));
+	}
+	return handed;
+}
+
+//
+// Hand a partly filled buffer to the capture thread, so a quiet bus does not hold records back
+// returns TRUE if a buffer is waiting to be written
+//
+
+BOOL TouCAN_capture_rotate(TOUCAN_CAPTURE *capture) {
+	BOOL handed = FALSE;
+
+	AcquireSRWLockExclusive(&capture->lock);
+	if (capture->used > 0) {
+		handed = HandOver(capture);
+	}
+	ReleaseSRWLockExclusive(&capture->lock);
+	return handed;
+}
+
+//
+// Write the buffers handed over, oldest first, and index them. Only called by the capture thread.
+// returns FALSE if a block could not be written, its records are lost
+//
+
+BOOL TouCAN_capture_write(TOUCAN_CAPTURE *capture) {
+	TOUCAN_CAPTURE_INDEX *index;
+	size_t length;
+	BOOL status = TRUE;
+
+	while (ReadAcquire(&capture->full[capture->writing])) {
+		length = (size_t)capture->lengths[capture->writing] * sizeof(TOUCAN_CAPTURE_RECORD);
+
+		if (WriteAt(capture, capture->offset, capture->buffers[capture->writing], length) == TRUE) {
+			if (capture->indexEntries == capture->indexCapacity) {
+				index = (TOUCAN_CAPTURE_INDEX *)realloc(capture->index, (capture->indexCapacity + INDEX_GROWTH) * sizeof(TOUCAN_CAPTURE_INDEX));
+				if (index != NULL) {
+					capture->index = index;
+					capture->indexCapacity += INDEX_GROWTH;
+				}
+			}
+
+			// Without memory for the entry the index is coarser, a seek searches more records
+			if (capture->indexEntries < capture->indexCapacity) {
+				capture->index[capture->indexEntries].hostTime = capture->buffers[capture->writing][0].hostTime;
+				capture->index[capture->indexEntries].offset = capture->offset;
+				capture->indexEntries++;
+			}
+			capture->offset += length;
+		}
+		else {
+			InterlockedExchangeAdd(&capture->writeErrors, (LONG)capture->lengths[capture->writing]);
+			status = FALSE;
+		}
+
+		WriteRelease(&capture->full[capture->writing], FALSE);
+		capture->writing ^= 1;
+	}
+	return status;
+}
+
+//
+// Write the remaining records, the index and the final header, then close the file.
+// Must only be called once nothing appends any more and the capture thread has exited.
+// returns FALSE if any of it could not be written
+//
+
+BOOL TouCAN_capture_close(TOUCAN_CAPTURE *capture) {
+	TOUCAN_CAPTURE_HEADER header;
+	BOOL status = TRUE;
+
+#if defined(_WIN32)
+	if ((capture->file != NULL) && (capture->file != INVALID_HANDLE_VALUE)) {
+#else
+	if (capture->descriptor >= 0) {
+#endif
+		status = TouCAN_capture_write(capture);
+		TouCAN_capture_rotate(capture);
+		status &= TouCAN_capture_write(capture);
+
+		memset(&header, 0, sizeof(header));
+		header.magic = TOUCAN_CAPTURE_MAGIC;
+		header.layout = TOUCAN_CAPTURE_LAYOUT;
+		header.recordSize = sizeof(TOUCAN_CAPTURE_RECORD);
+		header.blockRecords = capture->blockRecords;
+		header.startTime = capture->startTime;
+		header.records = (capture->offset - sizeof(TOUCAN_CAPTURE_HEADER)) / sizeof(TOUCAN_CAPTURE_RECORD);
+		header.indexOffset = capture->offset;
+		header.indexEntries = capture->indexEntries;
+
+		// The header is written last, a capture is only indexed once its index is complete
+		if (WriteAt(capture, capture->offset, capture->index, (size_t)capture->indexEntries * sizeof(TOUCAN_CAPTURE_INDEX)) == FALSE) {
+			status = FALSE;
+		}
+		else if (WriteAt(capture, 0, &header, sizeof(header)) == FALSE) {
+			status = FALSE;
+		}
+
+#if defined(_WIN32)
+		status &= CloseHandle(capture->file);
+		capture->file = NULL;
+#else
+		status &= (close(capture->descriptor) == 0);
+		capture->descriptor = -1;
+#endif
+	}
+
+	free(capture->buffers[0]);
+	free(capture->buffers[1]);
+	free(capture->index);
+	capture->buffers[0] = NULL;
+	capture->buffers[1] = NULL;
+	capture->index = NULL;
+	return status;
+}
+
+//
+// Read from a capture file at an absolute offset
+// returns FALSE if not every byte could be read
+//
+
+static BOOL ReadAt(TOUCAN_CAPTURE_READER *reader, ULONGLONG offset, void *data, size_t length) {
+	UINT8 *bytes = (UINT8 *)data;
+#if defined(_WIN32)
+	OVERLAPPED position;
+	DWORD read;
+
+	while (length > 0) {
+		memset(&position, 0, sizeof(position));
+		position.Offset = (DWORD)offset;
+		position.OffsetHigh = (DWORD)(offset >> 32);
+
+		if ((ReadFile(reader->file, bytes, (length > 0x100000) ? 0x100000 : (DWORD)length, &read, &position) == FALSE) || (read == 0)) {
+			return FALSE;
+		}
+		bytes += read;
+		offset += read;
+		length -= read;
+	}
+#else
+	ssize_t read;
+
+	while (length > 0) {
+		read = pread(reader->descriptor, bytes, length, (off_t)offset);
+		if (read <= 0) {
+			return FALSE;
+		}
+		bytes += read;
+		offset += (ULONGLONG)read;
+		length -= (size_t)read;
+	}
+#endif
+	return TRUE;
+}
+
+static void UnmapWindow(TOUCAN_CAPTURE_READER *reader) {
+	if (reader->view != NULL) {
+#if defined(_WIN32)
+		UnmapViewOfFile(reader->view);
+#else
+		munmap((void *)reader->view, reader->viewLength);
+#endif
+	}
+	reader->view = NULL;
+	reader->viewOffset = 0;
+	reader->viewLength = 0;
+}
+
+//
+// Find a record, mapping the window around it if the current window does not hold it
+// returns the record, NULL if the window could not be mapped
+//
+
+static const TOUCAN_CAPTURE_RECORD *Record(TOUCAN_CAPTURE_READER *reader, ULONGLONG record) {
+	ULONGLONG offset = sizeof(TOUCAN_CAPTURE_HEADER) + (record * sizeof(TOUCAN_CAPTURE_RECORD));
+	ULONGLONG start;
+	ULONGLONG end;
+
+	if ((reader->view == NULL) || (offset < reader->viewOffset) ||
+		(offset + sizeof(TOUCAN_CAPTURE_RECORD) > reader->viewOffset + reader->viewLength)) {
+		UnmapWindow(reader);
+
+		// Centred on the record, so reading on from it or searching either side stays in the window
+		start = (offset > (TOUCAN_CAPTURE_WINDOW / 2)) ? offset - (TOUCAN_CAPTURE_WINDOW / 2) : 0;
+		start -= start % TOUCAN_CAPTURE_GRANULARITY;
+		end = start + TOUCAN_CAPTURE_WINDOW;
+		if (end > reader->size) {
+			end = reader->size;
+		}
+
+#if defined(_WIN32)
+		reader->view = (const UINT8 *)MapViewOfFile(reader->mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)(end - start));
+#else
+		reader->view = (const UINT8 *)mmap(NULL, (size_t)(end - start), PROT_READ, MAP_SHARED, reader->descriptor, (off_t)start);
+		if (reader->view == MAP_FAILED) {
+			reader->view = NULL;
+		}
+#endif
+		if (reader->view == NULL) {
+			return NULL;
+		}
+		reader->viewOffset = start;
+		reader->viewLength = (size_t)(end - start);
+	}
+	return (const TOUCAN_CAPTURE_RECORD *)(reader->view + (offset - reader->viewOffset));
+}
+
+//
+// Open a capture file read only. A capture still being written, or never closed, has no index
+// and holds the whole records present when it was opened. Records are mapped as they are read.
+// returns TOUCAN_CAPTURE_MAPPED, or why the file could not be used
+//
+
+TOUCAN_CAPTURE_MAP_RESULT TouCAN_capture_map(TOUCAN_CAPTURE_READER *reader, const char *path) {
+	TOUCAN_CAPTURE_HEADER *header = &reader->header;
+#if defined(_WIN32)
+	LARGE_INTEGER length;
+#else
+	struct stat status;
+#endif
+
+	memset(reader, 0, sizeof(TOUCAN_CAPTURE_READER));
+#if !defined(_WIN32)
+	reader->descriptor = -1;
+#endif
+	if (path == NULL) {
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+
+#if defined(_WIN32)
+	reader->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (reader->file == INVALID_HANDLE_VALUE) {
+		reader->file = NULL;
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+	if ((GetFileSizeEx(reader->file, &length) == FALSE) || ((ULONGLONG)length.QuadPart < sizeof(TOUCAN_CAPTURE_HEADER))) {
+		TouCAN_capture_unmap(reader);
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+	reader->size = (ULONGLONG)length.QuadPart;
+
+	// The mapping object only reserves the file, windows onto it are mapped as records are read
+	reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, (DWORD)(reader->size >> 32), (DWORD)reader->size, NULL);
+	if (reader->mapping == NULL) {
+		TouCAN_capture_unmap(reader);
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+#else
+	reader->descriptor = open(path, O_RDONLY);
+	if (reader->descriptor < 0) {
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+	if ((fstat(reader->descriptor, &status) != 0) || ((ULONGLONG)status.st_size < sizeof(TOUCAN_CAPTURE_HEADER))) {
+		TouCAN_capture_unmap(reader);
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+	reader->size = (ULONGLONG)status.st_size;
+#endif
+
+	if (ReadAt(reader, 0, header, sizeof(TOUCAN_CAPTURE_HEADER)) == FALSE) {
+		TouCAN_capture_unmap(reader);
+		return TOUCAN_CAPTURE_UNREADABLE;
+	}
+	if ((header->magic != TOUCAN_CAPTURE_MAGIC) || (header->layout != TOUCAN_CAPTURE_LAYOUT) ||
+		(header->recordSize != sizeof(TOUCAN_CAPTURE_RECORD))) {
+		TouCAN_capture_unmap(reader);
+		return TOUCAN_CAPTURE_INVALID;
+	}
+
+	reader->count = (reader->size - sizeof(TOUCAN_CAPTURE_HEADER)) / sizeof(TOUCAN_CAPTURE_RECORD);
+
+	// The index is small, one entry per block, it is read whole rather than mapped
+	if ((header->indexOffset != 0) && (header->indexEntries > 0) &&
+		(header->indexOffset == sizeof(TOUCAN_CAPTURE_HEADER) + (header->records * sizeof(TOUCAN_CAPTURE_RECORD))) &&
+		(header->indexOffset + ((ULONGLONG)header->indexEntries * sizeof(TOUCAN_CAPTURE_INDEX)) <= reader->size)) {
+		reader->index = (TOUCAN_CAPTURE_INDEX *)malloc((size_t)header->indexEntries * sizeof(TOUCAN_CAPTURE_INDEX));
+		if ((reader->index != NULL) &&
+			(ReadAt(reader, header->indexOffset, reader->index, (size_t)header->indexEntries * sizeof(TOUCAN_CAPTURE_INDEX)) == FALSE)) {
+			free(reader->index);
+			reader->index = NULL;
+		}
+
+		// Without the index the records are still read, a seek searches all of them
+		reader->count = header->records;
+		reader->indexEntries = (reader->index != NULL) ? header->indexEntries : 0;
+	}
+	return TOUCAN_CAPTURE_MAPPED;
+}
+
+void TouCAN_capture_unmap(TOUCAN_CAPTURE_READER *reader) {
+	UnmapWindow(reader);
+#if defined(_WIN32)
+	if (reader->mapping != NULL) {
+		CloseHandle(reader->mapping);
+	}
+	if (reader->file != NULL) {
+		CloseHandle(reader->file);
+	}
+	reader->mapping = NULL;
+	reader->file = NULL;
+#else
+	if (reader->descriptor >= 0) {
+		close(reader->descriptor);
+	}
+	reader->descriptor = -1;
+#endif
+	free(reader->index);
+	reader->index = NULL;
+	reader->indexEntries = 0;
+	reader->count = 0;
+}
+
+//
+// Position the reader at the first record at or after a host time. The index narrows
+// the search to one block, records are then searched within it.
+// [in] hostTime, microseconds, as recorded in the capture
+// returns the record the reader now points at, the record count if every record is earlier
+//
+
+ULONGLONG TouCAN_capture_seek(TOUCAN_CAPTURE_READER *reader, LONGLONG hostTime) {
+	const TOUCAN_CAPTURE_RECORD *record;
+	ULONGLONG low = 0;
+	ULONGLONG high = reader->count;
+	ULONGLONG middle;
+	UINT32 first = 0;
+	UINT32 last;
+	UINT32 entry;
+
+	if ((reader->index != NULL) && (reader->indexEntries > 0)) {
+		// Last block starting before the time, records of equal time may end the block before it
+		last = reader->indexEntries;
+		while (first + 1 < last) {
+			entry = first + ((last - first) / 2);
+			if (reader->index[entry].hostTime < hostTime) {
+				first = entry;
+			}
+			else {
+				last = entry;
+			}
+		}
+
+		low = (reader->index[first].offset - sizeof(TOUCAN_CAPTURE_HEADER)) / sizeof(TOUCAN_CAPTURE_RECORD);
+		if (first + 1 < reader->indexEntries) {
+			high = (reader->index[first + 1].offset - sizeof(TOUCAN_CAPTURE_HEADER)) / sizeof(TOUCAN_CAPTURE_RECORD);
+		}
+		if ((low > reader->count) || (high > reader->count) || (low > high)) {
+			low = 0;
+			high = reader->count;
+		}
+	}
+
+	while (low < high) {
+		middle = low + ((high - low) / 2);
+		record = Record(reader, middle);
+		if (record == NULL) {
+			break;
+		}
+		if (record->hostTime < hostTime) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	reader->cursor = low;
+	return low;
+}
+
+//
+// Read the records following the cursor
+// [out] frames, receives the frames with their device timestamp and host time
+// [out] directions, optional, receives the direction of each frame
+// [in] maxFrames, capacity of frames and directions
+// returns the number of frames read, zero at the end of the capture
+//
+
+UINT32 TouCAN_capture_next(TOUCAN_CAPTURE_READER *reader, TOUCAN_FRAME *frames, UINT8 *directions, UINT32 maxFrames) {
+	const TOUCAN_CAPTURE_RECORD *record;
+	UINT32 count = 0;
+
+	while ((count < maxFrames) && (reader->cursor < reader->count)) {
+		record = Record(reader, reader->cursor);
+		if (record == NULL) {
+			break;
+		}
+		reader->cursor++;
+		frames[count].hostTime = record->hostTime;
+		frames[count].id = record->id;
+		frames[count].timestamp = record->timestamp;
+		frames[count].flags = record->flags;
+		frames[count].length = record->length;
+		memcpy(frames[count].data, record->data, TOUCAN_FRAME_DATA_LENGTH);
+
+		if (directions != NULL) {
+			directions[count] = record->direction;
+		}
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,317 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Channel
+// Unit Description: Shared memory frame channel
+// Function: Publishes received frames into a named shared memory ring that readers in other
+// processes follow independently, each detecting for itself when it has been overrun
+//
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_channel.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static size_t ChannelSize(UINT32 slots) {
+	return sizeof(TOUCAN_CHANNEL_HEADER) + ((size_t)slots * sizeof(TOUCAN_CHANNEL_SLOT));
+}
+
+//
+// Check that mapped memory holds a channel this build can use
+//
+
+static BOOL ValidHeader(const TOUCAN_CHANNEL_HEADER *header, size_t size) {
+	return ((size >= sizeof(TOUCAN_CHANNEL_HEADER)) && (header->magic == TOUCAN_CHANNEL_MAGIC) &&
+		(header->layout == TOUCAN_CHANNEL_LAYOUT) && (header->slotSize == sizeof(TOUCAN_CHANNEL_SLOT)) &&
+		(header->slots >= TOUCAN_CHANNEL_MIN_SLOTS) && (header->slots <= TOUCAN_CHANNEL_MAX_SLOTS) &&
+		((header->slots & (header->slots - 1)) == 0) && (size >= ChannelSize(header->slots)));
+}
+
+//
+// Map a named shared memory object
+// [in] size, bytes to create it with, zero to open an existing one
+// [out] existed, TRUE if the object was already there
+// returns the mapped address and its size in channel->size, NULL on failure
+//
+
+static void *Map(TOUCAN_CHANNEL *channel, const char *name, size_t size, BOOL *existed) {
+	void *view;
+#if defined(_WIN32)
+	MEMORY_BASIC_INFORMATION region;
+
+	if (size > 0) {
+		channel->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((ULONGLONG)size >> 32), (DWORD)size, name);
+		*existed = (GetLastError() == ERROR_ALREADY_EXISTS);
+	}
+	else {
+		channel->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+		*existed = TRUE;
+	}
+
+	if (channel->mapping == NULL) {
+		return NULL;
+	}
+
+	view = MapViewOfFile(channel->mapping, (size > 0) ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+	if ((view == NULL) || (VirtualQuery(view, &region, sizeof(region)) == 0)) {
+		if (view != NULL) {
+			UnmapViewOfFile(view);
+		}
+		CloseHandle(channel->mapping);
+		channel->mapping = NULL;
+		return NULL;
+	}
+
+	channel->size = region.RegionSize;
+	return view;
+#else
+	struct stat status;
+
+	channel->descriptor = shm_open(name, (size > 0) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (channel->descriptor < 0) {
+		return NULL;
+	}
+
+	*existed = TRUE;
+	if ((fstat(channel->descriptor, &status) != 0) ||
+		((status.st_size == 0) && (size > 0) && (ftruncate(channel->descriptor, (off_t)size) != 0))) {
+		close(channel->descriptor);
+		channel->descriptor = -1;
+		return NULL;
+	}
+
+	if (status.st_size == 0) {
+		*existed = FALSE;
+		status.st_size = (off_t)size;
+	}
+
+	view = mmap(NULL, (size_t)status.st_size, (size > 0) ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, channel->descriptor, 0);
+	if (view == MAP_FAILED) {
+		close(channel->descriptor);
+		channel->descriptor = -1;
+		return NULL;
+	}
+
+	channel->size = (size_t)status.st_size;
+	return view;
+#endif
+}
+
+static void Unmap(TOUCAN_CHANNEL *channel) {
+#if defined(_WIN32)
+	if (channel->header != NULL) {
+		UnmapViewOfFile(channel->header);
+	}
+	if (channel->mapping != NULL) {
+		CloseHandle(channel->mapping);
+	}
+	channel->mapping = NULL;
+#else
+	if (channel->header != NULL) {
+		munmap(channel->header, channel->size);
+	}
+	if (channel->descriptor >= 0) {
+		close(channel->descriptor);
+	}
+	channel->descriptor = -1;
+#endif
+	channel->header = NULL;
+	channel->slots = NULL;
+}
+
+//
+// Create the channel as its writer. A channel left by an earlier session with the same
+// depth is taken over, so readers still attached to it carry on across the restart.
+// [in] name, shared memory name, NULL for TOUCAN_CHANNEL_DEFAULT_NAME
+// [in] slots, frames the channel holds, rounded up to a power of two
+// returns FALSE if the channel could not be created, or the name is used by an incompatible channel
+//
+
+BOOL TouCAN_channel_create(TOUCAN_CHANNEL *channel, const char *name, UINT32 slots) {
+	UINT32 depth = TOUCAN_CHANNEL_MIN_SLOTS;
+	BOOL existed;
+
+	memset(channel, 0, sizeof(TOUCAN_CHANNEL));
+#if !defined(_WIN32)
+	channel->descriptor = -1;
+#endif
+
+	if (slots > TOUCAN_CHANNEL_MAX_SLOTS) {
+		return FALSE;
+	}
+	while (depth < slots) {
+		depth <<= 1;
+	}
+
+	channel->header = (TOUCAN_CHANNEL_HEADER *)Map(channel, (name != NULL) ? name : TOUCAN_CHANNEL_DEFAULT_NAME, ChannelSize(depth), &existed);
+	if (channel->header == NULL) {
+		return FALSE;
+	}
+	channel->slots = (TOUCAN_CHANNEL_SLOT *)&channel->header[1];
+	channel->mask = depth - 1;
+	channel->writer = TRUE;
+
+	if (existed) {
+		if ((ValidHeader(channel->header, channel->size) == FALSE) || (channel->header->slots != depth)) {
+			Unmap(channel);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	// Odd versions are never what a reader looks for
+	for (UINT32 i = 0; i < depth; i++) {
+		channel->slots[i].version = 1;
+	}
+	channel->header->slots = depth;
+	channel->header->slotSize = sizeof(TOUCAN_CHANNEL_SLOT);
+	channel->header->layout = TOUCAN_CHANNEL_LAYOUT;
+	channel->header->published = 0;
+	WriteRelease((volatile LONG *)&channel->header->magic, TOUCAN_CHANNEL_MAGIC);
+	return TRUE;
+}
+
+//
+// Attach to a channel as a reader, starting with the next frame published
+// [in] name, shared memory name, NULL for TOUCAN_CHANNEL_DEFAULT_NAME
+// returns FALSE if there is no usable channel of that name
+//
+
+BOOL TouCAN_channel_open(TOUCAN_CHANNEL *channel, const char *name) {
+	BOOL existed;
+
+	memset(channel, 0, sizeof(TOUCAN_CHANNEL));
+#if !defined(_WIN32)
+	channel->descriptor = -1;
+#endif
+
+	channel->header = (TOUCAN_CHANNEL_HEADER *)Map(channel, (name != NULL) ? name : TOUCAN_CHANNEL_DEFAULT_NAME, 0, &existed);
+	if (channel->header == NULL) {
+		return FALSE;
+	}
+
+	if (ValidHeader(channel->header, channel->size) == FALSE) {
+		Unmap(channel);
+		return FALSE;
+	}
+
+	channel->slots = (TOUCAN_CHANNEL_SLOT *)&channel->header[1];
+	channel->mask = channel->header->slots - 1;
+	channel->cursor = (UINT32)ReadAcquire(&channel->header->published);
+	return TRUE;
+}
+
+void TouCAN_channel_close(TOUCAN_CHANNEL *channel) {
+	Unmap(channel);
+}
+
+//
+// Publish frames, only the writer may call this
+//
+
+void TouCAN_channel_publish(TOUCAN_CHANNEL *channel, const TOUCAN_FRAME *frames, UINT32 count) {
+	TOUCAN_CHANNEL_SLOT *slot;
+	UINT32 sequence = (UINT32)channel->header->published;
+
+	for (UINT32 i = 0; i < count; i++, sequence++) {
+		slot = &channel->slots[sequence & channel->mask];
+
+		// Readers copying the old frame see the odd version and discard their copy
+		WriteNoFence(&slot->version, (LONG)((sequence << 1) | 1));
+		MemoryBarrier();
+		slot->frame = frames[i];
+		WriteRelease(&slot->version, (LONG)(sequence << 1));
+	}
+
+	WriteRelease(&channel->header->published, (LONG)sequence);
+}
+
+//
+// Move a lapped reader to the oldest frames still held, leaving an eighth of the channel
+// as a margin so it is not lapped again at once
+//
+
+static void Skip(TOUCAN_CHANNEL *channel, UINT32 published) {
+	UINT32 target = published - channel->mask + (channel->mask >> 3);
+
+	if ((LONG)(target - channel->cursor) <= 0) {
+		target = channel->cursor + 1;
+	}
+	channel->lost += target - channel->cursor;
+	channel->cursor = target;
+}
+
+//
+// Read the frames published since the previous call, oldest first
+// [out] frames, receives the frames
+// [in] maxFrames, capacity of frames
+// [out] lost, optional, frames this reader has missed since it opened the channel
+// returns the number of frames read
+//
+
+UINT32 TouCAN_channel_read(TOUCAN_CHANNEL *channel, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *lost) {
+	const TOUCAN_CHANNEL_SLOT *slot;
+	UINT32 published = (UINT32)ReadAcquire(&channel->header->published);
+	UINT32 count = 0;
+	LONG expected;
+
+	while ((count < maxFrames) && (channel->cursor != published)) {
+		if ((published - channel->cursor) > (channel->mask + 1)) {
+			Skip(channel, published);
+			continue;
+		}
+
+		slot = &channel->slots[channel->cursor & channel->mask];
+		expected = (LONG)(channel->cursor << 1);
+
+		if (ReadAcquire(&slot->version) == expected) {
+			frames[count] = slot->frame;
+
+			// The copy is only good if the writer did not start on the slot meanwhile
+			MemoryBarrier();
+			if (ReadNoFence(&slot->version) == expected) {
+				count++;
+				channel->cursor++;
+				continue;
+			}
+		}
+
+		// Overwritten, the writer has moved on
+		published = (UINT32)ReadAcquire(&channel->header->published);
+		Skip(channel, published);
+	}
+
+	if (lost != NULL) {
+		*lost = channel->lost;
+	}
+	return count;
+}
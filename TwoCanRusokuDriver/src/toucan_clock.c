@@ -0,0 +1,182 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Clock
+// Unit Description: Correlates the adapter's timestamp with the host clock
+// Function: Unwraps the 32 bit device timestamp and estimates the offset and drift
+// between the device and host clocks from the packet arrival times
+//
+
+#include "../inc/toucan_clock.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+//
+// Reset the correlation
+// [in] tickFrequency, nominal device ticks per second
+//
+
+void TouCAN_clock_init(TOUCAN_CLOCK *clock, UINT32 tickFrequency) {
+	memset(clock, 0, sizeof(TOUCAN_CLOCK));
+	clock->tickPeriod = 1000000.0 / (double)((tickFrequency == 0) ? TOUCAN_TIMESTAMP_FREQUENCY : tickFrequency);
+	clock->rate = 1.0;
+}
+
+//
+// Start the mapping again from a single sample, keeping the drift estimate
+//
+
+static void Restart(TOUCAN_CLOCK *clock, UINT32 deviceTicks, LONGLONG hostTime) {
+	clock->started = TRUE;
+	clock->lastTicks = deviceTicks;
+	clock->deviceTime = 0;
+	clock->deviceBase = 0;
+	clock->hostBase = hostTime;
+	clock->windowStart = hostTime;
+	clock->windowDevice = 0;
+	clock->windowHost = hostTime;
+	clock->windowResidual = 0;
+	clock->anchored = FALSE;
+}
+
+//
+// Host time predicted for an unwrapped device time
+//
+
+static LONGLONG Predict(const TOUCAN_CLOCK *clock, LONGLONG deviceTime) {
+	return clock->hostBase + (LONGLONG)((double)(deviceTime - clock->deviceBase) * clock->tickPeriod * clock->rate);
+}
+
+//
+// Add a sample, the device timestamp of the last record of a packet and the host time it arrived
+// USB latency only ever delays a packet, so the least delayed packets bound the true mapping from below
+// [in] deviceTicks, raw device timestamp
+// [in] hostTime, host monotonic time in microseconds
+//
+
+void TouCAN_clock_update(TOUCAN_CLOCK *clock, UINT32 deviceTicks, LONGLONG hostTime) {
+	UINT32 elapsed;
+	LONGLONG residual;
+	double measured;
+	double limit;
+
+	if (clock->started == FALSE) {
+		Restart(clock, deviceTicks, hostTime);
+		return;
+	}
+
+	// Unsigned arithmetic absorbs a wraparound, a step backwards means the adapter was restarted
+	elapsed = deviceTicks - clock->lastTicks;
+	if (elapsed > 0x80000000) {
+		InterlockedIncrement(&clock->resets);
+		Restart(clock, deviceTicks, hostTime);
+		return;
+	}
+	clock->lastTicks = deviceTicks;
+	clock->deviceTime += elapsed;
+
+	// A packet earlier than predicted moves the mapping down, no packet can arrive before it was sent
+	residual = hostTime - Predict(clock, clock->deviceTime);
+	if (residual < 0) {
+		clock->hostBase += residual;
+		clock->windowResidual -= residual;
+		residual = 0;
+	}
+
+	if (residual <= clock->windowResidual) {
+		clock->windowDevice = clock->deviceTime;
+		clock->windowHost = hostTime;
+		clock->windowResidual = residual;
+	}
+
+	if ((hostTime - clock->windowStart) < TOUCAN_CLOCK_WINDOW) {
+		return;
+	}
+
+	// Window complete, the drift is the slope between the least delayed samples of successive windows
+	if (clock->anchored) {
+		measured = (double)(clock->windowDevice - clock->anchorDevice) * clock->tickPeriod;
+		if (measured > 0.0) {
+			measured = (double)(clock->windowHost - clock->anchorHost) / measured;
+			limit = (double)TOUCAN_CLOCK_MAX_DRIFT / 1000000.0;
+
+			if ((measured > (1.0 - limit)) && (measured < (1.0 + limit))) {
+				clock->rate += (measured - clock->rate) / TOUCAN_CLOCK_SMOOTHING;
+				WriteNoFence(&clock->drift, (LONG)((clock->rate - 1.0) * 1000000000.0));
+				WriteNoFence(&clock->synchronised, TRUE);
+			}
+		}
+	}
+
+	clock->anchored = TRUE;
+	clock->anchorDevice = clock->windowDevice;
+	clock->anchorHost = clock->windowHost;
+
+	// Anchor the mapping on the least delayed sample and open the next window
+	clock->deviceBase = clock->windowDevice;
+	clock->hostBase = clock->windowHost;
+	clock->windowStart = hostTime;
+	clock->windowResidual = hostTime - Predict(clock, clock->deviceTime);
+	clock->windowDevice = clock->deviceTime;
+	clock->windowHost = hostTime;
+}
+
+//
+// Convert a device timestamp close to the latest sample into host time
+// [in] deviceTicks, raw device timestamp
+// returns the host monotonic time in microseconds
+//
+
+LONGLONG TouCAN_clock_to_host(const TOUCAN_CLOCK *clock, UINT32 deviceTicks) {
+	LONGLONG deviceTime = clock->deviceTime + (LONG)(deviceTicks - clock->lastTicks);
+
+	return Predict(clock, deviceTime);
+}
+
+//
+// Host monotonic clock in microseconds, the clock frames are stamped and timed against
+//
+
+LONGLONG HostMicroseconds(void) {
+#if defined(_WIN32)
+	// Fixed at boot, read once for every host timestamp
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+
+	// Split the conversion so the multiplication cannot overflow
+	return ((counter.QuadPart / frequency.QuadPart) * 1000000) +
+		(((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((LONGLONG)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+#endif
+}
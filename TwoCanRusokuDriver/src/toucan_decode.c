@@ -0,0 +1,196 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Decoder
+// Unit Description: Decodes the USB records received from the TouCAN adapter
+// Function: Validates a bulk IN packet and converts its records in a single pass
+// straight from the read buffer into the caller's frames, and encodes frames for transmission
+//
+
+#include "../inc/toucan_decode.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(TOUCAN_DECODE_SIMD)
+#if defined(__SSSE3__) || (defined(_MSC_VER) && defined(__AVX__))
+#define TOUCAN_DECODE_SSSE3
+#include <tmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+// MSVC emits SSSE3 for any x86 target, without /arch:AVX the processor is checked at run time
+#define TOUCAN_DECODE_SSSE3
+#define TOUCAN_DECODE_CPUID
+#include <intrin.h>
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define TOUCAN_DECODE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(TOUCAN_DECODE_SSSE3) || defined(TOUCAN_DECODE_NEON)
+
+// The shuffles write the first 16 bytes of a TOUCAN_FRAME directly, so its layout must not change
+typedef char TOUCAN_FRAME_LAYOUT[((offsetof(TOUCAN_FRAME, timestamp) == 4) && (offsetof(TOUCAN_FRAME, flags) == 8) &&
+	(offsetof(TOUCAN_FRAME, length) == 9) && (offsetof(TOUCAN_FRAME, data) == 10)) ? 1 : -1];
+
+// Bytes 0 - 15 of the record give the identifier, flags, length and the first six data bytes.
+// Bytes 2 - 17 give the timestamp. Indices of 0x80 produce zero.
+static const UINT8 shuffleHead[16] = { 4, 3, 2, 1, 0x80, 0x80, 0x80, 0x80, 0, 5, 6, 7, 8, 9, 10, 11 };
+static const UINT8 shuffleTail[16] = { 0x80, 0x80, 0x80, 0x80, 15, 14, 13, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+static const UINT8 identifierMask[16] = { 0xff, 0xff, 0xff, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+#endif
+
+#if defined(TOUCAN_DECODE_CPUID)
+
+// 0 until the processor has been checked, then 1 without and 2 with SSSE3
+static volatile LONG ssse3Support;
+
+static BOOL SimdAvailable(void) {
+	LONG support = ReadNoFence(&ssse3Support);
+	int info[4];
+
+	if (support == 0) {
+		__cpuid(info, 1);
+		support = ((info[2] & (1 << 9)) != 0) ? 2 : 1;
+		WriteNoFence(&ssse3Support, support);
+	}
+	return (support == 2);
+}
+
+#elif defined(TOUCAN_DECODE_SSSE3) || defined(TOUCAN_DECODE_NEON)
+#define SimdAvailable() TRUE
+#endif
+
+#if defined(TOUCAN_DECODE_SSSE3) || defined(TOUCAN_DECODE_NEON)
+
+//
+// Decode a single record with byte shuffles. Records are 18 bytes, so each needs its own
+// pair of unaligned loads, and a packet holds at most three of them.
+// [in] record, 18 bytes as received from the adapter
+// [out] frame, the decoded frame
+//
+
+static void DecodeRecordSimd(const UINT8 *record, TOUCAN_FRAME *frame) {
+#if defined(TOUCAN_DECODE_SSSE3)
+	__m128i head = _mm_loadu_si128((const __m128i *)record);
+	__m128i tail = _mm_loadu_si128((const __m128i *)&record[2]);
+
+	head = _mm_shuffle_epi8(head, _mm_loadu_si128((const __m128i *)shuffleHead));
+	tail = _mm_shuffle_epi8(tail, _mm_loadu_si128((const __m128i *)shuffleTail));
+	head = _mm_and_si128(_mm_or_si128(head, tail), _mm_loadu_si128((const __m128i *)identifierMask));
+	_mm_storeu_si128((__m128i *)frame, head);
+	memcpy(&frame->data[6], &record[TOUCAN_RECORD_DATA + 6], 2);
+#elif defined(TOUCAN_DECODE_NEON)
+	uint8x16_t head = vqtbl1q_u8(vld1q_u8(record), vld1q_u8(shuffleHead));
+	uint8x16_t tail = vqtbl1q_u8(vld1q_u8(&record[2]), vld1q_u8(shuffleTail));
+
+	vst1q_u8((UINT8 *)frame, vandq_u8(vorrq_u8(head, tail), vld1q_u8(identifierMask)));
+	memcpy(&frame->data[6], &record[TOUCAN_RECORD_DATA + 6], 2);
+#endif
+}
+
+#endif
+
+//
+// Decode a single record
+// [in] record, 18 bytes as received from the adapter
+// [out] frame, the decoded frame
+//
+
+static void DecodeRecord(const UINT8 *record, TOUCAN_FRAME *frame) {
+	UINT32 value;
+
+	frame->flags = record[TOUCAN_RECORD_FLAGS];
+
+	memcpy(&value, &record[TOUCAN_RECORD_ID], sizeof(UINT32));
+	frame->id = TWOCAN_FROM_BE32(value) & 0x1fffffff;
+
+	frame->length = record[TOUCAN_RECORD_LENGTH_CODE];
+	memcpy(frame->data, &record[TOUCAN_RECORD_DATA], TOUCAN_FRAME_DATA_LENGTH);
+
+	memcpy(&value, &record[TOUCAN_RECORD_TIMESTAMP], sizeof(UINT32));
+	frame->timestamp = TWOCAN_FROM_BE32(value);
+}
+
+//
+// Decode every record of a bulk IN packet
+// [in] packet, the received data, read in place
+// [in] length, number of bytes received
+// [out] frames, receives one frame per record
+// [in] maxFrames, capacity of frames
+// [out] count, number of frames decoded
+// returns FALSE, decoding nothing, if the packet is not a whole number of records,
+// holds more records than frames can take, or a record has an invalid data length
+//
+
+BOOL TouCAN_decode_packet(const UINT8 *packet, ULONG length, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	UINT32 records = length / TOUCAN_RECORD_LENGTH;
+
+	*count = 0;
+
+	if ((records == 0) || ((length % TOUCAN_RECORD_LENGTH) != 0) || (records > maxFrames)) {
+		return FALSE;
+	}
+
+	// A corrupt data length usually means the packet is out of step, so the whole packet is dropped
+	for (UINT32 i = 0; i < records; i++) {
+		if (packet[(i * TOUCAN_RECORD_LENGTH) + TOUCAN_RECORD_LENGTH_CODE] > TOUCAN_FRAME_DATA_LENGTH) {
+			return FALSE;
+		}
+	}
+
+#if defined(TOUCAN_DECODE_SSSE3) || defined(TOUCAN_DECODE_NEON)
+	if (SimdAvailable()) {
+		for (UINT32 i = 0; i < records; i++) {
+			DecodeRecordSimd(&packet[i * TOUCAN_RECORD_LENGTH], &frames[i]);
+		}
+		*count = records;
+		return TRUE;
+	}
+#endif
+
+	for (UINT32 i = 0; i < records; i++) {
+		DecodeRecord(&packet[i * TOUCAN_RECORD_LENGTH], &frames[i]);
+	}
+
+	*count = records;
+	return TRUE;
+}
+
+//
+// Encode a frame into an 18 byte TouCAN USB record
+// flags, id (big endian), data length, 8 data bytes, timestamp (unused on transmit)
+// returns the number of bytes written
+//
+
+UINT32 TouCAN_encode_record(const TOUCAN_FRAME *frame, UINT8 *record) {
+	UINT32 value = TWOCAN_FROM_BE32(frame->id);
+
+	record[TOUCAN_RECORD_FLAGS] = frame->flags;
+	memcpy(&record[TOUCAN_RECORD_ID], &value, sizeof(UINT32));
+	record[TOUCAN_RECORD_LENGTH_CODE] = frame->length;
+	memcpy(&record[TOUCAN_RECORD_DATA], frame->data, TOUCAN_FRAME_DATA_LENGTH);
+	memset(&record[TOUCAN_RECORD_TIMESTAMP], 0, sizeof(UINT32));
+
+	return TOUCAN_RECORD_LENGTH;
+}
@@ -0,0 +1,204 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Fake USB
+// Unit Description: Scripted TouCAN USB device
+// Function: Replays recorded bulk IN packets and records the requests and transfers it
+// receives, so the USB backend and the read pipeline can be exercised without an adapter
+//
+
+#include "../inc/toucan_fakeusb.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <string.h>
+
+static int FakeOpen(void *context) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	fake->open = TRUE;
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+static void FakeClose(void *context) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	fake->open = FALSE;
+}
+
+static BOOL FakeControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	if (fake->open == FALSE) {
+		return FALSE;
+	}
+
+	if (fake->requestCount < TOUCAN_FAKE_USB_MAX_REQUESTS) {
+		fake->requests[fake->requestCount] = request;
+	}
+	fake->requestCount++;
+
+	if ((requestType & USB_DEVICE_TO_HOST) != 0) {
+		if ((request == TouCAN_GET_LAST_ERROR_CODE) && (data != NULL) && (length >= 1)) {
+			data[0] = fake->status;
+			length = 1;
+		}
+		else if ((request == TouCAN_GET_SERIAL_NUMBER) && (data != NULL) && (length >= 4)) {
+			// Most significant byte first, as the adapter sends it
+			data[0] = (UINT8)(fake->serialNumber >> 24);
+			data[1] = (UINT8)(fake->serialNumber >> 16);
+			data[2] = (UINT8)(fake->serialNumber >> 8);
+			data[3] = (UINT8)fake->serialNumber;
+			length = 4;
+		}
+		else if ((request == TouCAN_GET_STATISTICS) && (data != NULL) && (length >= 28)) {
+			const UINT32 values[7] = { fake->statistics.receiveFrames, fake->statistics.transmitFrames, fake->statistics.receiveData,
+				fake->statistics.transmitData, fake->statistics.overruns, fake->statistics.busWarnings, fake->statistics.busOff };
+
+			for (UINT32 i = 0; i < 7; i++) {
+				data[i * 4] = (UINT8)(values[i] >> 24);
+				data[(i * 4) + 1] = (UINT8)(values[i] >> 16);
+				data[(i * 4) + 2] = (UINT8)(values[i] >> 8);
+				data[(i * 4) + 3] = (UINT8)values[i];
+			}
+			length = 28;
+		}
+		else {
+			return FALSE;
+		}
+	}
+
+	if (transferred != NULL) {
+		*transferred = length;
+	}
+	return TRUE;
+}
+
+static BOOL FakeBulkOut(void *context, const UINT8 *data, UINT32 length) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	if (fake->open == FALSE) {
+		return FALSE;
+	}
+
+	if ((fake->capture != NULL) && (fake->captureLength + length <= fake->captureCapacity)) {
+		memcpy(&fake->capture[fake->captureLength], data, length);
+		fake->captureLength += length;
+	}
+	fake->bulkOutTransfers++;
+	return TRUE;
+}
+
+static BOOL FakeReadOpen(void *context, UINT32 queueDepth) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	(void)queueDepth;
+	memset(fake->buffers, 0, sizeof(fake->buffers));
+	return fake->open;
+}
+
+static void FakeReadClose(void *context) {
+	(void)context;
+}
+
+static BOOL FakeSubmitRead(void *context, UINT32 slot, UINT8 *buffer, UINT32 length) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	fake->buffers[slot] = buffer;
+	fake->bufferLengths[slot] = length;
+	return fake->open;
+}
+
+//
+// Complete the read of a slot with the next packet of the script
+//
+
+static TOUCAN_TRANSFER_RESULT FakeWaitRead(void *context, UINT32 slot, DWORD timeout, ULONG *transferred) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+	const TOUCAN_FAKE_PACKET *packet;
+	UINT32 length;
+
+	(void)timeout;
+
+	if (fake->buffers[slot] == NULL) {
+		return TOUCAN_TRANSFER_FAILED;
+	}
+
+	if (fake->position >= fake->scriptLength) {
+		return TOUCAN_TRANSFER_PENDING;
+	}
+
+	packet = &fake->script[fake->position++];
+	if (packet->result != TOUCAN_TRANSFER_COMPLETE) {
+		fake->buffers[slot] = NULL;
+		return packet->result;
+	}
+
+	// A packet larger than the read is truncated, as a real bulk read would overflow
+	length = (packet->length < fake->bufferLengths[slot]) ? packet->length : fake->bufferLengths[slot];
+	memcpy(fake->buffers[slot], packet->data, length);
+	fake->buffers[slot] = NULL;
+	*transferred = length;
+	return TOUCAN_TRANSFER_COMPLETE;
+}
+
+static void FakeCancelReads(void *context) {
+	TOUCAN_FAKE_USB *fake = (TOUCAN_FAKE_USB *)context;
+
+	memset(fake->buffers, 0, sizeof(fake->buffers));
+}
+
+//
+// Fill in the device operations of a scripted device
+// [in] fake, state of the device, must outlive it
+// [in] script, bulk IN packets in the order they are replayed
+// [in] count, number of packets
+//
+
+void TouCAN_fakeusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_FAKE_USB *fake, const TOUCAN_FAKE_PACKET *script, UINT32 count) {
+	memset(fake, 0, sizeof(TOUCAN_FAKE_USB));
+	fake->script = script;
+	fake->scriptLength = count;
+	fake->status = TouCAN_RETVAL_OK;
+
+	device->context = fake;
+	device->Open = FakeOpen;
+	device->Close = FakeClose;
+	device->Control = FakeControl;
+	device->BulkOut = FakeBulkOut;
+
+	device->bulkIn.context = fake;
+	device->bulkIn.Open = FakeReadOpen;
+	device->bulkIn.Close = FakeReadClose;
+	device->bulkIn.SubmitRead = FakeSubmitRead;
+	device->bulkIn.WaitRead = FakeWaitRead;
+	device->bulkIn.CancelReads = FakeCancelReads;
+}
+
+//
+// Append the payload of every following bulk OUT transfer to buffer, until it is full
+//
+
+void TouCAN_fakeusb_capture(TOUCAN_FAKE_USB *fake, UINT8 *buffer, UINT32 capacity) {
+	fake->capture = buffer;
+	fake->captureCapacity = capacity;
+	fake->captureLength = 0;
+}
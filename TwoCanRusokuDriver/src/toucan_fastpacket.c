@@ -0,0 +1,387 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Fast Packet
+// Unit Description: Reassembles and segments NMEA 2000 fast packet messages
+// Function: Collects the frames of fast packet PGNs into complete messages in a fixed
+// pool of slots, queues complete messages for the caller, and splits outgoing messages into frames
+//
+
+#include "../inc/toucan_fastpacket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes carried by the first frame and by each following frame
+#define FIRST_FRAME_DATA 6
+#define FRAME_DATA 7
+
+// PGNs transmitted as fast packets, used when the caller does not supply its own list
+static const UINT32 defaultFastPgns[] = {
+	126208, 126464, 126720, 126983, 126984, 126985, 126986, 126987, 126988, 126996, 126998,
+	127233, 127237, 127489, 127496, 127497, 127498, 127503, 127504, 127506, 127507, 127509,
+	127510, 127511, 127512, 127513, 127514, 128275, 128520, 129029, 129038, 129039, 129040,
+	129041, 129044, 129045, 129284, 129285, 129301, 129302, 129538, 129540, 129541, 129542,
+	129545, 129547, 129549, 129551, 129556, 129792, 129793, 129794, 129795, 129796, 129797,
+	129798, 129799, 129800, 129801, 129802, 129803, 129804, 129805, 129806, 129807, 129808,
+	129809, 129810, 130052, 130053, 130054, 130060, 130061, 130064, 130065, 130066, 130067,
+	130068, 130069, 130070, 130071, 130072, 130073, 130074, 130320, 130321, 130322, 130323,
+	130324, 130567, 130577, 130578, 130580, 130581, 130583, 130584, 130585, 130586, 130816,
+	130817, 130818, 130819, 130820, 130821, 130822, 130823, 130824, 130825, 130826, 130827,
+	130828, 130880, 130881, 130944
+};
+
+//
+// Fill a fast packet PGN bitmap, NULL selects the built in list
+//
+
+static void SetFastPgns(UINT32 *bitmap, const UINT32 *pgns, UINT32 count) {
+	if (pgns == NULL) {
+		pgns = defaultFastPgns;
+		count = sizeof(defaultFastPgns) / sizeof(defaultFastPgns[0]);
+	}
+
+	for (UINT32 i = 0; i < count; i++) {
+		if (pgns[i] <= TOUCAN_MAX_PGN) {
+			bitmap[pgns[i] >> 5] |= 1U << (pgns[i] & 0x1F);
+		}
+	}
+}
+
+static BOOL IsFastPgn(const UINT32 *bitmap, UINT32 pgn) {
+	return (bitmap[(pgn >> 5) & (TOUCAN_FAST_PACKET_BITMAP - 1)] >> (pgn & 0x1F)) & 1;
+}
+
+//
+// Reset the reassembler
+// [in] pgns, PGNs to reassemble, NULL selects the built in list of fast packet PGNs
+// [in] count, number of PGNs
+//
+
+void TouCAN_fastpacket_init(TOUCAN_REASSEMBLER *reassembler, const UINT32 *pgns, UINT32 count) {
+	memset(reassembler, 0, sizeof(TOUCAN_REASSEMBLER));
+
+	for (UINT32 i = 0; i < TOUCAN_FAST_PACKET_POOL; i++) {
+		reassembler->slots[i].key = TOUCAN_FAST_PACKET_FREE;
+	}
+
+	SetFastPgns(reassembler->fastPgns, pgns, count);
+}
+
+BOOL TouCAN_fastpacket_is_fast(const TOUCAN_REASSEMBLER *reassembler, UINT32 pgn) {
+	return IsFastPgn(reassembler->fastPgns, pgn);
+}
+
+static TOUCAN_FAST_PACKET_SLOT *FindSlot(TOUCAN_REASSEMBLER *reassembler, UINT32 key) {
+	if (reassembler->active == 0) {
+		return NULL;
+	}
+
+	for (UINT32 i = 0; i < TOUCAN_FAST_PACKET_POOL; i++) {
+		if (reassembler->slots[i].key == key) {
+			return &reassembler->slots[i];
+		}
+	}
+	return NULL;
+}
+
+static void ReleaseSlot(TOUCAN_REASSEMBLER *reassembler, TOUCAN_FAST_PACKET_SLOT *slot) {
+	slot->key = TOUCAN_FAST_PACKET_FREE;
+	reassembler->active--;
+}
+
+//
+// A free slot, or failing that the slot of a message that has already timed out
+//
+
+static TOUCAN_FAST_PACKET_SLOT *AllocateSlot(TOUCAN_REASSEMBLER *reassembler, LONGLONG now) {
+	TOUCAN_FAST_PACKET_SLOT *oldest = NULL;
+
+	for (UINT32 i = 0; i < TOUCAN_FAST_PACKET_POOL; i++) {
+		TOUCAN_FAST_PACKET_SLOT *slot = &reassembler->slots[i];
+
+		if (slot->key == TOUCAN_FAST_PACKET_FREE) {
+			reassembler->active++;
+			return slot;
+		}
+		if ((oldest == NULL) || (slot->lastTime < oldest->lastTime)) {
+			oldest = slot;
+		}
+	}
+
+	if ((now - oldest->lastTime) > TOUCAN_FAST_PACKET_TIMEOUT) {
+		InterlockedIncrement(&reassembler->timeouts);
+		return oldest;
+	}
+	return NULL;
+}
+
+//
+// Add a received frame
+// [in] frame, a decoded extended frame
+// [out] message, when the result is TOUCAN_FAST_PACKET_COMPLETE, the reassembled message.
+// It remains valid until the next call.
+// returns the outcome
+//
+
+TOUCAN_FAST_PACKET_RESULT TouCAN_fastpacket_add(TOUCAN_REASSEMBLER *reassembler, const TOUCAN_FRAME *frame, TOUCAN_MESSAGE **message) {
+	TOUCAN_FAST_PACKET_SLOT *slot;
+	UINT32 counter;
+	UINT32 key;
+	UINT32 count;
+
+	if (TouCAN_fastpacket_is_fast(reassembler, TouCAN_header_pgn(frame->id)) == FALSE) {
+		return TOUCAN_FAST_PACKET_SINGLE;
+	}
+
+	// The first data byte holds a 3 bit sequence id and a 5 bit frame counter
+	counter = frame->data[0] & 0x1F;
+	key = ((frame->id & 0x03FFFFFF) << 3) | (frame->data[0] >> 5);
+	slot = FindSlot(reassembler, key);
+
+	if (counter == 0) {
+		if (slot != NULL) {
+			// Restarted before the previous message with the same sequence id completed
+			InterlockedIncrement(&reassembler->sequenceErrors);
+		}
+		else {
+			slot = AllocateSlot(reassembler, frame->hostTime);
+			if (slot == NULL) {
+				InterlockedIncrement(&reassembler->bufferFull);
+				return TOUCAN_FAST_PACKET_DISCARDED;
+			}
+		}
+
+		if (frame->data[1] > TOUCAN_FAST_PACKET_MAX_LENGTH) {
+			InterlockedIncrement(&reassembler->sequenceErrors);
+			ReleaseSlot(reassembler, slot);
+			return TOUCAN_FAST_PACKET_DISCARDED;
+		}
+
+		slot->key = key;
+		slot->nextFrame = 1;
+		slot->lastTime = frame->hostTime;
+		slot->message.id = frame->id;
+		slot->message.timestamp = frame->timestamp;
+		slot->message.hostTime = frame->hostTime;
+		slot->message.length = frame->data[1];
+		slot->received = (slot->message.length < FIRST_FRAME_DATA) ? slot->message.length : FIRST_FRAME_DATA;
+		memcpy(slot->message.data, &frame->data[2], slot->received);
+	}
+	else {
+		if (slot == NULL) {
+			// Joined part way through a message, or its first frame was lost
+			InterlockedIncrement(&reassembler->sequenceErrors);
+			return TOUCAN_FAST_PACKET_DISCARDED;
+		}
+
+		if (counter != slot->nextFrame) {
+			InterlockedIncrement(&reassembler->sequenceErrors);
+			ReleaseSlot(reassembler, slot);
+			return TOUCAN_FAST_PACKET_DISCARDED;
+		}
+
+		count = slot->message.length - slot->received;
+		if (count > FRAME_DATA) {
+			count = FRAME_DATA;
+		}
+		memcpy(&slot->message.data[slot->received], &frame->data[1], count);
+		slot->received += count;
+		slot->nextFrame++;
+		slot->lastTime = frame->hostTime;
+	}
+
+	if (slot->received < slot->message.length) {
+		return TOUCAN_FAST_PACKET_PENDING;
+	}
+
+	InterlockedIncrement(&reassembler->completed);
+	ReleaseSlot(reassembler, slot);
+	*message = &slot->message;
+	return TOUCAN_FAST_PACKET_COMPLETE;
+}
+
+//
+// Abandon messages whose next frame is overdue
+// [in] now, host time in microseconds
+//
+
+void TouCAN_fastpacket_expire(TOUCAN_REASSEMBLER *reassembler, LONGLONG now) {
+	for (UINT32 i = 0; (i < TOUCAN_FAST_PACKET_POOL) && (reassembler->active > 0); i++) {
+		TOUCAN_FAST_PACKET_SLOT *slot = &reassembler->slots[i];
+
+		if ((slot->key != TOUCAN_FAST_PACKET_FREE) && ((now - slot->lastTime) > TOUCAN_FAST_PACKET_TIMEOUT)) {
+			InterlockedIncrement(&reassembler->timeouts);
+			ReleaseSlot(reassembler, slot);
+		}
+	}
+}
+
+//
+// Reset the segmenter
+// [in] pgns, PGNs sent as fast packets, NULL selects the built in list of fast packet PGNs
+// [in] count, number of PGNs
+//
+
+void TouCAN_segmenter_init(TOUCAN_SEGMENTER *segmenter, const UINT32 *pgns, UINT32 count) {
+	memset(segmenter, 0, sizeof(TOUCAN_SEGMENTER));
+	SetFastPgns(segmenter->fastPgns, pgns, count);
+}
+
+//
+// Split a message into the frames that carry it
+// [in] id, 29 bit CAN identifier of every frame
+// [in] payload, message data
+// [in] length, at most 8 bytes for other PGNs, at most TOUCAN_FAST_PACKET_MAX_LENGTH for fast packet PGNs
+// [out] frames, room for TOUCAN_FAST_PACKET_MAX_FRAMES frames
+// returns the number of frames, zero if the message is too long for its PGN
+//
+
+UINT32 TouCAN_fastpacket_segment(TOUCAN_SEGMENTER *segmenter, UINT32 id, const UINT8 *payload, UINT32 length, TOUCAN_FRAME *frames) {
+	UINT32 pgn = TouCAN_header_pgn(id);
+	UINT32 sequence;
+	UINT32 offset;
+	UINT32 count;
+	UINT32 n;
+
+	if (IsFastPgn(segmenter->fastPgns, pgn) == FALSE) {
+		if (length > TOUCAN_FRAME_DATA_LENGTH) {
+			return 0;
+		}
+		frames[0].flags = TOUCAN_FRAME_EXTENDED;
+		frames[0].id = id;
+		frames[0].length = (UINT8)length;
+		frames[0].timestamp = 0;
+		frames[0].hostTime = 0;
+		memset(frames[0].data, 0xFF, TOUCAN_FRAME_DATA_LENGTH);
+		memcpy(frames[0].data, payload, length);
+		return 1;
+	}
+
+	if (length > TOUCAN_FAST_PACKET_MAX_LENGTH) {
+		return 0;
+	}
+
+	// Consecutive messages of a PGN carry consecutive 3 bit sequence ids
+	sequence = (UINT32)InterlockedIncrement(&segmenter->sequence[(pgn ^ (pgn >> 8)) & (TOUCAN_FAST_PACKET_SEQUENCES - 1)]);
+	sequence = (sequence & 0x07) << 5;
+
+	offset = 0;
+	for (n = 0; (n == 0) || (offset < length); n++) {
+		frames[n].flags = TOUCAN_FRAME_EXTENDED;
+		frames[n].id = id;
+		frames[n].length = TOUCAN_FRAME_DATA_LENGTH;
+		frames[n].timestamp = 0;
+		frames[n].hostTime = 0;
+		memset(frames[n].data, 0xFF, TOUCAN_FRAME_DATA_LENGTH);
+		frames[n].data[0] = (UINT8)(sequence | n);
+
+		if (n == 0) {
+			frames[n].data[1] = (UINT8)length;
+			count = (length < FIRST_FRAME_DATA) ? length : FIRST_FRAME_DATA;
+			memcpy(&frames[n].data[2], payload, count);
+		}
+		else {
+			count = ((length - offset) < FRAME_DATA) ? (length - offset) : FRAME_DATA;
+			memcpy(&frames[n].data[1], &payload[offset], count);
+		}
+		offset += count;
+	}
+	return n;
+}
+
+//
+// Allocate the message queue
+// [in] depth, requested number of messages, rounded up to a power of two
+// returns TRUE if the storage was allocated
+//
+
+BOOL TouCAN_msgqueue_init(TOUCAN_MESSAGE_QUEUE *queue, UINT32 depth) {
+	UINT32 size = TOUCAN_RING_MIN_DEPTH;
+
+	if (depth > TOUCAN_RING_MAX_DEPTH) {
+		depth = TOUCAN_RING_MAX_DEPTH;
+	}
+
+	while (size < depth) {
+		size <<= 1;
+	}
+
+	memset(queue, 0, sizeof(TOUCAN_MESSAGE_QUEUE));
+	queue->messages = (TOUCAN_MESSAGE *)calloc(size, sizeof(TOUCAN_MESSAGE));
+	if (queue->messages == NULL) {
+		return FALSE;
+	}
+	queue->mask = size - 1;
+	return TRUE;
+}
+
+void TouCAN_msgqueue_free(TOUCAN_MESSAGE_QUEUE *queue) {
+	if (queue->messages != NULL) {
+		free(queue->messages);
+		queue->messages = NULL;
+		queue->mask = 0;
+	}
+}
+
+//
+// Producer side, append a message
+// returns FALSE and increments the overflow counter if the queue is full
+//
+
+BOOL TouCAN_msgqueue_push(TOUCAN_MESSAGE_QUEUE *queue, const TOUCAN_MESSAGE *message) {
+	UINT32 head = (UINT32)ReadNoFence(&queue->head);
+	UINT32 tail = (UINT32)ReadAcquire(&queue->tail);
+	TOUCAN_MESSAGE *slot;
+
+	if ((head - tail) > queue->mask) {
+		InterlockedIncrement(&queue->overflows);
+		return FALSE;
+	}
+
+	// Only the bytes in use are copied
+	slot = &queue->messages[head & queue->mask];
+	memcpy(slot, message, (size_t)((const UINT8 *)&message->data[message->length] - (const UINT8 *)message));
+
+	WriteRelease(&queue->head, (LONG)(head + 1));
+	return TRUE;
+}
+
+//
+// Consumer side, remove the oldest message
+// returns FALSE if the queue is empty
+//
+
+BOOL TouCAN_msgqueue_pop(TOUCAN_MESSAGE_QUEUE *queue, TOUCAN_MESSAGE *message) {
+	UINT32 tail = (UINT32)ReadNoFence(&queue->tail);
+	UINT32 head = (UINT32)ReadAcquire(&queue->head);
+	TOUCAN_MESSAGE *slot;
+
+	if (head == tail) {
+		return FALSE;
+	}
+
+	slot = &queue->messages[tail & queue->mask];
+	memcpy(message, slot, (size_t)((const UINT8 *)&slot->data[slot->length] - (const UINT8 *)slot));
+
+	WriteRelease(&queue->tail, (LONG)(tail + 1));
+	return TRUE;
+}
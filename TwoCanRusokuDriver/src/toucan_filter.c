@@ -0,0 +1,199 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Filter
+// Unit Description: Host side allow / deny filter for received frames
+// Function: Compiles ordered rules over PGN, source, destination and priority into
+// lookup tables so each frame is decided in constant time
+//
+
+#include "../inc/toucan_filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Range of perfect hash table sizes, and how many multipliers are tried before the table is doubled
+#define MIN_PGN_TABLE_BITS 4
+#define MAX_PGN_TABLE_BITS 12
+#define HASH_ATTEMPTS 256
+
+// Marks an unused perfect hash slot, larger than any PGN
+#define EMPTY_SLOT 0xFFFFFFFF
+
+static UINT32 HashSlot(const TOUCAN_FILTER *filter, UINT32 pgn) {
+	return (pgn * filter->multiplier) >> filter->shift;
+}
+
+//
+// Place every PGN named by a rule in its own slot, trying odd multipliers until none collide
+// returns FALSE if no collision free table could be built or allocated
+//
+
+static BOOL BuildPgnTable(TOUCAN_FILTER *filter, const TOUCAN_FILTER_RULE *rules) {
+	TOUCAN_FILTER_PGN *table;
+	UINT32 size;
+	UINT32 slot;
+	BOOL collision;
+
+	for (UINT32 bits = MIN_PGN_TABLE_BITS; bits <= MAX_PGN_TABLE_BITS; bits++) {
+		size = 1U << bits;
+		table = (TOUCAN_FILTER_PGN *)realloc(filter->pgns, size * sizeof(TOUCAN_FILTER_PGN));
+		if (table == NULL) {
+			return FALSE;
+		}
+		filter->pgns = table;
+		filter->shift = 32 - bits;
+
+		for (UINT32 attempt = 0; attempt < HASH_ATTEMPTS; attempt++) {
+			// Odd multipliers spread from the golden ratio
+			filter->multiplier = (0x9E3779B1U + (attempt * 0x3C6EF372U)) | 1;
+			collision = FALSE;
+
+			for (UINT32 i = 0; i < size; i++) {
+				table[i].pgn = EMPTY_SLOT;
+				table[i].rules = filter->anyPgn;
+			}
+
+			for (UINT32 i = 0; (i < filter->count) && (collision == FALSE); i++) {
+				if (rules[i].pgn == TOUCAN_FILTER_ANY) {
+					continue;
+				}
+
+				slot = HashSlot(filter, rules[i].pgn);
+				if (table[slot].pgn == EMPTY_SLOT) {
+					table[slot].pgn = rules[i].pgn;
+				}
+				else if (table[slot].pgn != rules[i].pgn) {
+					collision = TRUE;
+				}
+			}
+
+			if (collision == FALSE) {
+				// Each slot holds the rules naming its PGN together with the rules matching any PGN
+				for (UINT32 i = 0; i < filter->count; i++) {
+					if (rules[i].pgn != TOUCAN_FILTER_ANY) {
+						table[HashSlot(filter, rules[i].pgn)].rules |= (UINT64)1 << i;
+					}
+				}
+				return TRUE;
+			}
+		}
+	}
+	return FALSE;
+}
+
+//
+// Set the bit of rule in every table entry the rule field matches
+//
+
+static void MarkField(UINT64 *table, UINT32 size, UINT32 value, UINT32 rule) {
+	if (value == TOUCAN_FILTER_ANY) {
+		for (UINT32 i = 0; i < size; i++) {
+			table[i] |= (UINT64)1 << rule;
+		}
+	}
+	else {
+		table[value] |= (UINT64)1 << rule;
+	}
+}
+
+//
+// Compile an ordered list of rules
+// [in] rules, evaluated in order, the first match decides
+// [in] count, number of rules, at most TOUCAN_MAX_FILTER_RULES
+// [in] defaultAllow, decision for frames no rule matches
+// returns the compiled filter, or NULL if a rule is invalid or memory is exhausted
+//
+
+TOUCAN_FILTER *TouCAN_filter_compile(const TOUCAN_FILTER_RULE *rules, UINT32 count, BOOL defaultAllow) {
+	TOUCAN_FILTER *filter;
+
+	if ((count > TOUCAN_MAX_FILTER_RULES) || ((count > 0) && (rules == NULL))) {
+		return NULL;
+	}
+
+	for (UINT32 i = 0; i < count; i++) {
+		if (((rules[i].action != TOUCAN_FILTER_ALLOW) && (rules[i].action != TOUCAN_FILTER_DENY)) ||
+			((rules[i].pgn != TOUCAN_FILTER_ANY) && (rules[i].pgn > TOUCAN_MAX_PGN)) ||
+			((rules[i].pgn != TOUCAN_FILTER_ANY) && TouCAN_header_is_pdu1(rules[i].pgn) && ((rules[i].pgn & 0xFF) != 0)) ||
+			((rules[i].source != TOUCAN_FILTER_ANY) && (rules[i].source > 0xFF)) ||
+			((rules[i].destination != TOUCAN_FILTER_ANY) && (rules[i].destination > 0xFF)) ||
+			((rules[i].priority != TOUCAN_FILTER_ANY) && (rules[i].priority > 7))) {
+			return NULL;
+		}
+	}
+
+	filter = (TOUCAN_FILTER *)calloc(1, sizeof(TOUCAN_FILTER));
+	if (filter == NULL) {
+		return NULL;
+	}
+
+	filter->count = count;
+	filter->defaultAllow = defaultAllow;
+
+	for (UINT32 i = 0; i < count; i++) {
+		if (rules[i].action == TOUCAN_FILTER_ALLOW) {
+			filter->allow |= (UINT64)1 << i;
+		}
+		if (rules[i].pgn == TOUCAN_FILTER_ANY) {
+			filter->anyPgn |= (UINT64)1 << i;
+		}
+		MarkField(filter->source, 256, rules[i].source, i);
+		MarkField(filter->destination, 256, rules[i].destination, i);
+		MarkField(filter->priority, 8, rules[i].priority, i);
+	}
+
+	if (BuildPgnTable(filter, rules) == FALSE) {
+		TouCAN_filter_free(filter);
+		return NULL;
+	}
+	return filter;
+}
+
+void TouCAN_filter_free(TOUCAN_FILTER *filter) {
+	if (filter != NULL) {
+		free(filter->pgns);
+		free(filter);
+	}
+}
+
+//
+// Decide a frame
+// [in] id, 29 bit CAN identifier
+// returns TRUE if the frame should be delivered
+//
+
+BOOL TouCAN_filter_accept(const TOUCAN_FILTER *filter, UINT32 id) {
+	UINT32 pgn = TouCAN_header_pgn(id);
+	const TOUCAN_FILTER_PGN *slot;
+	UINT64 matches;
+
+	slot = &filter->pgns[HashSlot(filter, pgn)];
+	matches = (slot->pgn == pgn) ? slot->rules : filter->anyPgn;
+	matches &= filter->source[TouCAN_header_source(id)] & filter->destination[TouCAN_header_destination(id)] & filter->priority[TouCAN_header_priority(id)];
+
+	if (matches == 0) {
+		return filter->defaultAllow;
+	}
+
+	// The lowest set bit is the first matching rule
+	return ((matches & (0 - matches) & filter->allow) != 0);
+}
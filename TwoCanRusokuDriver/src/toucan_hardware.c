@@ -22,12 +22,13 @@
 //
 
 #include "..\inc\toucan_hardware.h"
+#include "..\inc\toucan_decode.h"
+#include "..\inc\toucan_trace.h"
 #include "..\common\inc\twocanerror.h"
 
-DEVICE_DATA           deviceData;
+WINUSB_ADAPTER        winusbAdapter;
 HRESULT               hr;
 USB_DEVICE_DESCRIPTOR deviceDesc;
-BOOL                  noDevice;
 ULONG                 lengthReceived;
 
 HRESULT Toucan_winusb_init( DEVICE_DATA *DeviceData, BOOL *FailureDeviceNotFound )
@@ -37,7 +38,7 @@ HRESULT Toucan_winusb_init( DEVICE_DATA *DeviceData, BOOL *FailureDeviceNotFound
 
     DeviceData->HandlesOpen = FALSE;
 
-    hr = RetrieveDevicePath(DeviceData->DevicePath, sizeof(DeviceData->DevicePath), FailureDeviceNotFound);
+    hr = RetrieveDevicePath(DeviceData->DevicePath, sizeof(DeviceData->DevicePath), DeviceData->DeviceIndex, FailureDeviceNotFound);
 
     if (FAILED(hr)) {
         DebugPrintf(L"RetrieveDevicePath failed (%ld)\n", hr);
@@ -87,18 +88,18 @@ VOID Toucan_winusb_deinit(DEVICE_DATA *DeviceData)
     return;
 }
 
-HRESULT RetrieveDevicePath(LPTSTR DevicePath, ULONG  BufLen, BOOL *FailureDeviceNotFound)
+//
+// Interfaces of every TouCAN present, a list of NULL-terminated paths ending with an empty path.
+// The caller releases the list with HeapFree.
+//
+
+static HRESULT RetrieveDeviceInterfaceList(PTSTR *List)
 {
     CONFIGRET cr = CR_SUCCESS;
     HRESULT   hr = S_OK;
     PTSTR     DeviceInterfaceList = NULL;
     ULONG     DeviceInterfaceListLength = 0;
 
-    if (NULL != FailureDeviceNotFound) {
-
-        *FailureDeviceNotFound = FALSE;
-    }
-
     //
     // Enumerate all devices exposing the interface. Do this in a loop
     // in case a new interface is discovered while this code is executing,
@@ -132,6 +133,7 @@ HRESULT RetrieveDevicePath(LPTSTR DevicePath, ULONG  BufLen, BOOL *FailureDevice
 
         if (cr != CR_SUCCESS) {
             HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
+            DeviceInterfaceList = NULL;
 
             if (cr != CR_BUFFER_SMALL) {
                 hr = HRESULT_FROM_WIN32(CM_MapCrToWin32Err(cr, ERROR_INVALID_DATA));
@@ -139,14 +141,66 @@ HRESULT RetrieveDevicePath(LPTSTR DevicePath, ULONG  BufLen, BOOL *FailureDevice
         }
     } while (cr == CR_BUFFER_SMALL);
 
+    *List = DeviceInterfaceList;
+    return hr;
+}
+
+//
+// Number of TouCAN adapters present
+//
+
+ULONG CountDevicePaths(VOID)
+{
+    PTSTR   DeviceInterfaceList = NULL;
+    PTSTR   Path;
+    ULONG   Count = 0;
+
+    if (FAILED(RetrieveDeviceInterfaceList(&DeviceInterfaceList))) {
+        return 0;
+    }
+
+    for (Path = DeviceInterfaceList; *Path != TEXT('\0'); Path += lstrlen(Path) + 1) {
+        Count++;
+    }
+
+    HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
+    return Count;
+}
+
+//
+// Path of the Index'th TouCAN adapter, in the order the configuration manager lists them
+//
+
+HRESULT RetrieveDevicePath(LPTSTR DevicePath, ULONG  BufLen, ULONG Index, BOOL *FailureDeviceNotFound)
+{
+    HRESULT   hr = S_OK;
+    PTSTR     DeviceInterfaceList = NULL;
+    PTSTR     Path;
+
+    if (NULL != FailureDeviceNotFound) {
+
+        *FailureDeviceNotFound = FALSE;
+    }
+
+    hr = RetrieveDeviceInterfaceList(&DeviceInterfaceList);
+
     if (FAILED(hr)) {
         return hr;
     }
 
     //
-    // If the interface list is empty, no devices were found.
+    // Skip the interfaces before the one requested, each is NULL-terminated and an empty
+    // path ends the list
     //
-    if (*DeviceInterfaceList == TEXT('\0')) {
+    Path = DeviceInterfaceList;
+    for (ULONG i = 0; (i < Index) && (*Path != TEXT('\0')); i++) {
+        Path += lstrlen(Path) + 1;
+    }
+
+    //
+    // If no interface is left, the device was not found.
+    //
+    if (*Path == TEXT('\0')) {
         if (NULL != FailureDeviceNotFound) {
             *FailureDeviceNotFound = TRUE;
         }
@@ -157,214 +211,242 @@ HRESULT RetrieveDevicePath(LPTSTR DevicePath, ULONG  BufLen, BOOL *FailureDevice
         return hr;
     }
 
-    //
-    // Give path of the first found device interface instance to the caller. CM_Get_Device_Interface_List ensured
-    // the instance is NULL-terminated.
-    //
-    hr = StringCbCopy(DevicePath, BufLen, DeviceInterfaceList);
+    hr = StringCbCopy(DevicePath, BufLen, Path);
     HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
 
     return hr;
 }
 
-// NMEA2000 CAN bus speed: 250 kbit
-//sampling point 75%
-//m_Brp = 10;
-//m_Tseg1 = 14;
-//m_Tseg2 = 5;
-//m_Sjw = 4;
-BOOL TouCAN_init(void)
-{
-    UINT8		m_Tseg1 = 14;
-    UINT8		m_Tseg2 = 5;
-    UINT8		m_Sjw = 4;
-    UINT16		m_Brp = 10;
-    UINT32		m_OptionFlag = 0;
+//
+// Overlapped reads on the bulk IN endpoint, used by the read pipeline in toucan_transport.c
+// Every slot owns a manual reset event, reads complete in the order they were submitted
+//
 
-    UCHAR	data[64];
-    ULONG	Transfered;
-    UINT8	res;
-    WINUSB_SETUP_PACKET SetupPacket;
-    ULONG	timeout = 500;
+static BOOL WinUsbReadOpen(void *context, UINT32 queueDepth) {
+    WINUSB_READ_CONTEXT *ctx = (WINUSB_READ_CONTEXT *)context;
 
-    // Transmit frame timeout: 500mS
-    WinUsb_SetPipePolicy(deviceData.WinusbHandle, 0x01, PIPE_TRANSFER_TIMEOUT, sizeof(ULONG), &timeout);
-    WinUsb_SetPipePolicy(deviceData.WinusbHandle, 0x01, RAW_IO, 0, 0);
+    memset(ctx->Overlapped, 0, sizeof(ctx->Overlapped));
+    ctx->Slots = 0;
 
-    // Receive frame timeout : 500mS
-    WinUsb_SetPipePolicy(deviceData.WinusbHandle, 0x81, PIPE_TRANSFER_TIMEOUT, sizeof(ULONG), &timeout);
-    WinUsb_SetPipePolicy(deviceData.WinusbHandle, 0x81, RAW_IO, 0, 0);
-
-    SetupPacket.RequestType = USB_HOST_TO_DEVICE | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
-    SetupPacket.Request = TouCAN_CAN_INTERFACE_INIT;
-    SetupPacket.Value = 0;
-    SetupPacket.Index = 0;
-    SetupPacket.Length = 9;
-    // tseg1
-    data[0] = m_Tseg1;
-    // tseg2
-    data[1] = m_Tseg2;
-    // sjw
-    data[2] = m_Sjw;
-    // Brp
-
-    data[3] = (UINT8)((m_Brp >> 8) & 0xFF);
-    data[4] = (UINT8)(m_Brp & 0xFF);
-
-    // flags
-    data[5] = (UINT8)((m_OptionFlag >> 24) & 0xFF);
-    data[6] = (UINT8)((m_OptionFlag >> 16) & 0xFF);
-    data[7] = (UINT8)((m_OptionFlag >> 8) & 0xFF);
-    data[8] = (UINT8)(m_OptionFlag & 0xFF);
-
-    // TouCAN_CAN_INTERFACE_INIT
-    if (WinUsb_ControlTransfer(deviceData.WinusbHandle, SetupPacket, &data[0], 9, &Transfered, NULL) != TRUE)
-        return	FALSE;
-
-    if (TouCAN_get_last_error_code(&res) != TRUE)
-        return FALSE;
-
-    if (res != TouCAN_RETVAL_OK)
-        return FALSE;
+    for (UINT32 slot = 0; slot < queueDepth; slot++) {
+        ctx->Overlapped[slot].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (ctx->Overlapped[slot].hEvent == NULL) {
+            DebugPrintf(L"TouCAN read event Error: %d\n", GetLastError());
+            for (UINT32 i = 0; i < slot; i++) {
+                CloseHandle(ctx->Overlapped[i].hEvent);
+            }
+            return FALSE;
+        }
+    }
 
+    ctx->Slots = queueDepth;
     return TRUE;
 }
 
-BOOL TouCAN_deinit(void)
-{
-    WINUSB_SETUP_PACKET SetupPacket;
-    UINT8	res;
+static VOID WinUsbReadClose(void *context) {
+    WINUSB_READ_CONTEXT *ctx = (WINUSB_READ_CONTEXT *)context;
 
-    SetupPacket.RequestType = USB_HOST_TO_DEVICE | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
-    SetupPacket.Request = TouCAN_CAN_INTERFACE_DEINIT;
-    SetupPacket.Value = 0;
-    SetupPacket.Index = 0;
-    SetupPacket.Length = 0;
-
-    // TouCAN_CAN_INTERFACE_DEINIT
-    if (WinUsb_ControlTransfer(deviceData.WinusbHandle, SetupPacket, NULL, 0, NULL, NULL) != TRUE)
-        return	FALSE;
+    for (UINT32 slot = 0; slot < ctx->Slots; slot++) {
+        CloseHandle(ctx->Overlapped[slot].hEvent);
+        ctx->Overlapped[slot].hEvent = NULL;
+    }
+    ctx->Slots = 0;
+}
 
-    if (TouCAN_get_last_error_code(&res) != TRUE)
-        return FALSE;
+static BOOL WinUsbSubmitRead(void *context, UINT32 slot, UINT8 *buffer, UINT32 length) {
+    WINUSB_READ_CONTEXT *ctx = (WINUSB_READ_CONTEXT *)context;
+    OVERLAPPED *overlapped = &ctx->Overlapped[slot];
+    HANDLE event = overlapped->hEvent;
 
-    if (res != TouCAN_RETVAL_OK)
-        return FALSE;
+    memset(overlapped, 0, sizeof(OVERLAPPED));
+    overlapped->hEvent = event;
+    ResetEvent(event);
 
-    return	TRUE;
+    if (WinUsb_ReadPipe(ctx->DeviceData->WinusbHandle, ctx->PipeId, buffer, length, NULL, overlapped) == FALSE) {
+        if (GetLastError() != ERROR_IO_PENDING) {
+            TOUCAN_TRACE_ERROR(TOUCAN_TRACE_READ_SUBMIT_FAILED, GetLastError(), 0);
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
-BOOL TouCAN_start(void)
-{
-    WINUSB_SETUP_PACKET SetupPacket;
-    UINT8	res;
+static TOUCAN_TRANSFER_RESULT WinUsbWaitRead(void *context, UINT32 slot, DWORD timeout, ULONG *transferred) {
+    WINUSB_READ_CONTEXT *ctx = (WINUSB_READ_CONTEXT *)context;
+    OVERLAPPED *overlapped = &ctx->Overlapped[slot];
+    DWORD   waitResult;
+    ULONG   length = 0;
 
-    SetupPacket.RequestType = USB_HOST_TO_DEVICE | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
-    SetupPacket.Request = TouCAN_CAN_INTERFACE_START;
-    SetupPacket.Value = 0;
-    SetupPacket.Index = 0;
-    SetupPacket.Length = 0;
+    waitResult = WaitForSingleObject(overlapped->hEvent, timeout);
+    if (waitResult == WAIT_TIMEOUT) {
+        return TOUCAN_TRANSFER_PENDING;
+    }
 
-    // TouCAN_CAN_INTERFACE_START
-    if (WinUsb_ControlTransfer(deviceData.WinusbHandle, SetupPacket, NULL, 0, NULL, NULL) != TRUE)
-        return	FALSE;
+    if (WinUsb_GetOverlappedResult(ctx->DeviceData->WinusbHandle, overlapped, &length, FALSE) == FALSE) {
+        switch (GetLastError()) {
+        case ERROR_IO_INCOMPLETE:
+            return TOUCAN_TRANSFER_PENDING;
+        case ERROR_SEM_TIMEOUT:
+            // PIPE_TRANSFER_TIMEOUT expired on an idle bus
+            *transferred = 0;
+            return TOUCAN_TRANSFER_COMPLETE;
+        default:
+            return TOUCAN_TRANSFER_FAILED;
+        }
+    }
 
-    if (TouCAN_get_last_error_code(&res) != TRUE)
-        return FALSE;
+    *transferred = length;
+    return TOUCAN_TRANSFER_COMPLETE;
+}
 
-    if (res != TouCAN_RETVAL_OK)
-        return FALSE;
+static VOID WinUsbCancelReads(void *context) {
+    WINUSB_READ_CONTEXT *ctx = (WINUSB_READ_CONTEXT *)context;
 
-    return TRUE;
+    WinUsb_AbortPipe(ctx->DeviceData->WinusbHandle, ctx->PipeId);
+
+    // Give the aborted reads a chance to complete before their buffers are released
+    for (UINT32 slot = 0; slot < ctx->Slots; slot++) {
+        WaitForSingleObject(ctx->Overlapped[slot].hEvent, TOUCAN_READ_WAIT_TIMEOUT);
+    }
 }
 
-BOOL TouCAN_stop(void)
-{
-    WINUSB_SETUP_PACKET SetupPacket;
-    UINT8	res;
+//
+// WinUSB backend operations
+//
 
-    SetupPacket.RequestType = USB_HOST_TO_DEVICE | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
-    SetupPacket.Request = TouCAN_CAN_INTERFACE_STOP;
-    SetupPacket.Value = 0;
-    SetupPacket.Index = 0;
-    SetupPacket.Length = 0;
+static int WinUsbOpen(void *context) {
+    DEVICE_DATA *device = &((WINUSB_ADAPTER *)context)->DeviceData;
+    ULONG   timeout = 500;
+    BOOL    noDevice;
 
-    // TouCAN_CAN_INTERFACE_START
-    if (WinUsb_ControlTransfer(deviceData.WinusbHandle, SetupPacket, NULL, 0, NULL, NULL) != TRUE)
-        return	FALSE;
+    if (FAILED(Toucan_winusb_init(device, &noDevice))) {
+        DebugPrintf(L"Toucan_winusb_init failed\n");
+        return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+    }
 
-    if (TouCAN_get_last_error_code(&res) != TRUE)
-        return FALSE;
+    // Transmit frame timeout: 500mS
+    WinUsb_SetPipePolicy(device->WinusbHandle, 0x01, PIPE_TRANSFER_TIMEOUT, sizeof(ULONG), &timeout);
+    WinUsb_SetPipePolicy(device->WinusbHandle, 0x01, RAW_IO, 0, 0);
 
-    if (res != TouCAN_RETVAL_OK)
-        return FALSE;
+    // Receive frame timeout : 500mS
+    WinUsb_SetPipePolicy(device->WinusbHandle, 0x81, PIPE_TRANSFER_TIMEOUT, sizeof(ULONG), &timeout);
+    WinUsb_SetPipePolicy(device->WinusbHandle, 0x81, RAW_IO, 0, 0);
 
-    return	TRUE;
+    return TWOCAN_RESULT_SUCCESS;
 }
 
-BOOL TouCAN_get_last_error_code(UINT8* res)
-{
-    UINT8	LastErrorCode;
-    ULONG	Transfered;
-    WINUSB_SETUP_PACKET	SetupPacket;
+static VOID WinUsbClose(void *context) {
+    Toucan_winusb_deinit(&((WINUSB_ADAPTER *)context)->DeviceData);
+}
 
-    if (res == NULL)
-        return FALSE;
+static BOOL WinUsbControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+    DEVICE_DATA *device = &((WINUSB_ADAPTER *)context)->DeviceData;
+    WINUSB_SETUP_PACKET SetupPacket;
 
-    SetupPacket.RequestType = USB_DEVICE_TO_HOST | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE;
-    SetupPacket.Request = TouCAN_GET_LAST_ERROR_CODE;
+    SetupPacket.RequestType = requestType;
+    SetupPacket.Request = request;
     SetupPacket.Value = 0;
     SetupPacket.Index = 0;
-    SetupPacket.Length = 1;
+    SetupPacket.Length = length;
+
+    return WinUsb_ControlTransfer(device->WinusbHandle, SetupPacket, data, length, transferred, NULL);
+}
 
-    if (WinUsb_ControlTransfer(deviceData.WinusbHandle, SetupPacket, &LastErrorCode, 1, &Transfered, NULL) != TRUE)
-        return	FALSE;
+static BOOL WinUsbReadPipelineOpen(void *context, UINT32 queueDepth, UINT32 bufferSize) {
+    WINUSB_ADAPTER *adapter = (WINUSB_ADAPTER *)context;
 
-    if ((LastErrorCode != HAL_OK) & (Transfered != 1))
-        return	FALSE;
+    adapter->ReadContext.DeviceData = &adapter->DeviceData;
+    adapter->ReadContext.PipeId = 0x81;
 
-    *res = LastErrorCode;
+    adapter->ReadEndpoint.context = &adapter->ReadContext;
+    adapter->ReadEndpoint.Open = WinUsbReadOpen;
+    adapter->ReadEndpoint.Close = WinUsbReadClose;
+    adapter->ReadEndpoint.SubmitRead = WinUsbSubmitRead;
+    adapter->ReadEndpoint.WaitRead = WinUsbWaitRead;
+    adapter->ReadEndpoint.CancelReads = WinUsbCancelReads;
 
-    return	TRUE;
+    return TouCAN_pipeline_open(&adapter->ReadPipeline, &adapter->ReadEndpoint, queueDepth, bufferSize);
 }
 
+static TOUCAN_TRANSFER_RESULT WinUsbReadBatch(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+    return TouCAN_pipeline_read_frames(&((WINUSB_ADAPTER *)context)->ReadPipeline, timeout, frames, maxFrames, count);
+}
+
+static VOID WinUsbReadPipelineClose(void *context) {
+    // Cancel the reads still in flight before the buffer pool is released
+    TouCAN_pipeline_close(&((WINUSB_ADAPTER *)context)->ReadPipeline);
+}
 
-BOOL TouCAN_write(const unsigned int id, const int dataLength, byte* data) {
+//
+// Transmit several frames, packing up to TOUCAN_MAX_RECORDS_PER_TRANSFER records into each bulk OUT transfer
+//
 
-    UINT8   TxDataBuf[64];
+static BOOL WinUsbWriteBatch(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+    WINUSB_ADAPTER *adapter = (WINUSB_ADAPTER *)context;
+    DEVICE_DATA *device = &adapter->DeviceData;
+    UINT8   TxDataBuf[TOUCAN_RECORD_LENGTH * TOUCAN_MAX_RECORDS_PER_TRANSFER];
     ULONG	Transfered;
-    UINT8	index = 0;
+    UINT32  index;
+    UINT32  records;
+    UINT32  sent = 0;
 
-    // CAN frame flags
-    TxDataBuf[index++] = (UINT8)CANAL_IDFLAG_EXTENDED; // Extended message id (29-bit)
-    TxDataBuf[index++] = (UINT8)(id >> 24);
-    TxDataBuf[index++] = (UINT8)(id >> 16);
-    TxDataBuf[index++] = (UINT8)(id >> 8);
-    TxDataBuf[index++] = (UINT8)id;
+    *written = 0;
 
-    // CAN msg data length
-    TxDataBuf[index++] = dataLength;
+    while (sent < count) {
+        records = count - sent;
+        if (records > TOUCAN_MAX_RECORDS_PER_TRANSFER) {
+            records = TOUCAN_MAX_RECORDS_PER_TRANSFER;
+        }
 
-    // CAN msg data
-    for (UINT8 y = 0; y < 8; y++)    {
-        TxDataBuf[index++] = data[y];
-    }
+        index = 0;
+        for (UINT32 r = 0; r < records; r++) {
+            index += TouCAN_encode_record(&frames[sent + r], &TxDataBuf[index]);
+        }
+
+        if (WinUsb_WritePipe(device->WinusbHandle, 0x01, &TxDataBuf[0], index, &Transfered, NULL) == FALSE) {
+            TOUCAN_TRACE_ERROR(TOUCAN_TRACE_WRITE_FAILED, GetLastError(), 0);
+            return FALSE;
+        }
 
-    // CAN msg timestamp
-    TxDataBuf[index++] = 0;
-    TxDataBuf[index++] = 0;
-    TxDataBuf[index++] = 0;
-    TxDataBuf[index++] = 0;
+        InterlockedIncrement(&adapter->Transmitted.transfers);
+        InterlockedExchangeAdd(&adapter->Transmitted.frames, (LONG)records);
 
-    if (WinUsb_WritePipe(deviceData.WinusbHandle, 0x01, &TxDataBuf[0], index, &Transfered, NULL) == FALSE){
-        DebugPrintf(L"TouCAN_write Error: %d", GetLastError());
-        return FALSE;
+        sent += records;
+        *written = sent;
     }
     return TRUE;
 }
 
+//
+// Fill in the backend operations for the first TouCAN adapter on WinUSB,
+// the bulk OUT endpoint 0x01 and the bulk IN endpoint 0x81
+//
 
-BOOL TouCAN_read( UINT8 *data, UINT16 dataLength, ULONG *Transfered ) {
-    return WinUsb_ReadPipe(deviceData.WinusbHandle, 0x81, data, dataLength, Transfered, NULL);
+VOID TouCAN_winusb_backend(TOUCAN_BACKEND *backend) {
+    TouCAN_winusb_adapter_backend(backend, &winusbAdapter, 0);
 }
 
+//
+// Fill in the backend operations for one of several TouCAN adapters
+// [in] adapter, state of the adapter, must outlive the backend
+// [in] index, position of the adapter in the device interface list, see CountDevicePaths
+//
+
+VOID TouCAN_winusb_adapter_backend(TOUCAN_BACKEND *backend, WINUSB_ADAPTER *adapter, ULONG index) {
+    memset(adapter, 0, sizeof(WINUSB_ADAPTER));
+    adapter->DeviceData.DeviceIndex = index;
+
+    backend->name = "WinUSB";
+    backend->context = adapter;
+    backend->Open = WinUsbOpen;
+    backend->Close = WinUsbClose;
+    backend->Control = WinUsbControl;
+    backend->ReadOpen = WinUsbReadPipelineOpen;
+    backend->ReadBatch = WinUsbReadBatch;
+    backend->ReadClose = WinUsbReadPipelineClose;
+    backend->WriteBatch = WinUsbWriteBatch;
+    backend->transmitted = &adapter->Transmitted;
+    InitializeSRWLock(&adapter->RequestLock);
+    backend->requestLock = &adapter->RequestLock;
+    backend->filterBanks = 0;
+}
@@ -0,0 +1,65 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Header
+// Unit Description: NMEA 2000 identifier decoding
+// Function: Decodes arrays of 29 bit identifiers into arrays of PGN, priority, source and
+// destination with branch free loops the compiler can vectorise
+//
+
+#include "../inc/toucan_header.h"
+
+//
+// Decode identifiers
+// [in] ids, 29 bit identifiers
+// [in] count, number of identifiers
+// [out] headers, arrays of at least count entries, a NULL array is not decoded
+//
+
+void TouCAN_header_decode_batch(const UINT32 *ids, UINT32 count, const TOUCAN_HEADERS *headers) {
+	UINT32 *pgns = headers->pgns;
+	UINT8 *priorities = headers->priorities;
+	UINT8 *sources = headers->sources;
+	UINT8 *destinations = headers->destinations;
+
+	// Each field in its own loop, so every loop is a single stream the compiler can vectorise.
+	// The arrays are copied to locals as byte stores could otherwise alias headers.
+	if (pgns != NULL) {
+		for (UINT32 i = 0; i < count; i++) {
+			pgns[i] = TouCAN_header_pgn(ids[i]);
+		}
+	}
+	if (priorities != NULL) {
+		for (UINT32 i = 0; i < count; i++) {
+			priorities[i] = TouCAN_header_priority(ids[i]);
+		}
+	}
+	if (sources != NULL) {
+		for (UINT32 i = 0; i < count; i++) {
+			sources[i] = TouCAN_header_source(ids[i]);
+		}
+	}
+	if (destinations != NULL) {
+		for (UINT32 i = 0; i < count; i++) {
+			destinations[i] = TouCAN_header_destination(ids[i]);
+		}
+	}
+}
@@ -0,0 +1,187 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Health
+// Unit Description: CAN bus health
+// Function: Derives the bus condition from the interface state and the error states it latched,
+// and keeps rolling counts of bus errors and receive FIFO overruns over the last polls.
+// Polls an adapter through its backend, so every open adapter has a health of its own.
+//
+
+#include "../inc/toucan_health.h"
+
+#include <string.h>
+
+//
+// The condition an interface state and its latched state bits describe
+//
+
+TOUCAN_BUS_CONDITION TouCAN_health_condition(UINT8 state, UINT32 latched) {
+	if ((latched & HAL_CAN_ERROR_BOF) != 0) {
+		return TOUCAN_BUS_OFF;
+	}
+	if (state == HAL_CAN_STATE_ERROR) {
+		return TOUCAN_BUS_OFF;
+	}
+	if (state != HAL_CAN_STATE_LISTENING) {
+		return TOUCAN_BUS_STOPPED;
+	}
+	if ((latched & HAL_CAN_ERROR_EPV) != 0) {
+		return TOUCAN_BUS_PASSIVE;
+	}
+	if ((latched & HAL_CAN_ERROR_EWG) != 0) {
+		return TOUCAN_BUS_WARNING;
+	}
+	return TOUCAN_BUS_ACTIVE;
+}
+
+void TouCAN_health_init(TOUCAN_HEALTH *health) {
+	memset((void *)health, 0, sizeof(TOUCAN_HEALTH));
+}
+
+//
+// Move the condition, returns TRUE if it changed
+//
+
+static BOOL SetCondition(TOUCAN_HEALTH *health, TOUCAN_BUS_CONDITION condition) {
+	if ((LONG)condition == health->condition) {
+		return FALSE;
+	}
+
+	if (condition == TOUCAN_BUS_OFF) {
+		WriteNoFence(&health->busOffEvents, health->busOffEvents + 1);
+	}
+	WriteNoFence(&health->changes, health->changes + 1);
+	WriteNoFence(&health->condition, (LONG)condition);
+	return TRUE;
+}
+
+//
+// Add a poll to the window, the oldest poll leaves it once the window is full
+//
+
+static void AddSample(TOUCAN_HEALTH *health, const TOUCAN_HEALTH_SAMPLE *sample) {
+	TOUCAN_HEALTH_SAMPLE *slot = &health->samples[health->position];
+
+	if (health->filled == TOUCAN_HEALTH_WINDOW) {
+		WriteNoFence(&health->busErrors, health->busErrors - (LONG)slot->busErrors);
+		WriteNoFence(&health->fifoOverruns, health->fifoOverruns - (LONG)slot->fifoOverruns);
+		WriteNoFence(&health->overrunFrames, health->overrunFrames - (LONG)slot->overrunFrames);
+	}
+	else {
+		health->filled++;
+	}
+
+	*slot = *sample;
+	WriteNoFence(&health->busErrors, health->busErrors + (LONG)sample->busErrors);
+	WriteNoFence(&health->fifoOverruns, health->fifoOverruns + (LONG)sample->fifoOverruns);
+	WriteNoFence(&health->overrunFrames, health->overrunFrames + (LONG)sample->overrunFrames);
+
+	health->position = (health->position + 1) % TOUCAN_HEALTH_WINDOW;
+}
+
+//
+// Add a poll of the adapter
+// [in] state, HAL_CAN_STATE_xxx
+// [in] errorCode, HAL_CAN_ERROR_xxx bits raised since the error code was last cleared
+// [in] errorStatus, the states the interface is in now, as TOUCAN_HEALTH_STATES bits, NULL if it could not be read
+// [in] cleared, the error code was cleared after this poll, see TOUCAN_HEALTH_EVENTS
+// [in] statistics, the adapter's counters, NULL if they could not be read
+// returns TRUE if the bus condition changed
+//
+
+BOOL TouCAN_health_update(TOUCAN_HEALTH *health, UINT8 state, UINT32 errorCode, const UINT32 *errorStatus, BOOL cleared, const TOUCAN_DEVICE_STATISTICS *statistics) {
+	TOUCAN_HEALTH_SAMPLE sample;
+	UINT32 raised;
+
+	sample.busErrors = ((errorCode & TOUCAN_HEALTH_BUS_ERRORS) != 0) ? 1 : 0;
+	sample.fifoOverruns = ((errorCode & TOUCAN_HEALTH_FIFO_OVERRUNS) != 0) ? 1 : 0;
+	sample.overrunFrames = 0;
+
+	if (statistics != NULL) {
+		// A counter lower than before was cleared in between
+		if (health->hasOverruns) {
+			sample.overrunFrames = (statistics->overruns >= health->lastOverruns) ? statistics->overruns - health->lastOverruns : statistics->overruns;
+		}
+		health->lastOverruns = statistics->overruns;
+		health->hasOverruns = TRUE;
+	}
+
+	// State bits still in the error code from an earlier poll are not raised again
+	raised = errorCode & TOUCAN_HEALTH_STATES & ~health->remaining;
+	health->remaining = (cleared) ? 0 : errorCode & TOUCAN_HEALTH_STATES;
+
+	if (state != HAL_CAN_STATE_LISTENING) {
+		// Stopped or restarted, the interface starts error active again
+		health->latched = 0;
+	}
+	else if (errorStatus != NULL) {
+		// Held while the adapter reports the state, a state entered and left between two polls shows for one poll
+		health->latched = (*errorStatus & TOUCAN_HEALTH_STATES) | raised;
+	}
+	else {
+		// Without the error status a state is held until the interface is stopped
+		health->latched |= raised;
+	}
+
+	AddSample(health, &sample);
+	WriteNoFence(&health->state, (LONG)state);
+	WriteNoFence(&health->errorCode, (LONG)errorCode);
+	WriteNoFence(&health->polls, health->polls + 1);
+
+	return SetCondition(health, TouCAN_health_condition(state, health->latched));
+}
+
+//
+// Count a poll the adapter did not answer, the condition becomes unknown
+// returns TRUE if the bus condition changed
+//
+
+BOOL TouCAN_health_failed(TOUCAN_HEALTH *health) {
+	WriteNoFence(&health->failures, health->failures + 1);
+	return SetCondition(health, TOUCAN_BUS_UNKNOWN);
+}
+
+//
+// Poll an adapter's interface state, error code, error status and counters, and update its health.
+// The error code is cleared after a poll that saw event bits, so every poll counts the events raised
+// since the one before. The adapter clears the state bits with them, the health latches those.
+// [in] adapter, backend of an open adapter
+// returns TRUE if the bus condition changed
+//
+
+BOOL TouCAN_health_poll(TOUCAN_HEALTH *health, TOUCAN_BACKEND *adapter) {
+	TOUCAN_DEVICE_STATISTICS statistics;
+	UINT32 errorCode;
+	UINT32 errorStatus;
+	UINT8 state;
+	BOOL hasStatus;
+	BOOL cleared;
+
+	if ((TouCAN_backend_get_interface_state(adapter, &state) == FALSE) || (TouCAN_backend_get_interface_error_code(adapter, &errorCode) == FALSE)) {
+		return TouCAN_health_failed(health);
+	}
+
+	hasStatus = TouCAN_backend_get_error_status(adapter, &errorStatus);
+	cleared = ((errorCode & TOUCAN_HEALTH_EVENTS) != 0) && (TouCAN_backend_clear_interface_error_code(adapter));
+	return TouCAN_health_update(health, state, errorCode, (hasStatus) ? &errorStatus : NULL, cleared,
+		(TouCAN_backend_get_statistics(adapter, &statistics)) ? &statistics : NULL);
+}
@@ -0,0 +1,938 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Instance
+// Unit Description: The driver core, one adapter reached through a transport backend
+// Function: Opens and initialises the adapter, runs the read thread that stamps, filters and queues
+// received frames and the writer thread that drains the transmit queue. The single adapter API drives
+// one instance, OpenAdapterInstance one per adapter.
+//
+
+#include "../inc/toucan_instance.h"
+#include "../inc/toucan_capture.h"
+#include "../inc/toucan_protocol.h"
+#include "../inc/toucan_trace.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <string.h>
+
+// How long stopping waits for the read and writer threads to exit, milliseconds
+#define TOUCAN_INSTANCE_JOIN_TIMEOUT 1000
+
+//
+// Program the adapter's extended acceptance filter from compiled subscriptions
+// returns FALSE if the adapter rejected the filter
+//
+
+static BOOL ApplySubscription(TOUCAN_BACKEND *backend, const TOUCAN_SUBSCRIPTION *compiled) {
+	if (compiled->count == 0) {
+		return TouCAN_backend_filter_ext_accept_all(backend);
+	}
+
+	// Where each bank adds a filter, the previous subscription's filters are cleared first
+	if ((backend->filterBanks > 1) && (TouCAN_backend_set_filter_ext_list_mask(backend, FILTER_REJECT_ALL, 0, 0) == FALSE)) {
+		return FALSE;
+	}
+
+	for (UINT32 i = 0; i < compiled->banks; i++) {
+		if (TouCAN_backend_set_filter_ext_list_mask(backend, FILTER_VALUE, compiled->bank[i].id, compiled->bank[i].mask) == FALSE) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+//
+// Count the time from receipt to delivery of frames handed to the caller,
+// consecutive frames of one packet share a timestamp and are counted together
+//
+
+static void RecordDelivery(TOUCAN_INSTANCE *instance, const TOUCAN_FRAME *frames, UINT32 count) {
+	LONGLONG now;
+	UINT32 run;
+
+	if (count == 0) {
+		return;
+	}
+
+	now = HostMicroseconds();
+	for (UINT32 i = 0; i < count; i += run) {
+		run = 1;
+		while (((i + run) < count) && (frames[i + run].hostTime == frames[i].hostTime)) {
+			run++;
+		}
+		TouCAN_latency_record(&instance->deliveryLatency, now - frames[i].hostTime, run);
+	}
+}
+
+//
+// Pass a frame through the fast packet reassembler and queue any message it completes
+// returns TRUE if a message was queued
+//
+
+static BOOL QueueMessage(TOUCAN_INSTANCE *instance, const TOUCAN_FRAME *frame) {
+	TOUCAN_MESSAGE single;
+	TOUCAN_MESSAGE *message;
+
+	switch (TouCAN_fastpacket_add(&instance->reassembler, frame, &message)) {
+	case TOUCAN_FAST_PACKET_SINGLE:
+		single.id = frame->id;
+		single.timestamp = frame->timestamp;
+		single.hostTime = frame->hostTime;
+		single.length = (frame->length > TOUCAN_FRAME_DATA_LENGTH) ? TOUCAN_FRAME_DATA_LENGTH : frame->length;
+		memcpy(single.data, frame->data, TOUCAN_FRAME_DATA_LENGTH);
+		return TouCAN_msgqueue_push(&instance->messageQueue, &single);
+
+	case TOUCAN_FAST_PACKET_COMPLETE:
+		return TouCAN_msgqueue_push(&instance->messageQueue, message);
+
+	default:
+		return FALSE;
+	}
+}
+
+//
+// Signal the frame received event, unless the caller was signalled and has not drained since
+//
+
+static void NotifyCaller(TOUCAN_INSTANCE *instance) {
+	instance->unsignalledFrames = 0;
+
+	if (InterlockedExchange(&instance->notificationPending, TRUE) == TRUE) {
+		InterlockedIncrement(&instance->notificationsCoalesced);
+		return;
+	}
+
+	InterlockedIncrement(&instance->notificationsSent);
+	if (!SetEvent(instance->frameReceivedEvent)) {
+		// Non fatal error
+		TOUCAN_TRACE_WARNING(TOUCAN_TRACE_SET_EVENT_FAILED, GetLastError(), 0);
+	}
+}
+
+//
+// Signal the caller once enough frames are waiting, or the oldest of them has waited for the deadline
+// returns how long the read thread may wait for the next packet in milliseconds, so that a deadline is not overrun
+//
+
+static DWORD ModerateNotification(TOUCAN_INSTANCE *instance) {
+	LONGLONG waited;
+
+	if (instance->unsignalledFrames == 0) {
+		return TOUCAN_READ_WAIT_TIMEOUT;
+	}
+
+	waited = HostMicroseconds() - instance->unsignalledSince;
+	if ((instance->unsignalledFrames >= instance->config.notifyFrames) || (waited >= (LONGLONG)instance->config.notifyDeadline)) {
+		NotifyCaller(instance);
+		return TOUCAN_READ_WAIT_TIMEOUT;
+	}
+
+	waited = (((LONGLONG)instance->config.notifyDeadline - waited) + 999) / 1000;
+	return (waited < TOUCAN_READ_WAIT_TIMEOUT) ? (DWORD)waited : TOUCAN_READ_WAIT_TIMEOUT;
+}
+
+//
+// Read thread, stamps the frames of every packet, passes the extended frames through the
+// subscription post filter and the filter rules, and queues them for the caller
+//
+
+static DWORD WINAPI ReadThread(LPVOID lParam) {
+	TOUCAN_INSTANCE *instance = (TOUCAN_INSTANCE *)lParam;
+	const TOUCAN_INSTANCE_CONFIG *config = &instance->config;
+	TOUCAN_BACKEND *backend = instance->backend;
+	TOUCAN_FRAME frames[TOUCAN_MAX_READ_BATCH];
+	TOUCAN_FRAME frame;
+	TOUCAN_TRANSFER_RESULT result;
+	TOUCAN_FILTER *filter;
+	UINT32 frameCount;
+	UINT32 queued;
+	LONG notExtended;
+	LONGLONG bytes;
+	LONGLONG hostTime;
+
+	DebugPrintf(L"TouCAN ReadThread: %u\n", instance->index);
+
+	while (ReadAcquire(&instance->running)) {
+		// Quiescent point, nothing from the previous packet is in use
+		WriteRelease(&instance->readerEpoch, ReadAcquire(&instance->filterEpoch));
+		filter = (TOUCAN_FILTER *)ReadPointerAcquire((PVOID volatile *)&instance->receiveFilter);
+
+		result = backend->ReadBatch(backend->context, ModerateNotification(instance), frames, TOUCAN_MAX_READ_BATCH, &frameCount);
+
+		if (result == TOUCAN_TRANSFER_MALFORMED) {
+			TouCAN_stats_add(&instance->receiveMalformed, 1);
+			TOUCAN_TRACE_WARNING(TOUCAN_TRACE_MALFORMED_PACKET, instance->index, 0);
+			continue;
+		}
+
+		if (result == TOUCAN_TRANSFER_FAILED) {
+			TouCAN_stats_add(&instance->receiveFailures, 1);
+		}
+
+		// Nothing received, partial fast packet messages still time out on a quiet bus
+		if (((result != TOUCAN_TRANSFER_COMPLETE) || (frameCount == 0)) && (config->receiveMode == TOUCAN_RECEIVE_MODE_MESSAGES)) {
+			TouCAN_fastpacket_expire(&instance->reassembler, HostMicroseconds());
+		}
+
+		if ((result != TOUCAN_TRANSFER_COMPLETE) || (frameCount == 0)) {
+			continue;
+		}
+
+		// The read thread is the only writer of its counters
+		TouCAN_stats_add(&instance->receiveTransfers, 1);
+		TouCAN_stats_add(&instance->receiveFrames, (LONG)frameCount);
+		TouCAN_stats_transfer(&instance->receiveStatistics, frameCount);
+
+		// The last record left the adapter immediately before the packet was sent
+		hostTime = HostMicroseconds();
+		if (config->deviceTime) {
+			TouCAN_clock_update(&instance->clock, frames[frameCount - 1].timestamp, hostTime);
+		}
+
+		queued = 0;
+		notExtended = 0;
+		bytes = 0;
+		AcquireSRWLockShared(&instance->subscriptionLock);
+		for (UINT32 x = 0; x < frameCount; x++) {
+			frames[x].hostTime = (config->deviceTime) ? TouCAN_clock_to_host(&instance->clock, frames[x].timestamp) : hostTime;
+			bytes += frames[x].length;
+
+			// We are interested in CAN Extended frames only
+			if (frames[x].flags != CANAL_IDFLAG_EXTENDED) {
+				notExtended++;
+				continue;
+			}
+
+			// Other processes see the bus as received, before this plugin's own filters
+			if (config->hooks.Publish != NULL) {
+				config->hooks.Publish(config->hooks.context, &frames[x]);
+			}
+
+			// Passed by a merged acceptance filter but not subscribed to
+			if ((instance->subscriptionPostFilter) && (TouCAN_subscription_match(&instance->subscription, frames[x].id) == FALSE)) {
+				InterlockedIncrement(&instance->subscriptionRejected);
+				continue;
+			}
+
+			// Host side filter rules
+			if ((filter != NULL) && (TouCAN_filter_accept(filter, frames[x].id) == FALSE)) {
+				InterlockedIncrement(&instance->filterRejected);
+				continue;
+			}
+
+			// Queue every frame of the packet before notifying the caller, so that
+			// a burst is never overwritten before it has been consumed
+			if (config->receiveMode == TOUCAN_RECEIVE_MODE_MESSAGES) {
+				if (QueueMessage(instance, &frames[x]) == TRUE) {
+					queued++;
+				}
+			}
+			else if (TouCAN_ring_push(&instance->receiveRing, &frames[x]) == TRUE) {
+				queued++;
+			}
+		}
+		ReleaseSRWLockShared(&instance->subscriptionLock);
+
+		TouCAN_stats_add64(&instance->receiveStatistics.bytes, bytes);
+		if (notExtended > 0) {
+			TouCAN_stats_add(&instance->receiveStatistics.notExtended, notExtended);
+		}
+
+		TOUCAN_TRACE_DEBUG(TOUCAN_TRACE_PACKET, frameCount, queued);
+
+		// Every frame of the packet, before any filtering
+		if (config->hooks.Capture != NULL) {
+			config->hooks.Capture(config->hooks.context, frames, frameCount, TOUCAN_CAPTURE_RECEIVED);
+		}
+
+		if (config->receiveMode == TOUCAN_RECEIVE_MODE_MESSAGES) {
+			TouCAN_fastpacket_expire(&instance->reassembler, hostTime);
+		}
+
+		if (queued == 0) {
+			continue;
+		}
+
+		if ((config->receiveMode == TOUCAN_RECEIVE_MODE_LEGACY) && (config->hooks.Deliver != NULL)) {
+			// Compatibility shim, hand the frames over one at a time through the caller's single frame buffer
+			while (TouCAN_ring_pop(&instance->receiveRing, &frame) == TRUE) {
+				if (config->hooks.Deliver(config->hooks.context, &frame)) {
+					RecordDelivery(instance, &frame, 1);
+				}
+				else {
+					TouCAN_stats_add(&instance->receiveStatistics.mutexTimeouts, 1);
+				}
+			}
+		}
+		else {
+			// Signalled by ModerateNotification before the next wait, the caller collects everything available
+			if (instance->unsignalledFrames == 0) {
+				instance->unsignalledSince = hostTime;
+			}
+			instance->unsignalledFrames += queued;
+		}
+	}
+
+	// The filter is no longer in use
+	WriteRelease(&instance->readerActive, FALSE);
+
+	// Cancel the reads still in flight before their buffers are released
+	backend->ReadClose(backend->context);
+
+	DebugPrintf(L"TouCAN ReadThread exit: %u\n", instance->index);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Send frames taken from the transmit queue, repeating a failed transfer once
+// returns FALSE if the frames could not be transmitted
+//
+
+static BOOL TransmitFrames(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 count) {
+	UINT32 written;
+
+	if (TouCAN_instance_write(instance, frames, count, &written) == TRUE) {
+		return TRUE;
+	}
+
+	InterlockedIncrement(&instance->transmitRetries);
+	frames += written;
+	count -= written;
+	if (TouCAN_instance_write(instance, frames, count, &written) == TRUE) {
+		return TRUE;
+	}
+
+	InterlockedExchangeAdd(&instance->transmitFailures, (LONG)(count - written));
+	return FALSE;
+}
+
+//
+// Writer thread, drains the transmit queue most urgent priority first.
+// When coalescing is enabled, a partially filled transfer of non urgent frames
+// waits up to the deadline for further frames to share it. It is sent at once
+// when the transfer fills up or a frame of an urgent priority is queued.
+//
+
+static DWORD WINAPI TransmitThread(LPVOID lParam) {
+	TOUCAN_INSTANCE *instance = (TOUCAN_INSTANCE *)lParam;
+	TOUCAN_FRAME frames[TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	LONGLONG deadline;
+	LONGLONG remaining;
+	UINT32 count;
+
+	DebugPrintf(L"TouCAN TransmitThread: %u\n", instance->index);
+
+	for (;;) {
+		count = TouCAN_txqueue_pop(&instance->transmitQueue, frames, TOUCAN_MAX_RECORDS_PER_TRANSFER);
+
+		if (count == 0) {
+			// Frames queued before the instance was closed have been sent
+			if (ReadAcquire(&instance->transmitting) == FALSE) {
+				break;
+			}
+
+			// Signalled when a frame is queued while the queue is empty
+			WaitForSingleObject(instance->transmitPendingEvent, TOUCAN_READ_WAIT_TIMEOUT);
+			continue;
+		}
+
+		if ((count < TOUCAN_MAX_RECORDS_PER_TRANSFER) && (instance->config.transmitDeadline > 0) && (ReadAcquire(&instance->transmitting)) &&
+			(TOUCAN_TX_PRIORITY(frames[0].id) >= TOUCAN_TX_URGENT_PRIORITY)) {
+			deadline = HostMicroseconds() + ((LONGLONG)instance->config.transmitDeadline * 1000);
+
+			// The queue is empty now, so the next frame queued signals the event
+			while ((count < TOUCAN_MAX_RECORDS_PER_TRANSFER) && (ReadAcquire(&instance->transmitting))) {
+				remaining = deadline - HostMicroseconds();
+				if ((remaining <= 0) || (WaitForSingleObject(instance->transmitPendingEvent, (DWORD)((remaining + 999) / 1000)) != WAIT_OBJECT_0)) {
+					count += TouCAN_txqueue_pop(&instance->transmitQueue, &frames[count], TOUCAN_MAX_RECORDS_PER_TRANSFER - count);
+					break;
+				}
+
+				// Urgent frames are not held back, send this transfer and pick them up next
+				if (TouCAN_txqueue_waiting(&instance->transmitQueue, TOUCAN_TX_URGENT_PRIORITY) > 0) {
+					break;
+				}
+				count += TouCAN_txqueue_pop(&instance->transmitQueue, &frames[count], TOUCAN_MAX_RECORDS_PER_TRANSFER - count);
+			}
+		}
+
+		if ((TransmitFrames(instance, frames, count) == FALSE) && (ReadAcquire(&instance->transmitting) == FALSE)) {
+			// The adapter is going away, do not hold up the close with the rest of the queue
+			break;
+		}
+	}
+
+	DebugPrintf(L"TouCAN TransmitThread exit: %u\n", instance->index);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Stop the writer thread once it has sent what is still queued
+// returns FALSE if it did not exit, its handle is kept and the transmit queue not released
+//
+
+static BOOL StopWriter(TOUCAN_INSTANCE *instance) {
+	if (instance->writerHandle == NULL) {
+		return TRUE;
+	}
+
+	WriteRelease(&instance->transmitting, FALSE);
+	SetEvent(instance->transmitPendingEvent);
+	if (WaitForSingleObject(instance->writerHandle, TOUCAN_INSTANCE_JOIN_TIMEOUT) != WAIT_OBJECT_0) {
+		DebugPrintf(L"Wait for transmit thread timed out: %u\n", instance->index);
+		return FALSE;
+	}
+
+	CloseHandle(instance->writerHandle);
+	instance->writerHandle = NULL;
+	TouCAN_txqueue_free(&instance->transmitQueue);
+	return TRUE;
+}
+
+//
+// Free the retired filters the read thread has passed a quiescent point since, or all of them
+// once it is no longer active. The caller holds the filter update lock.
+//
+
+static void ReclaimFilters(TOUCAN_INSTANCE *instance) {
+	TOUCAN_FILTER **link = &instance->retiredFilters;
+	TOUCAN_FILTER *filter;
+
+	while (*link != NULL) {
+		filter = *link;
+		if ((ReadAcquire(&instance->readerActive) == FALSE) || ((LONG)(ReadAcquire(&instance->readerEpoch) - filter->retiredEpoch) >= 0)) {
+			*link = filter->retiredNext;
+			TouCAN_filter_free(filter);
+		}
+		else {
+			link = &filter->retiredNext;
+		}
+	}
+}
+
+//
+// Close the backend and the events of an instance whose threads have exited
+//
+
+static void Release(TOUCAN_INSTANCE *instance) {
+	if (instance->transmitPendingEvent != NULL) {
+		CloseHandle(instance->transmitPendingEvent);
+		instance->transmitPendingEvent = NULL;
+	}
+
+	if ((instance->ownsEvent) && (instance->frameReceivedEvent != NULL)) {
+		CloseHandle(instance->frameReceivedEvent);
+	}
+	instance->frameReceivedEvent = NULL;
+	instance->ownsEvent = FALSE;
+
+	if (instance->backend != NULL) {
+		instance->backend->Close(instance->backend->context);
+		instance->backend = NULL;
+	}
+}
+
+//
+// Prepare an instance for its first open, its configuration is reset to the defaults
+//
+
+void TouCAN_instance_init(TOUCAN_INSTANCE *instance) {
+	memset(instance, 0, sizeof(TOUCAN_INSTANCE));
+	InitializeSRWLock(&instance->subscriptionLock);
+	InitializeSRWLock(&instance->subscriptionUpdateLock);
+	InitializeSRWLock(&instance->filterUpdateLock);
+	InitializeSRWLock(&instance->writeLock);
+
+	instance->config.receiveMode = TOUCAN_RECEIVE_MODE_LEGACY;
+	instance->config.receiveDepth = TOUCAN_DEFAULT_RECEIVE_DEPTH;
+	instance->config.readQueueDepth = TOUCAN_DEFAULT_READ_QUEUE_DEPTH;
+	instance->config.readBufferSize = TOUCAN_DEFAULT_READ_BUFFER_SIZE;
+	instance->config.notifyFrames = 1;
+	TouCAN_clock_init(&instance->clock, TOUCAN_TIMESTAMP_FREQUENCY);
+}
+
+//
+// Open the adapter behind a backend, initialise and start its CAN interface, and start the
+// writer thread if the configuration queues transmitted frames. Any adapter the instance had open is closed first.
+// [in] backend, filled in by the backend, for example TouCAN_usb_backend, must stay valid until TouCAN_instance_close
+// [in] serialNumber, optional, the serial number the adapter must report
+// returns TWOCAN_RESULT_SUCCESS, or the adapter not found if it cannot be opened or is not the one asked for
+//
+
+int TouCAN_instance_open(TOUCAN_INSTANCE *instance, TOUCAN_BACKEND *backend, const UINT32 *serialNumber) {
+	const TOUCAN_INSTANCE_CONFIG *config = &instance->config;
+	BOOL applied;
+	int result;
+
+	// An instance whose threads are still running cannot be reused
+	if (TouCAN_instance_close(instance) == FALSE) {
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	result = backend->Open(backend->context);
+	if (result != TWOCAN_RESULT_SUCCESS) {
+		DebugPrintf(L"TouCAN open failed: %u\n", instance->index);
+		return result;
+	}
+	instance->backend = backend;
+
+	// Not every backend reports a serial number, it is only required to select an adapter by it
+	instance->serialNumber = 0;
+	if ((TouCAN_backend_get_serial_number(backend, &instance->serialNumber) == FALSE) && (serialNumber != NULL)) {
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	if ((serialNumber != NULL) && (instance->serialNumber != *serialNumber)) {
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	if (TouCAN_backend_init(backend, config->options) == FALSE) {
+		DebugPrintf(L"TouCAN init failed: %u\n", instance->serialNumber);
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	// Apply the PGN subscriptions before any frame is received
+	AcquireSRWLockExclusive(&instance->subscriptionUpdateLock);
+	if (instance->subscription.count > 0) {
+		applied = ApplySubscription(backend, &instance->subscription);
+		AcquireSRWLockExclusive(&instance->subscriptionLock);
+		instance->subscriptionPostFilter = (applied == FALSE) || (instance->subscription.exact == FALSE);
+		ReleaseSRWLockExclusive(&instance->subscriptionLock);
+	}
+	ReleaseSRWLockExclusive(&instance->subscriptionUpdateLock);
+
+	TouCAN_segmenter_init(&instance->segmenter, config->fastPacketPgns, config->fastPacketPgnCount);
+
+	if (TouCAN_backend_start(backend) == FALSE) {
+		DebugPrintf(L"TouCAN start failed: %u\n", instance->serialNumber);
+		TouCAN_backend_deinit(backend);
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	instance->ownsEvent = (config->frameReceivedEvent == NULL);
+	instance->frameReceivedEvent = (instance->ownsEvent) ? CreateEvent(NULL, FALSE, FALSE, NULL) : config->frameReceivedEvent;
+	if (instance->frameReceivedEvent == NULL) {
+		DebugPrintf(L"Create FrameReceivedEvent failed (%d)\n", GetLastError());
+		TouCAN_backend_deinit(backend);
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_FRAME_RECEIVED_EVENT);
+	}
+
+	if (config->transmitLaneDepth == 0) {
+		return TWOCAN_RESULT_SUCCESS;
+	}
+
+	// Start the writer thread that drains the transmit queue
+	instance->transmitPendingEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if ((instance->transmitPendingEvent == NULL) || (TouCAN_txqueue_init(&instance->transmitQueue, config->transmitLaneDepth) == FALSE)) {
+		DebugPrintf(L"Transmit queue allocation failed\n");
+		TouCAN_backend_deinit(backend);
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_TRANSMIT_FAILURE);
+	}
+
+	WriteRelease(&instance->transmitting, TRUE);
+	instance->writerHandle = CreateThread(NULL, 0, TransmitThread, instance, 0, NULL);
+	if (instance->writerHandle == NULL) {
+		DebugPrintf(L"Transmit thread failed (%d)\n", GetLastError());
+		WriteRelease(&instance->transmitting, FALSE);
+		TouCAN_txqueue_free(&instance->transmitQueue);
+		TouCAN_backend_deinit(backend);
+		Release(instance);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Allocate the receive queue and start the read thread, the instance must be open.
+// The counters and the clock correlation start again from here.
+// returns TWOCAN_RESULT_SUCCESS if the read thread was started
+//
+
+int TouCAN_instance_start(TOUCAN_INSTANCE *instance) {
+	const TOUCAN_INSTANCE_CONFIG *config = &instance->config;
+
+	if ((instance->backend == NULL) || (instance->threadHandle != NULL)) {
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	// Allocate the queue between the read thread and the caller
+	if (config->receiveMode == TOUCAN_RECEIVE_MODE_MESSAGES) {
+		TouCAN_fastpacket_init(&instance->reassembler, config->fastPacketPgns, config->fastPacketPgnCount);
+		instance->messagesLostReported = 0;
+		if (TouCAN_msgqueue_init(&instance->messageQueue, config->receiveDepth) == FALSE) {
+			DebugPrintf(L"Message queue allocation failed: %d\n", config->receiveDepth);
+			return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+		}
+	}
+	else if (TouCAN_ring_init(&instance->receiveRing, config->receiveDepth) == FALSE) {
+		DebugPrintf(L"Receive queue allocation failed: %d\n", config->receiveDepth);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+
+	// Frames are stamped against the host's monotonic clock
+	TouCAN_clock_init(&instance->clock, TOUCAN_TIMESTAMP_FREQUENCY);
+
+	// Performance counters cover one run of the read thread
+	instance->receiveFrames = 0;
+	instance->receiveTransfers = 0;
+	instance->receiveMalformed = 0;
+	instance->receiveFailures = 0;
+	memset((void *)&instance->receiveStatistics, 0, sizeof(TOUCAN_RECEIVE_STATISTICS));
+	TouCAN_latency_reset(&instance->deliveryLatency);
+	instance->receiveStarted = HostMicroseconds();
+	instance->unsignalledFrames = 0;
+	instance->notificationPending = FALSE;
+
+	// Post the reads on the bulk IN endpoint before the read thread starts waiting on them
+	if (instance->backend->ReadOpen(instance->backend->context, config->readQueueDepth, config->readBufferSize) == FALSE) {
+		TouCAN_ring_free(&instance->receiveRing);
+		TouCAN_msgqueue_free(&instance->messageQueue);
+		DebugPrintf(L"Read pipeline failed: %d (%d)\n", config->readQueueDepth, config->readBufferSize);
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_RECEIVE_FAILURE);
+	}
+
+	WriteRelease(&instance->running, TRUE);
+	WriteRelease(&instance->readerActive, TRUE);
+	instance->threadHandle = CreateThread(NULL, 0, ReadThread, instance, 0, NULL);
+	if (instance->threadHandle != NULL) {
+		return TWOCAN_RESULT_SUCCESS;
+	}
+
+	DebugPrintf(L"Read thread failed (%d)\n", GetLastError());
+	WriteRelease(&instance->running, FALSE);
+	WriteRelease(&instance->readerActive, FALSE);
+	instance->backend->ReadClose(instance->backend->context);
+	TouCAN_ring_free(&instance->receiveRing);
+	TouCAN_msgqueue_free(&instance->messageQueue);
+	return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+}
+
+//
+// Stop the read thread, frames still queued are discarded
+// returns FALSE if the read thread did not exit, its handle and the receive queue are then kept
+// and a later stop or close waits for it again
+//
+
+BOOL TouCAN_instance_stop(TOUCAN_INSTANCE *instance) {
+	if (instance->threadHandle == NULL) {
+		return TRUE;
+	}
+
+	WriteRelease(&instance->running, FALSE);
+	if (WaitForSingleObject(instance->threadHandle, TOUCAN_INSTANCE_JOIN_TIMEOUT) != WAIT_OBJECT_0) {
+		DebugPrintf(L"Wait for read thread timed out: %u\n", instance->index);
+		return FALSE;
+	}
+
+	CloseHandle(instance->threadHandle);
+	instance->threadHandle = NULL;
+
+	// The read thread has exited, no retired filter is in use any longer
+	AcquireSRWLockExclusive(&instance->filterUpdateLock);
+	ReclaimFilters(instance);
+	ReleaseSRWLockExclusive(&instance->filterUpdateLock);
+
+	TouCAN_ring_free(&instance->receiveRing);
+	TouCAN_msgqueue_free(&instance->messageQueue);
+	return TRUE;
+}
+
+//
+// Stop the read thread and the writer thread, which sends the frames still queued first,
+// then stop and close the adapter. The backend is only closed once both threads have exited,
+// a thread still inside the backend would otherwise use it after it was released.
+// returns FALSE if a thread did not exit, the adapter is then left open
+//
+
+BOOL TouCAN_instance_close(TOUCAN_INSTANCE *instance) {
+	BOOL exited;
+
+	exited = StopWriter(instance);
+	exited = (TouCAN_instance_stop(instance) == TRUE) && (exited == TRUE);
+
+	if (exited == FALSE) {
+		DebugPrintf(L"TouCAN close deferred, a thread is still running: %u\n", instance->index);
+		return FALSE;
+	}
+
+	if (instance->backend != NULL) {
+		TouCAN_backend_deinit(instance->backend);
+		Sleep(50);
+	}
+	Release(instance);
+	return TRUE;
+}
+
+//
+// Copy the queued frames, oldest first, and rearm the frame received event
+// Only one thread may drain an instance
+// returns the number of frames copied
+//
+
+UINT32 TouCAN_instance_drain(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 maxFrames) {
+	UINT32 count;
+
+	// Cleared before draining, so frames queued from here on raise a new signal
+	InterlockedExchange(&instance->notificationPending, FALSE);
+
+	count = TouCAN_ring_drain(&instance->receiveRing, frames, maxFrames);
+	RecordDelivery(instance, frames, count);
+	return count;
+}
+
+//
+// Read a complete message in TOUCAN_RECEIVE_MODE_MESSAGES, and rearm the frame received event
+// [out] lost, TRUE when messages have been lost since the previous call
+// returns TRUE if a message was read
+//
+
+BOOL TouCAN_instance_read_message(TOUCAN_INSTANCE *instance, TOUCAN_MESSAGE *message, BOOL *lost) {
+	BOOL read;
+	LONG total;
+
+	InterlockedExchange(&instance->notificationPending, FALSE);
+
+	read = TouCAN_msgqueue_pop(&instance->messageQueue, message);
+	if (read) {
+		TouCAN_latency_record(&instance->deliveryLatency, HostMicroseconds() - message->hostTime, 1);
+	}
+
+	total = instance->reassembler.bufferFull + instance->messageQueue.overflows;
+	*lost = (total != instance->messagesLostReported);
+	instance->messagesLostReported = total;
+	return read;
+}
+
+//
+// A frame carries at most TOUCAN_FRAME_DATA_LENGTH bytes, the record's length byte must not claim more
+//
+
+static BOOL ValidLengths(const TOUCAN_FRAME *frames, UINT32 count) {
+	for (UINT32 i = 0; i < count; i++) {
+		if (frames[i].length > TOUCAN_FRAME_DATA_LENGTH) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+//
+// Hand frames to the adapter, and capture the ones it accepted
+// [in] frames, frames to transmit, stamped with the host time they were sent when capturing
+// [out] written, number of frames handed to the adapter, valid also on failure
+// returns FALSE if a transfer failed, or a frame is longer than TOUCAN_FRAME_DATA_LENGTH and none were sent
+//
+
+BOOL TouCAN_instance_write(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+	const TOUCAN_INSTANCE_HOOKS *hooks = &instance->config.hooks;
+	BOOL status;
+	LONGLONG hostTime;
+
+	*written = 0;
+	if ((instance->backend == NULL) || (ValidLengths(frames, count) == FALSE)) {
+		return FALSE;
+	}
+
+	AcquireSRWLockExclusive(&instance->writeLock);
+	status = instance->backend->WriteBatch(instance->backend->context, frames, count, written);
+	ReleaseSRWLockExclusive(&instance->writeLock);
+
+	if ((hooks->Capture != NULL) && (*written > 0)) {
+		hostTime = HostMicroseconds();
+		for (UINT32 i = 0; i < *written; i++) {
+			frames[i].hostTime = hostTime;
+		}
+		hooks->Capture(hooks->context, frames, *written, TOUCAN_CAPTURE_TRANSMITTED);
+	}
+	return status;
+}
+
+//
+// Queue frames for the writer thread, never blocks. Frames sharing a priority are queued together
+// so they stay in order.
+// returns FALSE if a priority lane could not take its frames, those frames and the ones after them are not queued,
+// or if a frame is longer than TOUCAN_FRAME_DATA_LENGTH and none were queued
+//
+
+BOOL TouCAN_instance_queue(TOUCAN_INSTANCE *instance, const TOUCAN_FRAME *frames, UINT32 count) {
+	BOOL wasEmpty;
+	BOOL signal = FALSE;
+	BOOL status = TRUE;
+	UINT32 run;
+
+	if (ValidLengths(frames, count) == FALSE) {
+		return FALSE;
+	}
+
+	for (UINT32 i = 0; (i < count) && (status == TRUE); i += run) {
+		run = 1;
+		while (((i + run) < count) && (TOUCAN_TX_PRIORITY(frames[i + run].id) == TOUCAN_TX_PRIORITY(frames[i].id))) {
+			run++;
+		}
+
+		status = TouCAN_txqueue_push_batch(&instance->transmitQueue, &frames[i], run, &wasEmpty);
+		signal |= wasEmpty;
+	}
+
+	if (signal) {
+		SetEvent(instance->transmitPendingEvent);
+	}
+	return status;
+}
+
+//
+// Replace the PGN subscriptions, the adapter keeps running. The adapter is programmed first,
+// the read thread keeps filtering with the old subscriptions meanwhile.
+// returns FALSE if the open adapter rejected the acceptance filter, the post filter then discards the frames
+//
+
+BOOL TouCAN_instance_subscribe(TOUCAN_INSTANCE *instance, const TOUCAN_SUBSCRIPTION *compiled) {
+	BOOL applied = FALSE;
+	BOOL open;
+
+	AcquireSRWLockExclusive(&instance->subscriptionUpdateLock);
+	open = (instance->backend != NULL);
+	if (open) {
+		applied = ApplySubscription(instance->backend, compiled);
+	}
+
+	AcquireSRWLockExclusive(&instance->subscriptionLock);
+	instance->subscription = *compiled;
+	instance->subscriptionPostFilter = (compiled->count > 0) && ((applied == FALSE) || (compiled->exact == FALSE));
+	ReleaseSRWLockExclusive(&instance->subscriptionLock);
+	ReleaseSRWLockExclusive(&instance->subscriptionUpdateLock);
+
+	return (open == FALSE) || (applied == TRUE);
+}
+
+//
+// Install compiled filter rules, NULL removes the filter. The read thread switches to the new
+// filter with its next packet, the old one is freed once it has. If the read thread does not
+// reach its next packet within the grace period the old filter is retired instead, and freed
+// by a later update or the stop once the thread has moved on.
+//
+
+void TouCAN_instance_set_filter(TOUCAN_INSTANCE *instance, TOUCAN_FILTER *filter) {
+	TOUCAN_FILTER *previous;
+	LONG epoch;
+	ULONGLONG start;
+
+	// Publish the new filter, then wait for the read thread to pass a quiescent point before freeing the old one
+	AcquireSRWLockExclusive(&instance->filterUpdateLock);
+	previous = (TOUCAN_FILTER *)InterlockedExchangePointer((PVOID volatile *)&instance->receiveFilter, filter);
+	epoch = InterlockedIncrement(&instance->filterEpoch);
+
+	start = GetTickCount64();
+	while ((ReadAcquire(&instance->readerActive)) && ((LONG)(ReadAcquire(&instance->readerEpoch) - epoch) < 0) &&
+		((GetTickCount64() - start) < TOUCAN_FILTER_GRACE_PERIOD)) {
+		Sleep(1);
+	}
+
+	if ((ReadAcquire(&instance->readerActive) == FALSE) || ((LONG)(ReadAcquire(&instance->readerEpoch) - epoch) >= 0)) {
+		TouCAN_filter_free(previous);
+	}
+	else if (previous != NULL) {
+		// The read thread is stalled, keep the old filter until it has passed this epoch
+		DebugPrintf(L"Filter grace period expired\n");
+		previous->retiredEpoch = epoch;
+		previous->retiredNext = instance->retiredFilters;
+		instance->retiredFilters = previous;
+	}
+
+	// Filters retired by earlier updates whose epochs the read thread has since passed
+	ReclaimFilters(instance);
+	ReleaseSRWLockExclusive(&instance->filterUpdateLock);
+}
+
+//
+// Take a snapshot of the instance's counters without stopping its threads. The adapter's own
+// counters are asked for if it is open, deviceValid tells whether it answered.
+// The bus health window is left zero, its length depends on how the monitor polls.
+//
+
+void TouCAN_instance_statistics(TOUCAN_INSTANCE *instance, TOUCAN_STATISTICS *statistics) {
+	LONG queued;
+
+	memset(statistics, 0, sizeof(TOUCAN_STATISTICS));
+
+	statistics->receiveBytes = (ULONGLONG)ReadNoFence64(&instance->receiveStatistics.bytes);
+	statistics->receiveFrames = (UINT32)ReadNoFence(&instance->receiveFrames);
+	statistics->receiveTransfers = (UINT32)ReadNoFence(&instance->receiveTransfers);
+	statistics->receiveMalformed = (UINT32)ReadNoFence(&instance->receiveMalformed);
+	statistics->receiveFailures = (UINT32)ReadNoFence(&instance->receiveFailures);
+	statistics->receiveQueued = (instance->receiveRing.frames == NULL) ? 0 : TouCAN_ring_count(&instance->receiveRing);
+	statistics->receiveOverflows = (UINT32)ReadNoFence(&instance->receiveRing.overflows);
+	statistics->receiveHighWater = (UINT32)ReadNoFence(&instance->receiveRing.highWater);
+	statistics->notExtended = (UINT32)ReadNoFence(&instance->receiveStatistics.notExtended);
+	statistics->mutexTimeouts = (UINT32)ReadNoFence(&instance->receiveStatistics.mutexTimeouts);
+	statistics->notificationsSent = (UINT32)ReadNoFence(&instance->notificationsSent);
+	statistics->notificationsCoalesced = (UINT32)ReadNoFence(&instance->notificationsCoalesced);
+
+	AcquireSRWLockShared(&instance->subscriptionLock);
+	statistics->subscriptionBanks = instance->subscription.banks;
+	ReleaseSRWLockShared(&instance->subscriptionLock);
+	statistics->subscriptionRejected = (UINT32)ReadNoFence(&instance->subscriptionRejected);
+
+	// The lock keeps the filter from being freed while it is read
+	AcquireSRWLockShared(&instance->filterUpdateLock);
+	statistics->filterRules = (instance->receiveFilter == NULL) ? 0 : instance->receiveFilter->count;
+	ReleaseSRWLockShared(&instance->filterUpdateLock);
+	statistics->filterRejected = (UINT32)ReadNoFence(&instance->filterRejected);
+
+	statistics->fastPacketCompleted = (UINT32)ReadNoFence(&instance->reassembler.completed);
+	statistics->fastPacketTimeouts = (UINT32)ReadNoFence(&instance->reassembler.timeouts);
+	statistics->fastPacketSequenceErrors = (UINT32)ReadNoFence(&instance->reassembler.sequenceErrors);
+	statistics->fastPacketBufferFull = (UINT32)(ReadNoFence(&instance->reassembler.bufferFull) + ReadNoFence(&instance->messageQueue.overflows));
+
+	if ((instance->backend != NULL) && (instance->backend->transmitted != NULL)) {
+		statistics->transmitFrames = (UINT32)ReadNoFence(&instance->backend->transmitted->frames);
+		statistics->transmitTransfers = (UINT32)ReadNoFence(&instance->backend->transmitted->transfers);
+	}
+	statistics->transmitFailures = (UINT32)ReadNoFence(&instance->transmitFailures);
+	queued = ReadNoFence(&instance->transmitQueue.queued);
+	statistics->transmitQueued = (queued > 0) ? (UINT32)queued : 0;
+	statistics->transmitHighWater = (UINT32)ReadNoFence(&instance->transmitQueue.highWater);
+	statistics->transmitDrops = (UINT32)ReadNoFence(&instance->transmitQueue.drops);
+	statistics->transmitRetries = (UINT32)ReadNoFence(&instance->transmitRetries);
+
+	statistics->clockSynchronised = ReadNoFence(&instance->clock.synchronised);
+	statistics->clockDrift = ReadNoFence(&instance->clock.drift);
+	statistics->clockResets = (UINT32)ReadNoFence(&instance->clock.resets);
+
+	statistics->busErrors = (UINT32)ReadNoFence(&instance->health.busErrors);
+	statistics->fifoOverruns = (UINT32)ReadNoFence(&instance->health.fifoOverruns);
+	statistics->overrunFrames = (UINT32)ReadNoFence(&instance->health.overrunFrames);
+	statistics->busOffEvents = (UINT32)ReadNoFence(&instance->health.busOffEvents);
+
+	if (instance->backend != NULL) {
+		statistics->deviceValid = TouCAN_backend_get_statistics(instance->backend, &statistics->device);
+		if (statistics->deviceValid == FALSE) {
+			memset(&statistics->device, 0, sizeof(statistics->device));
+		}
+	}
+}
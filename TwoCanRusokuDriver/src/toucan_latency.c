@@ -0,0 +1,146 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Latency
+// Unit Description: Latency histogram
+// Function: Counts latencies in log linear buckets so percentiles can be reported
+// without keeping every sample
+//
+
+#include "../inc/toucan_latency.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static UINT32 HighestBit(UINT32 value) {
+#if defined(_MSC_VER)
+	unsigned long index;
+
+	_BitScanReverse(&index, value);
+	return index;
+#else
+	return 31 - __builtin_clz(value);
+#endif
+}
+
+static UINT32 Bucket(UINT32 value) {
+	UINT32 bit;
+
+	if (value < (1U << TOUCAN_LATENCY_LINEAR_BITS)) {
+		return value;
+	}
+
+	bit = HighestBit(value);
+	return (1U << TOUCAN_LATENCY_LINEAR_BITS) + ((bit - TOUCAN_LATENCY_LINEAR_BITS) << TOUCAN_LATENCY_SUB_BITS) +
+		((value >> (bit - TOUCAN_LATENCY_SUB_BITS)) & ((1U << TOUCAN_LATENCY_SUB_BITS) - 1));
+}
+
+//
+// Largest latency counted in a bucket
+//
+
+static UINT32 UpperBound(UINT32 bucket) {
+	UINT32 bit;
+	UINT32 sub;
+
+	if (bucket < (1U << TOUCAN_LATENCY_LINEAR_BITS)) {
+		return bucket;
+	}
+
+	bucket -= (1U << TOUCAN_LATENCY_LINEAR_BITS);
+	bit = TOUCAN_LATENCY_LINEAR_BITS + (bucket >> TOUCAN_LATENCY_SUB_BITS);
+	sub = bucket & ((1U << TOUCAN_LATENCY_SUB_BITS) - 1);
+	return ((((1U << TOUCAN_LATENCY_SUB_BITS) + sub + 1) << (bit - TOUCAN_LATENCY_SUB_BITS)) - 1);
+}
+
+//
+// Largest latency in microseconds counted in a bucket, so a histogram can be reported
+//
+
+UINT32 TouCAN_latency_bound(UINT32 bucket) {
+	return UpperBound(bucket);
+}
+
+void TouCAN_latency_reset(TOUCAN_LATENCY *latency) {
+	memset((void *)latency, 0, sizeof(TOUCAN_LATENCY));
+}
+
+//
+// Count samples sharing one latency, as the frames of a USB packet do
+// [in] microseconds, the latency, negative values count as zero
+// [in] count, number of samples
+//
+
+void TouCAN_latency_record(TOUCAN_LATENCY *latency, LONGLONG microseconds, UINT32 count) {
+	UINT32 value;
+	LONG maximum;
+
+	if (count == 0) {
+		return;
+	}
+
+	value = (microseconds < 0) ? 0 : (microseconds > 0x7FFFFFFF) ? 0x7FFFFFFF : (UINT32)microseconds;
+
+	InterlockedExchangeAdd(&latency->counts[Bucket(value)], (LONG)count);
+	InterlockedExchangeAdd(&latency->samples, (LONG)count);
+
+	maximum = ReadNoFence(&latency->maximum);
+	while ((LONG)value > maximum) {
+		if (InterlockedCompareExchange(&latency->maximum, (LONG)value, maximum) == maximum) {
+			break;
+		}
+		maximum = ReadNoFence(&latency->maximum);
+	}
+}
+
+//
+// Latency not exceeded by a fraction of the samples
+// [in] perMille, the fraction in thousandths, 500 for the median, 999 for the 99.9th percentile
+// returns the upper bound in microseconds of the bucket holding the percentile, 0 without samples
+//
+
+UINT32 TouCAN_latency_percentile(const TOUCAN_LATENCY *latency, UINT32 perMille) {
+	ULONGLONG target;
+	ULONGLONG seen = 0;
+	UINT32 bound;
+
+	if (latency->samples <= 0) {
+		return 0;
+	}
+
+	target = (((ULONGLONG)latency->samples * perMille) + 999) / 1000;
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (UINT32 i = 0; i < TOUCAN_LATENCY_BUCKETS; i++) {
+		seen += (ULONGLONG)latency->counts[i];
+		if (seen >= target) {
+			// The largest sample bounds the top bucket more tightly
+			bound = UpperBound(i);
+			return (bound < (UINT32)latency->maximum) ? bound : (UINT32)latency->maximum;
+		}
+	}
+	return (UINT32)latency->maximum;
+}
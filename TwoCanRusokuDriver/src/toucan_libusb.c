@@ -0,0 +1,299 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN libusb
+// Unit Description: TouCAN USB device on libusb-1.0
+// Function: Keeps several asynchronous bulk IN transfers in flight, completed by a dedicated
+// event thread, and issues class requests and bulk OUT transfers synchronously
+//
+
+#if defined(TOUCAN_LIBUSB)
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_libusb.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <string.h>
+#include <time.h>
+
+//
+// Event thread, runs the libusb completion callbacks until the device is closed
+//
+
+static void *EventThread(void *parameter) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)parameter;
+	struct timeval interval;
+
+	while (ReadAcquire(&ctx->eventsRunning)) {
+		interval.tv_sec = 0;
+		interval.tv_usec = TOUCAN_LIBUSB_EVENT_INTERVAL * 1000;
+		libusb_handle_events_timeout_completed(ctx->usb, &interval, NULL);
+	}
+	return NULL;
+}
+
+static int LibUsbOpen(void *context) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+
+	if (libusb_init(&ctx->usb) != LIBUSB_SUCCESS) {
+		ctx->usb = NULL;
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_DRIVER_NOT_FOUND);
+	}
+
+	ctx->handle = libusb_open_device_with_vid_pid(ctx->usb, ctx->vendorId, ctx->productId);
+	if ((ctx->handle == NULL) || (libusb_claim_interface(ctx->handle, 0) != LIBUSB_SUCCESS)) {
+		if (ctx->handle != NULL) {
+			libusb_close(ctx->handle);
+			ctx->handle = NULL;
+		}
+		libusb_exit(ctx->usb);
+		ctx->usb = NULL;
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_ADAPTER_NOT_FOUND);
+	}
+
+	WriteRelease(&ctx->eventsRunning, TRUE);
+	if (pthread_create(&ctx->eventThread, NULL, EventThread, ctx) != 0) {
+		WriteRelease(&ctx->eventsRunning, FALSE);
+		libusb_release_interface(ctx->handle, 0);
+		libusb_close(ctx->handle);
+		libusb_exit(ctx->usb);
+		ctx->handle = NULL;
+		ctx->usb = NULL;
+		return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, TWOCAN_ERROR_CREATE_THREAD_HANDLE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+static void LibUsbClose(void *context) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+
+	if (ctx->handle == NULL) {
+		return;
+	}
+
+	WriteRelease(&ctx->eventsRunning, FALSE);
+	pthread_join(ctx->eventThread, NULL);
+
+	libusb_release_interface(ctx->handle, 0);
+	libusb_close(ctx->handle);
+	libusb_exit(ctx->usb);
+	ctx->handle = NULL;
+	ctx->usb = NULL;
+}
+
+static BOOL LibUsbControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+	int result;
+
+	result = libusb_control_transfer(ctx->handle, requestType, request, 0, 0, data, length, TOUCAN_LIBUSB_TIMEOUT);
+	if (result < 0) {
+		return FALSE;
+	}
+
+	if (transferred != NULL) {
+		*transferred = (ULONG)result;
+	}
+	return TRUE;
+}
+
+static BOOL LibUsbBulkOut(void *context, const UINT8 *data, UINT32 length) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+	int transferred = 0;
+
+	if (libusb_bulk_transfer(ctx->handle, TOUCAN_USB_BULK_OUT, (unsigned char *)data, (int)length, &transferred, TOUCAN_LIBUSB_TIMEOUT) != LIBUSB_SUCCESS) {
+		return FALSE;
+	}
+	return ((UINT32)transferred == length);
+}
+
+//
+// Completion callback, runs on the event thread
+//
+
+static void LIBUSB_CALL ReadCompleted(struct libusb_transfer *transfer) {
+	TOUCAN_LIBUSB_SLOT *slot = (TOUCAN_LIBUSB_SLOT *)transfer->user_data;
+	TOUCAN_LIBUSB_DEVICE *ctx = slot->owner;
+
+	pthread_mutex_lock(&ctx->lock);
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		slot->result = TOUCAN_TRANSFER_COMPLETE;
+		slot->length = (ULONG)transfer->actual_length;
+		break;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		// The transfer timeout expired on an idle bus
+		slot->result = TOUCAN_TRANSFER_COMPLETE;
+		slot->length = 0;
+		break;
+	default:
+		slot->result = TOUCAN_TRANSFER_FAILED;
+		slot->length = 0;
+		break;
+	}
+	slot->inFlight = FALSE;
+	slot->done = TRUE;
+	pthread_cond_broadcast(&ctx->completed);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static BOOL LibUsbReadOpen(void *context, UINT32 queueDepth) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->completed, NULL);
+
+	for (UINT32 i = 0; i < queueDepth; i++) {
+		memset(&ctx->slots[i], 0, sizeof(TOUCAN_LIBUSB_SLOT));
+		ctx->slots[i].owner = ctx;
+		ctx->slots[i].transfer = libusb_alloc_transfer(0);
+		if (ctx->slots[i].transfer == NULL) {
+			ctx->slotCount = i;
+			return FALSE;
+		}
+	}
+	ctx->slotCount = queueDepth;
+	return TRUE;
+}
+
+static void LibUsbReadClose(void *context) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+
+	for (UINT32 i = 0; i < ctx->slotCount; i++) {
+		// A transfer that never completed cannot be freed safely, it is leaked instead
+		if (ctx->slots[i].inFlight == FALSE) {
+			libusb_free_transfer(ctx->slots[i].transfer);
+		}
+		ctx->slots[i].transfer = NULL;
+	}
+	ctx->slotCount = 0;
+
+	pthread_cond_destroy(&ctx->completed);
+	pthread_mutex_destroy(&ctx->lock);
+}
+
+static BOOL LibUsbSubmitRead(void *context, UINT32 slot, UINT8 *buffer, UINT32 length) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+	TOUCAN_LIBUSB_SLOT *s = &ctx->slots[slot];
+	BOOL submitted;
+
+	libusb_fill_bulk_transfer(s->transfer, ctx->handle, TOUCAN_USB_BULK_IN, buffer, (int)length, ReadCompleted, s, TOUCAN_LIBUSB_TIMEOUT);
+
+	pthread_mutex_lock(&ctx->lock);
+	s->done = FALSE;
+	submitted = (libusb_submit_transfer(s->transfer) == LIBUSB_SUCCESS);
+	s->inFlight = submitted;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return submitted;
+}
+
+static TOUCAN_TRANSFER_RESULT LibUsbWaitRead(void *context, UINT32 slot, DWORD timeout, ULONG *transferred) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+	TOUCAN_LIBUSB_SLOT *s = &ctx->slots[slot];
+	TOUCAN_TRANSFER_RESULT result = TOUCAN_TRANSFER_PENDING;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (long)(timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	while ((s->done == FALSE) && (s->inFlight)) {
+		if (pthread_cond_timedwait(&ctx->completed, &ctx->lock, &deadline) != 0) {
+			break;
+		}
+	}
+
+	if (s->done) {
+		s->done = FALSE;
+		result = s->result;
+		*transferred = s->length;
+	}
+	else if (s->inFlight == FALSE) {
+		result = TOUCAN_TRANSFER_FAILED;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	return result;
+}
+
+static void LibUsbCancelReads(void *context) {
+	TOUCAN_LIBUSB_DEVICE *ctx = (TOUCAN_LIBUSB_DEVICE *)context;
+	struct timespec deadline;
+	BOOL pending = FALSE;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (UINT32 i = 0; i < ctx->slotCount; i++) {
+		if (ctx->slots[i].inFlight) {
+			libusb_cancel_transfer(ctx->slots[i].transfer);
+			pending = TRUE;
+		}
+	}
+
+	// Give the cancelled transfers a chance to complete before their buffers are released
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec++;
+	while (pending) {
+		pending = FALSE;
+		for (UINT32 i = 0; i < ctx->slotCount; i++) {
+			pending |= ctx->slots[i].inFlight;
+		}
+		if ((pending) && (pthread_cond_timedwait(&ctx->completed, &ctx->lock, &deadline) != 0)) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+//
+// Fill in the device operations for a TouCAN adapter reached through libusb
+// [in] libusb, state of the device, must outlive it
+// [in] vendorId, productId, USB identifiers, normally TOUCAN_USB_VENDOR_ID and TOUCAN_USB_PRODUCT_ID
+//
+
+void TouCAN_libusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_LIBUSB_DEVICE *libusb, UINT16 vendorId, UINT16 productId) {
+	memset(libusb, 0, sizeof(TOUCAN_LIBUSB_DEVICE));
+	libusb->vendorId = vendorId;
+	libusb->productId = productId;
+
+	device->context = libusb;
+	device->Open = LibUsbOpen;
+	device->Close = LibUsbClose;
+	device->Control = LibUsbControl;
+	device->BulkOut = LibUsbBulkOut;
+
+	device->bulkIn.context = libusb;
+	device->bulkIn.Open = LibUsbReadOpen;
+	device->bulkIn.Close = LibUsbReadClose;
+	device->bulkIn.SubmitRead = LibUsbSubmitRead;
+	device->bulkIn.WaitRead = LibUsbWaitRead;
+	device->bulkIn.CancelReads = LibUsbCancelReads;
+}
+
+#endif
@@ -0,0 +1,264 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Merge
+// Unit Description: Time ordered merge of frames from several buses
+// Function: Combines per source queues into one stream with a min heap over the sources'
+// earliest frames, holding frames for a bounded reorder window behind a watermark
+//
+
+#include "../inc/toucan_merge.h"
+
+#include <string.h>
+
+// Earlier frame first, the lower source breaks a tie so the order is reproducible
+static BOOL Before(const TOUCAN_MERGE *merge, UINT32 a, UINT32 b) {
+	LONGLONG timeA = merge->sources[a].head.hostTime;
+	LONGLONG timeB = merge->sources[b].head.hostTime;
+
+	return (timeA < timeB) || ((timeA == timeB) && (a < b));
+}
+
+static void SiftUp(TOUCAN_MERGE *merge, UINT32 position) {
+	UINT32 source = merge->heap[position];
+	UINT32 parent;
+
+	while (position > 0) {
+		parent = (position - 1) / 2;
+		if (Before(merge, merge->heap[parent], source)) {
+			break;
+		}
+		merge->heap[position] = merge->heap[parent];
+		position = parent;
+	}
+	merge->heap[position] = source;
+}
+
+static void SiftDown(TOUCAN_MERGE *merge, UINT32 position) {
+	UINT32 source = merge->heap[position];
+	UINT32 child;
+
+	for (;;) {
+		child = (position * 2) + 1;
+		if (child >= merge->heapSize) {
+			break;
+		}
+		if (((child + 1) < merge->heapSize) && (Before(merge, merge->heap[child + 1], merge->heap[child]))) {
+			child++;
+		}
+		if (Before(merge, source, merge->heap[child])) {
+			break;
+		}
+		merge->heap[position] = merge->heap[child];
+		position = child;
+	}
+	merge->heap[position] = source;
+}
+
+//
+// Move a source's next queued frame to its head
+// returns FALSE if the source has no frame waiting
+//
+
+static BOOL Advance(TOUCAN_MERGE *merge, UINT32 source) {
+	TOUCAN_MERGE_SOURCE *entry = &merge->sources[source];
+
+	entry->hasHead = TouCAN_ring_pop(&entry->queue, &entry->head);
+	return entry->hasHead;
+}
+
+//
+// Time up to which frames can be released
+// [in] now, current host time, or zero when merging recordings
+//
+
+static LONGLONG Watermark(const TOUCAN_MERGE *merge, LONGLONG now) {
+	LONGLONG watermark = 0x7FFFFFFFFFFFFFFF;
+	LONGLONG bound;
+
+	// Every open source has reached at least this time, a source yet to be heard from holds it back
+	for (UINT32 i = 0; i < merge->count; i++) {
+		if (merge->sources[i].closed == FALSE) {
+			if (merge->sources[i].seen == FALSE) {
+				watermark = -0x7FFFFFFFFFFFFFFF;
+				break;
+			}
+			if (merge->sources[i].latest < watermark) {
+				watermark = merge->sources[i].latest;
+			}
+		}
+	}
+
+	// A lagging source holds the output back for at most the window
+	bound = merge->newest - merge->window;
+	if ((merge->started) && (bound > watermark)) {
+		watermark = bound;
+	}
+	bound = now - merge->window;
+	if ((now > 0) && (bound > watermark)) {
+		watermark = bound;
+	}
+	return watermark;
+}
+
+//
+// Allocate the merge
+// [in] sources, number of sources, at most TOUCAN_MERGE_MAX_SOURCES
+// [in] depth, frames each source can hold, rounded up to a power of two
+// [in] window, reorder window in microseconds, zero selects TOUCAN_MERGE_DEFAULT_WINDOW
+// returns TRUE if the source queues were allocated
+//
+
+BOOL TouCAN_merge_init(TOUCAN_MERGE *merge, UINT32 sources, UINT32 depth, LONGLONG window) {
+	if ((sources == 0) || (sources > TOUCAN_MERGE_MAX_SOURCES)) {
+		return FALSE;
+	}
+
+	memset(merge, 0, sizeof(TOUCAN_MERGE));
+	merge->window = (window > 0) ? window : TOUCAN_MERGE_DEFAULT_WINDOW;
+
+	for (UINT32 i = 0; i < sources; i++) {
+		if (TouCAN_ring_init(&merge->sources[i].queue, depth) == FALSE) {
+			TouCAN_merge_free(merge);
+			return FALSE;
+		}
+		merge->count++;
+	}
+	return TRUE;
+}
+
+void TouCAN_merge_free(TOUCAN_MERGE *merge) {
+	for (UINT32 i = 0; i < merge->count; i++) {
+		TouCAN_ring_free(&merge->sources[i].queue);
+	}
+	merge->count = 0;
+	merge->heapSize = 0;
+}
+
+//
+// Add frames from one source, in the order the source produced them
+// [in] source, index of the source
+// [in] frames, frames with hostTime set
+// returns the number of frames accepted, the others were refused because the source queue was full
+//
+
+UINT32 TouCAN_merge_push(TOUCAN_MERGE *merge, UINT32 source, const TOUCAN_FRAME *frames, UINT32 count) {
+	TOUCAN_MERGE_SOURCE *entry;
+	UINT32 accepted = 0;
+
+	if (source >= merge->count) {
+		return 0;
+	}
+	entry = &merge->sources[source];
+
+	for (UINT32 i = 0; i < count; i++) {
+		if (TouCAN_ring_push(&entry->queue, &frames[i]) == FALSE) {
+			merge->overflows += count - i;
+			break;
+		}
+		accepted++;
+
+		if ((entry->seen == FALSE) || (frames[i].hostTime > entry->latest)) {
+			entry->latest = frames[i].hostTime;
+		}
+		entry->seen = TRUE;
+		if ((merge->started == FALSE) || (frames[i].hostTime > merge->newest)) {
+			merge->newest = frames[i].hostTime;
+		}
+		merge->started = TRUE;
+	}
+
+	// A source that had nothing waiting joins the heap with its earliest frame
+	if ((entry->hasHead == FALSE) && (Advance(merge, source))) {
+		merge->heap[merge->heapSize++] = source;
+		SiftUp(merge, merge->heapSize - 1);
+	}
+	return accepted;
+}
+
+//
+// Frames a source can take before it refuses them, so a caller can leave the rest where they are
+//
+
+UINT32 TouCAN_merge_space(TOUCAN_MERGE *merge, UINT32 source) {
+	if (source >= merge->count) {
+		return 0;
+	}
+	return (merge->sources[source].queue.mask + 1) - TouCAN_ring_count(&merge->sources[source].queue);
+}
+
+//
+// Mark the end of a source, for example a recording read to its end or an adapter closed,
+// so the watermark no longer waits for it
+//
+
+void TouCAN_merge_close_source(TOUCAN_MERGE *merge, UINT32 source) {
+	if (source < merge->count) {
+		merge->sources[source].closed = TRUE;
+	}
+}
+
+//
+// Release the frames the watermark has passed, earliest first
+// [in] now, current host time for live sources, zero when merging recordings
+// [out] frames, released frames
+// [out] sources, optional, the source of each frame
+// [in] maxFrames, capacity of frames and sources
+// returns the number of frames released
+//
+
+UINT32 TouCAN_merge_pop(TOUCAN_MERGE *merge, LONGLONG now, TOUCAN_FRAME *frames, UINT8 *sources, UINT32 maxFrames) {
+	LONGLONG watermark = Watermark(merge, now);
+	TOUCAN_MERGE_SOURCE *entry;
+	UINT32 released = 0;
+	UINT32 source;
+
+	while ((released < maxFrames) && (merge->heapSize > 0)) {
+		source = merge->heap[0];
+		entry = &merge->sources[source];
+		if (entry->head.hostTime > watermark) {
+			break;
+		}
+
+		if ((merge->merged > 0) && (entry->head.hostTime < merge->released)) {
+			merge->late++;
+		}
+		else {
+			merge->released = entry->head.hostTime;
+		}
+
+		frames[released] = entry->head;
+		if (sources != NULL) {
+			sources[released] = (UINT8)source;
+		}
+		released++;
+		merge->merged++;
+
+		// The source's next frame takes its place, or the source leaves the heap until it has more
+		if (Advance(merge, source) == FALSE) {
+			merge->heap[0] = merge->heap[--merge->heapSize];
+		}
+		if (merge->heapSize > 0) {
+			SiftDown(merge, 0);
+		}
+	}
+	return released;
+}
@@ -0,0 +1,480 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Protocol
+// Unit Description: TouCAN vendor requests issued through the selected transport backend
+// Function: Initialises, starts, stops and filters the adapter with class requests and
+// passes frames to and from the backend, independent of how the adapter is reached
+//
+
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <string.h>
+
+// Backend the adapter was opened with, NULL while closed
+static TOUCAN_BACKEND *backend = NULL;
+
+//
+// Open the adapter through a backend, closing any backend opened before
+// [in] selected, filled in by the backend, for example TouCAN_winusb_backend
+// returns TWOCAN_RESULT_SUCCESS or the backend's error result
+//
+
+int TouCAN_open(TOUCAN_BACKEND *selected) {
+	int result;
+
+	TouCAN_close();
+
+	result = selected->Open(selected->context);
+	if (result == TWOCAN_RESULT_SUCCESS) {
+		backend = selected;
+	}
+	return result;
+}
+
+void TouCAN_close(void) {
+	if (backend != NULL) {
+		backend->Close(backend->context);
+		backend = NULL;
+	}
+}
+
+BOOL TouCAN_is_open(void) {
+	return (backend != NULL);
+}
+
+//
+// Issue a class request to the interface of an adapter, the caller holds the request lock
+//
+
+static BOOL Request(TOUCAN_BACKEND *adapter, UINT8 direction, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	if (adapter == NULL) {
+		return FALSE;
+	}
+
+	return adapter->Control(adapter->context, direction | USB_REQ_TYPE_CLASS | USB_REQ_RECIPIENT_INTERFACE,
+		request, data, length, transferred);
+}
+
+//
+// Read the result of the last host to device request, the caller holds the request lock
+//
+
+static BOOL ReadLastErrorCode(TOUCAN_BACKEND *adapter, UINT8 *res)
+{
+	UINT8	LastErrorCode = HAL_ERROR;
+	ULONG	Transfered = 0;
+
+	if (res == NULL)
+		return FALSE;
+
+	if (Request(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_LAST_ERROR_CODE, &LastErrorCode, 1, &Transfered) != TRUE)
+		return FALSE;
+
+	if ((LastErrorCode != HAL_OK) & (Transfered != 1))
+		return FALSE;
+
+	*res = LastErrorCode;
+
+	return TRUE;
+}
+
+//
+// Issue a class request to the interface of an adapter, and for host to device requests
+// confirm with the adapter's last error code that it was carried out
+//
+
+static BOOL ClassRequest(TOUCAN_BACKEND *adapter, UINT8 direction, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	UINT8 res;
+	BOOL result;
+
+	if (adapter == NULL) {
+		return FALSE;
+	}
+
+	// The bus monitor, the filter and the statistics calls issue requests from different threads,
+	// a request slipping in between would overwrite the last error code before it is read.
+	// The last error code belongs to one adapter, so each backend has its own lock.
+	AcquireSRWLockExclusive(adapter->requestLock);
+
+	result = Request(adapter, direction, request, data, length, transferred);
+
+	if ((result) && (direction == USB_HOST_TO_DEVICE)) {
+		result = (ReadLastErrorCode(adapter, &res)) && (res == TouCAN_RETVAL_OK);
+	}
+
+	ReleaseSRWLockExclusive(adapter->requestLock);
+
+	return result;
+}
+
+// NMEA2000 CAN bus speed: 250 kbit
+//sampling point 75%
+//m_Brp = 10;
+//m_Tseg1 = 14;
+//m_Tseg2 = 5;
+//m_Sjw = 4;
+// optionFlags: TouCAN_ENABLE_xxx init flags
+BOOL TouCAN_init(UINT32 optionFlags)
+{
+	return TouCAN_backend_init(backend, optionFlags);
+}
+
+BOOL TouCAN_deinit(void)
+{
+	return TouCAN_backend_deinit(backend);
+}
+
+BOOL TouCAN_start(void)
+{
+	return TouCAN_backend_start(backend);
+}
+
+BOOL TouCAN_stop(void)
+{
+	return TouCAN_backend_stop(backend);
+}
+
+//
+// Requests to an adapter other than the one opened with TouCAN_open,
+// so several adapters can be driven at once
+//
+
+BOOL TouCAN_backend_init(TOUCAN_BACKEND *adapter, UINT32 optionFlags)
+{
+	UINT8	m_Tseg1 = 14;
+	UINT8	m_Tseg2 = 5;
+	UINT8	m_Sjw = 4;
+	UINT16	m_Brp = 10;
+	UINT8	data[9];
+	ULONG	Transfered;
+
+	// tseg1
+	data[0] = m_Tseg1;
+	// tseg2
+	data[1] = m_Tseg2;
+	// sjw
+	data[2] = m_Sjw;
+	// Brp
+	data[3] = (UINT8)((m_Brp >> 8) & 0xFF);
+	data[4] = (UINT8)(m_Brp & 0xFF);
+
+	// flags
+	data[5] = (UINT8)((optionFlags >> 24) & 0xFF);
+	data[6] = (UINT8)((optionFlags >> 16) & 0xFF);
+	data[7] = (UINT8)((optionFlags >> 8) & 0xFF);
+	data[8] = (UINT8)(optionFlags & 0xFF);
+
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CAN_INTERFACE_INIT, data, 9, &Transfered);
+}
+
+BOOL TouCAN_backend_deinit(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CAN_INTERFACE_DEINIT, NULL, 0, NULL);
+}
+
+BOOL TouCAN_backend_start(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CAN_INTERFACE_START, NULL, 0, NULL);
+}
+
+BOOL TouCAN_backend_stop(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CAN_INTERFACE_STOP, NULL, 0, NULL);
+}
+
+// Serial number, sent most significant byte first like the other 32 bit values
+BOOL TouCAN_backend_get_serial_number(TOUCAN_BACKEND *adapter, UINT32 *serial)
+{
+	UINT8	data[4];
+	ULONG	Transfered = 0;
+
+	if (serial == NULL)
+		return FALSE;
+
+	if (ClassRequest(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_SERIAL_NUMBER, data, 4, &Transfered) != TRUE)
+		return FALSE;
+
+	if (Transfered != 4)
+		return FALSE;
+
+	*serial = ((UINT32)data[0] << 24) | ((UINT32)data[1] << 16) | ((UINT32)data[2] << 8) | (UINT32)data[3];
+
+	return TRUE;
+}
+
+BOOL TouCAN_get_serial_number(UINT32 *serial)
+{
+	return TouCAN_backend_get_serial_number(backend, serial);
+}
+
+// CANAL statistics, seven 32 bit counters sent most significant byte first
+BOOL TouCAN_backend_get_statistics(TOUCAN_BACKEND *adapter, TOUCAN_DEVICE_STATISTICS *statistics)
+{
+	UINT8	data[28];
+	UINT32	values[7];
+	ULONG	Transfered = 0;
+
+	if (statistics == NULL)
+		return FALSE;
+
+	if (ClassRequest(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_STATISTICS, data, 28, &Transfered) != TRUE)
+		return FALSE;
+
+	if (Transfered != 28)
+		return FALSE;
+
+	for (UINT32 i = 0; i < 7; i++) {
+		values[i] = ((UINT32)data[i * 4] << 24) | ((UINT32)data[(i * 4) + 1] << 16) | ((UINT32)data[(i * 4) + 2] << 8) | (UINT32)data[(i * 4) + 3];
+	}
+
+	statistics->receiveFrames = values[0];
+	statistics->transmitFrames = values[1];
+	statistics->receiveData = values[2];
+	statistics->transmitData = values[3];
+	statistics->overruns = values[4];
+	statistics->busWarnings = values[5];
+	statistics->busOff = values[6];
+
+	return TRUE;
+}
+
+BOOL TouCAN_backend_clear_statistics(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CLEAR_STATISTICS, NULL, 0, NULL);
+}
+
+BOOL TouCAN_get_statistics(TOUCAN_DEVICE_STATISTICS *statistics)
+{
+	return TouCAN_backend_get_statistics(backend, statistics);
+}
+
+BOOL TouCAN_clear_statistics(void)
+{
+	return TouCAN_backend_clear_statistics(backend);
+}
+
+// HAL_CAN_ERROR_xxx bits the interface has raised since they were last cleared
+BOOL TouCAN_backend_get_interface_error_code(TOUCAN_BACKEND *adapter, UINT32 *ErrorCode)
+{
+	UINT8	data[4];
+	ULONG	Transfered = 0;
+
+	if (ErrorCode == NULL)
+		return FALSE;
+
+	if (ClassRequest(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_CAN_INTERFACE_ERROR_CODE, data, 4, &Transfered) != TRUE)
+		return FALSE;
+
+	if (Transfered != 4)
+		return FALSE;
+
+	*ErrorCode = ((UINT32)data[0] << 24) | ((UINT32)data[1] << 16) | ((UINT32)data[2] << 8) | (UINT32)data[3];
+
+	return TRUE;
+}
+
+BOOL TouCAN_backend_clear_interface_error_code(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_CLEAR_CAN_INTERFACE_ERROR_CODE, NULL, 0, NULL);
+}
+
+// HAL_CAN_STATE_xxx
+BOOL TouCAN_backend_get_interface_state(TOUCAN_BACKEND *adapter, UINT8 *state)
+{
+	UINT8	State = HAL_CAN_STATE_RESET;
+	ULONG	Transfered = 0;
+
+	if (state == NULL)
+		return FALSE;
+
+	if (ClassRequest(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_CAN_INTERFACE_STATE, &State, 1, &Transfered) != TRUE)
+		return FALSE;
+
+	if (Transfered != 1)
+		return FALSE;
+
+	*state = State;
+
+	return TRUE;
+}
+
+// CAN error status, the interface's present error warning, error passive and bus off flags,
+// unlike the error code they clear when the interface leaves the state. The flags are the
+// low bits of the controller's error status register, the same bits as HAL_CAN_ERROR_EWG, EPV and BOF.
+BOOL TouCAN_backend_get_error_status(TOUCAN_BACKEND *adapter, UINT32 *status)
+{
+	UINT8	data[4];
+	ULONG	Transfered = 0;
+
+	if (status == NULL)
+		return FALSE;
+
+	if (ClassRequest(adapter, USB_DEVICE_TO_HOST, TouCAN_GET_CAN_ERROR_STATUS, data, 4, &Transfered) != TRUE)
+		return FALSE;
+
+	// Older firmware answers the flags in a single byte
+	if (Transfered == 1)
+		*status = data[0];
+	else if (Transfered == 4)
+		*status = ((UINT32)data[0] << 24) | ((UINT32)data[1] << 16) | ((UINT32)data[2] << 8) | (UINT32)data[3];
+	else
+		return FALSE;
+
+	*status &= (HAL_CAN_ERROR_EWG | HAL_CAN_ERROR_EPV | HAL_CAN_ERROR_BOF);
+
+	return TRUE;
+}
+
+BOOL TouCAN_get_interface_error_code(UINT32 *ErrorCode)
+{
+	return TouCAN_backend_get_interface_error_code(backend, ErrorCode);
+}
+
+BOOL TouCAN_clear_interface_error_code(void)
+{
+	return TouCAN_backend_clear_interface_error_code(backend);
+}
+
+BOOL TouCAN_get_interface_state(UINT8 *state)
+{
+	return TouCAN_backend_get_interface_state(backend, state);
+}
+
+// Extended acceptance filter, applied by the adapter before frames cross USB
+// type: FILTER_VALUE to pass frames where ((id ^ list) & mask) == 0
+BOOL TouCAN_backend_set_filter_ext_list_mask(TOUCAN_BACKEND *adapter, Filter_Type_TypeDef type, UINT32 list, UINT32 mask)
+{
+	UINT8	data[9];
+	ULONG	Transfered;
+
+	data[0] = (UINT8)type;
+
+	// list
+	data[1] = (UINT8)((list >> 24) & 0xFF);
+	data[2] = (UINT8)((list >> 16) & 0xFF);
+	data[3] = (UINT8)((list >> 8) & 0xFF);
+	data[4] = (UINT8)(list & 0xFF);
+
+	// mask
+	data[5] = (UINT8)((mask >> 24) & 0xFF);
+	data[6] = (UINT8)((mask >> 16) & 0xFF);
+	data[7] = (UINT8)((mask >> 8) & 0xFF);
+	data[8] = (UINT8)(mask & 0xFF);
+
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_SET_FILTER_EXT_LIST_MASK, data, 9, &Transfered);
+}
+
+BOOL TouCAN_backend_filter_ext_accept_all(TOUCAN_BACKEND *adapter)
+{
+	return ClassRequest(adapter, USB_HOST_TO_DEVICE, TouCAN_FILTER_EXT_ACCEPT_ALL, NULL, 0, NULL);
+}
+
+BOOL TouCAN_set_filter_ext_list_mask(Filter_Type_TypeDef type, UINT32 list, UINT32 mask)
+{
+	return TouCAN_backend_set_filter_ext_list_mask(backend, type, list, mask);
+}
+
+BOOL TouCAN_filter_ext_accept_all(void)
+{
+	return TouCAN_backend_filter_ext_accept_all(backend);
+}
+
+BOOL TouCAN_get_last_error_code(UINT8* res)
+{
+	BOOL result;
+
+	if (backend == NULL)
+		return FALSE;
+
+	AcquireSRWLockExclusive(backend->requestLock);
+	result = ReadLastErrorCode(backend, res);
+	ReleaseSRWLockExclusive(backend->requestLock);
+
+	return result;
+}
+
+BOOL TouCAN_write(const unsigned int id, const int dataLength, UINT8* data) {
+	TOUCAN_FRAME	frame;
+	UINT32	written;
+
+	frame.flags = (UINT8)CANAL_IDFLAG_EXTENDED; // Extended message id (29-bit)
+	frame.id = id;
+	frame.length = (UINT8)dataLength;
+	frame.timestamp = 0;
+	memcpy(frame.data, data, TOUCAN_FRAME_DATA_LENGTH);
+
+	return TouCAN_write_batch(&frame, 1, &written);
+}
+
+//
+// Transmit several frames, the backend packs as many as it can into each transfer
+// [in] frames, frames to transmit in order
+// [in] count, number of frames
+// [out] written, number of frames handed to the adapter, valid also on failure
+// returns FALSE if a transfer failed
+//
+
+BOOL TouCAN_write_batch(const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+	*written = 0;
+
+	if (backend == NULL) {
+		return FALSE;
+	}
+	return backend->WriteBatch(backend->context, frames, count, written);
+}
+
+//
+// Start receiving, for USB backends by posting queueDepth reads of bufferSize bytes
+// returns TRUE if the backend is ready to return frames
+//
+
+BOOL TouCAN_read_open(UINT32 queueDepth, UINT32 bufferSize) {
+	if (backend == NULL) {
+		return FALSE;
+	}
+	return backend->ReadOpen(backend->context, queueDepth, bufferSize);
+}
+
+//
+// Wait for received frames
+// [in] timeout, milliseconds to wait
+// [out] frames, receives the frames, valid until the next call
+// [in] maxFrames, capacity of frames
+// [out] count, number of frames received
+// returns TOUCAN_TRANSFER_COMPLETE when frames are available
+//
+
+TOUCAN_TRANSFER_RESULT TouCAN_read_batch(DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	*count = 0;
+
+	if (backend == NULL) {
+		return TOUCAN_TRANSFER_FAILED;
+	}
+	return backend->ReadBatch(backend->context, timeout, frames, maxFrames, count);
+}
+
+void TouCAN_read_close(void) {
+	if (backend != NULL) {
+		backend->ReadClose(backend->context);
+	}
+}
@@ -0,0 +1,675 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+//
+// Unit: TouCAN Replay
+// Unit Description: Transport backend replaying recorded bus traffic
+// Function: Streams a binary capture, candump log or TwoCan raw log through the driver's receive path
+// at the recorded pace, scaled, or as fast as it can be read, and emulates the TouCAN class requests
+//
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_replay.h"
+#include "../inc/toucan_clock.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "../Common/inc/twocanhex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+// Bytes of a TwoCan raw log line, the little endian header followed by the data
+#define TWOCAN_RAW_BYTES 12
+
+// Most frames one read examines, so a filter rejecting a whole looping recording cannot stall the read thread
+#define SCAN_LIMIT 4096
+
+// How long a read that examined SCAN_LIMIT frames without delivering any waits before returning, in microseconds,
+// so the read thread does not spin through a recording the filter rejects
+#define SCAN_PAUSE 1000
+
+static void Pause(LONGLONG micros) {
+#if defined(_WIN32)
+	Sleep((DWORD)((micros + 999) / 1000));
+#else
+	struct timespec interval;
+
+	interval.tv_sec = (time_t)(micros / 1000000);
+	interval.tv_nsec = (long)((micros % 1000000) * 1000);
+	nanosleep(&interval, NULL);
+#endif
+}
+
+static BOOL IsDigit(char c) {
+	return ((c >= '0') && (c <= '9'));
+}
+
+//
+// Parse a candump -l line, "(1436509052.249713) can0 09F80103#A0B1C2D3E4F50617"
+// [out] time, recorded time in microseconds
+// returns FALSE if the line is not a classic CAN frame in that format
+//
+
+static BOOL ParseCandump(const char *line, const char *limit, TOUCAN_FRAME *frame, LONGLONG *time) {
+	ULONGLONG seconds = 0;
+	ULONGLONG fraction = 0;
+	UINT32 places = 0;
+	const char *id;
+	size_t digits;
+
+	if ((line >= limit) || (*line++ != '(')) {
+		return FALSE;
+	}
+	while ((line < limit) && (IsDigit(*line))) {
+		seconds = (seconds * 10) + (ULONGLONG)(*line++ - '0');
+	}
+	if ((line >= limit) || (*line++ != '.')) {
+		return FALSE;
+	}
+	while ((line < limit) && (IsDigit(*line)) && (places < 9)) {
+		fraction = (fraction * 10) + (ULONGLONG)(*line++ - '0');
+		places++;
+	}
+	if ((line >= limit) || (*line++ != ')')) {
+		return FALSE;
+	}
+
+	// candump writes microseconds, other tools more or fewer places
+	for (; places < 6; places++) {
+		fraction *= 10;
+	}
+	for (; places > 6; places--) {
+		fraction /= 10;
+	}
+	*time = (LONGLONG)((seconds * 1000000) + fraction);
+
+	// Interface name
+	while ((line < limit) && (*line == ' ')) {
+		line++;
+	}
+	while ((line < limit) && (*line != ' ')) {
+		line++;
+	}
+	while ((line < limit) && (*line == ' ')) {
+		line++;
+	}
+
+	id = line;
+	while ((line < limit) && (*line != '#')) {
+		line++;
+	}
+	if ((line >= limit) || (DecodeHexValue(id, (size_t)(line - id), &frame->id) != (size_t)(line - id))) {
+		return FALSE;
+	}
+
+	if ((line - id) == 8) {
+		frame->flags = CANAL_IDFLAG_EXTENDED;
+		if (frame->id > 0x1FFFFFFF) {
+			return FALSE;
+		}
+	}
+	else if ((line - id) == 3) {
+		frame->flags = CANAL_IDFLAG_STANDARD;
+		if (frame->id > 0x7FF) {
+			return FALSE;
+		}
+	}
+	else {
+		return FALSE;
+	}
+
+	line++;
+	frame->length = 0;
+	frame->timestamp = (UINT32)*time;
+	memset(frame->data, 0, TOUCAN_FRAME_DATA_LENGTH);
+
+	// Remote frame, optionally followed by its data length code
+	if ((line < limit) && ((*line == 'R') || (*line == 'r'))) {
+		frame->flags |= CANAL_IDFLAG_RTR;
+		line++;
+		if ((line < limit) && (*line >= '0') && (*line <= '8')) {
+			frame->length = (UINT8)(*line++ - '0');
+		}
+	}
+	else {
+		// A second '#' marks a CAN FD frame and is rejected as an invalid digit
+		for (digits = 0; (&line[digits] < limit) && (line[digits] != ' '); digits++);
+		if ((digits > (TOUCAN_FRAME_DATA_LENGTH * 2)) || (DecodeHexString(line, digits, frame->data) != digits)) {
+			return FALSE;
+		}
+		frame->length = (UINT8)(digits / 2);
+		line += digits;
+	}
+
+	return ((line == limit) || (*line == ' '));
+}
+
+//
+// Parse a TwoCan raw log line, "0x03,0x01,0xF8,0x09,0xA0,0xB1,0xC2,0xD3,0xE4,0xF5,0x06,0x17"
+// returns FALSE if the line is not twelve bytes in that format
+//
+
+static BOOL ParseTwoCan(const char *line, const char *limit, TOUCAN_FRAME *frame) {
+	UINT8 bytes[TWOCAN_RAW_BYTES];
+
+	for (UINT32 i = 0; i < TWOCAN_RAW_BYTES; i++) {
+		while ((line < limit) && (*line == ' ')) {
+			line++;
+		}
+		if (((limit - line) < 4) || (line[0] != '0') || ((line[1] != 'x') && (line[1] != 'X')) || (DecodeHexString(&line[2], 2, &bytes[i]) != 2)) {
+			return FALSE;
+		}
+		line += 4;
+
+		if (i < TWOCAN_RAW_BYTES - 1) {
+			if ((line >= limit) || (*line++ != ',')) {
+				return FALSE;
+			}
+		}
+	}
+
+	frame->id = (UINT32)bytes[0] | ((UINT32)bytes[1] << 8) | ((UINT32)bytes[2] << 16) | ((UINT32)bytes[3] << 24);
+	frame->flags = CANAL_IDFLAG_EXTENDED;
+	frame->length = TOUCAN_FRAME_DATA_LENGTH;
+	frame->timestamp = 0;
+	memcpy(frame->data, &bytes[4], TOUCAN_FRAME_DATA_LENGTH);
+
+	while ((line < limit) && (*line == ' ')) {
+		line++;
+	}
+	return (line == limit);
+}
+
+//
+// Take the next line from the read buffer, refilling it from the file as it empties
+// returns FALSE at the end of the file
+//
+
+static BOOL ReadLine(TOUCAN_REPLAY *replay, const char **line, const char **limit) {
+	char *newline;
+	size_t count;
+
+	for (;;) {
+		newline = (char *)memchr(&replay->buffer[replay->start], '\n', replay->end - replay->start);
+		if (newline != NULL) {
+			*line = &replay->buffer[replay->start];
+			*limit = newline;
+			replay->start = (UINT32)(newline - replay->buffer) + 1;
+			return TRUE;
+		}
+
+		if (replay->endOfFile) {
+			// A last line without a newline
+			if (replay->start < replay->end) {
+				*line = &replay->buffer[replay->start];
+				*limit = &replay->buffer[replay->end];
+				replay->start = replay->end;
+				return TRUE;
+			}
+			return FALSE;
+		}
+
+		// A line longer than the buffer is not a frame, parse on from its last block
+		if ((replay->start == 0) && (replay->end == TOUCAN_REPLAY_BUFFER)) {
+			InterlockedIncrement(&replay->rejected);
+			replay->end = 0;
+		}
+
+		// Keep the partial line and fill the buffer behind it
+		memmove(replay->buffer, &replay->buffer[replay->start], replay->end - replay->start);
+		replay->end -= replay->start;
+		replay->start = 0;
+
+		count = fread(&replay->buffer[replay->end], 1, TOUCAN_REPLAY_BUFFER - replay->end, replay->file);
+		replay->end += (UINT32)count;
+		replay->endOfFile = (count == 0);
+	}
+}
+
+//
+// Read the next frame of the recording into replay->next
+// returns FALSE at the end of the recording
+//
+
+static BOOL NextRecorded(TOUCAN_REPLAY *replay) {
+	const char *line;
+	const char *limit;
+	UINT8 direction;
+	BOOL parsed;
+
+	if (replay->mapped) {
+		while (TouCAN_capture_next(&replay->capture, &replay->next, &direction, 1) == 1) {
+			// Frames the driver transmitted were not received from the bus
+			if (direction == TOUCAN_CAPTURE_RECEIVED) {
+				replay->nextTime = replay->next.hostTime;
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+
+	while (ReadLine(replay, &line, &limit)) {
+		while ((limit > line) && ((limit[-1] == '\r') || (limit[-1] == ' ') || (limit[-1] == '\t'))) {
+			limit--;
+		}
+		if (limit == line) {
+			continue;
+		}
+
+		if (replay->format == TOUCAN_REPLAY_FORMAT_CANDUMP) {
+			parsed = ParseCandump(line, limit, &replay->next, &replay->nextTime);
+		}
+		else {
+			// No timestamps, every frame is due as soon as it is read
+			parsed = ParseTwoCan(line, limit, &replay->next);
+			replay->nextTime = 0;
+		}
+
+		if (parsed) {
+			return TRUE;
+		}
+		InterlockedIncrement(&replay->rejected);
+	}
+	return FALSE;
+}
+
+static BOOL Rewind(TOUCAN_REPLAY *replay) {
+	if (replay->mapped) {
+		replay->capture.cursor = 0;
+		return TRUE;
+	}
+
+	replay->start = 0;
+	replay->end = 0;
+	replay->endOfFile = FALSE;
+	return (fseek(replay->file, 0, SEEK_SET) == 0);
+}
+
+//
+// Move on to the next frame, starting a new pass when a looping recording is exhausted
+// returns FALSE once there are no more frames
+//
+
+static BOOL Advance(TOUCAN_REPLAY *replay) {
+	replay->hasNext = NextRecorded(replay);
+	if (replay->hasNext) {
+		return TRUE;
+	}
+
+	InterlockedIncrement(&replay->passes);
+	if ((replay->config.loop) && (Rewind(replay))) {
+		// The next pass is paced from its own first frame
+		replay->paced = FALSE;
+		replay->hasNext = NextRecorded(replay);
+	}
+
+	if (replay->hasNext == FALSE) {
+		WriteRelease(&replay->finished, TRUE);
+	}
+	return replay->hasNext;
+}
+
+static BOOL Accept(const TOUCAN_REPLAY *replay, const TOUCAN_FRAME *frame) {
+	if ((frame->flags & CANAL_IDFLAG_EXTENDED) == 0) {
+		return TRUE;
+	}
+
+	switch (replay->filterType) {
+	case FILTER_REJECT_ALL:
+		return FALSE;
+	case FILTER_VALUE:
+		return (((frame->id ^ replay->filterList) & replay->filterMask) == 0);
+	default:
+		return TRUE;
+	}
+}
+
+//
+// Guess the format from the start of the file, a capture header or the first character of a text log
+//
+
+static UINT32 DetectFormat(FILE *file) {
+	UINT8 start[16];
+	size_t count;
+	size_t i = 0;
+
+	count = fread(start, 1, sizeof(start), file);
+	if ((count >= sizeof(UINT32)) &&
+		(((UINT32)start[0] | ((UINT32)start[1] << 8) | ((UINT32)start[2] << 16) | ((UINT32)start[3] << 24)) == TOUCAN_CAPTURE_MAGIC)) {
+		return TOUCAN_REPLAY_FORMAT_BINARY;
+	}
+
+	while ((i < count) && ((start[i] == ' ') || (start[i] == '\t') || (start[i] == '\r') || (start[i] == '\n'))) {
+		i++;
+	}
+	if (i < count) {
+		if (start[i] == '(') {
+			return TOUCAN_REPLAY_FORMAT_CANDUMP;
+		}
+		if (start[i] == '0') {
+			return TOUCAN_REPLAY_FORMAT_TWOCAN;
+		}
+	}
+	return TOUCAN_REPLAY_FORMAT_AUTO;
+}
+
+static void ReplayClose(void *context) {
+	TOUCAN_REPLAY *ctx = (TOUCAN_REPLAY *)context;
+
+	if (ctx->file != NULL) {
+		fclose(ctx->file);
+		ctx->file = NULL;
+	}
+	if (ctx->mapped) {
+		TouCAN_capture_unmap(&ctx->capture);
+		ctx->mapped = FALSE;
+	}
+	free(ctx->buffer);
+	ctx->buffer = NULL;
+}
+
+static int ReplayError(TOUCAN_REPLAY *ctx, int code) {
+	ReplayClose(ctx);
+	return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, code);
+}
+
+static int ReplayOpen(void *context) {
+	TOUCAN_REPLAY *ctx = (TOUCAN_REPLAY *)context;
+
+	ctx->started = FALSE;
+	ctx->lastError = HAL_OK;
+	ctx->filterType = FILTER_ACCEPT_ALL;
+	ctx->hasNext = FALSE;
+	ctx->paced = FALSE;
+	ctx->frames = 0;
+	ctx->rejected = 0;
+	ctx->passes = 0;
+	ctx->finished = FALSE;
+
+#if defined(_MSC_VER)
+	if (fopen_s(&ctx->file, ctx->config.path, "rb") != 0) {
+		ctx->file = NULL;
+	}
+#else
+	ctx->file = fopen(ctx->config.path, "rb");
+#endif
+	if (ctx->file == NULL) {
+		return ReplayError(ctx, TWOCAN_ERROR_FILE_NOT_FOUND);
+	}
+
+	ctx->format = (ctx->config.format == TOUCAN_REPLAY_FORMAT_AUTO) ? DetectFormat(ctx->file) : ctx->config.format;
+
+	if (ctx->format == TOUCAN_REPLAY_FORMAT_BINARY) {
+		// Captures are mapped rather than read
+		fclose(ctx->file);
+		ctx->file = NULL;
+
+		switch (TouCAN_capture_map(&ctx->capture, ctx->config.path)) {
+		case TOUCAN_CAPTURE_MAPPED:
+			ctx->mapped = TRUE;
+			return TWOCAN_RESULT_SUCCESS;
+		case TOUCAN_CAPTURE_INVALID:
+			return ReplayError(ctx, TWOCAN_ERROR_INVALID_LOGFILE_FORMAT);
+		default:
+			return ReplayError(ctx, TWOCAN_ERROR_FILE_NOT_FOUND);
+		}
+	}
+
+	if ((ctx->format != TOUCAN_REPLAY_FORMAT_CANDUMP) && (ctx->format != TOUCAN_REPLAY_FORMAT_TWOCAN)) {
+		return ReplayError(ctx, TWOCAN_ERROR_INVALID_LOGFILE_FORMAT);
+	}
+
+	ctx->buffer = (char *)malloc(TOUCAN_REPLAY_BUFFER);
+	if ((ctx->buffer == NULL) || (Rewind(ctx) == FALSE)) {
+		return ReplayError(ctx, TWOCAN_ERROR_OPEN_LOGFILE);
+	}
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+//
+// Emulate the TouCAN class requests. Initialisation is accepted as is, the extended
+// acceptance filter is applied to replayed frames as the adapter would.
+// Every host to device request records its outcome for TouCAN_GET_LAST_ERROR_CODE.
+//
+
+static BOOL ReplayControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_REPLAY *ctx = (TOUCAN_REPLAY *)context;
+	BOOL status = TRUE;
+	ULONG answered;
+
+	// The recorded bus has no errors, the interface is error active and listening once started
+	if ((requestType & USB_DEVICE_TO_HOST) != 0) {
+		answered = ((request == TouCAN_GET_CAN_INTERFACE_ERROR_CODE) || (request == TouCAN_GET_CAN_ERROR_STATUS)) ? 4 : 1;
+		if ((data == NULL) || (length < answered)) {
+			return FALSE;
+		}
+
+		switch (request) {
+		case TouCAN_GET_LAST_ERROR_CODE:
+			data[0] = ctx->lastError;
+			break;
+
+		case TouCAN_GET_CAN_INTERFACE_STATE:
+			data[0] = (ctx->started) ? HAL_CAN_STATE_LISTENING : HAL_CAN_STATE_READY;
+			break;
+
+		case TouCAN_GET_CAN_INTERFACE_ERROR_CODE:
+		case TouCAN_GET_CAN_ERROR_STATUS:
+			memset(data, 0, answered);
+			break;
+
+		default:
+			return FALSE;
+		}
+
+		if (transferred != NULL) {
+			*transferred = answered;
+		}
+		return TRUE;
+	}
+
+	switch (request) {
+	case TouCAN_CAN_INTERFACE_INIT:
+		status = ((data != NULL) && (length >= 9));
+		break;
+
+	case TouCAN_CAN_INTERFACE_START:
+		ctx->started = TRUE;
+		break;
+
+	case TouCAN_CAN_INTERFACE_STOP:
+	case TouCAN_CAN_INTERFACE_DEINIT:
+		ctx->started = FALSE;
+		break;
+
+	case TouCAN_FILTER_EXT_ACCEPT_ALL:
+		ctx->filterType = FILTER_ACCEPT_ALL;
+		break;
+
+	case TouCAN_FILTER_EXT_REJECT_ALL:
+		ctx->filterType = FILTER_REJECT_ALL;
+		break;
+
+	case TouCAN_SET_FILTER_EXT_LIST_MASK:
+		if ((data == NULL) || (length < 9) || (data[0] > FILTER_VALUE)) {
+			status = FALSE;
+			break;
+		}
+		ctx->filterType = data[0];
+		ctx->filterList = ((UINT32)data[1] << 24) | ((UINT32)data[2] << 16) | ((UINT32)data[3] << 8) | data[4];
+		ctx->filterMask = ((UINT32)data[5] << 24) | ((UINT32)data[6] << 16) | ((UINT32)data[7] << 8) | data[8];
+		break;
+
+	case TouCAN_CLEAR_CAN_INTERFACE_ERROR_CODE:
+		break;
+
+	default:
+		status = FALSE;
+		break;
+	}
+
+	ctx->lastError = (status) ? HAL_OK : HAL_ERROR;
+	if (transferred != NULL) {
+		*transferred = length;
+	}
+	return TRUE;
+}
+
+static BOOL ReplayReadOpen(void *context, UINT32 queueDepth, UINT32 bufferSize) {
+	TOUCAN_REPLAY *ctx = (TOUCAN_REPLAY *)context;
+
+	// Frames are parsed on demand, there are no reads to post
+	(void)queueDepth;
+	(void)bufferSize;
+	return ((ctx->mapped) || (ctx->file != NULL));
+}
+
+static void ReplayReadClose(void *context) {
+	(void)context;
+}
+
+//
+// Deliver the frames whose scaled recorded time has passed, waiting up to the timeout for the next one
+//
+
+static TOUCAN_TRANSFER_RESULT ReplayReadBatch(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	TOUCAN_REPLAY *ctx = (TOUCAN_REPLAY *)context;
+	LONGLONG now;
+	LONGLONG due;
+	UINT32 delivered = 0;
+	UINT32 examined = 0;
+
+	*count = 0;
+
+	if (maxFrames > TOUCAN_MAX_READ_BATCH) {
+		maxFrames = TOUCAN_MAX_READ_BATCH;
+	}
+
+	// Nothing is received while the interface is stopped, and the recording waits
+	if ((ctx->started == FALSE) || ((ctx->hasNext == FALSE) && ((ctx->finished) || (Advance(ctx) == FALSE)))) {
+		Pause((LONGLONG)timeout * 1000);
+		return TOUCAN_TRANSFER_PENDING;
+	}
+
+	now = HostMicroseconds();
+	if (ctx->paced == FALSE) {
+		ctx->firstTime = ctx->nextTime;
+		ctx->startClock = now;
+		ctx->paced = TRUE;
+	}
+
+	for (;;) {
+		due = now;
+		while ((ctx->hasNext) && (delivered < maxFrames) && (examined < SCAN_LIMIT)) {
+			if (ctx->config.speed > 0) {
+				due = ctx->startClock + (((ctx->nextTime - ctx->firstTime) * TOUCAN_REPLAY_REAL_TIME) / ctx->config.speed);
+				if (due > now) {
+					break;
+				}
+			}
+
+			if (Accept(ctx, &ctx->next)) {
+				frames[delivered++] = ctx->next;
+			}
+			examined++;
+			if ((Advance(ctx)) && (ctx->paced == FALSE)) {
+				// A new pass starts where the previous one ended
+				ctx->firstTime = ctx->nextTime;
+				ctx->startClock = now;
+				ctx->paced = TRUE;
+			}
+		}
+
+		if (delivered > 0) {
+			InterlockedExchangeAdd(&ctx->frames, (LONG)delivered);
+			*count = delivered;
+			return TOUCAN_TRANSFER_COMPLETE;
+		}
+
+		if (ctx->hasNext == FALSE) {
+			return TOUCAN_TRANSFER_PENDING;
+		}
+		if (examined == SCAN_LIMIT) {
+			Pause(SCAN_PAUSE);
+			return TOUCAN_TRANSFER_PENDING;
+		}
+
+		// The next frame is not yet due
+		if (due - now >= (LONGLONG)timeout * 1000) {
+			Pause((LONGLONG)timeout * 1000);
+			return TOUCAN_TRANSFER_PENDING;
+		}
+		Pause(due - now);
+		now = HostMicroseconds();
+	}
+}
+
+//
+// Transmitted frames leave the adapter and are not seen again
+//
+
+static BOOL ReplayWriteBatch(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+	TOUCAN_REPLAY *replay = (TOUCAN_REPLAY *)context;
+	(void)frames;
+
+	InterlockedIncrement(&replay->transmitted.transfers);
+	InterlockedExchangeAdd(&replay->transmitted.frames, (LONG)count);
+	*written = count;
+	return TRUE;
+}
+
+//
+// Fill in the backend operations for a replayed recording
+// [in] replay, state of the backend, must outlive it
+// [in] config, recording, format, speed and looping, copied
+//
+
+void TouCAN_replay_backend(TOUCAN_BACKEND *backend, TOUCAN_REPLAY *replay, const TOUCAN_REPLAY_CONFIG *config) {
+	memset(replay, 0, sizeof(TOUCAN_REPLAY));
+	memcpy(&replay->config, config, sizeof(TOUCAN_REPLAY_CONFIG));
+	replay->config.path[TOUCAN_REPLAY_MAX_PATH - 1] = '\0';
+
+	backend->name = "Replay";
+	backend->context = replay;
+	backend->Open = ReplayOpen;
+	backend->Close = ReplayClose;
+	backend->Control = ReplayControl;
+	backend->ReadOpen = ReplayReadOpen;
+	backend->ReadBatch = ReplayReadBatch;
+	backend->ReadClose = ReplayReadClose;
+	backend->WriteBatch = ReplayWriteBatch;
+	backend->transmitted = &replay->transmitted;
+	InitializeSRWLock(&replay->requestLock);
+	backend->requestLock = &replay->requestLock;
+	backend->filterBanks = 0;
+}
+
+void TouCAN_replay_statistics(TOUCAN_REPLAY *replay, TOUCAN_REPLAY_STATISTICS *statistics) {
+	statistics->frames = (UINT32)ReadAcquire(&replay->frames);
+	statistics->rejected = (UINT32)ReadAcquire(&replay->rejected);
+	statistics->passes = (UINT32)ReadAcquire(&replay->passes);
+	statistics->finished = (BOOL)ReadAcquire(&replay->finished);
+}
@@ -0,0 +1,180 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Ring
+// Unit Description: Single producer, single consumer receive queue
+// Function: Buffers decoded frames between the read thread and the plugin so that
+// bursts of up to three frames per USB packet are not overwritten before they are consumed
+//
+
+#include "../inc/toucan_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Allocate the ring
+// [in] ring, pointer to ring
+// [in] depth, requested number of frames, rounded up to a power of two
+// returns TRUE if the frame storage was allocated
+//
+
+BOOL TouCAN_ring_init(TOUCAN_RING *ring, UINT32 depth) {
+	UINT32 size = TOUCAN_RING_MIN_DEPTH;
+
+	if (ring == NULL) {
+		return FALSE;
+	}
+
+	if (depth > TOUCAN_RING_MAX_DEPTH) {
+		depth = TOUCAN_RING_MAX_DEPTH;
+	}
+
+	while (size < depth) {
+		size <<= 1;
+	}
+
+	memset(ring, 0, sizeof(TOUCAN_RING));
+	ring->frames = (TOUCAN_FRAME *)calloc(size, sizeof(TOUCAN_FRAME));
+	if (ring->frames == NULL) {
+		return FALSE;
+	}
+	ring->mask = size - 1;
+	return TRUE;
+}
+
+//
+// Release the frame storage
+// Only valid once both the producer and the consumer have stopped
+//
+
+void TouCAN_ring_free(TOUCAN_RING *ring) {
+	if ((ring != NULL) && (ring->frames != NULL)) {
+		free(ring->frames);
+		ring->frames = NULL;
+		ring->mask = 0;
+	}
+}
+
+//
+// Discard any queued frames and clear the counters
+// Only valid once both the producer and the consumer have stopped
+//
+
+void TouCAN_ring_reset(TOUCAN_RING *ring) {
+	ring->head = 0;
+	ring->tail = 0;
+	ring->overflows = 0;
+	ring->highWater = 0;
+}
+
+//
+// Producer side, append a frame
+// [in] frame, the decoded frame
+// returns FALSE and increments the overflow counter if the ring is full
+//
+
+BOOL TouCAN_ring_push(TOUCAN_RING *ring, const TOUCAN_FRAME *frame) {
+	UINT32 head = (UINT32)ReadNoFence(&ring->head);
+	UINT32 tail = (UINT32)ReadAcquire(&ring->tail);
+	UINT32 queued = head - tail;
+
+	if (queued > ring->mask) {
+		InterlockedIncrement(&ring->overflows);
+		return FALSE;
+	}
+
+	ring->frames[head & ring->mask] = *frame;
+
+	// Publish the frame only after it has been completely written
+	WriteRelease(&ring->head, (LONG)(head + 1));
+
+	if ((queued + 1) > (UINT32)ReadNoFence(&ring->highWater)) {
+		WriteNoFence(&ring->highWater, (LONG)(queued + 1));
+	}
+	return TRUE;
+}
+
+//
+// Consumer side, remove the oldest frame
+// [out] frame, receives the frame
+// returns FALSE if the ring is empty
+//
+
+BOOL TouCAN_ring_pop(TOUCAN_RING *ring, TOUCAN_FRAME *frame) {
+	UINT32 tail = (UINT32)ReadNoFence(&ring->tail);
+	UINT32 head = (UINT32)ReadAcquire(&ring->head);
+
+	if (head == tail) {
+		return FALSE;
+	}
+
+	*frame = ring->frames[tail & ring->mask];
+
+	// Hand the slot back to the producer only after it has been copied
+	WriteRelease(&ring->tail, (LONG)(tail + 1));
+	return TRUE;
+}
+
+//
+// Consumer side, remove up to maxFrames frames in a single pass
+// [out] frames, receives the frames in arrival order
+// [in] maxFrames, capacity of frames
+// returns the number of frames copied
+//
+
+UINT32 TouCAN_ring_drain(TOUCAN_RING *ring, TOUCAN_FRAME *frames, UINT32 maxFrames) {
+	UINT32 tail = (UINT32)ReadNoFence(&ring->tail);
+	UINT32 head = (UINT32)ReadAcquire(&ring->head);
+	UINT32 count = head - tail;
+	UINT32 first;
+
+	if (count > maxFrames) {
+		count = maxFrames;
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	// Copy in at most two contiguous runs, before and after the wrap point
+	first = (ring->mask + 1) - (tail & ring->mask);
+	if (first > count) {
+		first = count;
+	}
+	memcpy(frames, &ring->frames[tail & ring->mask], first * sizeof(TOUCAN_FRAME));
+	if (count > first) {
+		memcpy(&frames[first], &ring->frames[0], (count - first) * sizeof(TOUCAN_FRAME));
+	}
+
+	WriteRelease(&ring->tail, (LONG)(tail + count));
+	return count;
+}
+
+//
+// Number of frames currently queued, exact only when called from the producer or consumer
+//
+
+UINT32 TouCAN_ring_count(TOUCAN_RING *ring) {
+	UINT32 head = (UINT32)ReadAcquire(&ring->head);
+	UINT32 tail = (UINT32)ReadAcquire(&ring->tail);
+	return head - tail;
+}
@@ -0,0 +1,700 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Simulated USB
+// Unit Description: Simulated TouCAN adapter on a simulated NMEA 2000 bus
+// Function: Answers the class requests like the firmware and produces bulk IN packets from
+// configurable background and burst traffic, with coalescing, overruns and injected faults,
+// all on a virtual clock so a session is reproducible and runs without an adapter
+//
+
+#include "../inc/toucan_simusb.h"
+#include "../inc/toucan_decode.h"
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <string.h>
+
+// Background traffic when the configuration names no identifiers: priority, PGN and source
+// of the rapid navigation messages, all single frame
+static const UINT32 defaultIds[] = {
+	TOUCAN_PDU2_ID(2, 127250, 0x23),		// Vessel heading
+	TOUCAN_PDU2_ID(2, 127251, 0x23),		// Rate of turn
+	TOUCAN_PDU2_ID(3, 127257, 0x23),		// Attitude
+	TOUCAN_PDU2_ID(2, 128259, 0x11),		// Speed through water
+	TOUCAN_PDU2_ID(3, 128267, 0x11),		// Water depth
+	TOUCAN_PDU2_ID(2, 129025, 0x05),		// Position, rapid update
+	TOUCAN_PDU2_ID(2, 129026, 0x05),		// COG and SOG, rapid update
+	TOUCAN_PDU2_ID(2, 130306, 0x0A)		// Wind data
+};
+
+static void Lock(TOUCAN_SIM_USB *sim) {
+	while (InterlockedCompareExchange(&sim->lock, 1, 0) != 0) {
+	}
+}
+
+static void Unlock(TOUCAN_SIM_USB *sim) {
+	InterlockedExchange(&sim->lock, 0);
+}
+
+static UINT32 Random(TOUCAN_SIM_USB *sim) {
+	sim->random ^= sim->random << 13;
+	sim->random ^= sim->random >> 17;
+	sim->random ^= sim->random << 5;
+	return sim->random;
+}
+
+//
+// Decide whether an event with a rate in parts per million happens this time
+//
+
+static BOOL Chance(TOUCAN_SIM_USB *sim, UINT32 rate) {
+	return ((rate > 0) && ((Random(sim) % TOUCAN_SIM_RATE_SCALE) < rate));
+}
+
+static LONGLONG AirTime(const TOUCAN_SIM_USB *sim, UINT32 length) {
+	return ((LONGLONG)(TOUCAN_SIM_FRAME_OVERHEAD + (8 * length)) * 1000000) / sim->config.bitrate;
+}
+
+static UINT32 DeviceTicks(const TOUCAN_SIM_USB *sim, LONGLONG time) {
+	return (UINT32)(time + ((time * sim->config.drift) / 1000000));
+}
+
+//
+// Gap before the next background frame, spread evenly over half to one and a half times
+// the mean gap the bus load gives
+//
+
+static LONGLONG BackgroundGap(TOUCAN_SIM_USB *sim) {
+	LONGLONG mean = (AirTime(sim, TOUCAN_FRAME_DATA_LENGTH) * 100) / sim->config.busLoad;
+
+	return (mean / 2) + (LONGLONG)(Random(sim) % (UINT32)(mean + 1));
+}
+
+//
+// Queue the next generated frame on the bus. Bursts and background traffic are scheduled
+// independently, a frame starts when it is scheduled or when the bus becomes free.
+//
+
+static void Generate(TOUCAN_SIM_USB *sim) {
+	LONGLONG scheduled;
+	UINT32 sequence;
+
+	if ((sim->burstRemaining > 0) && (sim->burstTime <= sim->backgroundTime)) {
+		scheduled = sim->burstTime;
+		if (--sim->burstRemaining == 0) {
+			sim->burstTime += sim->config.burstPeriod;
+			sim->burstRemaining = sim->config.burstFrames;
+		}
+	}
+	else if (sim->backgroundTime != TOUCAN_SIM_NEVER) {
+		scheduled = sim->backgroundTime;
+		sim->backgroundTime += BackgroundGap(sim);
+	}
+	else {
+		sim->nextStart = TOUCAN_SIM_NEVER;
+		sim->nextTime = TOUCAN_SIM_NEVER;
+		return;
+	}
+
+	// The first four data bytes number the frames, so a consumer can count the ones it lost
+	sequence = sim->sequence++;
+	sim->next.id = sim->ids[Random(sim) % sim->config.idCount];
+	sim->next.flags = TOUCAN_FRAME_EXTENDED;
+	sim->next.length = TOUCAN_FRAME_DATA_LENGTH;
+	sim->next.data[0] = (UINT8)sequence;
+	sim->next.data[1] = (UINT8)(sequence >> 8);
+	sim->next.data[2] = (UINT8)(sequence >> 16);
+	sim->next.data[3] = (UINT8)(sequence >> 24);
+	for (UINT32 i = 4; i < TOUCAN_FRAME_DATA_LENGTH; i++) {
+		sim->next.data[i] = (UINT8)Random(sim);
+	}
+
+	sim->nextStart = (scheduled > sim->busFree) ? scheduled : sim->busFree;
+	sim->nextTime = sim->nextStart + AirTime(sim, TOUCAN_FRAME_DATA_LENGTH);
+	sim->statistics.generated++;
+}
+
+static BOOL Accept(const TOUCAN_SIM_USB *sim, UINT32 id) {
+	switch (sim->filterType) {
+	case FILTER_ACCEPT_ALL:
+		return TRUE;
+
+	case FILTER_VALUE:
+		return (((id ^ sim->filterList) & sim->filterMask) == 0);
+
+	default:
+		return FALSE;
+	}
+}
+
+//
+// A frame has been received by the adapter at time, store it in the FIFO if the
+// interface is started and the acceptance filter passes it
+//
+
+static void Capture(TOUCAN_SIM_USB *sim, const TOUCAN_FRAME *frame, LONGLONG time) {
+	TOUCAN_FRAME *entry;
+
+	if (sim->state != HAL_CAN_STATE_LISTENING) {
+		return;
+	}
+
+	if (Accept(sim, frame->id) == FALSE) {
+		sim->statistics.filtered++;
+		return;
+	}
+
+	if (sim->fifoCount == TOUCAN_SIM_FIFO_DEPTH) {
+		sim->statistics.overruns++;
+		sim->errorCode |= HAL_CAN_ERROR_RX_FOV0;
+		return;
+	}
+
+	entry = &sim->fifo[(sim->fifoHead + sim->fifoCount) % TOUCAN_SIM_FIFO_DEPTH];
+	*entry = *frame;
+	entry->timestamp = DeviceTicks(sim, time);
+	entry->hostTime = 0;
+	sim->fifoCount++;
+	sim->statistics.received++;
+	sim->statistics.receiveData += frame->length;
+}
+
+static LONGLONG NextArrival(const TOUCAN_SIM_USB *sim) {
+	if ((sim->loopbackCount > 0) && (sim->loopbackTimes[sim->loopbackHead] <= sim->nextTime)) {
+		return sim->loopbackTimes[sim->loopbackHead];
+	}
+	return sim->nextTime;
+}
+
+//
+// Receive every frame, generated or looped back, that has left the bus by until
+//
+
+static void Fill(TOUCAN_SIM_USB *sim, LONGLONG until) {
+	LONGLONG time;
+
+	while ((time = NextArrival(sim)) <= until) {
+		if ((sim->loopbackCount > 0) && (sim->loopbackTimes[sim->loopbackHead] == time)) {
+			Capture(sim, &sim->loopbackFrames[sim->loopbackHead], time);
+			sim->loopbackHead = (sim->loopbackHead + 1) % TOUCAN_SIM_LOOPBACK_DEPTH;
+			sim->loopbackCount--;
+		}
+		else {
+			Capture(sim, &sim->next, time);
+			if (time > sim->busFree) {
+				sim->busFree = time;
+			}
+			Generate(sim);
+		}
+	}
+}
+
+static void Pace(const TOUCAN_SIM_USB *sim, LONGLONG now) {
+	if (sim->config.Pace != NULL) {
+		sim->config.Pace(sim->config.paceContext, now);
+	}
+}
+
+static int SimOpen(void *context) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+
+	Lock(sim);
+	sim->open = TRUE;
+	Unlock(sim);
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+static void SimClose(void *context) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+
+	Lock(sim);
+	sim->open = FALSE;
+	sim->state = HAL_CAN_STATE_RESET;
+	sim->fifoCount = 0;
+	Unlock(sim);
+}
+
+static UINT32 ReadBigEndian(const UINT8 *data) {
+	return ((UINT32)data[0] << 24) | ((UINT32)data[1] << 16) | ((UINT32)data[2] << 8) | data[3];
+}
+
+static void WriteBigEndian(UINT8 *data, UINT32 value) {
+	data[0] = (UINT8)(value >> 24);
+	data[1] = (UINT8)(value >> 16);
+	data[2] = (UINT8)(value >> 8);
+	data[3] = (UINT8)value;
+}
+
+//
+// Answer a device to host request
+// returns the number of bytes written to data, 0 if the request is not supported
+//
+
+static UINT16 GetRequest(TOUCAN_SIM_USB *sim, UINT8 request, UINT8 *data, UINT16 length) {
+	const TOUCAN_SIM_STATISTICS *statistics = &sim->statistics;
+
+	switch (request) {
+	case TouCAN_GET_LAST_ERROR_CODE:
+		if (length < 1) {
+			return 0;
+		}
+		data[0] = sim->status;
+		return 1;
+
+	case TouCAN_GET_CAN_INTERFACE_STATE:
+		if (length < 1) {
+			return 0;
+		}
+		data[0] = sim->state;
+		return 1;
+
+	case TouCAN_GET_CAN_INTERFACE_ERROR_CODE:
+		if (length < 4) {
+			return 0;
+		}
+		WriteBigEndian(data, sim->errorCode);
+		return 4;
+
+	case TouCAN_GET_CAN_ERROR_STATUS:
+		// The simulated bus has no error counters, the interface stays error active
+		if (length < 4) {
+			return 0;
+		}
+		WriteBigEndian(data, 0);
+		return 4;
+
+	case TouCAN_GET_STATISTICS:
+		// CANAL statistics: frames and data bytes received and transmitted, overruns, bus warnings and bus off
+		if (length < 28) {
+			return 0;
+		}
+		WriteBigEndian(&data[0], statistics->received);
+		WriteBigEndian(&data[4], statistics->transmitted);
+		WriteBigEndian(&data[8], statistics->receiveData);
+		WriteBigEndian(&data[12], statistics->transmitData);
+		WriteBigEndian(&data[16], statistics->overruns);
+		WriteBigEndian(&data[20], 0);
+		WriteBigEndian(&data[24], 0);
+		return 28;
+
+	default:
+		return 0;
+	}
+}
+
+//
+// Carry out a host to device request
+// returns the HAL status the firmware would report for it
+//
+
+static UINT8 SetRequest(TOUCAN_SIM_USB *sim, UINT8 request, const UINT8 *data, UINT16 length) {
+	switch (request) {
+	case TouCAN_RESET:
+	case TouCAN_CAN_INTERFACE_DEINIT:
+		sim->state = HAL_CAN_STATE_RESET;
+		sim->fifoCount = 0;
+		return HAL_OK;
+
+	case TouCAN_CAN_INTERFACE_INIT:
+		if ((data == NULL) || (length < 9) || (sim->state == HAL_CAN_STATE_LISTENING)) {
+			sim->errorCode |= HAL_CAN_ERROR_PARAM;
+			return HAL_ERROR;
+		}
+		sim->loopback = ((ReadBigEndian(&data[5]) & TouCAN_ENABLE_LOOPBACK_MODE) != 0);
+		sim->state = HAL_CAN_STATE_READY;
+		return HAL_OK;
+
+	case TouCAN_CAN_INTERFACE_START:
+		if (sim->state != HAL_CAN_STATE_READY) {
+			sim->errorCode |= HAL_CAN_ERROR_NOT_READY;
+			return HAL_ERROR;
+		}
+		// Traffic already on the bus is not received
+		Fill(sim, sim->now);
+		sim->state = HAL_CAN_STATE_LISTENING;
+		return HAL_OK;
+
+	case TouCAN_CAN_INTERFACE_STOP:
+		if (sim->state != HAL_CAN_STATE_LISTENING) {
+			sim->errorCode |= HAL_CAN_ERROR_NOT_STARTED;
+			return HAL_ERROR;
+		}
+		sim->state = HAL_CAN_STATE_READY;
+		return HAL_OK;
+
+	case TouCAN_FILTER_EXT_ACCEPT_ALL:
+		sim->filterType = FILTER_ACCEPT_ALL;
+		return HAL_OK;
+
+	case TouCAN_FILTER_EXT_REJECT_ALL:
+		sim->filterType = FILTER_REJECT_ALL;
+		return HAL_OK;
+
+	case TouCAN_SET_FILTER_EXT_LIST_MASK:
+		if ((data == NULL) || (length < 9) || (data[0] > FILTER_VALUE)) {
+			sim->errorCode |= HAL_CAN_ERROR_PARAM;
+			return HAL_ERROR;
+		}
+		sim->filterType = data[0];
+		sim->filterList = ReadBigEndian(&data[1]);
+		sim->filterMask = ReadBigEndian(&data[5]);
+		return HAL_OK;
+
+	case TouCAN_CLEAR_STATISTICS:
+		memset(&sim->statistics, 0, sizeof(TOUCAN_SIM_STATISTICS));
+		return HAL_OK;
+
+	case TouCAN_CLEAR_LAST_ERROR_CODE:
+		return HAL_OK;
+
+	case TouCAN_CLEAR_CAN_INTERFACE_ERROR_CODE:
+		sim->errorCode = HAL_CAN_ERROR_NONE;
+		return HAL_OK;
+
+	default:
+		return HAL_ERROR;
+	}
+}
+
+//
+// Answer a class request like the firmware: host to device requests report their
+// outcome through TouCAN_GET_LAST_ERROR_CODE, device to host requests fail the transfer
+// when they are not supported
+//
+
+static BOOL SimControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+	UINT16 answered;
+
+	Lock(sim);
+
+	if (sim->open == FALSE) {
+		Unlock(sim);
+		return FALSE;
+	}
+
+	if ((requestType & USB_DEVICE_TO_HOST) != 0) {
+		answered = (data != NULL) ? GetRequest(sim, request, data, length) : 0;
+		Unlock(sim);
+
+		if (answered == 0) {
+			return FALSE;
+		}
+		if (transferred != NULL) {
+			*transferred = answered;
+		}
+		return TRUE;
+	}
+
+	if (Chance(sim, sim->config.requestErrorRate)) {
+		sim->statistics.requestErrors++;
+		sim->status = HAL_ERROR;
+	}
+	else {
+		sim->status = SetRequest(sim, request, data, length);
+	}
+	Unlock(sim);
+
+	if (transferred != NULL) {
+		*transferred = length;
+	}
+	return TRUE;
+}
+
+//
+// Transmit the records of a bulk OUT transfer. The adapter accepts a frame once it can start
+// sending it, so a backlog moves the virtual clock on. In loopback mode the frame is also
+// received when it leaves the bus.
+//
+
+static BOOL SimBulkOut(void *context, const UINT8 *data, UINT32 length) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+	TOUCAN_FRAME frames[TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	LONGLONG start;
+	UINT32 count;
+	UINT32 slot;
+
+	if (TouCAN_decode_packet(data, length, frames, TOUCAN_MAX_RECORDS_PER_TRANSFER, &count) == FALSE) {
+		return FALSE;
+	}
+
+	Lock(sim);
+
+	if ((sim->open == FALSE) || (sim->state != HAL_CAN_STATE_LISTENING)) {
+		Unlock(sim);
+		return FALSE;
+	}
+
+	for (UINT32 i = 0; i < count; i++) {
+		start = (sim->busFree > sim->now) ? sim->busFree : sim->now;
+
+		// A generated frame already on the bus goes first, one not yet started waits for this one
+		if (sim->nextStart <= start) {
+			if (sim->nextTime > start) {
+				start = sim->nextTime;
+			}
+			sim->busFree = start + AirTime(sim, frames[i].length);
+		}
+		else {
+			sim->busFree = start + AirTime(sim, frames[i].length);
+			if ((sim->nextTime != TOUCAN_SIM_NEVER) && (sim->nextStart < sim->busFree)) {
+				sim->nextStart = sim->busFree;
+				sim->nextTime = sim->busFree + AirTime(sim, sim->next.length);
+			}
+		}
+		sim->now = start;
+		sim->statistics.transmitted++;
+		sim->statistics.transmitData += frames[i].length;
+
+		if (sim->loopback) {
+			if (sim->loopbackCount == TOUCAN_SIM_LOOPBACK_DEPTH) {
+				sim->statistics.overruns++;
+				continue;
+			}
+			slot = (sim->loopbackHead + sim->loopbackCount) % TOUCAN_SIM_LOOPBACK_DEPTH;
+			sim->loopbackFrames[slot] = frames[i];
+			sim->loopbackTimes[slot] = sim->busFree;
+			sim->loopbackCount++;
+		}
+	}
+
+	Unlock(sim);
+	return TRUE;
+}
+
+static BOOL SimReadOpen(void *context, UINT32 queueDepth) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+	BOOL open;
+
+	(void)queueDepth;
+
+	Lock(sim);
+	memset(sim->buffers, 0, sizeof(sim->buffers));
+	open = sim->open;
+	Unlock(sim);
+	return open;
+}
+
+static void SimReadClose(void *context) {
+	(void)context;
+}
+
+static BOOL SimSubmitRead(void *context, UINT32 slot, UINT8 *buffer, UINT32 length) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+	BOOL open;
+
+	Lock(sim);
+	sim->buffers[slot] = buffer;
+	sim->bufferLengths[slot] = length;
+	open = sim->open;
+	Unlock(sim);
+	return open;
+}
+
+//
+// Complete the read of a slot with the records waiting in the adapter FIFO. With the FIFO
+// empty the virtual clock moves to the first USB frame after the next arrival, or by the
+// whole timeout when nothing arrives in time.
+//
+
+static TOUCAN_TRANSFER_RESULT SimWaitRead(void *context, UINT32 slot, DWORD timeout, ULONG *transferred) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+	LONGLONG deadline;
+	LONGLONG arrival;
+	LONGLONG now;
+	UINT32 records;
+	UINT32 length;
+	UINT32 ticks;
+	UINT8 *buffer;
+
+	Lock(sim);
+
+	buffer = sim->buffers[slot];
+	if ((sim->open == FALSE) || (buffer == NULL)) {
+		Unlock(sim);
+		return TOUCAN_TRANSFER_FAILED;
+	}
+
+	deadline = sim->now + ((LONGLONG)timeout * 1000);
+	Fill(sim, sim->now);
+
+	while (sim->fifoCount == 0) {
+		arrival = NextArrival(sim);
+		if (arrival > deadline) {
+			sim->now = deadline;
+			Unlock(sim);
+			Pace(sim, deadline);
+			return TOUCAN_TRANSFER_PENDING;
+		}
+
+		arrival = ((arrival + TOUCAN_SIM_USB_FRAME - 1) / TOUCAN_SIM_USB_FRAME) * TOUCAN_SIM_USB_FRAME;
+		if (arrival > sim->now) {
+			sim->now = arrival;
+		}
+		Fill(sim, sim->now);
+	}
+
+	records = sim->fifoCount;
+	if (records > sim->config.maxCoalesce) {
+		records = sim->config.maxCoalesce;
+	}
+	if (records > sim->bufferLengths[slot] / TOUCAN_RECORD_LENGTH) {
+		records = sim->bufferLengths[slot] / TOUCAN_RECORD_LENGTH;
+	}
+
+	length = 0;
+	for (UINT32 i = 0; i < records; i++) {
+		const TOUCAN_FRAME *frame = &sim->fifo[sim->fifoHead];
+
+		TouCAN_encode_record(frame, &buffer[length]);
+		ticks = TWOCAN_FROM_BE32(frame->timestamp);
+		memcpy(&buffer[length + TOUCAN_RECORD_TIMESTAMP], &ticks, sizeof(UINT32));
+		length += TOUCAN_RECORD_LENGTH;
+
+		sim->fifoHead = (sim->fifoHead + 1) % TOUCAN_SIM_FIFO_DEPTH;
+		sim->fifoCount--;
+	}
+
+	sim->buffers[slot] = NULL;
+	sim->statistics.packets++;
+	now = sim->now;
+
+	if (Chance(sim, sim->config.transferErrorRate)) {
+		sim->statistics.transferErrors++;
+		sim->statistics.lost += records;
+		Unlock(sim);
+		Pace(sim, now);
+		return TOUCAN_TRANSFER_FAILED;
+	}
+
+	if (Chance(sim, sim->config.malformedRate)) {
+		sim->statistics.malformedPackets++;
+		sim->statistics.lost += records;
+		length -= TOUCAN_RECORD_LENGTH / 2;
+	}
+	else {
+		sim->statistics.delivered += records;
+	}
+
+	Unlock(sim);
+	Pace(sim, now);
+	*transferred = length;
+	return TOUCAN_TRANSFER_COMPLETE;
+}
+
+static void SimCancelReads(void *context) {
+	TOUCAN_SIM_USB *sim = (TOUCAN_SIM_USB *)context;
+
+	Lock(sim);
+	memset(sim->buffers, 0, sizeof(sim->buffers));
+	Unlock(sim);
+}
+
+//
+// Fill in the device operations of a simulated adapter
+// [in] sim, state of the adapter, must outlive it
+// [in] config, traffic and faults, copied, NULL for an idle bus
+//
+
+void TouCAN_simusb_device(TOUCAN_USB_DEVICE *device, TOUCAN_SIM_USB *sim, const TOUCAN_SIM_CONFIG *config) {
+	memset(sim, 0, sizeof(TOUCAN_SIM_USB));
+	if (config != NULL) {
+		sim->config = *config;
+	}
+
+	if (sim->config.bitrate == 0) {
+		sim->config.bitrate = TOUCAN_SIM_DEFAULT_BITRATE;
+	}
+	if (sim->config.busLoad > 100) {
+		sim->config.busLoad = 100;
+	}
+	if ((sim->config.maxCoalesce == 0) || (sim->config.maxCoalesce > TOUCAN_MAX_RECORDS_PER_TRANSFER)) {
+		sim->config.maxCoalesce = TOUCAN_MAX_RECORDS_PER_TRANSFER;
+	}
+	if ((sim->config.ids == NULL) || (sim->config.idCount == 0)) {
+		sim->config.ids = defaultIds;
+		sim->config.idCount = sizeof(defaultIds) / sizeof(defaultIds[0]);
+	}
+	if (sim->config.idCount > TOUCAN_SIM_MAX_IDS) {
+		sim->config.idCount = TOUCAN_SIM_MAX_IDS;
+	}
+	memcpy(sim->ids, sim->config.ids, sim->config.idCount * sizeof(UINT32));
+	sim->config.ids = sim->ids;
+
+	// xorshift has no zero state
+	sim->random = (sim->config.seed != 0) ? sim->config.seed : 0x2545F491;
+	sim->status = HAL_OK;
+	sim->state = HAL_CAN_STATE_RESET;
+	sim->filterType = FILTER_ACCEPT_ALL;
+
+	sim->backgroundTime = (sim->config.busLoad > 0) ? BackgroundGap(sim) : TOUCAN_SIM_NEVER;
+	if ((sim->config.burstFrames > 0) && (sim->config.burstPeriod > 0)) {
+		sim->burstTime = sim->config.burstPeriod;
+		sim->burstRemaining = sim->config.burstFrames;
+	}
+	Generate(sim);
+
+	device->context = sim;
+	device->Open = SimOpen;
+	device->Close = SimClose;
+	device->Control = SimControl;
+	device->BulkOut = SimBulkOut;
+
+	device->bulkIn.context = sim;
+	device->bulkIn.Open = SimReadOpen;
+	device->bulkIn.Close = SimReadClose;
+	device->bulkIn.SubmitRead = SimSubmitRead;
+	device->bulkIn.WaitRead = SimWaitRead;
+	device->bulkIn.CancelReads = SimCancelReads;
+}
+
+//
+// Virtual time of the adapter in microseconds, the device timestamps are derived from it
+//
+
+LONGLONG TouCAN_simusb_now(TOUCAN_SIM_USB *sim) {
+	LONGLONG now;
+
+	Lock(sim);
+	now = sim->now;
+	Unlock(sim);
+	return now;
+}
+
+//
+// Move the virtual clock on without reading, as when the host stalls. Frames received
+// meanwhile fill the adapter FIFO and overrun it once it is full.
+//
+
+void TouCAN_simusb_advance(TOUCAN_SIM_USB *sim, LONGLONG microseconds) {
+	Lock(sim);
+	sim->now += microseconds;
+	Fill(sim, sim->now);
+	Unlock(sim);
+}
+
+void TouCAN_simusb_statistics(TOUCAN_SIM_USB *sim, TOUCAN_SIM_STATISTICS *statistics) {
+	Lock(sim);
+	*statistics = sim->statistics;
+	Unlock(sim);
+}
@@ -0,0 +1,413 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN SocketCAN
+// Unit Description: Transport backend for Linux SocketCAN interfaces
+// Function: Reads and writes batches of frames on a CAN_RAW socket, and emulates the TouCAN
+// class requests the driver issues so the driver core runs unchanged on Linux
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "../inc/toucan_socketcan.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+typedef struct _TOUCAN_SOCKETCAN_BATCH {
+	struct can_frame	frames[TOUCAN_MAX_READ_BATCH];
+	struct iovec		vectors[TOUCAN_MAX_READ_BATCH];
+	struct mmsghdr		messages[TOUCAN_MAX_READ_BATCH];
+	UINT8	control[TOUCAN_MAX_READ_BATCH][CMSG_SPACE(sizeof(struct timeval))];
+} TOUCAN_SOCKETCAN_BATCH;
+
+static int SocketError(TOUCAN_SOCKETCAN *ctx, int code) {
+	if (ctx->socket >= 0) {
+		close(ctx->socket);
+		ctx->socket = -1;
+	}
+	free(ctx->batch);
+	ctx->batch = NULL;
+	return SET_ERROR(TWOCAN_RESULT_FATAL, TWOCAN_SOURCE_DRIVER, code);
+}
+
+static int SocketCanOpen(void *context) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+	struct sockaddr_can address;
+	struct ifreq request;
+	struct timeval timeout;
+	int enable = 1;
+
+	ctx->started = FALSE;
+	ctx->lastError = HAL_OK;
+	ctx->filterCount = 0;
+
+	ctx->batch = (TOUCAN_SOCKETCAN_BATCH *)calloc(1, sizeof(TOUCAN_SOCKETCAN_BATCH));
+	ctx->socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if ((ctx->batch == NULL) || (ctx->socket < 0)) {
+		return SocketError(ctx, TWOCAN_ERROR_SOCKET_CREATE);
+	}
+
+	// An empty name is left by TouCAN_socketcan_backend when the requested one did not fit
+	memset(&request, 0, sizeof(request));
+	if ((ctx->interfaceName[0] == '\0') ||
+		(snprintf(request.ifr_name, sizeof(request.ifr_name), "%s", ctx->interfaceName) >= (int)sizeof(request.ifr_name)) ||
+		(ioctl(ctx->socket, SIOCGIFINDEX, &request) < 0)) {
+		return SocketError(ctx, TWOCAN_ERROR_SOCKET_IOCTL);
+	}
+
+	// Kernel receive times stand in for the adapter's timestamps, transmits wait as long as a WinUSB bulk OUT
+	timeout.tv_sec = TOUCAN_SOCKETCAN_SEND_TIMEOUT / 1000;
+	timeout.tv_usec = (TOUCAN_SOCKETCAN_SEND_TIMEOUT % 1000) * 1000;
+	if ((setsockopt(ctx->socket, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable)) < 0) ||
+		(setsockopt(ctx->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)) {
+		return SocketError(ctx, TWOCAN_ERROR_SOCKET_FLAGS);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.can_family = AF_CAN;
+	address.can_ifindex = request.ifr_ifindex;
+	if (bind(ctx->socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		return SocketError(ctx, TWOCAN_ERROR_SOCKET_BIND);
+	}
+
+	return TWOCAN_RESULT_SUCCESS;
+}
+
+static void SocketCanClose(void *context) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+
+	if (ctx->socket >= 0) {
+		close(ctx->socket);
+		ctx->socket = -1;
+	}
+	free(ctx->batch);
+	ctx->batch = NULL;
+}
+
+//
+// Set the socket's receive filters with the adapter's list / mask semantics, a frame passes when
+// ((id ^ list) & mask) == 0 for any of them. Each list / mask adds a filter, up to
+// TOUCAN_SOCKETCAN_FILTER_BANKS, accepting or rejecting everything clears them.
+//
+
+static BOOL SetFilter(TOUCAN_SOCKETCAN *ctx, Filter_Type_TypeDef type, UINT32 list, UINT32 mask) {
+	struct can_filter all;
+
+	switch (type) {
+	case FILTER_ACCEPT_ALL:
+		ctx->filterCount = 0;
+		all.can_id = 0;
+		all.can_mask = 0;
+		return (setsockopt(ctx->socket, SOL_CAN_RAW, CAN_RAW_FILTER, &all, sizeof(all)) == 0);
+
+	case FILTER_REJECT_ALL:
+		ctx->filterCount = 0;
+		return (setsockopt(ctx->socket, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) == 0);
+
+	case FILTER_VALUE:
+		if (ctx->filterCount == TOUCAN_SOCKETCAN_FILTER_BANKS) {
+			return FALSE;
+		}
+		ctx->filters[ctx->filterCount].can_id = (list & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		ctx->filters[ctx->filterCount].can_mask = (mask & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		if (setsockopt(ctx->socket, SOL_CAN_RAW, CAN_RAW_FILTER, ctx->filters, (socklen_t)((ctx->filterCount + 1) * sizeof(struct can_filter))) != 0) {
+			return FALSE;
+		}
+		ctx->filterCount++;
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+//
+// Emulate the TouCAN class requests. Bit timing belongs to the interface configuration
+// (ip link set can0 type can bitrate 250000), so initialisation only applies the loopback flag.
+// Every host to device request records its outcome for TouCAN_GET_LAST_ERROR_CODE.
+//
+
+static BOOL SocketCanControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+	UINT32 flags;
+	int enable;
+	BOOL status = TRUE;
+
+	if ((requestType & USB_DEVICE_TO_HOST) != 0) {
+		if ((request != TouCAN_GET_LAST_ERROR_CODE) || (data == NULL) || (length < 1)) {
+			return FALSE;
+		}
+		data[0] = ctx->lastError;
+		if (transferred != NULL) {
+			*transferred = 1;
+		}
+		return TRUE;
+	}
+
+	switch (request) {
+	case TouCAN_CAN_INTERFACE_INIT:
+		if ((data == NULL) || (length < 9)) {
+			status = FALSE;
+			break;
+		}
+		flags = ((UINT32)data[5] << 24) | ((UINT32)data[6] << 16) | ((UINT32)data[7] << 8) | data[8];
+		enable = ((flags & TouCAN_ENABLE_LOOPBACK_MODE) != 0);
+		status = (setsockopt(ctx->socket, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &enable, sizeof(enable)) == 0);
+		break;
+
+	case TouCAN_CAN_INTERFACE_START:
+		ctx->started = TRUE;
+		break;
+
+	case TouCAN_CAN_INTERFACE_STOP:
+	case TouCAN_CAN_INTERFACE_DEINIT:
+		ctx->started = FALSE;
+		break;
+
+	case TouCAN_FILTER_EXT_ACCEPT_ALL:
+		status = SetFilter(ctx, FILTER_ACCEPT_ALL, 0, 0);
+		break;
+
+	case TouCAN_FILTER_EXT_REJECT_ALL:
+		status = SetFilter(ctx, FILTER_REJECT_ALL, 0, 0);
+		break;
+
+	case TouCAN_SET_FILTER_EXT_LIST_MASK:
+		if ((data == NULL) || (length < 9)) {
+			status = FALSE;
+			break;
+		}
+		status = SetFilter(ctx, (Filter_Type_TypeDef)data[0],
+			((UINT32)data[1] << 24) | ((UINT32)data[2] << 16) | ((UINT32)data[3] << 8) | data[4],
+			((UINT32)data[5] << 24) | ((UINT32)data[6] << 16) | ((UINT32)data[7] << 8) | data[8]);
+		break;
+
+	default:
+		status = FALSE;
+		break;
+	}
+
+	ctx->lastError = (status) ? HAL_OK : HAL_ERROR;
+	if (transferred != NULL) {
+		*transferred = length;
+	}
+	return TRUE;
+}
+
+static BOOL SocketCanReadOpen(void *context, UINT32 queueDepth, UINT32 bufferSize) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+
+	// The kernel queues received frames, there are no reads to post
+	(void)queueDepth;
+	(void)bufferSize;
+	return (ctx->socket >= 0);
+}
+
+static void SocketCanReadClose(void *context) {
+	(void)context;
+}
+
+//
+// Wait for frames and collect everything already queued with one recvmmsg.
+// A message that is not a classic CAN frame is counted and left out, the rest of the batch is kept.
+//
+
+static TOUCAN_TRANSFER_RESULT SocketCanReadBatch(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+	TOUCAN_SOCKETCAN_BATCH *batch = ctx->batch;
+	struct pollfd descriptor;
+	struct cmsghdr *cmsg;
+	struct timeval stamp;
+	UINT32 kept = 0;
+	int received;
+
+	*count = 0;
+
+	descriptor.fd = ctx->socket;
+	descriptor.events = POLLIN;
+	descriptor.revents = 0;
+	switch (poll(&descriptor, 1, (int)timeout)) {
+	case 0:
+		return TOUCAN_TRANSFER_PENDING;
+	case -1:
+		return (errno == EINTR) ? TOUCAN_TRANSFER_PENDING : TOUCAN_TRANSFER_FAILED;
+	default:
+		break;
+	}
+
+	if (maxFrames > TOUCAN_MAX_READ_BATCH) {
+		maxFrames = TOUCAN_MAX_READ_BATCH;
+	}
+
+	for (UINT32 i = 0; i < maxFrames; i++) {
+		batch->vectors[i].iov_base = &batch->frames[i];
+		batch->vectors[i].iov_len = sizeof(struct can_frame);
+		memset(&batch->messages[i], 0, sizeof(struct mmsghdr));
+		batch->messages[i].msg_hdr.msg_iov = &batch->vectors[i];
+		batch->messages[i].msg_hdr.msg_iovlen = 1;
+		batch->messages[i].msg_hdr.msg_control = batch->control[i];
+		batch->messages[i].msg_hdr.msg_controllen = sizeof(batch->control[i]);
+	}
+
+	received = recvmmsg(ctx->socket, batch->messages, maxFrames, MSG_DONTWAIT, NULL);
+	if (received < 0) {
+		return ((errno == EAGAIN) || (errno == EINTR)) ? TOUCAN_TRANSFER_PENDING : TOUCAN_TRANSFER_FAILED;
+	}
+
+	// Frames arriving while the interface is stopped are discarded, as the adapter would
+	if (ctx->started == FALSE) {
+		return TOUCAN_TRANSFER_PENDING;
+	}
+
+	for (int i = 0; i < received; i++) {
+		const struct can_frame *frame = &batch->frames[i];
+		TOUCAN_FRAME *entry = &frames[kept];
+
+		if (batch->messages[i].msg_len != sizeof(struct can_frame)) {
+			InterlockedIncrement(&ctx->malformed);
+			continue;
+		}
+
+		entry->flags = (frame->can_id & CAN_EFF_FLAG) ? CANAL_IDFLAG_EXTENDED : CANAL_IDFLAG_STANDARD;
+		if (frame->can_id & CAN_RTR_FLAG) {
+			entry->flags |= CANAL_IDFLAG_RTR;
+		}
+		if (frame->can_id & CAN_ERR_FLAG) {
+			entry->flags |= CANAL_IDFLAG_STATUS;
+		}
+		entry->id = frame->can_id & ((frame->can_id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+		entry->length = (frame->can_dlc > TOUCAN_FRAME_DATA_LENGTH) ? TOUCAN_FRAME_DATA_LENGTH : frame->can_dlc;
+		memcpy(entry->data, frame->data, TOUCAN_FRAME_DATA_LENGTH);
+
+		// Kernel receive time in microseconds, wrapping like the adapter's 32 bit timestamp
+		entry->timestamp = 0;
+		for (cmsg = CMSG_FIRSTHDR(&batch->messages[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&batch->messages[i].msg_hdr, cmsg)) {
+			if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+				memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+				entry->timestamp = (UINT32)(((UINT64)stamp.tv_sec * 1000000) + (UINT64)stamp.tv_usec);
+			}
+		}
+		kept++;
+	}
+
+	*count = kept;
+	return (kept > 0) ? TOUCAN_TRANSFER_COMPLETE : TOUCAN_TRANSFER_PENDING;
+}
+
+//
+// Transmit frames with as few sendmmsg calls as the interface queue allows
+//
+
+static BOOL SocketCanWriteBatch(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+	TOUCAN_SOCKETCAN *ctx = (TOUCAN_SOCKETCAN *)context;
+	struct can_frame packets[TOUCAN_MAX_READ_BATCH];
+	struct iovec vectors[TOUCAN_MAX_READ_BATCH];
+	struct mmsghdr messages[TOUCAN_MAX_READ_BATCH];
+	UINT32 chunk;
+	int sent;
+
+	*written = 0;
+
+	while (*written < count) {
+		chunk = count - *written;
+		if (chunk > TOUCAN_MAX_READ_BATCH) {
+			chunk = TOUCAN_MAX_READ_BATCH;
+		}
+
+		for (UINT32 i = 0; i < chunk; i++) {
+			const TOUCAN_FRAME *frame = &frames[*written + i];
+
+			memset(&packets[i], 0, sizeof(struct can_frame));
+			packets[i].can_id = (frame->flags & CANAL_IDFLAG_EXTENDED) ? ((frame->id & CAN_EFF_MASK) | CAN_EFF_FLAG) : (frame->id & CAN_SFF_MASK);
+			if (frame->flags & CANAL_IDFLAG_RTR) {
+				packets[i].can_id |= CAN_RTR_FLAG;
+			}
+			packets[i].can_dlc = (frame->length > TOUCAN_FRAME_DATA_LENGTH) ? TOUCAN_FRAME_DATA_LENGTH : frame->length;
+			memcpy(packets[i].data, frame->data, TOUCAN_FRAME_DATA_LENGTH);
+
+			vectors[i].iov_base = &packets[i];
+			vectors[i].iov_len = sizeof(struct can_frame);
+			memset(&messages[i], 0, sizeof(struct mmsghdr));
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// A full interface queue blocks for at most the send timeout
+		sent = sendmmsg(ctx->socket, messages, chunk, 0);
+		if (sent <= 0) {
+			if ((sent < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return FALSE;
+		}
+
+		InterlockedIncrement(&ctx->transmitted.transfers);
+		InterlockedExchangeAdd(&ctx->transmitted.frames, (LONG)sent);
+		*written += (UINT32)sent;
+	}
+	return TRUE;
+}
+
+//
+// Fill in the backend operations for a SocketCAN interface
+// [in] socketcan, state of the backend, must outlive it
+// [in] interfaceName, for example "can0" or "vcan0", NULL selects TOUCAN_SOCKETCAN_DEFAULT_INTERFACE.
+// A name longer than IFNAMSIZ - 1 is not truncated to another interface's name, Open fails instead.
+//
+
+void TouCAN_socketcan_backend(TOUCAN_BACKEND *backend, TOUCAN_SOCKETCAN *socketcan, const char *interfaceName) {
+	memset(socketcan, 0, sizeof(TOUCAN_SOCKETCAN));
+	if (snprintf(socketcan->interfaceName, sizeof(socketcan->interfaceName), "%s",
+		(interfaceName != NULL) ? interfaceName : TOUCAN_SOCKETCAN_DEFAULT_INTERFACE) >= (int)sizeof(socketcan->interfaceName)) {
+		socketcan->interfaceName[0] = '\0';
+	}
+	socketcan->socket = -1;
+
+	backend->name = "SocketCAN";
+	backend->context = socketcan;
+	backend->Open = SocketCanOpen;
+	backend->Close = SocketCanClose;
+	backend->Control = SocketCanControl;
+	backend->ReadOpen = SocketCanReadOpen;
+	backend->ReadBatch = SocketCanReadBatch;
+	backend->ReadClose = SocketCanReadClose;
+	backend->WriteBatch = SocketCanWriteBatch;
+	backend->transmitted = &socketcan->transmitted;
+	InitializeSRWLock(&socketcan->requestLock);
+	backend->requestLock = &socketcan->requestLock;
+	backend->filterBanks = TOUCAN_SOCKETCAN_FILTER_BANKS;
+}
+
+#endif
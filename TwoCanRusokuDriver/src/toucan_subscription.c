@@ -0,0 +1,159 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Subscription
+// Unit Description: Compiles a PGN subscription list into acceptance filters
+// Function: Finds the fewest identifier / mask filter banks that pass every subscribed
+// PGN and source address, so that unwanted frames are discarded by the adapter
+//
+
+#include "../inc/toucan_subscription.h"
+
+#include <string.h>
+
+// Bits of the 29 bit identifier holding the PGN, the PDU specific field and the source address
+#define PGN_MASK 0x03FFFF00
+#define PDU_SPECIFIC_MASK 0x0000FF00
+#define SOURCE_MASK 0x000000FF
+
+static UINT32 CountBits(UINT32 value) {
+	UINT32 count = 0;
+
+	for (; value != 0; value &= value - 1) {
+		count++;
+	}
+	return count;
+}
+
+//
+// The narrowest filter passing both a and b
+//
+
+static TOUCAN_FILTER_BANK MergeBanks(const TOUCAN_FILTER_BANK *a, const TOUCAN_FILTER_BANK *b) {
+	TOUCAN_FILTER_BANK merged;
+
+	merged.mask = a->mask & b->mask & ~(a->id ^ b->id);
+	merged.id = a->id & merged.mask;
+	return merged;
+}
+
+//
+// Compile a subscription list
+// [in] pgns, parameter group numbers to receive
+// [in] sources, source address of each PGN or TOUCAN_ANY_SOURCE, NULL receives every PGN from any source
+// [in] count, number of subscriptions, zero accepts every frame
+// [in] maxBanks, number of filters the adapter offers
+// returns FALSE if a PGN is invalid or there are too many subscriptions
+//
+
+BOOL TouCAN_subscription_compile(TOUCAN_SUBSCRIPTION *subscription, const UINT32 *pgns, const UINT8 *sources, UINT32 count, UINT32 maxBanks) {
+	TOUCAN_FILTER_BANK entry;
+	TOUCAN_FILTER_BANK merged;
+	UINT32 bestBits;
+	UINT32 bestA;
+	UINT32 bestB;
+	UINT32 bits;
+	BOOL duplicate;
+
+	if ((count > TOUCAN_MAX_SUBSCRIPTIONS) || (maxBanks == 0)) {
+		return FALSE;
+	}
+
+	memset(subscription, 0, sizeof(TOUCAN_SUBSCRIPTION));
+
+	for (UINT32 i = 0; i < count; i++) {
+		if (pgns[i] > (PGN_MASK >> 8)) {
+			return FALSE;
+		}
+
+		// The priority bits never take part in the match
+		entry.id = pgns[i] << 8;
+		entry.mask = PGN_MASK;
+
+		if (TouCAN_header_is_pdu1(pgns[i])) {
+			entry.id &= ~PDU_SPECIFIC_MASK;
+			entry.mask &= ~PDU_SPECIFIC_MASK;
+		}
+
+		if ((sources != NULL) && (sources[i] != TOUCAN_ANY_SOURCE)) {
+			entry.id |= sources[i];
+			entry.mask |= SOURCE_MASK;
+		}
+
+		duplicate = FALSE;
+		for (UINT32 j = 0; j < subscription->count; j++) {
+			if ((subscription->entries[j].id == entry.id) && (subscription->entries[j].mask == entry.mask)) {
+				duplicate = TRUE;
+			}
+		}
+
+		if (duplicate == FALSE) {
+			subscription->entries[subscription->count++] = entry;
+		}
+	}
+
+	memcpy(subscription->bank, subscription->entries, subscription->count * sizeof(TOUCAN_FILTER_BANK));
+	subscription->banks = subscription->count;
+	subscription->exact = (subscription->count <= maxBanks);
+
+	// Repeatedly merge the two banks whose union keeps the most identifier bits significant,
+	// admitting as few unwanted frames as possible
+	while (subscription->banks > maxBanks) {
+		bestBits = 0;
+		bestA = 0;
+		bestB = 1;
+
+		for (UINT32 a = 0; a < subscription->banks; a++) {
+			for (UINT32 b = a + 1; b < subscription->banks; b++) {
+				merged = MergeBanks(&subscription->bank[a], &subscription->bank[b]);
+				bits = CountBits(merged.mask);
+				if (bits > bestBits) {
+					bestBits = bits;
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+
+		subscription->bank[bestA] = MergeBanks(&subscription->bank[bestA], &subscription->bank[bestB]);
+		subscription->bank[bestB] = subscription->bank[--subscription->banks];
+	}
+
+	return TRUE;
+}
+
+//
+// Software post filter, for frames passed by merged banks
+// returns TRUE if the identifier matches a subscription, or nothing is subscribed
+//
+
+BOOL TouCAN_subscription_match(const TOUCAN_SUBSCRIPTION *subscription, UINT32 id) {
+	if (subscription->count == 0) {
+		return TRUE;
+	}
+
+	for (UINT32 i = 0; i < subscription->count; i++) {
+		if (((id ^ subscription->entries[i].id) & subscription->entries[i].mask) == 0) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
@@ -0,0 +1,312 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Trace
+// Unit Description: Binary event trace
+// Function: Records fixed size events to a lock free ring per thread on the hot paths,
+// leaving the formatting to whoever drains them, a background thread or an offline dump
+//
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+typedef struct _TRACE_FORMAT {
+	const char	*format;		// printf format taking the two arguments as unsigned int
+} TRACE_FORMAT;
+
+static const TRACE_FORMAT formats[TOUCAN_TRACE_EVENTS] = {
+	{ "Packet: %u frames (%u queued)" },
+	{ "Malformed packet" },
+	{ "Adapter Mutex: %u -->%u" },
+	{ "Set Event Error: %u" },
+	{ "Transmit failed: %u frames (%u written)" },
+	{ "Transmit message failed: %u (%u written)" },
+	{ "TouCAN_read submit Error: %u" },
+	{ "TouCAN_write Error: %u" },
+	{ "Bus condition: %u (error code 0x%08X)" }
+};
+
+static const char *levels[] = { "NONE", "ERROR", "WARNING", "INFO", "DEBUG" };
+
+static TOUCAN_TRACE_RING rings[TOUCAN_TRACE_MAX_THREADS];
+
+// The ring of the calling thread, NULL until it records its first event
+static THREAD_LOCAL TOUCAN_TRACE_RING *threadRing;
+
+// Events of threads that found every ring claimed
+static volatile LONG unowned;
+
+// Serialises the threads draining the rings
+static volatile LONG drainLock;
+
+static void Lock(void) {
+	while (InterlockedCompareExchange(&drainLock, 1, 0) != 0) {
+	}
+}
+
+static void Unlock(void) {
+	InterlockedExchange(&drainLock, 0);
+}
+
+static LONGLONG Now(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((LONGLONG)now.tv_sec * 1000000000) + now.tv_nsec;
+#endif
+}
+
+static LONGLONG Frequency(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+#else
+	return 1000000000;
+#endif
+}
+
+//
+// Claim a free ring for the calling thread
+// returns NULL if every ring is in use
+//
+
+static TOUCAN_TRACE_RING *Claim(void) {
+	for (UINT32 i = 0; i < TOUCAN_TRACE_MAX_THREADS; i++) {
+		if ((ReadNoFence(&rings[i].owned) == FALSE) && (InterlockedCompareExchange(&rings[i].owned, TRUE, FALSE) == FALSE)) {
+#if defined(_WIN32)
+			rings[i].thread = GetCurrentThreadId();
+#else
+			rings[i].thread = i + 1;
+#endif
+			return &rings[i];
+		}
+	}
+	return NULL;
+}
+
+//
+// Record an event on the calling thread's ring, use the TOUCAN_TRACE_xxx macros so the
+// events below the configured level are compiled out
+// Never blocks, an event is dropped if the ring is full
+//
+
+void TouCAN_trace_record(UINT8 level, UINT16 event, UINT32 arg0, UINT32 arg1) {
+	TOUCAN_TRACE_RING *ring = threadRing;
+	TOUCAN_TRACE_RECORD *record;
+	LONG head;
+
+	if (ring == NULL) {
+		ring = Claim();
+		if (ring == NULL) {
+			InterlockedIncrement(&unowned);
+			return;
+		}
+		threadRing = ring;
+	}
+
+	head = ring->head;
+	if ((UINT32)(head - ReadAcquire(&ring->tail)) >= TOUCAN_TRACE_RING_DEPTH) {
+		WriteNoFence(&ring->dropped, ring->dropped + 1);
+		return;
+	}
+
+	record = &ring->records[head & (TOUCAN_TRACE_RING_DEPTH - 1)];
+	record->time = Now();
+	record->thread = ring->thread;
+	record->event = event;
+	record->level = level;
+	record->args[0] = arg0;
+	record->args[1] = arg1;
+
+	// Publish the event to the draining thread
+	WriteRelease(&ring->head, head + 1);
+}
+
+//
+// Give up the calling thread's ring, called as the thread exits.
+// Events not yet drained stay in the ring for the next thread to claim it.
+//
+
+void TouCAN_trace_release(void) {
+	if (threadRing != NULL) {
+		WriteRelease(&threadRing->owned, FALSE);
+		threadRing = NULL;
+	}
+}
+
+//
+// Take the recorded events from every ring, oldest first within each ring
+// [out] records, drained events
+// [in] maxRecords, capacity of records
+// returns the number of events drained
+//
+
+UINT32 TouCAN_trace_drain(TOUCAN_TRACE_RECORD *records, UINT32 maxRecords) {
+	TOUCAN_TRACE_RING *ring;
+	UINT32 total = 0;
+	LONG head;
+	LONG tail;
+
+	Lock();
+	for (UINT32 i = 0; (i < TOUCAN_TRACE_MAX_THREADS) && (total < maxRecords); i++) {
+		ring = &rings[i];
+		tail = ring->tail;
+		head = ReadAcquire(&ring->head);
+
+		while ((tail != head) && (total < maxRecords)) {
+			records[total] = ring->records[tail & (TOUCAN_TRACE_RING_DEPTH - 1)];
+			tail++;
+			total++;
+		}
+
+		// The slots may be reused
+		WriteRelease(&ring->tail, tail);
+	}
+	Unlock();
+	return total;
+}
+
+//
+// Format an event as a line of text
+// [out] text, receives the line without a line end
+// [in] size, capacity of text
+// returns the length of the line, 0 if it did not fit
+//
+
+UINT32 TouCAN_trace_format(const TOUCAN_TRACE_RECORD *record, char *text, UINT32 size) {
+	static LONGLONG frequency;
+	const char *format = (record->event < TOUCAN_TRACE_EVENTS) ? formats[record->event].format : "Event %u %u";
+	int length;
+	int message;
+
+	if (frequency == 0) {
+		frequency = Frequency();
+	}
+
+#if defined(_MSC_VER)
+	length = _snprintf_s(text, size, _TRUNCATE, "%.6f %u %s ", (double)record->time / frequency, record->thread,
+		levels[(record->level <= TOUCAN_TRACE_LEVEL_DEBUG) ? record->level : 0]);
+	message = (length < 0) ? -1 : _snprintf_s(&text[length], size - length, _TRUNCATE, format, record->args[0], record->args[1]);
+#else
+	length = snprintf(text, size, "%.6f %u %s ", (double)record->time / frequency, record->thread,
+		levels[(record->level <= TOUCAN_TRACE_LEVEL_DEBUG) ? record->level : 0]);
+	message = ((length < 0) || ((UINT32)length >= size)) ? -1 : snprintf(&text[length], size - length, format, record->args[0], record->args[1]);
+#endif
+
+	if ((message < 0) || ((UINT32)(length + message) >= size)) {
+		return 0;
+	}
+	return (UINT32)(length + message);
+}
+
+static int CompareTime(const void *a, const void *b) {
+	const TOUCAN_TRACE_RECORD *first = (const TOUCAN_TRACE_RECORD *)a;
+	const TOUCAN_TRACE_RECORD *second = (const TOUCAN_TRACE_RECORD *)b;
+
+	if (first->time != second->time) {
+		return (first->time < second->time) ? -1 : 1;
+	}
+	return (first->thread < second->thread) ? -1 : (first->thread > second->thread) ? 1 : 0;
+}
+
+//
+// Drain every ring and write the events, in time order across threads, to a text file
+// [in] path, file to create
+// returns FALSE if the file could not be written
+//
+
+BOOL TouCAN_trace_dump(const char *path) {
+	TOUCAN_TRACE_RECORD *records;
+	char line[256];
+	UINT32 count;
+	FILE *file;
+	BOOL status = TRUE;
+
+	records = (TOUCAN_TRACE_RECORD *)malloc(TOUCAN_TRACE_MAX_THREADS * TOUCAN_TRACE_RING_DEPTH * sizeof(TOUCAN_TRACE_RECORD));
+	if (records == NULL) {
+		return FALSE;
+	}
+
+#if defined(_MSC_VER)
+	if (fopen_s(&file, path, "w") != 0) {
+		file = NULL;
+	}
+#else
+	file = fopen(path, "w");
+#endif
+	if (file == NULL) {
+		free(records);
+		return FALSE;
+	}
+
+	count = TouCAN_trace_drain(records, TOUCAN_TRACE_MAX_THREADS * TOUCAN_TRACE_RING_DEPTH);
+	qsort(records, count, sizeof(TOUCAN_TRACE_RECORD), CompareTime);
+
+	for (UINT32 i = 0; (i < count) && (status == TRUE); i++) {
+		if (TouCAN_trace_format(&records[i], line, sizeof(line)) > 0) {
+			status = (fprintf(file, "%s\n", line) > 0);
+		}
+	}
+
+	status &= (fclose(file) == 0);
+	free(records);
+	return status;
+}
+
+//
+// [out] recorded, events recorded since the process started
+// [out] dropped, events lost because a ring was full or every ring was claimed
+//
+
+void TouCAN_trace_statistics(UINT32 *recorded, UINT32 *dropped) {
+	*recorded = 0;
+	*dropped = (UINT32)ReadNoFence(&unowned);
+
+	for (UINT32 i = 0; i < TOUCAN_TRACE_MAX_THREADS; i++) {
+		*recorded += (UINT32)ReadNoFence(&rings[i].head);
+		*dropped += (UINT32)ReadNoFence(&rings[i].dropped);
+	}
+}
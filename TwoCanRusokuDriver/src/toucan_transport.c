@@ -0,0 +1,200 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Transport
+// Unit Description: Multi buffer read pipeline for the bulk IN endpoint
+// Function: Keeps several reads posted on the endpoint so that USB packets arriving while
+// the previous packet is decoded land in an already submitted buffer
+//
+
+#include "../inc/toucan_transport.h"
+#include "../inc/toucan_decode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Submit the read for a slot, recording whether it is in flight
+//
+
+static BOOL SubmitSlot(TOUCAN_READ_PIPELINE *pipeline, UINT32 slot) {
+	pipeline->pending[slot] = pipeline->endpoint->SubmitRead(pipeline->endpoint->context, slot,
+		&pipeline->pool[slot * pipeline->bufferSize], pipeline->bufferSize);
+	if (pipeline->pending[slot] == FALSE) {
+		InterlockedIncrement(&pipeline->failures);
+	}
+	return pipeline->pending[slot];
+}
+
+//
+// Allocate the buffer pool and post every read
+// [in] endpoint, bulk IN endpoint operations
+// [in] queueDepth, number of reads kept in flight
+// [in] bufferSize, size of each read, rounded up to a whole number of USB packets
+// returns TRUE if the endpoint was opened and at least one read is in flight
+//
+
+BOOL TouCAN_pipeline_open(TOUCAN_READ_PIPELINE *pipeline, TOUCAN_READ_ENDPOINT *endpoint, UINT32 queueDepth, UINT32 bufferSize) {
+	BOOL submitted = FALSE;
+
+	if ((pipeline == NULL) || (endpoint == NULL)) {
+		return FALSE;
+	}
+
+	memset(pipeline, 0, sizeof(TOUCAN_READ_PIPELINE));
+
+	if ((queueDepth == 0) || (queueDepth > TOUCAN_MAX_READ_QUEUE_DEPTH)) {
+		queueDepth = TOUCAN_DEFAULT_READ_QUEUE_DEPTH;
+	}
+
+	if ((bufferSize == 0) || (bufferSize > TOUCAN_MAX_READ_BUFFER_SIZE)) {
+		bufferSize = TOUCAN_DEFAULT_READ_BUFFER_SIZE;
+	}
+	bufferSize = (bufferSize + TOUCAN_USB_MAX_PACKET_SIZE - 1) & ~(TOUCAN_USB_MAX_PACKET_SIZE - 1);
+
+	pipeline->pool = (UINT8 *)malloc(queueDepth * bufferSize);
+	if (pipeline->pool == NULL) {
+		return FALSE;
+	}
+
+	pipeline->endpoint = endpoint;
+	pipeline->queueDepth = queueDepth;
+	pipeline->bufferSize = bufferSize;
+
+	if (endpoint->Open(endpoint->context, queueDepth) == FALSE) {
+		free(pipeline->pool);
+		pipeline->pool = NULL;
+		return FALSE;
+	}
+
+	for (UINT32 slot = 0; slot < queueDepth; slot++) {
+		submitted |= SubmitSlot(pipeline, slot);
+	}
+
+	if (submitted == FALSE) {
+		TouCAN_pipeline_close(pipeline);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Cancel every read still in flight and release the buffer pool
+//
+
+void TouCAN_pipeline_close(TOUCAN_READ_PIPELINE *pipeline) {
+	if ((pipeline == NULL) || (pipeline->pool == NULL)) {
+		return;
+	}
+
+	// The endpoint must not complete into the pool once it has been freed
+	pipeline->endpoint->CancelReads(pipeline->endpoint->context);
+	pipeline->endpoint->Close(pipeline->endpoint->context);
+
+	free(pipeline->pool);
+	pipeline->pool = NULL;
+}
+
+//
+// Wait for the oldest read to complete
+// The buffer handed out on the previous call is resubmitted first
+// [in] timeout, milliseconds to wait for the oldest read
+// [out] data, pointer to the received packet, valid until the next call
+// [out] length, number of bytes received
+// returns TOUCAN_TRANSFER_COMPLETE when a packet is available
+//
+
+TOUCAN_TRANSFER_RESULT TouCAN_pipeline_read(TOUCAN_READ_PIPELINE *pipeline, DWORD timeout, UINT8 **data, ULONG *length) {
+	TOUCAN_TRANSFER_RESULT result;
+	UINT32 slot;
+	ULONG transferred = 0;
+
+	// Recycle the buffer the caller has finished with
+	if (pipeline->held) {
+		SubmitSlot(pipeline, pipeline->next);
+		pipeline->next = (pipeline->next + 1) % pipeline->queueDepth;
+		pipeline->held = FALSE;
+	}
+
+	slot = pipeline->next;
+
+	// A slot whose earlier submission failed is retried in turn. Its packet then completes after
+	// the reads submitted ahead of it, which is the only case where packets can be reordered
+	if (pipeline->pending[slot] == FALSE) {
+		if (SubmitSlot(pipeline, slot) == FALSE) {
+			pipeline->next = (slot + 1) % pipeline->queueDepth;
+			return TOUCAN_TRANSFER_FAILED;
+		}
+	}
+
+	result = pipeline->endpoint->WaitRead(pipeline->endpoint->context, slot, timeout, &transferred);
+
+	if (result == TOUCAN_TRANSFER_PENDING) {
+		return result;
+	}
+
+	pipeline->pending[slot] = FALSE;
+	pipeline->held = TRUE;
+
+	if (result == TOUCAN_TRANSFER_FAILED) {
+		InterlockedIncrement(&pipeline->failures);
+		return result;
+	}
+
+	// A read that expired on the pipe timeout without data is simply recycled
+	if (transferred == 0) {
+		return TOUCAN_TRANSFER_PENDING;
+	}
+
+	InterlockedIncrement(&pipeline->packets);
+	InterlockedExchangeAdd(&pipeline->bytes, (LONG)transferred);
+
+	*data = &pipeline->pool[slot * pipeline->bufferSize];
+	*length = transferred;
+	return TOUCAN_TRANSFER_COMPLETE;
+}
+
+//
+// Wait for the oldest read and decode its records, the read batch of the USB backends
+// [in] timeout, milliseconds to wait for the oldest read
+// [out] frames, receives one frame per record
+// [in] maxFrames, capacity of frames
+// [out] count, number of frames decoded
+// returns TOUCAN_TRANSFER_COMPLETE when frames are available
+//
+
+TOUCAN_TRANSFER_RESULT TouCAN_pipeline_read_frames(TOUCAN_READ_PIPELINE *pipeline, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	TOUCAN_TRANSFER_RESULT result;
+	UINT8 *data;
+	ULONG length;
+
+	*count = 0;
+	result = TouCAN_pipeline_read(pipeline, timeout, &data, &length);
+	if (result != TOUCAN_TRANSFER_COMPLETE) {
+		return result;
+	}
+
+	// Decode every record of the packet straight out of the read buffer
+	if (TouCAN_decode_packet(data, length, frames, maxFrames, count) == FALSE) {
+		return TOUCAN_TRANSFER_MALFORMED;
+	}
+	return TOUCAN_TRANSFER_COMPLETE;
+}
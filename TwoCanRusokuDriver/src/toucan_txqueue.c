@@ -0,0 +1,270 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Transmit Queue
+// Unit Description: Bounded, prioritised transmit queue
+// Function: Lets any thread queue frames without blocking while a single writer thread
+// drains them, most urgent NMEA 2000 priority first
+//
+
+#include "../inc/toucan_txqueue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Allocate every lane
+// [in] laneDepth, frames per lane, rounded up to a power of two
+// returns TRUE if all lanes were allocated
+//
+
+BOOL TouCAN_txqueue_init(TOUCAN_TX_QUEUE *queue, UINT32 laneDepth) {
+	UINT32 size = TOUCAN_RING_MIN_DEPTH;
+
+	if (queue == NULL) {
+		return FALSE;
+	}
+
+	if (laneDepth > TOUCAN_MAX_TX_LANE_DEPTH) {
+		laneDepth = TOUCAN_MAX_TX_LANE_DEPTH;
+	}
+
+	while (size < laneDepth) {
+		size <<= 1;
+	}
+
+	memset(queue, 0, sizeof(TOUCAN_TX_QUEUE));
+
+	for (UINT32 lane = 0; lane < TOUCAN_TX_LANES; lane++) {
+		queue->lanes[lane].slots = (TOUCAN_TX_SLOT *)calloc(size, sizeof(TOUCAN_TX_SLOT));
+		if (queue->lanes[lane].slots == NULL) {
+			TouCAN_txqueue_free(queue);
+			return FALSE;
+		}
+
+		// A slot is free for position p when its sequence equals p
+		for (UINT32 i = 0; i < size; i++) {
+			queue->lanes[lane].slots[i].sequence = (LONG)i;
+		}
+		queue->lanes[lane].mask = size - 1;
+	}
+	return TRUE;
+}
+
+//
+// Release every lane, only valid once the producers and the writer thread have stopped
+//
+
+void TouCAN_txqueue_free(TOUCAN_TX_QUEUE *queue) {
+	for (UINT32 lane = 0; lane < TOUCAN_TX_LANES; lane++) {
+		if (queue->lanes[lane].slots != NULL) {
+			free(queue->lanes[lane].slots);
+			queue->lanes[lane].slots = NULL;
+		}
+	}
+}
+
+//
+// Claim count consecutive slots of a lane
+// Because the writer frees slots strictly in order, the last slot being free means all of them are
+// returns the first claimed position, or FALSE in *claimed if the lane cannot take count frames
+//
+
+static UINT32 ClaimSlots(TOUCAN_TX_LANE *lane, UINT32 count, BOOL *claimed) {
+	UINT32 position = (UINT32)ReadNoFence(&lane->enqueuePosition);
+	UINT32 last;
+	LONG difference;
+
+	for (;;) {
+		last = position + count - 1;
+		difference = (LONG)((UINT32)ReadAcquire(&lane->slots[last & lane->mask].sequence) - last);
+
+		if (difference == 0) {
+			UINT32 previous = (UINT32)InterlockedCompareExchange(&lane->enqueuePosition, (LONG)(position + count), (LONG)position);
+			if (previous == position) {
+				*claimed = TRUE;
+				return position;
+			}
+			position = previous;
+		}
+		else if (difference < 0) {
+			// The writer has not yet released the slot, the lane is full
+			*claimed = FALSE;
+			return 0;
+		}
+		else {
+			// Another producer claimed the slot first
+			position = (UINT32)ReadNoFence(&lane->enqueuePosition);
+		}
+	}
+}
+
+//
+// Account for frames entering the queue
+// returns TRUE if the writer thread may have found the queue empty and needs waking
+//
+
+static BOOL CountQueued(TOUCAN_TX_QUEUE *queue, UINT32 count) {
+	LONG previous = InterlockedExchangeAdd(&queue->queued, (LONG)count);
+
+	InterlockedExchangeAdd(&queue->enqueued, (LONG)count);
+	if ((previous + (LONG)count) > ReadNoFence(&queue->highWater)) {
+		WriteNoFence(&queue->highWater, previous + (LONG)count);
+	}
+
+	// The count can briefly go negative when the writer drains a frame before it was counted
+	return (previous <= 0);
+}
+
+//
+// Queue a frame in the lane of its NMEA 2000 priority, never blocks
+// [in] frame, frame to transmit
+// [out] wasEmpty, TRUE if the writer thread should be signalled
+// returns FALSE and counts a drop if the lane is full
+//
+
+BOOL TouCAN_txqueue_push(TOUCAN_TX_QUEUE *queue, const TOUCAN_FRAME *frame, BOOL *wasEmpty) {
+	UINT32 priority = TOUCAN_TX_PRIORITY(frame->id);
+	TOUCAN_TX_LANE *lane = &queue->lanes[priority];
+	TOUCAN_TX_SLOT *slot;
+	UINT32 position;
+	BOOL claimed;
+
+	position = ClaimSlots(lane, 1, &claimed);
+	if (claimed == FALSE) {
+		InterlockedIncrement(&queue->drops);
+		InterlockedIncrement(&queue->laneDrops[priority]);
+		*wasEmpty = FALSE;
+		return FALSE;
+	}
+
+	slot = &lane->slots[position & lane->mask];
+	slot->frame = *frame;
+	WriteRelease(&slot->sequence, (LONG)(position + 1));
+
+	*wasEmpty = CountQueued(queue, 1);
+	return TRUE;
+}
+
+//
+// Queue a run of frames that must stay together, all or nothing
+// The frames must share a priority so they land consecutively in one lane
+// [in] frames, frames to transmit in order
+// [in] count, number of frames
+// [out] wasEmpty, TRUE if the writer thread should be signalled
+// returns FALSE and counts the drops if the lane cannot take every frame
+//
+
+BOOL TouCAN_txqueue_push_batch(TOUCAN_TX_QUEUE *queue, const TOUCAN_FRAME *frames, UINT32 count, BOOL *wasEmpty) {
+	UINT32 priority;
+	TOUCAN_TX_LANE *lane;
+	TOUCAN_TX_SLOT *slot;
+	UINT32 position;
+	BOOL claimed = FALSE;
+
+	*wasEmpty = FALSE;
+
+	if (count == 0) {
+		return TRUE;
+	}
+
+	priority = TOUCAN_TX_PRIORITY(frames[0].id);
+	lane = &queue->lanes[priority];
+
+	for (UINT32 i = 1; i < count; i++) {
+		if (TOUCAN_TX_PRIORITY(frames[i].id) != priority) {
+			return FALSE;
+		}
+	}
+
+	position = (count > lane->mask + 1) ? 0 : ClaimSlots(lane, count, &claimed);
+	if ((count > lane->mask + 1) || (claimed == FALSE)) {
+		InterlockedExchangeAdd(&queue->drops, (LONG)count);
+		InterlockedExchangeAdd(&queue->laneDrops[priority], (LONG)count);
+		return FALSE;
+	}
+
+	for (UINT32 i = 0; i < count; i++) {
+		slot = &lane->slots[(position + i) & lane->mask];
+		slot->frame = frames[i];
+		WriteRelease(&slot->sequence, (LONG)(position + i + 1));
+	}
+
+	*wasEmpty = CountQueued(queue, count);
+	return TRUE;
+}
+
+//
+// Writer thread side, remove up to maxFrames frames, most urgent lane first
+// [out] frames, receives the frames in transmit order
+// [in] maxFrames, capacity of frames
+// returns the number of frames removed
+//
+
+UINT32 TouCAN_txqueue_pop(TOUCAN_TX_QUEUE *queue, TOUCAN_FRAME *frames, UINT32 maxFrames) {
+	UINT32 count = 0;
+
+	for (UINT32 priority = 0; (priority < TOUCAN_TX_LANES) && (count < maxFrames); priority++) {
+		TOUCAN_TX_LANE *lane = &queue->lanes[priority];
+		UINT32 position = (UINT32)lane->dequeuePosition;
+
+		while (count < maxFrames) {
+			TOUCAN_TX_SLOT *slot = &lane->slots[position & lane->mask];
+
+			// Empty, or the producer that claimed the slot has not finished writing it
+			if ((UINT32)ReadAcquire(&slot->sequence) != (position + 1)) {
+				break;
+			}
+
+			frames[count++] = slot->frame;
+
+			// Release the slot for the producer one lap ahead
+			WriteRelease(&slot->sequence, (LONG)(position + lane->mask + 1));
+			position++;
+		}
+		lane->dequeuePosition = (LONG)position;
+	}
+
+	if (count > 0) {
+		InterlockedExchangeAdd(&queue->queued, -(LONG)count);
+	}
+	return count;
+}
+
+//
+// Writer thread side, frames claimed in the most urgent lanes, including any still being written
+// [in] lanes, number of lanes to count, starting with lane 0
+// returns the number of frames waiting in those lanes
+//
+
+UINT32 TouCAN_txqueue_waiting(TOUCAN_TX_QUEUE *queue, UINT32 lanes) {
+	UINT32 count = 0;
+
+	if (lanes > TOUCAN_TX_LANES) {
+		lanes = TOUCAN_TX_LANES;
+	}
+
+	for (UINT32 priority = 0; priority < lanes; priority++) {
+		TOUCAN_TX_LANE *lane = &queue->lanes[priority];
+		count += (UINT32)ReadAcquire(&lane->enqueuePosition) - (UINT32)lane->dequeuePosition;
+	}
+	return count;
+}
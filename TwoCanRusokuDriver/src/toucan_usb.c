@@ -0,0 +1,127 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN USB
+// Unit Description: Transport backend for USB stacks other than WinUSB
+// Function: Maps the backend operations onto a TouCAN USB device, packing records into
+// bulk OUT transfers and decoding bulk IN packets through the read pipeline
+//
+
+#include "../inc/toucan_usb.h"
+#include "../inc/toucan_decode.h"
+#include "../inc/toucan_protocol.h"
+
+#include <string.h>
+
+static int UsbOpen(void *context) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	return usb->device->Open(usb->device->context);
+}
+
+static void UsbClose(void *context) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	usb->device->Close(usb->device->context);
+}
+
+static BOOL UsbControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	return usb->device->Control(usb->device->context, requestType, request, data, length, transferred);
+}
+
+static BOOL UsbReadOpen(void *context, UINT32 queueDepth, UINT32 bufferSize) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	return TouCAN_pipeline_open(&usb->pipeline, &usb->device->bulkIn, queueDepth, bufferSize);
+}
+
+static TOUCAN_TRANSFER_RESULT UsbReadBatch(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	return TouCAN_pipeline_read_frames(&usb->pipeline, timeout, frames, maxFrames, count);
+}
+
+static void UsbReadClose(void *context) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+
+	TouCAN_pipeline_close(&usb->pipeline);
+}
+
+//
+// Transmit several frames, packing up to TOUCAN_MAX_RECORDS_PER_TRANSFER records into each bulk OUT transfer
+//
+
+static BOOL UsbWriteBatch(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT32 *written) {
+	TOUCAN_USB_BACKEND *usb = (TOUCAN_USB_BACKEND *)context;
+	UINT8 buffer[TOUCAN_RECORD_LENGTH * TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	UINT32 index;
+	UINT32 records;
+
+	*written = 0;
+
+	while (*written < count) {
+		records = count - *written;
+		if (records > TOUCAN_MAX_RECORDS_PER_TRANSFER) {
+			records = TOUCAN_MAX_RECORDS_PER_TRANSFER;
+		}
+
+		index = 0;
+		for (UINT32 r = 0; r < records; r++) {
+			index += TouCAN_encode_record(&frames[*written + r], &buffer[index]);
+		}
+
+		if (usb->device->BulkOut(usb->device->context, buffer, index) == FALSE) {
+			return FALSE;
+		}
+
+		InterlockedIncrement(&usb->transmitted.transfers);
+		InterlockedExchangeAdd(&usb->transmitted.frames, (LONG)records);
+		*written += records;
+	}
+	return TRUE;
+}
+
+//
+// Fill in the backend operations for a TouCAN USB device
+// [in] usb, state of the backend, must outlive it
+// [in] device, the device operations, for example from TouCAN_libusb_device
+//
+
+void TouCAN_usb_backend(TOUCAN_BACKEND *backend, TOUCAN_USB_BACKEND *usb, TOUCAN_USB_DEVICE *device) {
+	memset(usb, 0, sizeof(TOUCAN_USB_BACKEND));
+	usb->device = device;
+
+	backend->name = "USB";
+	backend->context = usb;
+	backend->Open = UsbOpen;
+	backend->Close = UsbClose;
+	backend->Control = UsbControl;
+	backend->ReadOpen = UsbReadOpen;
+	backend->ReadBatch = UsbReadBatch;
+	backend->ReadClose = UsbReadClose;
+	backend->WriteBatch = UsbWriteBatch;
+	backend->transmitted = &usb->transmitted;
+	InitializeSRWLock(&usb->requestLock);
+	backend->requestLock = &usb->requestLock;
+	backend->filterBanks = 0;
+}
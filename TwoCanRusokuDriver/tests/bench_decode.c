@@ -0,0 +1,78 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Decoder Benchmark
+// Unit Description: Micro benchmark of the bulk IN packet decoder
+// Function: Decodes packets of one, two and three records in a tight loop and reports
+// nanoseconds per record and records per second
+//
+
+#include "../inc/toucan_decode.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Packets decoded for each size unless the first argument gives another count
+#define BENCH_DECODE_PACKETS 10000000
+
+// Distinct packets cycled through, so the branch predictor cannot learn one
+#define BENCH_DECODE_VARIANTS 64
+
+static UINT8 packets[BENCH_DECODE_VARIANTS][TOUCAN_RECORD_LENGTH * TOUCAN_MAX_RECORDS_PER_TRANSFER];
+
+int main(int argc, char *argv[]) {
+	UINT32 iterations = (argc > 1) ? (UINT32)strtoul(argv[1], NULL, 10) : BENCH_DECODE_PACKETS;
+	TOUCAN_FRAME frames[TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	volatile UINT32 checksum = 0;
+	UINT32 count;
+	long long start;
+	long long elapsed;
+
+	for (UINT32 v = 0; v < BENCH_DECODE_VARIANTS; v++) {
+		for (UINT32 i = 0; i < sizeof(packets[v]); i++) {
+			packets[v][i] = (UINT8)((v * 131) + (i * 7));
+		}
+		for (UINT32 r = 0; r < TOUCAN_MAX_RECORDS_PER_TRANSFER; r++) {
+			packets[v][(r * TOUCAN_RECORD_LENGTH) + TOUCAN_RECORD_LENGTH_CODE] = (UINT8)((v + r) % 9);
+		}
+	}
+
+	for (UINT32 records = 1; records <= TOUCAN_MAX_RECORDS_PER_TRANSFER; records++) {
+		start = TestNow();
+		for (UINT32 n = 0; n < iterations; n++) {
+			if (TouCAN_decode_packet(packets[n % BENCH_DECODE_VARIANTS], records * TOUCAN_RECORD_LENGTH, frames, TOUCAN_MAX_RECORDS_PER_TRANSFER, &count)) {
+				checksum += frames[count - 1].id;
+			}
+		}
+		elapsed = TestNow() - start;
+		if (elapsed <= 0) {
+			elapsed = 1;
+		}
+
+		printf("%u record packets: %6.2f ns/record %12.0f records/s\n", records,
+			(double)elapsed * 1000.0 / ((double)iterations * records),
+			(double)iterations * records * 1000000.0 / (double)elapsed);
+	}
+
+	CHECK(checksum != 0);
+	return TEST_RESULT();
+}
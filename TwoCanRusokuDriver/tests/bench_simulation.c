@@ -0,0 +1,208 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Simulation Benchmark
+// Unit Description: End to end receive benchmark against the simulated adapter
+// Function: Opens an adapter instance, the driver's own read thread and receive queue, on the simulated
+// adapter at 25, 50 and 100 % of 250 kbit/s held to the host clock, and unpaced as an overload, drains it
+// as a caller would and writes frames/s, transfers per frame, delivery latency, losses and CPU time as JSON
+//
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include "../inc/toucan_adapter.h"
+#include "../inc/toucan_instance.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Length of each run in milliseconds unless the first argument gives another
+#define BENCH_SIM_DURATION 1000
+
+// Longest wait of the caller for the instance's notification, in milliseconds
+#define BENCH_SIM_CALLER_WAIT 10
+
+// One run of the benchmark
+typedef struct _BENCH_SIM_RUN {
+	const char	*name;
+	UINT32	busLoad;
+	BOOL	paced;
+} BENCH_SIM_RUN;
+
+static const BENCH_SIM_RUN runs[] = {
+	{ "load25", 25, TRUE },
+	{ "load50", 50, TRUE },
+	{ "load100", 100, TRUE },
+	{ "overload", 100, FALSE }
+};
+
+// The simulated adapter, and the instance reading it as the driver's single adapter API does
+static TOUCAN_ADAPTER adapter;
+static TOUCAN_INSTANCE instance;
+static LONGLONG simulationStart;
+
+// Sequence number the caller expects next
+static UINT32 expected;
+
+static LONGLONG CpuTime(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return ((LONGLONG)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+// Hold the virtual clock to the host clock, as the driver's real time simulation does
+static void Pace(void *context, LONGLONG now) {
+	LONGLONG ahead = now - (HostMicroseconds() - *(LONGLONG *)context);
+
+	if (ahead >= 1000) {
+		Sleep((DWORD)(ahead / 1000));
+	}
+}
+
+// Sequence number the simulator writes into the first four data bytes
+static UINT32 Sequence(const TOUCAN_FRAME *frame) {
+	return (UINT32)frame->data[0] | ((UINT32)frame->data[1] << 8) | ((UINT32)frame->data[2] << 16) | ((UINT32)frame->data[3] << 24);
+}
+
+// Drain the instance as the caller, counting the frames the simulator's sequence numbers say are missing
+static void Drain(UINT32 *delivered, UINT32 *gaps) {
+	TOUCAN_FRAME frames[64];
+	UINT32 count;
+
+	while ((count = TouCAN_instance_drain(&instance, frames, 64)) > 0) {
+		for (UINT32 i = 0; i < count; i++) {
+			*gaps += Sequence(&frames[i]) - expected;
+			expected = Sequence(&frames[i]) + 1;
+		}
+		*delivered += count;
+	}
+}
+
+// Run one load, the calling thread drains the instance, appends the result to json
+static BOOL Run(const BENCH_SIM_RUN *run, UINT32 duration, char *json, size_t size) {
+	TOUCAN_SIM_STATISTICS statistics;
+	LONGLONG end;
+	LONGLONG elapsed;
+	LONGLONG processCpu;
+	LONGLONG callerCpu;
+	UINT32 frameCount;
+	UINT32 transfers;
+	UINT32 delivered = 0;
+	UINT32 gaps = 0;
+	size_t length;
+
+	expected = 0;
+	memset(&adapter, 0, sizeof(adapter));
+	adapter.kind = (run->paced) ? TOUCAN_ADAPTER_SIMULATED_REAL_TIME : TOUCAN_ADAPTER_SIMULATED;
+	adapter.simulationConfig.seed = 1;
+	adapter.simulationConfig.busLoad = run->busLoad;
+	adapter.simulationConfig.Pace = (run->paced) ? Pace : NULL;
+	adapter.simulationConfig.paceContext = &simulationStart;
+
+	TouCAN_instance_init(&instance);
+	instance.config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+
+	simulationStart = HostMicroseconds();
+	if ((TouCAN_adapter_backend(&adapter) == FALSE) || (TouCAN_instance_open(&instance, &adapter.backend, NULL) != TWOCAN_RESULT_SUCCESS)) {
+		return FALSE;
+	}
+
+	processCpu = CpuTime(CLOCK_PROCESS_CPUTIME_ID);
+	callerCpu = CpuTime(CLOCK_THREAD_CPUTIME_ID);
+	if (TouCAN_instance_start(&instance) != TWOCAN_RESULT_SUCCESS) {
+		TouCAN_instance_close(&instance);
+		return FALSE;
+	}
+	end = HostMicroseconds() + ((LONGLONG)duration * 1000);
+
+	// Frames still queued when the read thread stops are discarded, as by CloseAdapter
+	do {
+		WaitForSingleObject(instance.frameReceivedEvent, BENCH_SIM_CALLER_WAIT);
+		Drain(&delivered, &gaps);
+	} while (HostMicroseconds() < end);
+	TouCAN_instance_stop(&instance);
+	elapsed = HostMicroseconds() - instance.receiveStarted;
+
+	// The read thread's time is all the process used beyond the caller's own
+	callerCpu = CpuTime(CLOCK_THREAD_CPUTIME_ID) - callerCpu;
+	processCpu = CpuTime(CLOCK_PROCESS_CPUTIME_ID) - processCpu - callerCpu;
+	frameCount = (UINT32)instance.receiveFrames;
+	transfers = (UINT32)instance.receiveTransfers;
+
+	TouCAN_simusb_statistics(&adapter.simulated, &statistics);
+
+	length = strlen(json);
+	// The same layout as GetPerformanceReport, with the run's parameters and the caller's sequence check
+	snprintf(&json[length], size - length,
+		"%s{\"name\":\"%s\",\"busLoad\":%u,\"paced\":%s,\"elapsed\":%lld,"
+		"\"receive\":{\"frames\":%u,\"delivered\":%u,\"transfers\":%u,\"framesPerSecond\":%.1f,\"framesPerTransfer\":%.3f,\"transfersPerFrame\":%.3f},"
+		"\"latency\":{\"samples\":%u,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},"
+		"\"dropped\":{\"queueOverflows\":%u,\"malformedPackets\":%u,\"sequenceGaps\":%u},"
+		"\"cpu\":{\"readThread\":%lld,\"perFrame\":%.3f},"
+		"\"simulation\":{\"virtualTime\":%lld,\"generated\":%u,\"overruns\":%u,\"lost\":%u}}",
+		(length > 1) ? "," : "", run->name, run->busLoad, (run->paced) ? "true" : "false", (long long)elapsed,
+		frameCount, delivered, transfers,
+		(double)frameCount * 1000000.0 / (double)elapsed,
+		(transfers > 0) ? (double)frameCount / (double)transfers : 0.0,
+		(frameCount > 0) ? (double)transfers / (double)frameCount : 0.0,
+		(UINT32)instance.deliveryLatency.samples, TouCAN_latency_percentile(&instance.deliveryLatency, 500), TouCAN_latency_percentile(&instance.deliveryLatency, 990),
+		TouCAN_latency_percentile(&instance.deliveryLatency, 999), (UINT32)instance.deliveryLatency.maximum,
+		(UINT32)instance.receiveRing.overflows, (UINT32)instance.receiveMalformed, gaps,
+		(long long)processCpu, (frameCount > 0) ? (double)processCpu / (double)frameCount : 0.0,
+		(long long)TouCAN_simusb_now(&adapter.simulated), statistics.generated, statistics.overruns, statistics.lost);
+
+	CHECK(frameCount > 0);
+	if (run->paced) {
+		// Held to the host clock the offered load is far below what the path can take
+		CHECK_EQUAL(0, instance.receiveRing.overflows);
+		CHECK(frameCount < (UINT32)(((UINT64)duration * 2 * 250000 * run->busLoad) / (100 * 1000 * (TOUCAN_SIM_FRAME_OVERHEAD + 64))) + 64);
+	}
+	return TouCAN_instance_close(&instance);
+}
+
+int main(int argc, char *argv[]) {
+	static char json[8192];
+	UINT32 duration = (argc > 1) ? (UINT32)strtoul(argv[1], NULL, 10) : BENCH_SIM_DURATION;
+	FILE *output;
+
+	strcpy(json, "[");
+	for (UINT32 i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		CHECK(Run(&runs[i], duration, json, sizeof(json) - 2));
+	}
+	strcat(json, "]");
+
+	printf("{\"benchmark\":\"simulation\",\"bitrate\":%u,\"duration\":%u,\"runs\":%s}\n", TOUCAN_SIM_DEFAULT_BITRATE, duration, json);
+
+	// Optionally also written to a file, to be kept for comparison with later runs
+	if (argc > 2) {
+		output = fopen(argv[2], "w");
+		if (output != NULL) {
+			fprintf(output, "{\"benchmark\":\"simulation\",\"bitrate\":%u,\"duration\":%u,\"runs\":%s}\n", TOUCAN_SIM_DEFAULT_BITRATE, duration, json);
+			fclose(output);
+		}
+	}
+	return TEST_RESULT();
+}
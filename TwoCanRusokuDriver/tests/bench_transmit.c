@@ -0,0 +1,183 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Transmit Benchmark
+// Unit Description: Frames per second and bulk OUT transfers per frame
+// Function: Sends fast packet messages to a simulated adapter one frame per transfer, the way
+// TouCAN_write used to, and batched three records per transfer, and reports both
+//
+
+#include "../inc/toucan_simusb.h"
+#include "../inc/toucan_usb.h"
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// A 223 byte fast packet message, the largest, takes 32 frames
+#define BENCH_MESSAGE_FRAMES 32
+#define BENCH_MESSAGES 2000
+
+// A synchronous bulk OUT transfer completes at the earliest on the next full speed USB frame
+#define BENCH_TRANSFER_TIME TOUCAN_SIM_USB_FRAME
+
+// The simulated adapter behind a device that counts bulk OUT transfers and charges each
+// the USB frame the caller waits for
+typedef struct _BENCH_DEVICE {
+	TOUCAN_USB_DEVICE	device;
+	TOUCAN_USB_DEVICE	sim;
+	TOUCAN_SIM_USB	*state;
+	UINT32	transfers;
+} BENCH_DEVICE;
+
+static int BenchOpen(void *context) {
+	BENCH_DEVICE *bench = (BENCH_DEVICE *)context;
+	return bench->sim.Open(bench->sim.context);
+}
+
+static void BenchClose(void *context) {
+	BENCH_DEVICE *bench = (BENCH_DEVICE *)context;
+	bench->sim.Close(bench->sim.context);
+}
+
+static BOOL BenchControl(void *context, UINT8 requestType, UINT8 request, UINT8 *data, UINT16 length, ULONG *transferred) {
+	BENCH_DEVICE *bench = (BENCH_DEVICE *)context;
+	return bench->sim.Control(bench->sim.context, requestType, request, data, length, transferred);
+}
+
+static BOOL BenchBulkOut(void *context, const UINT8 *data, UINT32 length) {
+	BENCH_DEVICE *bench = (BENCH_DEVICE *)context;
+
+	bench->transfers++;
+	if (bench->sim.BulkOut(bench->sim.context, data, length) == FALSE) {
+		return FALSE;
+	}
+	TouCAN_simusb_advance(bench->state, BENCH_TRANSFER_TIME);
+	return TRUE;
+}
+
+// Result of one run
+typedef struct _BENCH_RESULT {
+	UINT32	frames;
+	UINT32	transfers;
+	double	simulatedRate;		// Frames per second on the simulated clock
+	double	hostRate;			// Frames per second the host encoded and submitted
+} BENCH_RESULT;
+
+// Send every message, framesPerCall frames to each WriteBatch call
+static BOOL Run(UINT32 framesPerCall, BENCH_RESULT *result) {
+	static TOUCAN_SIM_USB sim;
+	BENCH_DEVICE bench;
+	TOUCAN_USB_BACKEND usb;
+	TOUCAN_BACKEND backend;
+	TOUCAN_SIM_CONFIG config;
+	TOUCAN_SIM_STATISTICS statistics;
+	TOUCAN_FRAME message[BENCH_MESSAGE_FRAMES];
+	UINT32 written;
+	UINT32 sent;
+	LONGLONG simulatedStart;
+	long long hostStart;
+	long long hostTime;
+
+	memset(&config, 0, sizeof(config));
+	config.seed = 1;
+	TouCAN_simusb_device(&bench.sim, &sim, &config);
+	bench.state = &sim;
+	bench.transfers = 0;
+	bench.device = bench.sim;
+	bench.device.context = &bench;
+	bench.device.Open = BenchOpen;
+	bench.device.Close = BenchClose;
+	bench.device.Control = BenchControl;
+	bench.device.BulkOut = BenchBulkOut;
+	TouCAN_usb_backend(&backend, &usb, &bench.device);
+
+	if ((backend.Open(backend.context) != TWOCAN_RESULT_SUCCESS) ||
+		(TouCAN_backend_init(&backend, 0) == FALSE) || (TouCAN_backend_start(&backend) == FALSE)) {
+		return FALSE;
+	}
+
+	// PGN 129029, GNSS position, priority 3, every frame a full 8 bytes
+	memset(message, 0, sizeof(message));
+	for (UINT32 i = 0; i < BENCH_MESSAGE_FRAMES; i++) {
+		message[i].id = TOUCAN_PDU2_ID(3, 129029, 0x23);
+		message[i].flags = TOUCAN_FRAME_EXTENDED;
+		message[i].length = TOUCAN_FRAME_DATA_LENGTH;
+		message[i].data[0] = (UINT8)i;
+	}
+
+	simulatedStart = TouCAN_simusb_now(&sim);
+	hostStart = TestNow();
+
+	for (UINT32 m = 0; m < BENCH_MESSAGES; m++) {
+		for (sent = 0; sent < BENCH_MESSAGE_FRAMES; sent += written) {
+			UINT32 count = BENCH_MESSAGE_FRAMES - sent;
+			if (count > framesPerCall) {
+				count = framesPerCall;
+			}
+			if (backend.WriteBatch(backend.context, &message[sent], count, &written) == FALSE) {
+				return FALSE;
+			}
+		}
+	}
+
+	hostTime = TestNow() - hostStart;
+	TouCAN_simusb_statistics(&sim, &statistics);
+
+	result->frames = statistics.transmitted;
+	result->transfers = bench.transfers;
+	result->simulatedRate = (double)statistics.transmitted * 1000000.0 / (double)(TouCAN_simusb_now(&sim) - simulatedStart);
+	result->hostRate = (hostTime > 0) ? (double)statistics.transmitted * 1000000.0 / (double)hostTime : 0.0;
+
+	TouCAN_backend_stop(&backend);
+	backend.Close(backend.context);
+	return TRUE;
+}
+
+static void Report(const char *name, const BENCH_RESULT *result) {
+	printf("%-8s %8u frames %8u transfers %6.3f transfers/frame %9.0f frames/s simulated %12.0f frames/s host\n",
+		name, result->frames, result->transfers, (double)result->transfers / (double)result->frames,
+		result->simulatedRate, result->hostRate);
+}
+
+int main(void) {
+	BENCH_RESULT single;
+	BENCH_RESULT batched;
+	UINT32 frames = BENCH_MESSAGES * BENCH_MESSAGE_FRAMES;
+	UINT32 transfersPerMessage = (BENCH_MESSAGE_FRAMES + TOUCAN_MAX_RECORDS_PER_TRANSFER - 1) / TOUCAN_MAX_RECORDS_PER_TRANSFER;
+
+	CHECK(Run(1, &single));
+	CHECK(Run(BENCH_MESSAGE_FRAMES, &batched));
+
+	Report("single", &single);
+	Report("batched", &batched);
+
+	CHECK_EQUAL(frames, single.frames);
+	CHECK_EQUAL(frames, single.transfers);
+	CHECK_EQUAL(frames, batched.frames);
+	CHECK_EQUAL(BENCH_MESSAGES * transfersPerMessage, batched.transfers);
+	CHECK(batched.simulatedRate > single.simulatedRate);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,66 @@
+// Declarations standing in for libusb-1.0's libusb.h, only the parts toucan_libusb.c uses,
+// so the libusb transport is compiled, though not linked, where libusb is not installed.
+
+#ifndef _TWOCAN_LIBUSB_STUB
+#define _TWOCAN_LIBUSB_STUB
+
+#include <sys/time.h>
+
+#define LIBUSB_CALL
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle	*dev_handle;
+	unsigned char	endpoint;
+	unsigned int	timeout;
+	enum libusb_transfer_status	status;
+	int		length;
+	int		actual_length;
+	libusb_transfer_cb_fn	callback;
+	void	*user_data;
+	unsigned char	*buffer;
+};
+
+int		libusb_init(libusb_context **context);
+void	libusb_exit(libusb_context *context);
+libusb_device_handle	*libusb_open_device_with_vid_pid(libusb_context *context, unsigned short vendorId, unsigned short productId);
+void	libusb_close(libusb_device_handle *handle);
+int		libusb_claim_interface(libusb_device_handle *handle, int interfaceNumber);
+int		libusb_release_interface(libusb_device_handle *handle, int interfaceNumber);
+int		libusb_handle_events_timeout_completed(libusb_context *context, struct timeval *timeout, int *completed);
+int		libusb_control_transfer(libusb_device_handle *handle, unsigned char requestType, unsigned char request, unsigned short value,
+	unsigned short index, unsigned char *data, unsigned short length, unsigned int timeout);
+int		libusb_bulk_transfer(libusb_device_handle *handle, unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+struct libusb_transfer	*libusb_alloc_transfer(int isoPackets);
+void	libusb_free_transfer(struct libusb_transfer *transfer);
+int		libusb_submit_transfer(struct libusb_transfer *transfer);
+int		libusb_cancel_transfer(struct libusb_transfer *transfer);
+
+static __inline void libusb_fill_bulk_transfer(struct libusb_transfer *transfer, libusb_device_handle *handle, unsigned char endpoint,
+	unsigned char *buffer, int length, libusb_transfer_cb_fn callback, void *userData, unsigned int timeout) {
+	transfer->dev_handle = handle;
+	transfer->endpoint = endpoint;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->callback = callback;
+	transfer->user_data = userData;
+	transfer->timeout = timeout;
+}
+
+#endif
@@ -0,0 +1,109 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Adapter Test
+// Unit Description: Tests of the transport selection
+// Function: Opens an instance on a simulated adapter selected by its kind, and checks which kinds
+// this platform offers, the SocketCAN interface on Linux and the adapter on libusb where it is built
+//
+
+#include "../inc/toucan_adapter.h"
+#include "../inc/toucan_instance.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Longest wait for the simulated adapter's frames, in milliseconds
+#define TEST_TIMEOUT 2000
+
+static TOUCAN_ADAPTER adapter;
+static TOUCAN_INSTANCE instance;
+
+// A simulated adapter is opened and read through the same instance as any other
+static void TestSimulated(void) {
+	TOUCAN_FRAME frames[64];
+	ULONGLONG start;
+	UINT32 total = 0;
+
+	memset(&adapter, 0, sizeof(adapter));
+	adapter.kind = TOUCAN_ADAPTER_SIMULATED;
+	adapter.simulationConfig.seed = 11;
+	adapter.simulationConfig.busLoad = 50;
+	CHECK(TouCAN_adapter_backend(&adapter));
+	CHECK(strcmp(adapter.backend.name, "USB") == 0);
+	CHECK_EQUAL(0, adapter.backend.filterBanks);
+
+	TouCAN_instance_init(&instance);
+	instance.config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_open(&instance, &adapter.backend, NULL));
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_start(&instance));
+
+	start = GetTickCount64();
+	while ((total < 64) && ((GetTickCount64() - start) < TEST_TIMEOUT)) {
+		WaitForSingleObject(instance.frameReceivedEvent, 10);
+		total += TouCAN_instance_drain(&instance, &frames[total], 64 - total);
+	}
+	CHECK_EQUAL(64, total);
+	CHECK(adapter.simulated.statistics.generated >= total);
+
+	CHECK(TouCAN_instance_close(&instance));
+}
+
+// Each kind this build offers fills in its own backend, the others are refused
+static void TestKinds(void) {
+	memset(&adapter, 0, sizeof(adapter));
+	adapter.kind = TOUCAN_ADAPTER_REPLAY;
+	CHECK(TouCAN_adapter_backend(&adapter));
+	CHECK(strcmp(adapter.backend.name, "Replay") == 0);
+
+	adapter.kind = TOUCAN_ADAPTER_HARDWARE;
+#if defined(TOUCAN_LIBUSB)
+	CHECK(TouCAN_adapter_backend(&adapter));
+	CHECK(strcmp(adapter.backend.name, "USB") == 0);
+#else
+	CHECK(TouCAN_adapter_backend(&adapter) == FALSE);
+#endif
+
+	adapter.kind = TOUCAN_ADAPTER_SOCKETCAN;
+#if defined(__linux__)
+	strcpy(adapter.interfaceName, "vcan3");
+	CHECK(TouCAN_adapter_backend(&adapter));
+	CHECK(strcmp(adapter.backend.name, "SocketCAN") == 0);
+	CHECK(strcmp(adapter.socketcan.interfaceName, "vcan3") == 0);
+	CHECK_EQUAL(TOUCAN_SOCKETCAN_FILTER_BANKS, adapter.backend.filterBanks);
+
+	adapter.interfaceName[0] = '\0';
+	CHECK(TouCAN_adapter_backend(&adapter));
+	CHECK(strcmp(adapter.socketcan.interfaceName, TOUCAN_SOCKETCAN_DEFAULT_INTERFACE) == 0);
+#else
+	CHECK(TouCAN_adapter_backend(&adapter) == FALSE);
+#endif
+
+	adapter.kind = TOUCAN_ADAPTER_SOCKETCAN + 1;
+	CHECK(TouCAN_adapter_backend(&adapter) == FALSE);
+}
+
+int main(void) {
+	TestSimulated();
+	TestKinds();
+	return TEST_RESULT();
+}
@@ -0,0 +1,192 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Capture Test
+// Unit Description: Tests of the capture writer and the windowed capture reader
+// Function: Writes captures several mapping windows long, then seeks and reads across the
+// windows through the index of a closed capture and without one while a capture is being written,
+// and checks the order of transmitted and received frames stamped from different clocks
+//
+
+#include "../inc/toucan_capture.h"
+#include "toucan_test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CAPTURE_PATH "test_capture.bin"
+
+// Enough records to span several windows
+#define TEST_RECORDS ((4 * TOUCAN_CAPTURE_WINDOW) / 32)
+#define TEST_BLOCK 4096
+
+// Transmitted and received frames appended alternately, several blocks of them
+#define TEST_INTERLEAVED 200
+
+static TOUCAN_CAPTURE capture;
+static TOUCAN_CAPTURE_READER reader;
+
+// Every record is 10 microseconds after the previous one and carries its number
+static void Append(UINT32 first, UINT32 count) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	for (UINT32 i = first; i < first + count; i++) {
+		frame.hostTime = (LONGLONG)i * 10;
+		frame.id = i & 0x1FFFFFFF;
+		frame.length = 8;
+		memcpy(frame.data, &i, sizeof(i));
+		TouCAN_capture_append(&capture, &frame, 1, (UINT8)(i & 1));
+		TouCAN_capture_write(&capture);
+	}
+}
+
+// Seeks land on the first record at or after the time, and reading on crosses window boundaries
+static void CheckReader(UINT32 records) {
+	TOUCAN_FRAME frames[256];
+	UINT8 directions[256];
+	UINT32 next;
+	UINT32 count;
+	UINT32 value;
+	ULONGLONG targets[] = { 0, 1, 4095, 4096, 131071, 131072, 131073, records / 2, records - 1 };
+
+	CHECK_EQUAL(records, reader.count);
+	for (UINT32 t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+		CHECK_EQUAL(targets[t], TouCAN_capture_seek(&reader, (LONGLONG)targets[t] * 10));
+		CHECK_EQUAL(targets[t] + 1, TouCAN_capture_seek(&reader, ((LONGLONG)targets[t] * 10) + 1));
+	}
+	CHECK_EQUAL(records, TouCAN_capture_seek(&reader, (LONGLONG)records * 10));
+
+	TouCAN_capture_seek(&reader, 0);
+	next = 0;
+	while ((count = TouCAN_capture_next(&reader, frames, directions, 256)) > 0) {
+		for (UINT32 i = 0; i < count; i++, next++) {
+			memcpy(&value, frames[i].data, sizeof(value));
+			if ((value != next) || (frames[i].hostTime != (LONGLONG)next * 10) || (directions[i] != (next & 1))) {
+				CHECK_EQUAL(next, value);
+				return;
+			}
+		}
+	}
+	CHECK_EQUAL(records, next);
+
+	// Only a window of the file is mapped however far the reader has gone
+	CHECK(reader.viewLength <= TOUCAN_CAPTURE_WINDOW);
+}
+
+static void TestClosed(void) {
+	CHECK(TouCAN_capture_open(&capture, TEST_CAPTURE_PATH, TEST_BLOCK, 1234));
+	Append(0, TEST_RECORDS);
+	CHECK(TouCAN_capture_close(&capture));
+
+	CHECK_EQUAL(TOUCAN_CAPTURE_MAPPED, TouCAN_capture_map(&reader, TEST_CAPTURE_PATH));
+	CHECK_EQUAL(1234, reader.header.startTime);
+	CHECK_EQUAL((TEST_RECORDS + TEST_BLOCK - 1) / TEST_BLOCK, reader.indexEntries);
+	CheckReader(TEST_RECORDS);
+	TouCAN_capture_unmap(&reader);
+}
+
+// A capture still being written has no index, its records are read up to the last whole block
+static void TestOpen(void) {
+	UINT32 records = TEST_RECORDS - (TEST_RECORDS % TEST_BLOCK);
+
+	CHECK(TouCAN_capture_open(&capture, TEST_CAPTURE_PATH, TEST_BLOCK, 0));
+	Append(0, records);
+
+	CHECK_EQUAL(TOUCAN_CAPTURE_MAPPED, TouCAN_capture_map(&reader, TEST_CAPTURE_PATH));
+	CHECK(reader.index == NULL);
+	CheckReader(records);
+	TouCAN_capture_unmap(&reader);
+	TouCAN_capture_close(&capture);
+}
+
+// A received frame mapped from the adapter's clock may be stamped before a frame transmitted just
+// ahead of it, it is recorded at that frame's time so seeks through the index still find it
+static void TestInterleaved(void) {
+	TOUCAN_FRAME frames[3];
+	UINT8 directions[3];
+	LONGLONG previous = 0;
+	UINT32 count;
+
+	CHECK(TouCAN_capture_open(&capture, TEST_CAPTURE_PATH, TOUCAN_CAPTURE_MIN_BLOCK, 0));
+	memset(frames, 0, sizeof(frames));
+	for (UINT32 k = 0; k < TEST_INTERLEAVED; k++) {
+		frames[0].id = k * 3;
+		frames[0].hostTime = ((LONGLONG)k * 1000) + 500;
+		TouCAN_capture_append(&capture, &frames[0], 1, TOUCAN_CAPTURE_TRANSMITTED);
+
+		frames[1].id = (k * 3) + 1;
+		frames[1].hostTime = ((LONGLONG)k * 1000) + 100;
+		frames[2].id = (k * 3) + 2;
+		frames[2].hostTime = ((LONGLONG)k * 1000) + 900;
+		TouCAN_capture_append(&capture, &frames[1], 2, TOUCAN_CAPTURE_RECEIVED);
+		TouCAN_capture_write(&capture);
+	}
+	CHECK(TouCAN_capture_close(&capture));
+
+	CHECK_EQUAL(TOUCAN_CAPTURE_MAPPED, TouCAN_capture_map(&reader, TEST_CAPTURE_PATH));
+	CHECK(reader.indexEntries > 1);
+	CHECK_EQUAL(TEST_INTERLEAVED * 3, reader.count);
+
+	// Append order is kept, the host times never decrease
+	TouCAN_capture_seek(&reader, 0);
+	for (UINT32 next = 0; (count = TouCAN_capture_next(&reader, frames, directions, 3)) > 0; next += count) {
+		for (UINT32 i = 0; i < count; i++) {
+			CHECK_EQUAL(next + i, frames[i].id);
+			CHECK(frames[i].hostTime >= previous);
+			previous = frames[i].hostTime;
+		}
+	}
+
+	for (UINT32 k = 0; k < TEST_INTERLEAVED; k += 7) {
+		CHECK_EQUAL(k * 3, TouCAN_capture_seek(&reader, ((LONGLONG)k * 1000) + 100));
+		CHECK_EQUAL(k * 3, TouCAN_capture_seek(&reader, ((LONGLONG)k * 1000) + 500));
+		CHECK_EQUAL((k * 3) + 2, TouCAN_capture_seek(&reader, ((LONGLONG)k * 1000) + 501));
+		CHECK(TouCAN_capture_next(&reader, frames, directions, 1) == 1);
+		CHECK_EQUAL(((LONGLONG)k * 1000) + 900, frames[0].hostTime);
+		CHECK_EQUAL(TOUCAN_CAPTURE_RECEIVED, directions[0]);
+	}
+	TouCAN_capture_unmap(&reader);
+}
+
+static void TestInvalid(void) {
+	FILE *file;
+
+	file = fopen(TEST_CAPTURE_PATH, "wb");
+	CHECK(file != NULL);
+	if (file != NULL) {
+		for (UINT32 i = 0; i < 256; i++) {
+			fputc('x', file);
+		}
+		fclose(file);
+	}
+	CHECK_EQUAL(TOUCAN_CAPTURE_INVALID, TouCAN_capture_map(&reader, TEST_CAPTURE_PATH));
+	CHECK_EQUAL(TOUCAN_CAPTURE_UNREADABLE, TouCAN_capture_map(&reader, "missing_capture.bin"));
+}
+
+int main(void) {
+	TestClosed();
+	TestOpen();
+	TestInterleaved();
+	TestInvalid();
+	remove(TEST_CAPTURE_PATH);
+	return TEST_RESULT();
+}
@@ -0,0 +1,216 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Channel Test
+// Unit Description: Tests of the shared memory frame channel
+// Function: Publishes frames to readers attached to the same channel, checking that a reader the
+// writer laps skips to the oldest frames still held and counts the frames it missed, and that a
+// slow reader racing the writer never returns a torn frame
+//
+
+#include "../inc/toucan_channel.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Frames the writer thread publishes while the slow reader follows
+#define TEST_FRAMES 200000
+
+// Longest wait for the writer thread, in milliseconds
+#define TEST_TIMEOUT 10000
+
+static char name[TOUCAN_CHANNEL_MAX_NAME];
+static TOUCAN_CHANNEL writer;
+static volatile LONG writerDone;
+
+// Frame with sequence s, its identifier and every data byte derived from s so a torn copy shows
+static TOUCAN_FRAME Frame(UINT32 sequence) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = sequence & 0x1FFFFFFF;
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = 8;
+	memset(frame.data, (int)(sequence & 0xFF), 8);
+	frame.timestamp = ~sequence;
+	return frame;
+}
+
+static BOOL Intact(const TOUCAN_FRAME *frame) {
+	TOUCAN_FRAME expected = Frame(frame->id);
+
+	return (memcmp(&expected, frame, sizeof(TOUCAN_FRAME)) == 0);
+}
+
+static void Publish(UINT32 first, UINT32 count) {
+	TOUCAN_FRAME frame;
+
+	for (UINT32 i = 0; i < count; i++) {
+		frame = Frame(first + i);
+		TouCAN_channel_publish(&writer, &frame, 1);
+	}
+}
+
+static DWORD WINAPI Writer(LPVOID parameter) {
+	UINT32 first = *(UINT32 *)parameter;
+
+	// In bursts shorter than the channel, as packets arrive
+	for (UINT32 i = 0; i < TEST_FRAMES; i += 16) {
+		Publish(first + i, 16);
+		Sleep(0);
+	}
+	WriteRelease(&writerDone, TRUE);
+	return 0;
+}
+
+// Readers follow independently, a reader lapped by the writer skips ahead and counts what it missed
+static void TestLap(void) {
+	TOUCAN_FRAME frames[TOUCAN_CHANNEL_MIN_SLOTS * 2];
+	TOUCAN_CHANNEL fast;
+	TOUCAN_CHANNEL slow;
+	UINT32 lost;
+	UINT32 count;
+
+	CHECK(TouCAN_channel_create(&writer, name, 50));
+	CHECK_EQUAL(TOUCAN_CHANNEL_MIN_SLOTS, writer.header->slots);
+	CHECK(TouCAN_channel_open(&fast, name));
+	CHECK(TouCAN_channel_open(&slow, name));
+
+	Publish(0, 10);
+	CHECK_EQUAL(10, TouCAN_channel_read(&fast, frames, TOUCAN_CHANNEL_MIN_SLOTS * 2, &lost));
+	CHECK_EQUAL(0, lost);
+	for (UINT32 i = 0; i < 10; i++) {
+		CHECK_EQUAL(i, frames[i].id);
+		CHECK(Intact(&frames[i]));
+	}
+
+	// A reader only sees what was published since it opened the channel
+	CHECK(TouCAN_channel_open(&fast, name));
+	CHECK_EQUAL(0, TouCAN_channel_read(&fast, frames, TOUCAN_CHANNEL_MIN_SLOTS * 2, &lost));
+
+	// The slow reader is lapped, it resumes an eighth of the channel behind the oldest frame still held
+	Publish(10, 100);
+	count = TouCAN_channel_read(&slow, frames, TOUCAN_CHANNEL_MIN_SLOTS * 2, &lost);
+	CHECK_EQUAL(110 - (TOUCAN_CHANNEL_MIN_SLOTS - 1) + ((TOUCAN_CHANNEL_MIN_SLOTS - 1) >> 3), lost);
+	CHECK_EQUAL(110 - lost, count);
+	CHECK_EQUAL(lost, frames[0].id);
+	CHECK_EQUAL(109, frames[count - 1].id);
+
+	// Within the channel's depth nothing more is lost
+	CHECK_EQUAL(100, TouCAN_channel_read(&fast, frames, TOUCAN_CHANNEL_MIN_SLOTS * 2, NULL) + fast.lost);
+	Publish(110, 20);
+	CHECK_EQUAL(20, TouCAN_channel_read(&slow, frames, TOUCAN_CHANNEL_MIN_SLOTS * 2, &count));
+	CHECK_EQUAL(lost, count);
+
+	// A writer taking over keeps the channel, one of another depth cannot
+	TouCAN_channel_close(&writer);
+	CHECK(TouCAN_channel_create(&writer, name, TOUCAN_CHANNEL_MIN_SLOTS));
+	CHECK_EQUAL(130, writer.header->published);
+	TouCAN_channel_close(&writer);
+	CHECK(TouCAN_channel_create(&writer, name, TOUCAN_CHANNEL_MIN_SLOTS * 2) == FALSE);
+
+	TouCAN_channel_close(&fast);
+	TouCAN_channel_close(&slow);
+}
+
+// A reader slower than the writer, every frame it returns is whole and in order, the gaps are its lost count
+static void TestSlowReader(void) {
+	TOUCAN_FRAME frames[16];
+	TOUCAN_CHANNEL reader;
+	HANDLE thread;
+	UINT32 first;
+	UINT32 next;
+	UINT32 lost = 0;
+	UINT32 read = 0;
+	UINT32 count;
+	UINT32 torn = 0;
+	UINT32 skipped = 0;
+	ULONGLONG start;
+
+	CHECK(TouCAN_channel_create(&writer, name, TOUCAN_CHANNEL_MIN_SLOTS));
+	CHECK(TouCAN_channel_open(&reader, name));
+	first = (UINT32)writer.header->published;
+	next = first;
+
+	thread = CreateThread(NULL, 0, Writer, &first, 0, NULL);
+	CHECK(thread != NULL);
+
+	start = GetTickCount64();
+	while ((read + lost < TEST_FRAMES) && ((GetTickCount64() - start) < TEST_TIMEOUT)) {
+		count = TouCAN_channel_read(&reader, frames, 16, &lost);
+		for (UINT32 i = 0; i < count; i++) {
+			if (Intact(&frames[i]) == FALSE) {
+				torn++;
+			}
+			skipped += frames[i].id - next;
+			next = frames[i].id + 1;
+		}
+		read += count;
+
+		// Now and then fall behind the writer
+		if ((count > 0) && ((read & 0x3FF) < count)) {
+			Sleep(1);
+		}
+	}
+
+	CHECK(WaitForSingleObject(thread, TEST_TIMEOUT) == WAIT_OBJECT_0);
+	CloseHandle(thread);
+	read += TouCAN_channel_read(&reader, frames, 16, &lost);
+
+	CHECK_EQUAL(0, torn);
+	CHECK_EQUAL(TEST_FRAMES, read + lost);
+	CHECK(read > 0);
+	CHECK(writerDone);
+
+	// Every frame skipped over is counted as lost
+	skipped += (first + TEST_FRAMES) - next;
+	CHECK_EQUAL(lost, skipped);
+
+	TouCAN_channel_close(&reader);
+	TouCAN_channel_close(&writer);
+}
+
+int main(void) {
+	TOUCAN_CHANNEL missing;
+
+#if defined(_WIN32)
+	snprintf(name, sizeof(name), "Local\\TwoCanChannelTest%lu", GetCurrentProcessId());
+#else
+	snprintf(name, sizeof(name), "/twocan-channel-test-%ld", (long)getpid());
+#endif
+
+	CHECK(TouCAN_channel_open(&missing, name) == FALSE);
+
+	TestLap();
+	TestSlowReader();
+
+#if !defined(_WIN32)
+	shm_unlink(name);
+#endif
+	return TEST_RESULT();
+}
@@ -0,0 +1,143 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Clock Test
+// Unit Description: Tests of the correlation between the adapter's timestamp and the host clock
+// Function: Feeds the clock synthetic packet arrivals, checking the 32 bit wraparound, the restart
+// of the adapter, and the drift estimate converging through USB latency while outliers are ignored
+//
+
+#include "../inc/toucan_clock.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+
+// Host time the synthetic recordings start at, in microseconds
+#define TEST_HOST_START 5000000
+
+// Seconds of synthetic packets, one every millisecond
+#define TEST_SECONDS 30
+
+// USB latency of the synthetic packet i, some packets of every window arrive undelayed
+static LONGLONG Latency(UINT32 i) {
+	return ((i % 97) == 0) ? 0 : (LONGLONG)((i * 7919) % 500);
+}
+
+// The unsigned timestamp wraps without disturbing the mapping
+static void TestWrap(void) {
+	TOUCAN_CLOCK clock;
+
+	TouCAN_clock_init(&clock, TOUCAN_TIMESTAMP_FREQUENCY);
+	TouCAN_clock_update(&clock, 0xFFFFFF00, TEST_HOST_START);
+	TouCAN_clock_update(&clock, 0x00000100, TEST_HOST_START + 512);
+
+	CHECK_EQUAL(0, clock.resets);
+	CHECK_EQUAL(512, clock.deviceTime);
+	CHECK_EQUAL(TEST_HOST_START + 512, TouCAN_clock_to_host(&clock, 0x00000100));
+
+	// Timestamps either side of the latest sample, across the wraparound
+	CHECK_EQUAL(TEST_HOST_START + 128, TouCAN_clock_to_host(&clock, 0xFFFFFF80));
+	CHECK_EQUAL(TEST_HOST_START + 768, TouCAN_clock_to_host(&clock, 0x00000200));
+
+	// Ticks of another frequency are scaled to microseconds
+	TouCAN_clock_init(&clock, TOUCAN_TIMESTAMP_FREQUENCY * 2);
+	TouCAN_clock_update(&clock, 0xFFFFFFF0, TEST_HOST_START);
+	TouCAN_clock_update(&clock, 0x00000010, TEST_HOST_START + 16);
+	CHECK_EQUAL(TEST_HOST_START + 16, TouCAN_clock_to_host(&clock, 0x00000010));
+}
+
+// A step backwards is the adapter restarting, the mapping starts again from that sample
+static void TestReset(void) {
+	TOUCAN_CLOCK clock;
+
+	TouCAN_clock_init(&clock, TOUCAN_TIMESTAMP_FREQUENCY);
+	TouCAN_clock_update(&clock, 2000000, TEST_HOST_START);
+	TouCAN_clock_update(&clock, 2001000, TEST_HOST_START + 1000);
+	TouCAN_clock_update(&clock, 40, TEST_HOST_START + 9000);
+
+	CHECK_EQUAL(1, clock.resets);
+	CHECK_EQUAL(0, clock.deviceTime);
+	CHECK_EQUAL(TEST_HOST_START + 9000, TouCAN_clock_to_host(&clock, 40));
+	CHECK_EQUAL(TEST_HOST_START + 9100, TouCAN_clock_to_host(&clock, 140));
+
+	TouCAN_clock_update(&clock, 1040, TEST_HOST_START + 10000);
+	CHECK_EQUAL(1, clock.resets);
+	CHECK_EQUAL(1000, clock.deviceTime);
+}
+
+//
+// Replay TEST_SECONDS of packets from a device whose clock is off by ppm, delayed by Latency
+// returns the largest error of the mapped time of an undelayed packet over the last second
+//
+
+static LONGLONG Drift(TOUCAN_CLOCK *clock, LONG ppm) {
+	double rate = 1.0 + ((double)ppm / 1000000.0);
+	LONGLONG error = 0;
+	LONGLONG host;
+	UINT32 ticks;
+
+	TouCAN_clock_init(clock, TOUCAN_TIMESTAMP_FREQUENCY);
+	for (UINT32 i = 0; i < TEST_SECONDS * 1000; i++) {
+		// The device timestamp starts near the wraparound
+		ticks = 0xFFF00000 + (i * 1000);
+		host = TEST_HOST_START + (LONGLONG)((double)i * 1000.0 * rate);
+		TouCAN_clock_update(clock, ticks, host + Latency(i));
+
+		if ((i >= (TEST_SECONDS - 1) * 1000) && (llabs(TouCAN_clock_to_host(clock, ticks) - host) > error)) {
+			error = llabs(TouCAN_clock_to_host(clock, ticks) - host);
+		}
+	}
+	return error;
+}
+
+// The drift converges on the device's through the latency, a measurement beyond the limit is ignored
+static void TestDrift(void) {
+	TOUCAN_CLOCK clock;
+	LONGLONG error;
+
+	// 100 ppm slow, smoothed over the windows toward 100000 parts per billion
+	error = Drift(&clock, 100);
+	CHECK(clock.synchronised);
+	CHECK(clock.drift > 95000);
+	CHECK(clock.drift <= 101000);
+	CHECK(error < 100);
+	CHECK_EQUAL(0, clock.resets);
+
+	// Running fast
+	Drift(&clock, -50);
+	CHECK(clock.synchronised);
+	CHECK(clock.drift < -47000);
+	CHECK(clock.drift >= -51000);
+
+	// Twice the limit, every measurement is rejected as an outlier
+	Drift(&clock, TOUCAN_CLOCK_MAX_DRIFT * 2);
+	CHECK(clock.synchronised == FALSE);
+	CHECK_EQUAL(0, clock.drift);
+	CHECK(clock.rate == 1.0);
+}
+
+int main(void) {
+	TestWrap();
+	TestReset();
+	TestDrift();
+	return TEST_RESULT();
+}
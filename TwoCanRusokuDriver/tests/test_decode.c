@@ -0,0 +1,187 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Decoder Test
+// Unit Description: Fuzz test of the bulk IN packet decoder
+// Function: Decodes random and mutated packets and compares every result with a byte by byte
+// reference decoder, so the scalar and the SIMD builds are held to the same behaviour
+//
+
+#include "../inc/toucan_decode.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Packets decoded by the fuzz test unless the first argument gives another count
+#define TEST_DECODE_ITERATIONS 1000000
+
+// Largest packet tried, longer than any the adapter sends
+#define TEST_DECODE_MAX_PACKET 64
+
+static UINT32 randomState = 0x2545F491;
+
+static UINT32 Random(void) {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState;
+}
+
+// Reference decoder, the record layout spelled out byte by byte
+static BOOL Reference(const UINT8 *packet, ULONG length, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	UINT32 records = length / TOUCAN_RECORD_LENGTH;
+
+	*count = 0;
+	if ((records == 0) || ((length % TOUCAN_RECORD_LENGTH) != 0) || (records > maxFrames)) {
+		return FALSE;
+	}
+	for (UINT32 i = 0; i < records; i++) {
+		if (packet[(i * TOUCAN_RECORD_LENGTH) + 5] > TOUCAN_FRAME_DATA_LENGTH) {
+			return FALSE;
+		}
+	}
+	for (UINT32 i = 0; i < records; i++) {
+		const UINT8 *record = &packet[i * TOUCAN_RECORD_LENGTH];
+
+		frames[i].flags = record[0];
+		frames[i].id = (((UINT32)record[1] << 24) | ((UINT32)record[2] << 16) | ((UINT32)record[3] << 8) | record[4]) & 0x1FFFFFFF;
+		frames[i].length = record[5];
+		memcpy(frames[i].data, &record[6], TOUCAN_FRAME_DATA_LENGTH);
+		frames[i].timestamp = ((UINT32)record[14] << 24) | ((UINT32)record[15] << 16) | ((UINT32)record[16] << 8) | record[17];
+	}
+	*count = records;
+	return TRUE;
+}
+
+static BOOL SameFrame(const TOUCAN_FRAME *a, const TOUCAN_FRAME *b) {
+	return (a->id == b->id) && (a->timestamp == b->timestamp) && (a->flags == b->flags) &&
+		(a->length == b->length) && (memcmp(a->data, b->data, TOUCAN_FRAME_DATA_LENGTH) == 0);
+}
+
+// Random packets, mostly of whole records with valid lengths so most of them decode
+static void TestFuzz(UINT32 iterations) {
+	UINT8 packet[TEST_DECODE_MAX_PACKET + 16];
+	TOUCAN_FRAME frames[TEST_DECODE_MAX_PACKET / TOUCAN_RECORD_LENGTH + 1];
+	TOUCAN_FRAME expected[TEST_DECODE_MAX_PACKET / TOUCAN_RECORD_LENGTH + 1];
+	UINT32 count;
+	UINT32 expectedCount;
+	UINT32 maxFrames;
+	UINT32 mismatches = 0;
+	UINT32 decoded = 0;
+	ULONG length;
+	BOOL result;
+
+	for (UINT32 n = 0; n < iterations; n++) {
+		for (UINT32 i = 0; i < sizeof(packet); i++) {
+			packet[i] = (UINT8)Random();
+		}
+
+		switch (Random() % 4) {
+		case 0:
+			length = Random() % (TEST_DECODE_MAX_PACKET + 1);
+			break;
+		default:
+			length = (1 + (Random() % TOUCAN_MAX_RECORDS_PER_TRANSFER)) * TOUCAN_RECORD_LENGTH;
+			for (UINT32 r = 0; r < length; r += TOUCAN_RECORD_LENGTH) {
+				packet[r + TOUCAN_RECORD_LENGTH_CODE] = (UINT8)(Random() % ((Random() % 16) == 0 ? 256 : 9));
+			}
+			break;
+		}
+		maxFrames = ((Random() % 8) == 0) ? (Random() % 4) : TOUCAN_MAX_RECORDS_PER_TRANSFER;
+
+		memset(frames, 0xA5, sizeof(frames));
+		memset(expected, 0xA5, sizeof(expected));
+		result = TouCAN_decode_packet(packet, length, frames, maxFrames, &count);
+		if ((result != Reference(packet, length, expected, maxFrames, &expectedCount)) || (count != expectedCount)) {
+			mismatches++;
+			continue;
+		}
+		for (UINT32 i = 0; i < count; i++) {
+			if (SameFrame(&frames[i], &expected[i]) == FALSE) {
+				mismatches++;
+			}
+		}
+		// Frames past the decoded ones are not touched
+		if (memcmp(&frames[count], &expected[count], sizeof(TOUCAN_FRAME)) != 0) {
+			mismatches++;
+		}
+		decoded += count;
+	}
+
+	CHECK_EQUAL(0, mismatches);
+	CHECK(decoded > 0);
+	printf("decode: %u packets, %u records decoded\n", iterations, decoded);
+}
+
+// Every field survives an encode and decode, and the identifier loses only bits above 29
+static void TestRoundTrip(void) {
+	UINT8 packet[TOUCAN_RECORD_LENGTH * TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	TOUCAN_FRAME frames[TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	TOUCAN_FRAME decoded[TOUCAN_MAX_RECORDS_PER_TRANSFER];
+	UINT32 count;
+
+	for (UINT32 i = 0; i < TOUCAN_MAX_RECORDS_PER_TRANSFER; i++) {
+		memset(&frames[i], 0, sizeof(TOUCAN_FRAME));
+		frames[i].id = 0xFFFFFFFF - i;
+		frames[i].flags = TOUCAN_FRAME_EXTENDED;
+		frames[i].length = (UINT8)(8 - i);
+		memset(frames[i].data, 0x11 * (i + 1), TOUCAN_FRAME_DATA_LENGTH);
+		CHECK_EQUAL(TOUCAN_RECORD_LENGTH, TouCAN_encode_record(&frames[i], &packet[i * TOUCAN_RECORD_LENGTH]));
+	}
+
+	CHECK(TouCAN_decode_packet(packet, sizeof(packet), decoded, TOUCAN_MAX_RECORDS_PER_TRANSFER, &count));
+	CHECK_EQUAL(TOUCAN_MAX_RECORDS_PER_TRANSFER, count);
+	for (UINT32 i = 0; i < count; i++) {
+		CHECK_EQUAL(frames[i].id & 0x1FFFFFFF, decoded[i].id);
+		CHECK_EQUAL(frames[i].flags, decoded[i].flags);
+		CHECK_EQUAL(frames[i].length, decoded[i].length);
+		CHECK(memcmp(frames[i].data, decoded[i].data, TOUCAN_FRAME_DATA_LENGTH) == 0);
+		CHECK_EQUAL(0, decoded[i].timestamp);
+	}
+}
+
+// Packets the adapter never sends whole are dropped without decoding anything
+static void TestRejected(void) {
+	UINT8 packet[TOUCAN_RECORD_LENGTH * 2];
+	TOUCAN_FRAME frames[2];
+	UINT32 count = 99;
+
+	memset(packet, 0, sizeof(packet));
+	CHECK(TouCAN_decode_packet(packet, 0, frames, 2, &count) == FALSE);
+	CHECK_EQUAL(0, count);
+	CHECK(TouCAN_decode_packet(packet, TOUCAN_RECORD_LENGTH + 9, frames, 2, &count) == FALSE);
+	CHECK(TouCAN_decode_packet(packet, sizeof(packet), frames, 1, &count) == FALSE);
+
+	// A bad length in the second record drops the first as well
+	packet[TOUCAN_RECORD_LENGTH + TOUCAN_RECORD_LENGTH_CODE] = 9;
+	CHECK(TouCAN_decode_packet(packet, sizeof(packet), frames, 2, &count) == FALSE);
+	CHECK_EQUAL(0, count);
+}
+
+int main(int argc, char *argv[]) {
+	UINT32 iterations = (argc > 1) ? (UINT32)strtoul(argv[1], NULL, 10) : TEST_DECODE_ITERATIONS;
+
+	TestRejected();
+	TestRoundTrip();
+	TestFuzz(iterations);
+	return TEST_RESULT();
+}
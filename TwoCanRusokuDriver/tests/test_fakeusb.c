@@ -0,0 +1,226 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Fake USB Test
+// Unit Description: Tests of the USB backend against the scripted fake device
+// Function: Runs the class requests, also from two threads, the bulk IN read pipeline and the
+// bulk OUT packing of the USB backend, the path libusb takes, against a device replaying a script
+//
+
+#include "../inc/toucan_fakeusb.h"
+#include "../inc/toucan_decode.h"
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <pthread.h>
+#include <string.h>
+
+static TOUCAN_FAKE_USB fake;
+static TOUCAN_USB_DEVICE device;
+static TOUCAN_USB_BACKEND usb;
+static TOUCAN_BACKEND backend;
+
+static TOUCAN_FRAME Frame(UINT32 source, UINT8 length) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = TOUCAN_PDU2_ID(2, 127250, source);
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = length;
+	memset(frame.data, (int)source, length);
+	return frame;
+}
+
+// Every host to device request is confirmed with TouCAN_GET_LAST_ERROR_CODE, whose answer decides the result
+static void TestRequests(void) {
+	TouCAN_fakeusb_device(&device, &fake, NULL, 0);
+	TouCAN_usb_backend(&backend, &usb, &device);
+
+	CHECK(TouCAN_backend_init(&backend, 0) == FALSE);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, backend.Open(backend.context));
+
+	CHECK(TouCAN_backend_init(&backend, 0));
+	CHECK(TouCAN_backend_start(&backend));
+	CHECK_EQUAL(4, fake.requestCount);
+	CHECK_EQUAL(TouCAN_CAN_INTERFACE_INIT, fake.requests[0]);
+	CHECK_EQUAL(TouCAN_GET_LAST_ERROR_CODE, fake.requests[1]);
+	CHECK_EQUAL(TouCAN_CAN_INTERFACE_START, fake.requests[2]);
+	CHECK_EQUAL(TouCAN_GET_LAST_ERROR_CODE, fake.requests[3]);
+
+	fake.status = TouCAN_RETVAL_ERROR;
+	CHECK(TouCAN_backend_stop(&backend) == FALSE);
+	fake.status = TouCAN_RETVAL_OK;
+	CHECK(TouCAN_backend_stop(&backend));
+
+	backend.Close(backend.context);
+	CHECK(fake.open == FALSE);
+}
+
+// Issues stop requests while the main thread issues start requests
+static void *StopThread(void *argument) {
+	for (UINT32 i = 0; i < TOUCAN_FAKE_USB_MAX_REQUESTS / 4; i++) {
+		TouCAN_backend_stop((TOUCAN_BACKEND *)argument);
+	}
+	return NULL;
+}
+
+// Requests from two threads never come between a request and the last error code read confirming it
+static void TestConcurrentRequests(void) {
+	pthread_t thread;
+
+	TouCAN_fakeusb_device(&device, &fake, NULL, 0);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, backend.Open(backend.context));
+
+	CHECK_EQUAL(0, pthread_create(&thread, NULL, StopThread, &backend));
+	for (UINT32 i = 0; i < TOUCAN_FAKE_USB_MAX_REQUESTS / 4; i++) {
+		CHECK(TouCAN_backend_start(&backend));
+	}
+	pthread_join(thread, NULL);
+
+	CHECK_EQUAL(TOUCAN_FAKE_USB_MAX_REQUESTS, fake.requestCount);
+	for (UINT32 i = 0; i < TOUCAN_FAKE_USB_MAX_REQUESTS; i += 2) {
+		CHECK((fake.requests[i] == TouCAN_CAN_INTERFACE_START) || (fake.requests[i] == TouCAN_CAN_INTERFACE_STOP));
+		CHECK_EQUAL(TouCAN_GET_LAST_ERROR_CODE, fake.requests[i + 1]);
+	}
+
+	backend.Close(backend.context);
+}
+
+// Scripted packets come out of ReadBatch decoded, failures and malformed packets are reported
+// without losing the packets after them, and an exhausted script reads as an idle bus
+static void TestRead(void) {
+	UINT8 three[TOUCAN_RECORD_LENGTH * 3];
+	UINT8 one[TOUCAN_RECORD_LENGTH];
+	TOUCAN_FAKE_PACKET script[5];
+	TOUCAN_FRAME sent[4];
+	TOUCAN_FRAME frames[TOUCAN_MAX_READ_BATCH];
+	UINT32 count;
+
+	for (UINT32 i = 0; i < 4; i++) {
+		sent[i] = Frame(0x10 + i, (UINT8)(5 + i));
+	}
+	for (UINT32 i = 0; i < 3; i++) {
+		TouCAN_encode_record(&sent[i], &three[i * TOUCAN_RECORD_LENGTH]);
+	}
+	TouCAN_encode_record(&sent[3], one);
+
+	script[0].data = three;
+	script[0].length = sizeof(three);
+	script[0].result = TOUCAN_TRANSFER_COMPLETE;
+	script[1].data = NULL;
+	script[1].length = 0;
+	script[1].result = TOUCAN_TRANSFER_FAILED;
+	script[2].data = one;
+	script[2].length = sizeof(one) - 1;
+	script[2].result = TOUCAN_TRANSFER_COMPLETE;
+	script[3].data = one;
+	script[3].length = sizeof(one);
+	script[3].result = TOUCAN_TRANSFER_COMPLETE;
+	script[4] = script[0];
+
+	TouCAN_fakeusb_device(&device, &fake, script, 5);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, backend.Open(backend.context));
+	CHECK(backend.ReadOpen(backend.context, 4, TOUCAN_DEFAULT_READ_BUFFER_SIZE));
+
+	CHECK_EQUAL(TOUCAN_TRANSFER_COMPLETE, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(3, count);
+	for (UINT32 i = 0; i < 3; i++) {
+		CHECK_EQUAL(sent[i].id, frames[i].id);
+		CHECK_EQUAL(sent[i].length, frames[i].length);
+		CHECK(memcmp(sent[i].data, frames[i].data, TOUCAN_FRAME_DATA_LENGTH) == 0);
+	}
+
+	CHECK_EQUAL(TOUCAN_TRANSFER_FAILED, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(0, count);
+	CHECK_EQUAL(TOUCAN_TRANSFER_MALFORMED, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(0, count);
+
+	CHECK_EQUAL(TOUCAN_TRANSFER_COMPLETE, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(1, count);
+	CHECK_EQUAL(sent[3].id, frames[0].id);
+
+	CHECK_EQUAL(TOUCAN_TRANSFER_COMPLETE, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(3, count);
+
+	CHECK_EQUAL(TOUCAN_TRANSFER_PENDING, backend.ReadBatch(backend.context, 0, frames, TOUCAN_MAX_READ_BATCH, &count));
+	CHECK_EQUAL(0, count);
+	CHECK_EQUAL(5, fake.position);
+
+	backend.ReadClose(backend.context);
+	backend.Close(backend.context);
+}
+
+// Writes are packed three records to a bulk OUT transfer, in order
+static void TestWrite(void) {
+	UINT8 capture[TOUCAN_RECORD_LENGTH * 8];
+	TOUCAN_FRAME sent[7];
+	TOUCAN_FRAME decoded[3];
+	UINT32 written;
+	UINT32 count;
+
+	for (UINT32 i = 0; i < 7; i++) {
+		sent[i] = Frame(0x20 + i, 8);
+	}
+
+	TouCAN_fakeusb_device(&device, &fake, NULL, 0);
+	TouCAN_fakeusb_capture(&fake, capture, sizeof(capture));
+	TouCAN_usb_backend(&backend, &usb, &device);
+
+	CHECK(backend.WriteBatch(backend.context, sent, 1, &written) == FALSE);
+	CHECK_EQUAL(0, written);
+
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, backend.Open(backend.context));
+	CHECK(backend.WriteBatch(backend.context, sent, 7, &written));
+	CHECK_EQUAL(7, written);
+	CHECK_EQUAL(3, fake.bulkOutTransfers);
+	CHECK_EQUAL(7 * TOUCAN_RECORD_LENGTH, fake.captureLength);
+
+	// Counted by this backend alone, another adapter's traffic is not included, nor are its requests serialised with this one's
+	CHECK(backend.transmitted == &usb.transmitted);
+	CHECK(backend.requestLock == &usb.requestLock);
+	CHECK_EQUAL(3, usb.transmitted.transfers);
+	CHECK_EQUAL(7, usb.transmitted.frames);
+
+	for (UINT32 i = 0; i < 7; i += count) {
+		UINT32 records = (7 - i < 3) ? 7 - i : 3;
+		CHECK(TouCAN_decode_packet(&capture[i * TOUCAN_RECORD_LENGTH], records * TOUCAN_RECORD_LENGTH, decoded, 3, &count));
+		if (count == 0) {
+			break;
+		}
+		for (UINT32 r = 0; r < count; r++) {
+			CHECK_EQUAL(sent[i + r].id, decoded[r].id);
+		}
+	}
+
+	backend.Close(backend.context);
+}
+
+int main(void) {
+	TestRequests();
+	TestConcurrentRequests();
+	TestRead();
+	TestWrite();
+	return TEST_RESULT();
+}
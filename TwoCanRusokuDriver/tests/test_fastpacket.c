@@ -0,0 +1,113 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Fast Packet Test
+// Unit Description: Tests of the fast packet segmenter and reassembler
+// Function: Reassembles segmented messages and checks that a message missing frames is
+// abandoned once the timeout has passed, as the read thread does when the bus goes quiet
+//
+
+#include "../inc/toucan_fastpacket.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+static TOUCAN_REASSEMBLER reassembler;
+static TOUCAN_SEGMENTER segmenter;
+
+// PGN 129029, GNSS position, a fast packet PGN in the built in list
+#define TEST_FAST_ID TOUCAN_PDU2_ID(3, 129029, 0x23)
+
+static UINT32 Segment(UINT32 length, TOUCAN_FRAME *frames, UINT8 *payload) {
+	UINT32 count;
+
+	for (UINT32 i = 0; i < length; i++) {
+		payload[i] = (UINT8)(i * 3);
+	}
+	count = TouCAN_fastpacket_segment(&segmenter, TEST_FAST_ID, payload, length, frames);
+	for (UINT32 i = 0; i < count; i++) {
+		frames[i].hostTime = (LONGLONG)i * 1000;
+	}
+	return count;
+}
+
+// Every frame of a segmented message is needed to reassemble it, byte for byte
+static void TestReassemble(void) {
+	TOUCAN_FRAME frames[TOUCAN_FAST_PACKET_MAX_FRAMES];
+	UINT8 payload[TOUCAN_FAST_PACKET_MAX_LENGTH];
+	TOUCAN_MESSAGE *message = NULL;
+	UINT32 count;
+
+	TouCAN_fastpacket_init(&reassembler, NULL, 0);
+	TouCAN_segmenter_init(&segmenter, NULL, 0);
+
+	count = Segment(TOUCAN_FAST_PACKET_MAX_LENGTH, frames, payload);
+	CHECK_EQUAL(TOUCAN_FAST_PACKET_MAX_FRAMES, count);
+
+	for (UINT32 i = 0; i < count - 1; i++) {
+		CHECK_EQUAL(TOUCAN_FAST_PACKET_PENDING, TouCAN_fastpacket_add(&reassembler, &frames[i], &message));
+	}
+	CHECK_EQUAL(TOUCAN_FAST_PACKET_COMPLETE, TouCAN_fastpacket_add(&reassembler, &frames[count - 1], &message));
+	CHECK(message != NULL);
+	if (message != NULL) {
+		CHECK_EQUAL(TOUCAN_FAST_PACKET_MAX_LENGTH, message->length);
+		CHECK(memcmp(message->data, payload, TOUCAN_FAST_PACKET_MAX_LENGTH) == 0);
+		CHECK_EQUAL(TEST_FAST_ID, message->id);
+	}
+	CHECK_EQUAL(1, reassembler.completed);
+	CHECK_EQUAL(0, reassembler.active);
+}
+
+// A message whose frames stop arriving is released after the timeout, without any further frame
+static void TestExpire(void) {
+	TOUCAN_FRAME frames[TOUCAN_FAST_PACKET_MAX_FRAMES];
+	UINT8 payload[TOUCAN_FAST_PACKET_MAX_LENGTH];
+	TOUCAN_MESSAGE *message = NULL;
+	UINT32 count;
+
+	TouCAN_fastpacket_init(&reassembler, NULL, 0);
+	TouCAN_segmenter_init(&segmenter, NULL, 0);
+
+	count = Segment(40, frames, payload);
+	CHECK_EQUAL(6, count);
+	CHECK_EQUAL(TOUCAN_FAST_PACKET_PENDING, TouCAN_fastpacket_add(&reassembler, &frames[0], &message));
+	CHECK_EQUAL(TOUCAN_FAST_PACKET_PENDING, TouCAN_fastpacket_add(&reassembler, &frames[1], &message));
+	CHECK_EQUAL(1, reassembler.active);
+
+	// A quiet bus, the read thread expires messages from the read timeout path
+	TouCAN_fastpacket_expire(&reassembler, frames[1].hostTime + TOUCAN_FAST_PACKET_TIMEOUT);
+	CHECK_EQUAL(1, reassembler.active);
+	CHECK_EQUAL(0, reassembler.timeouts);
+
+	TouCAN_fastpacket_expire(&reassembler, frames[1].hostTime + TOUCAN_FAST_PACKET_TIMEOUT + 1);
+	CHECK_EQUAL(0, reassembler.active);
+	CHECK_EQUAL(1, reassembler.timeouts);
+
+	// The rest of the message has lost its first frame
+	CHECK_EQUAL(TOUCAN_FAST_PACKET_DISCARDED, TouCAN_fastpacket_add(&reassembler, &frames[2], &message));
+	CHECK_EQUAL(0, reassembler.completed);
+}
+
+int main(void) {
+	TestReassemble();
+	TestExpire();
+	return TEST_RESULT();
+}
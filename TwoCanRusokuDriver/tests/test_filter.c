@@ -0,0 +1,211 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Filter Test
+// Unit Description: Tests of the host side filter rules and their replacement under a reading thread
+// Function: Checks that the first matching rule decides, that every PGN named by the rules finds its
+// own perfect hash slot, and that an instance frees a replaced filter once its read thread has moved
+// on, or retires it while the thread is stalled and frees it later
+//
+
+#include "../inc/toucan_filter.h"
+#include "../inc/toucan_instance.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Distinct PGNs named by the perfect hash rules
+#define TEST_PGNS 60
+
+static TOUCAN_INSTANCE instance;
+static volatile LONG readerRunning;
+static volatile LONG readerStalled;
+static volatile LONG readerDecisions;
+
+static TOUCAN_FILTER_RULE Rule(UINT32 action, UINT32 pgn, UINT32 source, UINT32 destination, UINT32 priority) {
+	TOUCAN_FILTER_RULE rule;
+
+	rule.action = action;
+	rule.pgn = pgn;
+	rule.source = source;
+	rule.destination = destination;
+	rule.priority = priority;
+	return rule;
+}
+
+// Stands in for the read thread, taking the published filter at each quiescent point as ReadThread does
+static DWORD WINAPI Reader(LPVOID parameter) {
+	TOUCAN_FILTER *filter;
+
+	(void)parameter;
+
+	while (ReadAcquire(&readerRunning)) {
+		if (ReadAcquire(&readerStalled) == FALSE) {
+			WriteRelease(&instance.readerEpoch, ReadAcquire(&instance.filterEpoch));
+			filter = (TOUCAN_FILTER *)ReadPointerAcquire((PVOID volatile *)&instance.receiveFilter);
+			if ((filter != NULL) && (TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 127250, 1)))) {
+				InterlockedIncrement(&readerDecisions);
+			}
+		}
+		Sleep(1);
+	}
+	WriteRelease(&instance.readerActive, FALSE);
+	return 0;
+}
+
+// The first matching rule decides, earlier rules shadow later ones
+static void TestFirstMatch(void) {
+	TOUCAN_FILTER_RULE rules[4];
+	TOUCAN_FILTER *filter;
+
+	rules[0] = Rule(TOUCAN_FILTER_DENY, 127250, 0x23, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY);
+	rules[1] = Rule(TOUCAN_FILTER_ALLOW, 127250, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY);
+	rules[2] = Rule(TOUCAN_FILTER_ALLOW, 59904, TOUCAN_FILTER_ANY, 0x10, TOUCAN_FILTER_ANY);
+	rules[3] = Rule(TOUCAN_FILTER_DENY, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY, 6);
+
+	filter = TouCAN_filter_compile(rules, 4, TRUE);
+	CHECK(filter != NULL);
+	CHECK_EQUAL(4, filter->count);
+	CHECK_EQUAL(0x6ULL, filter->allow);
+	CHECK_EQUAL(0x8ULL, filter->anyPgn);
+
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 127250, 0x23)) == FALSE);
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 127250, 0x24)));
+
+	// An allow ahead of the priority deny wins, whatever the priority
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(6, 127250, 0x24)));
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU1_ID(6, 59904, 0x10, 0x24)));
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU1_ID(3, 59904, 0x11, 0x24)));
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU1_ID(6, 59904, 0x11, 0x24)) == FALSE);
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(6, 129025, 0x24)) == FALSE);
+
+	// No rule matches, the default decides
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 129025, 0x24)));
+	TouCAN_filter_free(filter);
+
+	filter = TouCAN_filter_compile(rules, 4, FALSE);
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 129025, 0x24)) == FALSE);
+	TouCAN_filter_free(filter);
+
+	// Invalid rules are refused
+	rules[0].pgn = 59905;
+	CHECK(TouCAN_filter_compile(rules, 4, TRUE) == NULL);
+	rules[0].pgn = 127250;
+	rules[0].priority = 8;
+	CHECK(TouCAN_filter_compile(rules, 4, TRUE) == NULL);
+	rules[0].action = 2;
+	rules[0].priority = TOUCAN_FILTER_ANY;
+	CHECK(TouCAN_filter_compile(rules, 4, TRUE) == NULL);
+	CHECK(TouCAN_filter_compile(rules, TOUCAN_MAX_FILTER_RULES + 1, TRUE) == NULL);
+
+	// No rules at all, only the default
+	filter = TouCAN_filter_compile(NULL, 0, TRUE);
+	CHECK(filter != NULL);
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 127250, 0x23)));
+	TouCAN_filter_free(filter);
+}
+
+// Every named PGN has its own slot, a PGN the rules do not name only meets the rules matching any PGN
+static void TestPerfectHash(void) {
+	TOUCAN_FILTER_RULE rules[TEST_PGNS + 1];
+	TOUCAN_FILTER *filter;
+	UINT32 pgn;
+	UINT32 slot;
+
+	for (UINT32 i = 0; i < TEST_PGNS; i++) {
+		pgn = 126976 + (i * 37);
+		rules[i] = Rule((i & 1) ? TOUCAN_FILTER_ALLOW : TOUCAN_FILTER_DENY, pgn, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY);
+	}
+	rules[TEST_PGNS] = Rule(TOUCAN_FILTER_ALLOW, TOUCAN_FILTER_ANY, 0x42, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY);
+
+	filter = TouCAN_filter_compile(rules, TEST_PGNS + 1, FALSE);
+	CHECK(filter != NULL);
+
+	for (UINT32 i = 0; i < TEST_PGNS; i++) {
+		slot = (rules[i].pgn * filter->multiplier) >> filter->shift;
+		CHECK_EQUAL(rules[i].pgn, filter->pgns[slot].pgn);
+		CHECK_EQUAL(((UINT64)1 << i) | ((UINT64)1 << TEST_PGNS), filter->pgns[slot].rules);
+		CHECK_EQUAL((i & 1) != 0, TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, rules[i].pgn, 0x42)));
+	}
+
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 130000, 0x42)));
+	CHECK(TouCAN_filter_accept(filter, TOUCAN_PDU2_ID(2, 130000, 0x43)) == FALSE);
+	TouCAN_filter_free(filter);
+}
+
+// A replaced filter is freed at once while the read thread moves on, retired while it is stalled,
+// and freed by the next update or the stop once the thread has passed its epoch
+static void TestEpochSwap(void) {
+	TOUCAN_FILTER_RULE rule = Rule(TOUCAN_FILTER_ALLOW, 127250, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY, TOUCAN_FILTER_ANY);
+	TOUCAN_FILTER *first;
+	TOUCAN_FILTER *second;
+	ULONGLONG start;
+
+	TouCAN_instance_init(&instance);
+	WriteRelease(&readerRunning, TRUE);
+	WriteRelease(&instance.readerActive, TRUE);
+	instance.threadHandle = CreateThread(NULL, 0, Reader, NULL, 0, NULL);
+	CHECK(instance.threadHandle != NULL);
+
+	first = TouCAN_filter_compile(&rule, 1, FALSE);
+	TouCAN_instance_set_filter(&instance, first);
+	CHECK(instance.receiveFilter == first);
+	TouCAN_instance_set_filter(&instance, TouCAN_filter_compile(&rule, 1, FALSE));
+	CHECK(instance.retiredFilters == NULL);
+	CHECK(instance.readerEpoch >= 2);
+
+	// The stalled thread may still hold the filter, it is retired after the grace period
+	WriteRelease(&readerStalled, TRUE);
+	Sleep(10);
+	second = instance.receiveFilter;
+	start = GetTickCount64();
+	TouCAN_instance_set_filter(&instance, TouCAN_filter_compile(&rule, 1, FALSE));
+	CHECK(GetTickCount64() - start >= TOUCAN_FILTER_GRACE_PERIOD);
+	CHECK(instance.retiredFilters == second);
+	CHECK_EQUAL(instance.filterEpoch, second->retiredEpoch);
+
+	// Moving on, the next update frees the retired filter along with the one it replaces
+	WriteRelease(&readerStalled, FALSE);
+	start = GetTickCount64();
+	TouCAN_instance_set_filter(&instance, TouCAN_filter_compile(&rule, 1, FALSE));
+	CHECK(GetTickCount64() - start < TOUCAN_FILTER_GRACE_PERIOD);
+	CHECK(instance.retiredFilters == NULL);
+
+	// Stalled again, the stop frees the retired filter once the thread has exited
+	WriteRelease(&readerStalled, TRUE);
+	Sleep(10);
+	TouCAN_instance_set_filter(&instance, NULL);
+	CHECK(instance.retiredFilters != NULL);
+	CHECK(instance.receiveFilter == NULL);
+
+	WriteRelease(&readerRunning, FALSE);
+	CHECK(TouCAN_instance_stop(&instance));
+	CHECK(instance.retiredFilters == NULL);
+	CHECK(readerDecisions > 0);
+}
+
+int main(void) {
+	TestFirstMatch();
+	TestPerfectHash();
+	TestEpochSwap();
+	return TEST_RESULT();
+}
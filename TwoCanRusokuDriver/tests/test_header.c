@@ -0,0 +1,203 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Header Test
+// Unit Description: Tests of NMEA 2000 identifier decoding and encoding
+// Function: Checks the PDU1 and PDU2 boundary, destination addresses, the data page bits and
+// priority against a plain decoder written from the identifier layout, one field at a time
+// and in batches
+//
+
+#include "../inc/toucan_header.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Identifier layout: priority in bits 26 to 28, extended data page 25, data page 24,
+// PDU format 16 to 23, PDU specific 8 to 15, source 0 to 7
+static void Reference(UINT32 id, TOUCAN_HEADER *header) {
+	UINT32 format = (id >> 16) & 0xFF;
+	UINT32 specific = (id >> 8) & 0xFF;
+	UINT32 pages = (id >> 24) & 0x03;
+
+	header->priority = (UINT8)((id >> 26) & 0x07);
+	header->source = (UINT8)(id & 0xFF);
+	if (format < 240) {
+		header->pgn = (pages << 16) | (format << 8);
+		header->destination = (UINT8)specific;
+	}
+	else {
+		header->pgn = (pages << 16) | (format << 8) | specific;
+		header->destination = TOUCAN_GLOBAL_ADDRESS;
+	}
+}
+
+static void CheckDecode(UINT32 id) {
+	TOUCAN_HEADER expected;
+	TOUCAN_HEADER actual;
+
+	Reference(id, &expected);
+	TouCAN_header_decode(id, &actual);
+	if ((expected.pgn != actual.pgn) || (expected.priority != actual.priority) ||
+		(expected.source != actual.source) || (expected.destination != actual.destination)) {
+		fprintf(stderr, "identifier %08X\n", id);
+		CHECK_EQUAL(expected.pgn, actual.pgn);
+		CHECK_EQUAL(expected.priority, actual.priority);
+		CHECK_EQUAL(expected.source, actual.source);
+		CHECK_EQUAL(expected.destination, actual.destination);
+	}
+}
+
+// PDU format 239 is the last PDU1 format, 240 the first PDU2 format
+static void TestBoundary(void) {
+	TOUCAN_HEADER header;
+
+	TouCAN_header_decode(TOUCAN_PDU1_ID(3, 0xEF00, 0x42, 0x10), &header);
+	CHECK_EQUAL(0xEF00, header.pgn);
+	CHECK_EQUAL(0x42, header.destination);
+	CHECK(TouCAN_header_is_pdu1(0xEF00));
+
+	TouCAN_header_decode(TOUCAN_PDU2_ID(3, 0xF042, 0x10), &header);
+	CHECK_EQUAL(0xF042, header.pgn);
+	CHECK_EQUAL(TOUCAN_GLOBAL_ADDRESS, header.destination);
+	CHECK(!TouCAN_header_is_pdu1(0xF000));
+
+	// The destination of a PDU1 PGN is not part of its PGN, whatever it is
+	CHECK_EQUAL(0xEF00, TouCAN_header_pgn(TOUCAN_PDU1_ID(3, 0xEF00, 0x00, 0x10)));
+	CHECK_EQUAL(0xEF00, TouCAN_header_pgn(TOUCAN_PDU1_ID(3, 0xEF00, 0xFE, 0x10)));
+	CHECK_EQUAL(0x0000, TouCAN_header_pgn(TOUCAN_PDU1_ID(3, 0x0000, 0x42, 0x10)));
+	CHECK_EQUAL(0xFFFF, TouCAN_header_pgn(TOUCAN_PDU2_ID(3, 0xFFFF, 0x10)));
+}
+
+// A PDU1 message may be sent to the global address, it is still PDU1
+static void TestGlobalDestination(void) {
+	TOUCAN_HEADER header;
+
+	// ISO request to all
+	TouCAN_header_decode(TOUCAN_PDU1_ID(6, 59904, TOUCAN_GLOBAL_ADDRESS, 0x23), &header);
+	CHECK_EQUAL(59904, header.pgn);
+	CHECK_EQUAL(TOUCAN_GLOBAL_ADDRESS, header.destination);
+	CHECK_EQUAL(0x23, header.source);
+	CHECK_EQUAL(TOUCAN_PDU1_ID(6, 59904, TOUCAN_GLOBAL_ADDRESS, 0x23), TouCAN_header_encode(&header));
+
+	// The null address is a valid source
+	TouCAN_header_decode(TOUCAN_PDU1_ID(6, 59904, 0x00, 0xFE), &header);
+	CHECK_EQUAL(0x00, header.destination);
+	CHECK_EQUAL(0xFE, header.source);
+}
+
+// The data page and extended data page bits belong to the PGN for both PDU formats
+static void TestDataPages(void) {
+	TOUCAN_HEADER header;
+
+	// Proprietary PDU1 on data page 1
+	TouCAN_header_decode(TOUCAN_PDU1_ID(3, 126720, 0x05, 0x10), &header);
+	CHECK_EQUAL(126720, header.pgn);
+	CHECK_EQUAL(0x05, header.destination);
+
+	// GNSS position, PDU2 on data page 1
+	TouCAN_header_decode(TOUCAN_PDU2_ID(3, 129029, 0x10), &header);
+	CHECK_EQUAL(129029, header.pgn);
+	CHECK_EQUAL(TOUCAN_GLOBAL_ADDRESS, header.destination);
+
+	// Extended data page, with and without the data page bit
+	CHECK_EQUAL(0x2EA00, TouCAN_header_pgn(TOUCAN_PDU1_ID(3, 0x2EA00, 0x42, 0x10)));
+	CHECK_EQUAL(0x3F123, TouCAN_header_pgn(TOUCAN_PDU2_ID(3, 0x3F123, 0x10)));
+	CHECK_EQUAL(0x42, TouCAN_header_destination(TOUCAN_PDU1_ID(3, 0x3EA00, 0x42, 0x10)));
+}
+
+// Priority is three bits, it never reaches the PGN and bits above the identifier are ignored
+static void TestPriority(void) {
+	UINT32 id;
+
+	for (UINT32 priority = 0; priority < 8; priority++) {
+		id = TOUCAN_PDU2_ID(priority, 0x3FFFF, 0xFF);
+		CHECK_EQUAL(priority, TouCAN_header_priority(id));
+		CHECK_EQUAL(0x3FFFF, TouCAN_header_pgn(id));
+	}
+	CHECK_EQUAL(0, TouCAN_header_priority(0xE0000000 | TOUCAN_PDU2_ID(0, 130306, 0x10)));
+	CHECK_EQUAL(130306, TouCAN_header_pgn(0xE0000000 | TOUCAN_PDU2_ID(0, 130306, 0x10)));
+	CHECK_EQUAL(7, TouCAN_header_priority(0xFFFFFFFF));
+}
+
+// Every PDU format and specific value on both data pages, decoded and encoded back
+static void TestExhaustive(void) {
+	TOUCAN_HEADER header;
+	UINT32 id;
+
+	for (UINT32 pgn = 0; pgn <= TOUCAN_MAX_PGN; pgn++) {
+		id = ((UINT32)(pgn % 8) << 26) | (pgn << 8) | ((pgn & 0xFF) ^ 0x5A);
+		CheckDecode(id);
+
+		TouCAN_header_decode(id, &header);
+		if (TouCAN_header_encode(&header) != id) {
+			CHECK_EQUAL(id, TouCAN_header_encode(&header));
+			return;
+		}
+	}
+}
+
+// The batch decoder matches the single decoder, with any array left out and counts that are
+// not a multiple of a vector width
+static void TestBatch(void) {
+	UINT32 ids[67];
+	UINT32 pgns[67];
+	UINT8 priorities[67];
+	UINT8 sources[67];
+	UINT8 destinations[67];
+	TOUCAN_HEADERS headers = { pgns, priorities, sources, destinations };
+	TOUCAN_HEADERS partial = { NULL, NULL, sources, NULL };
+	UINT32 state = 12345;
+	TOUCAN_HEADER header;
+
+	for (UINT32 i = 0; i < 67; i++) {
+		state = (state * 1103515245) + 12345;
+		ids[i] = state & 0x1FFFFFFF;
+	}
+	// Both sides of the PDU1 and PDU2 boundary
+	ids[0] = TOUCAN_PDU1_ID(3, 0xEF00, 0x42, 0x10);
+	ids[1] = TOUCAN_PDU2_ID(3, 0xF042, 0x10);
+
+	memset(destinations, 0, sizeof(destinations));
+	TouCAN_header_decode_batch(ids, 67, &headers);
+	for (UINT32 i = 0; i < 67; i++) {
+		TouCAN_header_decode(ids[i], &header);
+		CHECK_EQUAL(header.pgn, pgns[i]);
+		CHECK_EQUAL(header.priority, priorities[i]);
+		CHECK_EQUAL(header.source, sources[i]);
+		CHECK_EQUAL(header.destination, destinations[i]);
+	}
+
+	memset(sources, 0, sizeof(sources));
+	TouCAN_header_decode_batch(ids, 3, &partial);
+	CHECK_EQUAL(TouCAN_header_source(ids[2]), sources[2]);
+	CHECK_EQUAL(0, sources[3]);
+}
+
+int main(void) {
+	TestBoundary();
+	TestGlobalDestination();
+	TestDataPages();
+	TestPriority();
+	TestExhaustive();
+	TestBatch();
+	return TEST_RESULT();
+}
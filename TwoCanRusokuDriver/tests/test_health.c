@@ -0,0 +1,119 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Health Test
+// Unit Description: Tests of the bus condition the monitor builds from its polls
+// Function: Checks the error states stay latched across polls after the adapter's error code is
+// cleared, are released only once the adapter's error status no longer shows them, that events
+// are counted per poll, and that a poll the adapter does not answer makes the condition unknown
+//
+
+#include "../inc/toucan_health.h"
+#include "../inc/toucan_fakeusb.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// The error status could not be read
+#define NO_STATUS 0xFFFFFFFF
+
+static TOUCAN_HEALTH health;
+static TOUCAN_DEVICE_STATISTICS statistics;
+
+// Poll the way the monitor does, clearing the error code when it holds event bits
+static TOUCAN_BUS_CONDITION Poll(UINT8 state, UINT32 errorCode, UINT32 errorStatus, UINT32 frames) {
+	statistics.receiveFrames = frames;
+	TouCAN_health_update(&health, state, errorCode, (errorStatus == NO_STATUS) ? NULL : &errorStatus, (errorCode & TOUCAN_HEALTH_EVENTS) != 0, &statistics);
+	return (TOUCAN_BUS_CONDITION)health.condition;
+}
+
+int main(void) {
+	TOUCAN_FAKE_USB fake;
+	TOUCAN_USB_DEVICE device;
+	TOUCAN_USB_BACKEND usb;
+	TOUCAN_BACKEND backend;
+
+	memset(&statistics, 0, sizeof(statistics));
+	TouCAN_health_init(&health);
+
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 0));
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 10));
+
+	// Warning alone is left in the error code, and holds while the error status shows it, traffic or not
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EWG, HAL_CAN_ERROR_EWG, 10));
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EWG, HAL_CAN_ERROR_EWG, 10));
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EWG, HAL_CAN_ERROR_EWG, 20));
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EWG, 0, 20));
+
+	// A bus error clears the error code with the state bit, the condition must not toggle back
+	CHECK_EQUAL(TOUCAN_BUS_PASSIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EPV | HAL_CAN_ERROR_STF, HAL_CAN_ERROR_EPV, 20));
+	CHECK_EQUAL(TOUCAN_BUS_PASSIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, HAL_CAN_ERROR_EPV, 20));
+	CHECK_EQUAL(TOUCAN_BUS_PASSIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_ACK, HAL_CAN_ERROR_EPV, 25));
+	CHECK_EQUAL(TOUCAN_BUS_PASSIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, HAL_CAN_ERROR_EPV, 30));
+	CHECK_EQUAL(2, health.busErrors);
+
+	// Falling back from passive to warning, then to active
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, HAL_CAN_ERROR_EWG, 30));
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 30));
+
+	// Bus off holds while the error status shows it
+	CHECK_EQUAL(TOUCAN_BUS_OFF, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_BOF | HAL_CAN_ERROR_BR, HAL_CAN_ERROR_BOF, 30));
+	CHECK_EQUAL(TOUCAN_BUS_OFF, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, HAL_CAN_ERROR_BOF, 30));
+	CHECK_EQUAL(1, health.busOffEvents);
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 40));
+
+	// A bus off the interface recovered from before the poll still shows for that poll
+	CHECK_EQUAL(TOUCAN_BUS_OFF, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_BOF | HAL_CAN_ERROR_BR, 0, 40));
+	CHECK_EQUAL(2, health.busOffEvents);
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 40));
+
+	// Without the error status frames getting through do not release the latch, stopping the interface does
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_EWG | HAL_CAN_ERROR_CRC, NO_STATUS, 40));
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, NO_STATUS, 50));
+	CHECK_EQUAL(TOUCAN_BUS_WARNING, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, NO_STATUS, 60));
+	CHECK_EQUAL(TOUCAN_BUS_STOPPED, Poll(HAL_CAN_STATE_READY, HAL_CAN_ERROR_NONE, NO_STATUS, 60));
+	CHECK_EQUAL(TOUCAN_BUS_ACTIVE, Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, NO_STATUS, 60));
+
+	// Overrun frames come from the counter delta, a lower counter was cleared
+	statistics.overruns = 5;
+	Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_RX_FOV0, 0, 60);
+	statistics.overruns = 2;
+	Poll(HAL_CAN_STATE_LISTENING, HAL_CAN_ERROR_NONE, 0, 60);
+	CHECK_EQUAL(1, health.fifoOverruns);
+	CHECK_EQUAL(7, health.overrunFrames);
+
+	// A poll the adapter did not answer
+	TouCAN_health_failed(&health);
+	CHECK_EQUAL(TOUCAN_BUS_UNKNOWN, (TOUCAN_BUS_CONDITION)health.condition);
+
+	// The fake device does not answer the state requests, so a poll through its backend fails
+	TouCAN_fakeusb_device(&device, &fake, NULL, 0);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, backend.Open(backend.context));
+	TouCAN_health_init(&health);
+	CHECK(TouCAN_health_poll(&health, &backend) == FALSE);
+	CHECK_EQUAL(1, health.failures);
+	CHECK_EQUAL(TOUCAN_BUS_UNKNOWN, (TOUCAN_BUS_CONDITION)health.condition);
+	backend.Close(backend.context);
+
+	return TEST_RESULT();
+}
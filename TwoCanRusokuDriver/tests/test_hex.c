@@ -0,0 +1,166 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TwoCan Hex Test
+// Unit Description: Tests of the hexadecimal decoder and encoder
+// Function: Compares every result with a character by character reference, for odd and even
+// lengths either side of the 16 and 32 digit blocks, both letter cases and an invalid character
+// at every position. Built again without AVX2 and without SIMD, so each kernel is held to it.
+//
+
+#include "../Common/inc/twocanhex.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Longest string tried, in digits, more than two of the widest blocks
+#define TEST_HEX_MAX_DIGITS 100
+
+static UINT32 randomState = 0x2545F491;
+
+static UINT32 Random(void) {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState;
+}
+
+static int Nibble(char c) {
+	if ((c >= '0') && (c <= '9')) {
+		return c - '0';
+	}
+	if ((c >= 'A') && (c <= 'F')) {
+		return c - 'A' + 10;
+	}
+	if ((c >= 'a') && (c <= 'f')) {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+// Reference decoder, one pair at a time
+static size_t Reference(const char *hex, size_t digits, UINT8 *bytes) {
+	size_t i;
+
+	for (i = 0; i + 1 < digits; i += 2) {
+		if (Nibble(hex[i]) < 0) {
+			return i;
+		}
+		if (Nibble(hex[i + 1]) < 0) {
+			return i + 1;
+		}
+		bytes[i / 2] = (UINT8)((Nibble(hex[i]) << 4) | Nibble(hex[i + 1]));
+	}
+	return i;
+}
+
+// Decode text at an unaligned offset and compare the position and the bytes with the reference
+static void Compare(const char *hex, size_t digits) {
+	char text[TEST_HEX_MAX_DIGITS + 1];
+	UINT8 expected[TEST_HEX_MAX_DIGITS / 2];
+	UINT8 actual[(TEST_HEX_MAX_DIGITS / 2) + 1];
+	size_t expectedPosition;
+	size_t position;
+
+	memcpy(&text[1], hex, digits);
+	memset(expected, 0xA5, sizeof(expected));
+	memset(actual, 0xA5, sizeof(actual));
+
+	expectedPosition = Reference(hex, digits, expected);
+	position = DecodeHexString(&text[1], digits, &actual[1]);
+	CHECK_EQUAL(expectedPosition, position);
+	CHECK(memcmp(expected, &actual[1], position / 2) == 0);
+	CHECK_EQUAL(0xA5, actual[0]);
+}
+
+int main(void) {
+	const char *lower = "0123456789abcdef";
+	char hex[TEST_HEX_MAX_DIGITS];
+	char encoded[TEST_HEX_MAX_DIGITS + 2];
+	UINT8 bytes[TEST_HEX_MAX_DIGITS / 2];
+	UINT8 decoded[TEST_HEX_MAX_DIGITS / 2];
+	UINT32 value;
+
+	memset(hex, '0', sizeof(hex));
+	for (size_t digits = 0; digits <= TEST_HEX_MAX_DIGITS; digits++) {
+		for (size_t i = 0; i < digits; i++) {
+			hex[i] = lower[Random() % 16];
+		}
+
+		// Lower case, upper case and both
+		Compare(hex, digits);
+		for (size_t i = 0; i < digits; i++) {
+			hex[i] = (char)(((hex[i] >= 'a') && (hex[i] <= 'f')) ? hex[i] - 0x20 : hex[i]);
+		}
+		Compare(hex, digits);
+		for (size_t i = 0; i < digits; i += 3) {
+			hex[i] = (char)(((hex[i] >= 'A') && (hex[i] <= 'F')) ? hex[i] + 0x20 : hex[i]);
+		}
+		Compare(hex, digits);
+
+		// Every character that is not a digit, at each position in turn, and at two
+		for (size_t position = 0; position < digits; position++) {
+			char saved = hex[position];
+
+			for (int c = 0; c < 256; c++) {
+				if (Nibble((char)c) < 0) {
+					hex[position] = (char)c;
+					Compare(hex, digits);
+				}
+			}
+			hex[position] = 'g';
+			hex[digits - 1 - (position / 2)] = '@';
+			Compare(hex, digits);
+			hex[digits - 1 - (position / 2)] = '0';
+			hex[position] = saved;
+		}
+	}
+
+	// The encoder is upper case, and decodes to the same bytes
+	for (size_t count = 0; count <= TEST_HEX_MAX_DIGITS / 2; count++) {
+		for (size_t i = 0; i < count; i++) {
+			bytes[i] = (UINT8)Random();
+		}
+		memset(encoded, '#', sizeof(encoded));
+		EncodeHexString(bytes, count, &encoded[1]);
+		CHECK_EQUAL('#', encoded[0]);
+		CHECK_EQUAL('#', encoded[(count * 2) + 1]);
+		for (size_t i = 0; i < count * 2; i++) {
+			CHECK((encoded[i + 1] >= '0' && encoded[i + 1] <= '9') || (encoded[i + 1] >= 'A' && encoded[i + 1] <= 'F'));
+		}
+		CHECK_EQUAL(count * 2, DecodeHexString(&encoded[1], count * 2, decoded));
+		CHECK(memcmp(bytes, decoded, count) == 0);
+	}
+
+	// Single values stop at the first invalid digit, and at 8 digits
+	CHECK_EQUAL(8, DecodeHexValue("09F80123", 8, &value));
+	CHECK_EQUAL(0x09F80123, value);
+	CHECK_EQUAL(8, DecodeHexValue("cafeF00D", 8, &value));
+	CHECK_EQUAL(0xCAFEF00D, value);
+	CHECK_EQUAL(3, DecodeHexValue("1fFx5", 5, &value));
+	CHECK_EQUAL(0x1FF, value);
+	CHECK_EQUAL(8, DecodeHexValue("123456789", 9, &value));
+	CHECK_EQUAL(0x12345678, value);
+	CHECK_EQUAL(0, DecodeHexValue(" 1", 2, &value));
+	CHECK_EQUAL(0, value);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,238 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Instance Test
+// Unit Description: Tests of the adapter instance core against two scripted fake devices
+// Function: Opens two instances side by side, one selected by its serial number, and runs their
+// read threads, a direct and a queued transmit path and the close, which the single adapter
+// API and the instance exports of the driver both go through
+//
+
+#include "../inc/toucan_instance.h"
+#include "../inc/toucan_capture.h"
+#include "../inc/toucan_decode.h"
+#include "../inc/toucan_fakeusb.h"
+#include "../inc/toucan_header.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Longest wait for a thread of an instance, in milliseconds
+#define TEST_TIMEOUT 2000
+
+typedef struct _TEST_DEVICE {
+	TOUCAN_FAKE_USB	fake;
+	TOUCAN_USB_DEVICE	device;
+	TOUCAN_USB_BACKEND	usb;
+	TOUCAN_BACKEND	backend;
+	UINT8	capture[TOUCAN_RECORD_LENGTH * 16];
+} TEST_DEVICE;
+
+static TEST_DEVICE first;
+static TEST_DEVICE second;
+static TOUCAN_INSTANCE one;
+static TOUCAN_INSTANCE two;
+
+static volatile LONG capturedReceived;
+static volatile LONG capturedTransmitted;
+
+static TOUCAN_FRAME Frame(UINT32 source, UINT8 length) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = TOUCAN_PDU2_ID(2, 127250, source);
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = length;
+	memset(frame.data, (int)source, length);
+	return frame;
+}
+
+static void Device(TEST_DEVICE *device, UINT32 serialNumber, const TOUCAN_FAKE_PACKET *script, UINT32 count) {
+	TouCAN_fakeusb_device(&device->device, &device->fake, script, count);
+	TouCAN_fakeusb_capture(&device->fake, device->capture, sizeof(device->capture));
+	TouCAN_usb_backend(&device->backend, &device->usb, &device->device);
+	device->fake.serialNumber = serialNumber;
+}
+
+static void CaptureHook(void *context, const TOUCAN_FRAME *frames, UINT32 count, UINT8 direction) {
+	(void)frames;
+
+	CHECK(context == &one);
+	InterlockedExchangeAdd((direction == TOUCAN_CAPTURE_RECEIVED) ? &capturedReceived : &capturedTransmitted, (LONG)count);
+}
+
+// Drain an instance until it has delivered count frames, or the timeout passes
+static UINT32 DrainFrames(TOUCAN_INSTANCE *instance, TOUCAN_FRAME *frames, UINT32 count) {
+	ULONGLONG start = GetTickCount64();
+	UINT32 total = 0;
+
+	while ((total < count) && ((GetTickCount64() - start) < TEST_TIMEOUT)) {
+		WaitForSingleObject(instance->frameReceivedEvent, 10);
+		total += TouCAN_instance_drain(instance, &frames[total], count - total);
+	}
+	return total;
+}
+
+int main(void) {
+	UINT8 packetOne[TOUCAN_RECORD_LENGTH * 3];
+	UINT8 packetTwo[TOUCAN_RECORD_LENGTH * 2];
+	TOUCAN_FAKE_PACKET scriptOne[1];
+	TOUCAN_FAKE_PACKET scriptTwo[1];
+	TOUCAN_FRAME received[3];
+	TOUCAN_FRAME decoded[3];
+	TOUCAN_FRAME sent[5];
+	UINT32 serialNumber;
+	UINT32 written;
+	UINT32 count;
+	ULONGLONG start;
+	TOUCAN_STATISTICS statistics;
+
+	for (UINT32 i = 0; i < 3; i++) {
+		TOUCAN_FRAME frame = Frame(0x10 + i, 8);
+		TouCAN_encode_record(&frame, &packetOne[i * TOUCAN_RECORD_LENGTH]);
+	}
+	for (UINT32 i = 0; i < 2; i++) {
+		TOUCAN_FRAME frame = Frame(0x40 + i, 6);
+		TouCAN_encode_record(&frame, &packetTwo[i * TOUCAN_RECORD_LENGTH]);
+	}
+	for (UINT32 i = 0; i < 5; i++) {
+		sent[i] = Frame(0x60 + i, 8);
+	}
+
+	scriptOne[0].data = packetOne;
+	scriptOne[0].length = sizeof(packetOne);
+	scriptOne[0].result = TOUCAN_TRANSFER_COMPLETE;
+	scriptTwo[0].data = packetTwo;
+	scriptTwo[0].length = sizeof(packetTwo);
+	scriptTwo[0].result = TOUCAN_TRANSFER_COMPLETE;
+
+	Device(&first, 0x11223344, scriptOne, 1);
+	Device(&second, 0x55667788, scriptTwo, 1);
+
+	// The first instance writes from the caller's thread and captures through its hook
+	TouCAN_instance_init(&one);
+	one.config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+	one.config.hooks.context = &one;
+	one.config.hooks.Capture = CaptureHook;
+
+	// The second has a writer thread, and is only opened on the adapter with its serial number
+	TouCAN_instance_init(&two);
+	two.config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+	two.config.transmitLaneDepth = 16;
+
+	serialNumber = 0x11223344;
+	CHECK(TouCAN_instance_open(&two, &second.backend, &serialNumber) != TWOCAN_RESULT_SUCCESS);
+	CHECK(two.backend == NULL);
+	CHECK(second.fake.open == FALSE);
+
+	serialNumber = 0x55667788;
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_open(&two, &second.backend, &serialNumber));
+	CHECK_EQUAL(0x55667788, two.serialNumber);
+	CHECK(two.writerHandle != NULL);
+
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_open(&one, &first.backend, NULL));
+	CHECK_EQUAL(0x11223344, one.serialNumber);
+	CHECK(one.writerHandle == NULL);
+
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_start(&one));
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_start(&two));
+
+	// Each instance receives its own adapter's frames only
+	CHECK_EQUAL(3, DrainFrames(&one, received, 3));
+	for (UINT32 i = 0; i < 3; i++) {
+		CHECK_EQUAL(Frame(0x10 + i, 8).id, received[i].id);
+	}
+	CHECK_EQUAL(2, DrainFrames(&two, received, 2));
+	for (UINT32 i = 0; i < 2; i++) {
+		CHECK_EQUAL(Frame(0x40 + i, 6).id, received[i].id);
+		CHECK_EQUAL(6, received[i].length);
+	}
+	CHECK_EQUAL(0, TouCAN_instance_drain(&two, received, 3));
+	CHECK_EQUAL(3, one.receiveFrames);
+	CHECK_EQUAL(2, two.receiveFrames);
+	CHECK_EQUAL(3, capturedReceived);
+
+	// A direct write reaches the first adapter before it returns
+	CHECK(TouCAN_instance_write(&one, sent, 2, &written));
+	CHECK_EQUAL(2, written);
+	CHECK_EQUAL(2 * TOUCAN_RECORD_LENGTH, first.fake.captureLength);
+	CHECK_EQUAL(2, capturedTransmitted);
+	CHECK(TouCAN_decode_packet(first.capture, 2 * TOUCAN_RECORD_LENGTH, decoded, 3, &count));
+	CHECK_EQUAL(2, count);
+	CHECK_EQUAL(sent[0].id, decoded[0].id);
+	CHECK_EQUAL(sent[1].id, decoded[1].id);
+
+	// One snapshot carries the host's counters and those the adapter firmware answers with
+	first.fake.statistics.receiveFrames = 7;
+	first.fake.statistics.busOff = 1;
+	TouCAN_instance_statistics(&one, &statistics);
+	CHECK_EQUAL(3, statistics.receiveFrames);
+	CHECK_EQUAL(2, statistics.transmitFrames);
+	CHECK_EQUAL(0, statistics.transmitFailures);
+	CHECK(statistics.deviceValid);
+	CHECK_EQUAL(7, statistics.device.receiveFrames);
+	CHECK_EQUAL(1, statistics.device.busOff);
+
+	// A frame longer than 8 bytes is refused, with the rest of its batch, on either path
+	sent[1].length = TOUCAN_FRAME_DATA_LENGTH + 1;
+	CHECK(TouCAN_instance_write(&one, sent, 2, &written) == FALSE);
+	CHECK_EQUAL(0, written);
+	CHECK(TouCAN_instance_queue(&two, sent, 2) == FALSE);
+	sent[1].length = TOUCAN_FRAME_DATA_LENGTH;
+	CHECK_EQUAL(2 * TOUCAN_RECORD_LENGTH, first.fake.captureLength);
+	CHECK_EQUAL(2, capturedTransmitted);
+
+	// Queued frames are sent by the second instance's writer thread
+	CHECK(TouCAN_instance_queue(&two, &sent[2], 3));
+	start = GetTickCount64();
+	while ((ReadAcquire((volatile LONG *)&second.fake.captureLength) < 3 * TOUCAN_RECORD_LENGTH) && ((GetTickCount64() - start) < TEST_TIMEOUT)) {
+		Sleep(1);
+	}
+	CHECK_EQUAL(3 * TOUCAN_RECORD_LENGTH, second.fake.captureLength);
+	CHECK(TouCAN_decode_packet(second.capture, 3 * TOUCAN_RECORD_LENGTH, decoded, 3, &count));
+	CHECK_EQUAL(3, count);
+	for (UINT32 i = 0; i < 3; i++) {
+		CHECK_EQUAL(sent[2 + i].id, decoded[i].id);
+	}
+	CHECK_EQUAL(2 * TOUCAN_RECORD_LENGTH, first.fake.captureLength);
+
+	// Closing one instance leaves the other running
+	CHECK(TouCAN_instance_close(&one));
+	CHECK(one.backend == NULL);
+	CHECK(one.threadHandle == NULL);
+	CHECK(first.fake.open == FALSE);
+	CHECK(second.fake.open);
+	TouCAN_instance_statistics(&one, &statistics);
+	CHECK(statistics.deviceValid == FALSE);
+	CHECK_EQUAL(0, statistics.device.receiveFrames);
+
+	CHECK(TouCAN_instance_close(&two));
+	CHECK(two.backend == NULL);
+	CHECK(two.writerHandle == NULL);
+	CHECK(second.fake.open == FALSE);
+
+	// A closed instance opens again
+	Device(&first, 0x11223344, scriptOne, 1);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_open(&one, &first.backend, NULL));
+	CHECK(TouCAN_instance_close(&one));
+	return TEST_RESULT();
+}
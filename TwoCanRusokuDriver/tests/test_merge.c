@@ -0,0 +1,159 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Merge Test
+// Unit Description: Tests of the time ordered merge of several sources
+// Function: Checks frames are released in time order behind the watermark, and that a caller
+// moving frames from a receive queue into a full source leaves them in the receive queue
+//
+
+#include "../inc/toucan_merge.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+#define TEST_DEPTH 16
+#define TEST_BATCH 8
+
+static TOUCAN_MERGE merge;
+
+static TOUCAN_FRAME Frame(LONGLONG hostTime, UINT32 id) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.hostTime = hostTime;
+	frame.id = id;
+	frame.flags = 1;
+	frame.length = 8;
+	return frame;
+}
+
+// Interleaved sources come out in time order, a frame waits until every source has passed it
+static void TestOrder(void) {
+	TOUCAN_FRAME a[3] = { Frame(10, 0), Frame(30, 2), Frame(50, 4) };
+	TOUCAN_FRAME b[2] = { Frame(20, 1), Frame(40, 3) };
+	TOUCAN_FRAME out[8];
+	UINT8 sources[8];
+	UINT32 count;
+
+	CHECK(TouCAN_merge_init(&merge, 2, TEST_DEPTH, 1000));
+	CHECK_EQUAL(3, TouCAN_merge_push(&merge, 0, a, 3));
+
+	// Source 1 has not been heard from, nothing can be released yet
+	CHECK_EQUAL(0, TouCAN_merge_pop(&merge, 0, out, sources, 8));
+
+	CHECK_EQUAL(2, TouCAN_merge_push(&merge, 1, b, 2));
+	count = TouCAN_merge_pop(&merge, 0, out, sources, 8);
+	CHECK_EQUAL(4, count);
+	for (UINT32 i = 0; i < count; i++) {
+		CHECK_EQUAL(i, out[i].id);
+		CHECK_EQUAL(i & 1, sources[i]);
+	}
+
+	// Once source 1 ends, source 0 is no longer held back
+	TouCAN_merge_close_source(&merge, 1);
+	CHECK_EQUAL(1, TouCAN_merge_pop(&merge, 0, out, sources, 8));
+	CHECK_EQUAL(4, out[0].id);
+	CHECK_EQUAL(5, merge.merged);
+	CHECK_EQUAL(0, merge.late);
+	TouCAN_merge_free(&merge);
+}
+
+// A full source refuses frames, its space says how many it takes
+static void TestSpace(void) {
+	TOUCAN_FRAME frames[TEST_DEPTH + 4];
+
+	for (UINT32 i = 0; i < TEST_DEPTH + 4; i++) {
+		frames[i] = Frame((LONGLONG)i, i);
+	}
+
+	CHECK(TouCAN_merge_init(&merge, 2, TEST_DEPTH, 1000));
+	CHECK_EQUAL(TEST_DEPTH, TouCAN_merge_space(&merge, 0));
+	CHECK_EQUAL(0, TouCAN_merge_space(&merge, 2));
+
+	CHECK_EQUAL(5, TouCAN_merge_push(&merge, 0, frames, 5));
+
+	// The earliest frame is held apart as the source's head
+	CHECK_EQUAL(TEST_DEPTH - 4, TouCAN_merge_space(&merge, 0));
+
+	CHECK_EQUAL(TEST_DEPTH - 4, TouCAN_merge_push(&merge, 0, &frames[5], TEST_DEPTH - 1));
+	CHECK_EQUAL(0, TouCAN_merge_space(&merge, 0));
+	CHECK_EQUAL(3, merge.overflows);
+	TouCAN_merge_free(&merge);
+}
+
+// As DrainMerged moves an instance's receive queue into its source: with the source full the
+// frames stay in the receive queue, and are merged in order once the source has room
+static void TestBackPressure(void) {
+	TOUCAN_RING receive;
+	TOUCAN_FRAME frame;
+	TOUCAN_FRAME batch[TEST_BATCH];
+	TOUCAN_FRAME out[64];
+	UINT32 space;
+	UINT32 count;
+	UINT32 released = 0;
+	UINT32 next = 0;
+
+	CHECK(TouCAN_ring_init(&receive, 64));
+	CHECK(TouCAN_merge_init(&merge, 1, TEST_DEPTH, 1000));
+
+	for (UINT32 i = 0; i < 40; i++) {
+		frame = Frame((LONGLONG)i, i);
+		CHECK(TouCAN_ring_push(&receive, &frame));
+	}
+
+	do {
+		space = TouCAN_merge_space(&merge, 0);
+		count = TouCAN_ring_drain(&receive, batch, (space < TEST_BATCH) ? space : TEST_BATCH);
+		CHECK_EQUAL(count, TouCAN_merge_push(&merge, 0, batch, count));
+	} while (count == TEST_BATCH);
+
+	CHECK_EQUAL(0, merge.overflows);
+	CHECK_EQUAL(40 - (TEST_DEPTH + 1), TouCAN_ring_count(&receive));
+
+	// Release what the source holds and move the rest across, nothing is lost or reordered
+	TouCAN_merge_close_source(&merge, 0);
+	while ((released < 40) && (next < 10)) {
+		released += TouCAN_merge_pop(&merge, 0, &out[released], NULL, 64 - released);
+		do {
+			space = TouCAN_merge_space(&merge, 0);
+			count = TouCAN_ring_drain(&receive, batch, (space < TEST_BATCH) ? space : TEST_BATCH);
+			TouCAN_merge_push(&merge, 0, batch, count);
+		} while (count == TEST_BATCH);
+		next++;
+	}
+
+	CHECK_EQUAL(40, released);
+	CHECK_EQUAL(0, merge.overflows);
+	for (UINT32 i = 0; i < released; i++) {
+		CHECK_EQUAL(i, out[i].id);
+	}
+
+	TouCAN_merge_free(&merge);
+	TouCAN_ring_free(&receive);
+}
+
+int main(void) {
+	TestOrder();
+	TestSpace();
+	TestBackPressure();
+	return TEST_RESULT();
+}
@@ -0,0 +1,196 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Moderation Test
+// Unit Description: Tests of the moderated frame received notification of an adapter instance
+// Function: Releases the packets of a fake device one at a time into a running instance, checking
+// that the caller is signalled once the frame threshold is reached or the deadline has passed,
+// that the read thread waits no longer than the deadline, and that signals coalesce until drained
+//
+
+#include "../inc/toucan_instance.h"
+#include "../inc/toucan_decode.h"
+#include "../inc/toucan_fakeusb.h"
+#include "../inc/toucan_header.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+// Packets of the script, each of two frames
+#define TEST_PACKETS 4
+#define TEST_PACKET_FRAMES 2
+
+// How long a signal that should not be raised is waited for, and the longest wait for one that should, in milliseconds
+#define TEST_QUIET 50
+#define TEST_TIMEOUT 2000
+
+static TOUCAN_FAKE_USB fake;
+static TOUCAN_USB_DEVICE device;
+static TOUCAN_USB_BACKEND usb;
+static TOUCAN_BACKEND backend;
+static TOUCAN_INSTANCE instance;
+static UINT8 packets[TEST_PACKETS][TOUCAN_RECORD_LENGTH * TEST_PACKET_FRAMES];
+static TOUCAN_FAKE_PACKET script[TEST_PACKETS];
+
+// The device's own read, and the packets the test has released to it
+static TOUCAN_TRANSFER_RESULT (*DeviceRead)(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count);
+static volatile LONG released;
+static volatile LONG shortestWait;
+static HANDLE releaseEvent;
+
+// Completes a read only with a released packet, otherwise waits as long as the read thread asks, as an idle bus would
+static TOUCAN_TRANSFER_RESULT ModeratedRead(void *context, DWORD timeout, TOUCAN_FRAME *frames, UINT32 maxFrames, UINT32 *count) {
+	if ((LONG)timeout < ReadAcquire(&shortestWait)) {
+		WriteRelease(&shortestWait, (LONG)timeout);
+	}
+
+	if (ReadAcquire(&released) > 0) {
+		InterlockedDecrement(&released);
+		return DeviceRead(context, timeout, frames, maxFrames, count);
+	}
+
+	WaitForSingleObject(releaseEvent, timeout);
+	*count = 0;
+	return TOUCAN_TRANSFER_PENDING;
+}
+
+static void Release(void) {
+	InterlockedIncrement(&released);
+	SetEvent(releaseEvent);
+}
+
+static BOOL Signalled(DWORD timeout) {
+	return (WaitForSingleObject(instance.frameReceivedEvent, timeout) == WAIT_OBJECT_0);
+}
+
+// Start an instance on the fake device with the given moderation
+static void Start(UINT32 notifyFrames, UINT32 notifyDeadline) {
+	TouCAN_fakeusb_device(&device, &fake, script, TEST_PACKETS);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	DeviceRead = backend.ReadBatch;
+	backend.ReadBatch = ModeratedRead;
+	WriteRelease(&released, 0);
+	WriteRelease(&shortestWait, TOUCAN_READ_WAIT_TIMEOUT);
+
+	TouCAN_instance_init(&instance);
+	instance.config.receiveMode = TOUCAN_RECEIVE_MODE_QUEUED;
+	instance.config.notifyFrames = notifyFrames;
+	instance.config.notifyDeadline = notifyDeadline;
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_open(&instance, &backend, NULL));
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_instance_start(&instance));
+}
+
+// The caller is signalled once the threshold is reached, not before
+static void TestThreshold(void) {
+	TOUCAN_FRAME frames[TEST_PACKETS * TEST_PACKET_FRAMES];
+
+	Start(5, 1000000);
+
+	Release();
+	CHECK(Signalled(TEST_QUIET) == FALSE);
+	Release();
+	CHECK(Signalled(TEST_QUIET) == FALSE);
+	CHECK_EQUAL(0, instance.notificationsSent);
+
+	// Six frames waiting, one signal for all of them
+	Release();
+	CHECK(Signalled(TEST_TIMEOUT));
+	CHECK_EQUAL(1, instance.notificationsSent);
+	CHECK_EQUAL(3 * TEST_PACKET_FRAMES, TouCAN_instance_drain(&instance, frames, TEST_PACKETS * TEST_PACKET_FRAMES));
+
+	// Far from the deadline, the read thread waits as long as it would unmoderated
+	CHECK_EQUAL(TOUCAN_READ_WAIT_TIMEOUT, shortestWait);
+	CHECK(TouCAN_instance_close(&instance));
+}
+
+// Below the threshold, the frames are signalled once the oldest has waited for the deadline
+static void TestDeadline(void) {
+	TOUCAN_FRAME frames[TEST_PACKETS * TEST_PACKET_FRAMES];
+	ULONGLONG start;
+
+	Start(100, 30000);
+
+	start = GetTickCount64();
+	Release();
+	CHECK(Signalled(TEST_TIMEOUT));
+	CHECK(GetTickCount64() - start >= 25);
+	CHECK(GetTickCount64() - start < TOUCAN_READ_WAIT_TIMEOUT * 5);
+	CHECK_EQUAL(TEST_PACKET_FRAMES, TouCAN_instance_drain(&instance, frames, TEST_PACKETS * TEST_PACKET_FRAMES));
+
+	// The read thread shortened its wait to meet the deadline
+	CHECK(shortestWait <= 30);
+	CHECK_EQUAL(1, instance.notificationsSent);
+	CHECK(TouCAN_instance_close(&instance));
+}
+
+// Without moderation each packet signals, until the caller drains the signals coalesce
+static void TestCoalesce(void) {
+	TOUCAN_FRAME frames[TEST_PACKETS * TEST_PACKET_FRAMES];
+	ULONGLONG start;
+
+	Start(1, 0);
+
+	Release();
+	CHECK(Signalled(TEST_TIMEOUT));
+	CHECK_EQUAL(1, instance.notificationsSent);
+
+	// Not drained, the following packets raise no new signal
+	Release();
+	Release();
+	start = GetTickCount64();
+	while ((ReadAcquire(&instance.notificationsCoalesced) < 2) && ((GetTickCount64() - start) < TEST_TIMEOUT)) {
+		Sleep(1);
+	}
+	CHECK_EQUAL(2, instance.notificationsCoalesced);
+	CHECK(Signalled(TEST_QUIET) == FALSE);
+	CHECK_EQUAL(3 * TEST_PACKET_FRAMES, TouCAN_instance_drain(&instance, frames, TEST_PACKETS * TEST_PACKET_FRAMES));
+
+	// Drained, the next packet is signalled again
+	Release();
+	CHECK(Signalled(TEST_TIMEOUT));
+	CHECK_EQUAL(2, instance.notificationsSent);
+	CHECK(TouCAN_instance_close(&instance));
+}
+
+int main(void) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = 8;
+	for (UINT32 i = 0; i < TEST_PACKETS; i++) {
+		for (UINT32 j = 0; j < TEST_PACKET_FRAMES; j++) {
+			frame.id = TOUCAN_PDU2_ID(2, 127250, (i * TEST_PACKET_FRAMES) + j);
+			TouCAN_encode_record(&frame, &packets[i][j * TOUCAN_RECORD_LENGTH]);
+		}
+		script[i].data = packets[i];
+		script[i].length = sizeof(packets[i]);
+		script[i].result = TOUCAN_TRANSFER_COMPLETE;
+	}
+
+	releaseEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	TestThreshold();
+	TestDeadline();
+	TestCoalesce();
+	CloseHandle(releaseEvent);
+	return TEST_RESULT();
+}
@@ -0,0 +1,253 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Replay Test
+// Unit Description: Tests of the replay backend against recordings in tests/fixtures
+// Function: Replays a candump log, a TwoCan raw log and a binary capture, checking the frames each
+// parser accepts and the lines it rejects, the format detection, the acceptance filter, the pace of
+// a real time replay, the bus state requests and that a rejected looping recording does not spin
+//
+
+#include "../inc/toucan_replay.h"
+#include "../inc/toucan_clock.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Directory of the recordings, unless the first argument gives another
+#define TEST_FIXTURES "tests/fixtures"
+
+// Reads tried before a recording is expected to be finished
+#define TEST_READS 100
+
+static const char *fixtures = TEST_FIXTURES;
+static TOUCAN_REPLAY replay;
+static TOUCAN_BACKEND backend;
+
+// Open and start a recording, as TouCAN_instance_open and TouCAN_instance_start would
+static BOOL Start(const char *name, UINT32 format, UINT32 speed, BOOL loop) {
+	TOUCAN_REPLAY_CONFIG config;
+
+	memset(&config, 0, sizeof(config));
+	snprintf(config.path, sizeof(config.path), "%s/%s", fixtures, name);
+	config.format = format;
+	config.speed = speed;
+	config.loop = loop;
+
+	TouCAN_replay_backend(&backend, &replay, &config);
+	if (backend.Open(backend.context) != TWOCAN_RESULT_SUCCESS) {
+		fprintf(stderr, "replay: %s could not be opened\n", config.path);
+		return FALSE;
+	}
+	return (TouCAN_backend_init(&backend, 0) && TouCAN_backend_start(&backend) && backend.ReadOpen(backend.context, 0, 0));
+}
+
+static void Stop(void) {
+	backend.ReadClose(backend.context);
+	TouCAN_backend_stop(&backend);
+	backend.Close(backend.context);
+}
+
+// Read until the recording is finished
+static UINT32 ReadAll(TOUCAN_FRAME *frames, UINT32 maxFrames) {
+	TOUCAN_REPLAY_STATISTICS statistics;
+	UINT32 total = 0;
+	UINT32 count;
+
+	for (UINT32 i = 0; i < TEST_READS; i++) {
+		if (backend.ReadBatch(backend.context, 10, &frames[total], maxFrames - total, &count) == TOUCAN_TRANSFER_COMPLETE) {
+			total += count;
+		}
+		TouCAN_replay_statistics(&replay, &statistics);
+		if (statistics.finished) {
+			break;
+		}
+	}
+	return total;
+}
+
+static void TestCandump(void) {
+	const UINT8 data[] = { 0xA0, 0xB1, 0xC2, 0xD3, 0xE4, 0xF5, 0x06, 0x17 };
+	TOUCAN_REPLAY_STATISTICS statistics;
+	TOUCAN_FRAME frames[16];
+
+	CHECK(Start("replay.log", TOUCAN_REPLAY_FORMAT_AUTO, 0, FALSE));
+	CHECK_EQUAL(TOUCAN_REPLAY_FORMAT_CANDUMP, replay.format);
+	CHECK_EQUAL(5, ReadAll(frames, 16));
+
+	CHECK_EQUAL(0x09F80103, frames[0].id);
+	CHECK_EQUAL(CANAL_IDFLAG_EXTENDED, frames[0].flags);
+	CHECK_EQUAL(8, frames[0].length);
+	CHECK(memcmp(data, frames[0].data, 8) == 0);
+	CHECK_EQUAL((UINT32)1436509052249713ULL, frames[0].timestamp);
+
+	CHECK_EQUAL(0x1DEFFF03, frames[1].id);
+	CHECK_EQUAL(2, frames[1].length);
+	CHECK_EQUAL(0x02, frames[1].data[1]);
+
+	CHECK_EQUAL(0x123, frames[2].id);
+	CHECK_EQUAL(CANAL_IDFLAG_STANDARD, frames[2].flags);
+	CHECK_EQUAL(4, frames[2].length);
+
+	CHECK_EQUAL(0x0CF00400, frames[3].id);
+	CHECK_EQUAL(CANAL_IDFLAG_EXTENDED | CANAL_IDFLAG_RTR, frames[3].flags);
+	CHECK_EQUAL(0, frames[3].length);
+
+	// Lower case data, after a frame of 9 bytes, a CAN FD frame and a line that is not a frame
+	CHECK_EQUAL(0x09F80104, frames[4].id);
+	CHECK(memcmp(data, frames[4].data, 8) == 0);
+
+	TouCAN_replay_statistics(&replay, &statistics);
+	CHECK_EQUAL(5, statistics.frames);
+	CHECK_EQUAL(3, statistics.rejected);
+	CHECK_EQUAL(1, statistics.passes);
+	CHECK(statistics.finished);
+	Stop();
+}
+
+static void TestTwoCan(void) {
+	TOUCAN_REPLAY_STATISTICS statistics;
+	TOUCAN_FRAME frames[16];
+
+	CHECK(Start("replay.twocan", TOUCAN_REPLAY_FORMAT_AUTO, 0, FALSE));
+	CHECK_EQUAL(TOUCAN_REPLAY_FORMAT_TWOCAN, replay.format);
+	CHECK_EQUAL(3, ReadAll(frames, 16));
+
+	// The header is little endian, both letter cases and trailing spaces are accepted
+	CHECK_EQUAL(0x09F80103, frames[0].id);
+	CHECK_EQUAL(8, frames[0].length);
+	CHECK_EQUAL(0xA0, frames[0].data[0]);
+	CHECK_EQUAL(0x17, frames[0].data[7]);
+	CHECK_EQUAL(0x09F80104, frames[1].id);
+	CHECK_EQUAL(0xF5, frames[1].data[5]);
+	CHECK_EQUAL(0x09F80107, frames[2].id);
+
+	// Eleven bytes, and an invalid digit
+	TouCAN_replay_statistics(&replay, &statistics);
+	CHECK_EQUAL(2, statistics.rejected);
+	Stop();
+}
+
+static void TestCapture(void) {
+	TOUCAN_REPLAY_STATISTICS statistics;
+	TOUCAN_FRAME frames[16];
+
+	// Only the received frames are replayed, the transmitted one in between is skipped
+	CHECK(Start("replay.bin", TOUCAN_REPLAY_FORMAT_AUTO, 0, FALSE));
+	CHECK_EQUAL(TOUCAN_REPLAY_FORMAT_BINARY, replay.format);
+	CHECK_EQUAL(3, ReadAll(frames, 16));
+	CHECK_EQUAL(0x09F80100, frames[0].id);
+	CHECK_EQUAL(0x09F80101, frames[1].id);
+	CHECK_EQUAL(0x09F80103, frames[2].id);
+	CHECK_EQUAL(0x33, frames[2].data[0]);
+
+	TouCAN_replay_statistics(&replay, &statistics);
+	CHECK_EQUAL(0, statistics.rejected);
+	Stop();
+}
+
+// The extended acceptance filter applies as the adapter's would, standard frames pass it
+static void TestFilter(void) {
+	TOUCAN_FRAME frames[16];
+
+	CHECK(Start("replay.log", TOUCAN_REPLAY_FORMAT_CANDUMP, 0, FALSE));
+	CHECK(TouCAN_backend_set_filter_ext_list_mask(&backend, FILTER_VALUE, 0x09F80100, 0x1FFFFF00));
+	CHECK_EQUAL(3, ReadAll(frames, 16));
+	CHECK_EQUAL(0x09F80103, frames[0].id);
+	CHECK_EQUAL(0x123, frames[1].id);
+	CHECK_EQUAL(0x09F80104, frames[2].id);
+	Stop();
+}
+
+// A recorded bus is error active, and listening once started
+static void TestBusState(void) {
+	UINT8 state = 0;
+	UINT32 errorCode = 1;
+	UINT32 errorStatus = 1;
+
+	CHECK(Start("replay.log", TOUCAN_REPLAY_FORMAT_CANDUMP, 0, FALSE));
+	CHECK(TouCAN_backend_get_interface_state(&backend, &state));
+	CHECK_EQUAL(HAL_CAN_STATE_LISTENING, state);
+	CHECK(TouCAN_backend_get_interface_error_code(&backend, &errorCode));
+	CHECK_EQUAL(0, errorCode);
+	CHECK(TouCAN_backend_get_error_status(&backend, &errorStatus));
+	CHECK_EQUAL(0, errorStatus);
+	CHECK(TouCAN_backend_clear_interface_error_code(&backend));
+
+	TouCAN_backend_stop(&backend);
+	CHECK(TouCAN_backend_get_interface_state(&backend, &state));
+	CHECK_EQUAL(HAL_CAN_STATE_READY, state);
+	backend.Close(backend.context);
+}
+
+// In real time the frames, a millisecond apart, take as long as they were recorded over
+static void TestPace(void) {
+	TOUCAN_FRAME frames[16];
+	LONGLONG start;
+
+	CHECK(Start("replay.log", TOUCAN_REPLAY_FORMAT_CANDUMP, TOUCAN_REPLAY_REAL_TIME, FALSE));
+	start = HostMicroseconds();
+	CHECK_EQUAL(5, ReadAll(frames, 16));
+	CHECK(HostMicroseconds() - start >= 4000);
+	Stop();
+}
+
+// A looping recording the filter rejects entirely waits between scans rather than spinning
+static void TestRejectedLoop(void) {
+	TOUCAN_REPLAY_STATISTICS statistics;
+	TOUCAN_FRAME frames[16];
+	LONGLONG start;
+	UINT32 count;
+
+	CHECK(Start("replay.twocan", TOUCAN_REPLAY_FORMAT_TWOCAN, 0, TRUE));
+	CHECK(TouCAN_backend_set_filter_ext_list_mask(&backend, FILTER_REJECT_ALL, 0, 0));
+
+	start = HostMicroseconds();
+	for (UINT32 i = 0; i < 5; i++) {
+		CHECK_EQUAL(TOUCAN_TRANSFER_PENDING, backend.ReadBatch(backend.context, 100, frames, 16, &count));
+		CHECK_EQUAL(0, count);
+	}
+	CHECK(HostMicroseconds() - start >= 5000);
+
+	TouCAN_replay_statistics(&replay, &statistics);
+	CHECK(statistics.passes > 1);
+	CHECK_EQUAL(0, statistics.frames);
+	CHECK(statistics.finished == FALSE);
+	Stop();
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		fixtures = argv[1];
+	}
+
+	TestCandump();
+	TestTwoCan();
+	TestCapture();
+	TestFilter();
+	TestBusState();
+	TestPace();
+	TestRejectedLoop();
+	return TEST_RESULT();
+}
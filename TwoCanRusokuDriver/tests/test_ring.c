@@ -0,0 +1,177 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Ring Test
+// Unit Description: Tests of the single producer, single consumer receive queue
+// Function: Runs a producer and a consumer thread against one ring and checks that
+// every frame arrives exactly once, in order, whenever the producer waits for space
+//
+
+#include "../inc/toucan_ring.h"
+#include "toucan_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+// Frames exchanged by the threaded test, several million wraps of a small ring
+#define TEST_RING_FRAMES 2000000
+#define TEST_RING_DEPTH 64
+#define TEST_RING_BATCH 16
+
+static TOUCAN_RING ring;
+
+// Stamp a frame with its sequence number in both the identifier and the data
+static void MakeFrame(TOUCAN_FRAME *frame, UINT32 sequence) {
+	memset(frame, 0, sizeof(TOUCAN_FRAME));
+	frame->id = sequence & 0x1FFFFFFF;
+	frame->flags = TOUCAN_FRAME_EXTENDED;
+	frame->length = (UINT8)(sequence & 0x07) + 1;
+	memcpy(frame->data, &sequence, sizeof(sequence));
+	frame->timestamp = ~sequence;
+	frame->hostTime = (LONGLONG)sequence * 3;
+}
+
+static BOOL IsFrame(const TOUCAN_FRAME *frame, UINT32 sequence) {
+	TOUCAN_FRAME expected;
+	MakeFrame(&expected, sequence);
+	return memcmp(frame, &expected, sizeof(TOUCAN_FRAME)) == 0;
+}
+
+// Producer thread, retries a full ring until the consumer has made space
+static void *Producer(void *argument) {
+	TOUCAN_FRAME frame;
+	UINT32 sequence;
+	UINT32 *retries = (UINT32 *)argument;
+
+	for (sequence = 0; sequence < TEST_RING_FRAMES; sequence++) {
+		MakeFrame(&frame, sequence);
+		while (!TouCAN_ring_push(&ring, &frame)) {
+			(*retries)++;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+// Every pushed frame is drained exactly once, in order, and the ring never loses a frame
+static void TestZeroLoss(void) {
+	pthread_t producer;
+	TOUCAN_FRAME frames[TEST_RING_BATCH];
+	UINT32 retries = 0;
+	UINT32 expected = 0;
+	UINT32 mismatches = 0;
+	UINT32 count;
+	UINT32 i;
+	BOOL usePop = FALSE;
+
+	CHECK(TouCAN_ring_init(&ring, TEST_RING_DEPTH));
+	CHECK(pthread_create(&producer, NULL, Producer, &retries) == 0);
+
+	// Alternate single pops and batched drains, so both consumer paths race the producer
+	while (expected < TEST_RING_FRAMES) {
+		if (usePop) {
+			count = TouCAN_ring_pop(&ring, &frames[0]) ? 1 : 0;
+		}
+		else {
+			count = TouCAN_ring_drain(&ring, frames, TEST_RING_BATCH);
+		}
+		for (i = 0; i < count; i++) {
+			if (!IsFrame(&frames[i], expected)) {
+				mismatches++;
+			}
+			expected++;
+		}
+		if (count == 0) {
+			sched_yield();
+		}
+		usePop = !usePop;
+	}
+
+	pthread_join(producer, NULL);
+
+	CHECK_EQUAL(0, mismatches);
+	CHECK_EQUAL(TEST_RING_FRAMES, expected);
+	CHECK_EQUAL(0, TouCAN_ring_count(&ring));
+	CHECK(TouCAN_ring_pop(&ring, &frames[0]) == FALSE);
+
+	// A retried push is counted as an overflow, but no frame was lost
+	CHECK_EQUAL(retries, ring.overflows);
+	CHECK(ring.highWater <= TEST_RING_DEPTH);
+
+	printf("ring: %u frames, %u full ring retries, high water %d\n", expected, retries, (int)ring.highWater);
+	TouCAN_ring_free(&ring);
+}
+
+// A full ring rejects the frame, counts the overflow and keeps the queued frames intact
+static void TestOverflow(void) {
+	TOUCAN_FRAME frame;
+	UINT32 i;
+
+	CHECK(TouCAN_ring_init(&ring, 5));
+	CHECK_EQUAL(7, ring.mask);
+
+	for (i = 0; i < 8; i++) {
+		MakeFrame(&frame, i);
+		CHECK(TouCAN_ring_push(&ring, &frame));
+	}
+	MakeFrame(&frame, 8);
+	CHECK(TouCAN_ring_push(&ring, &frame) == FALSE);
+	CHECK_EQUAL(1, ring.overflows);
+	CHECK_EQUAL(8, ring.highWater);
+
+	for (i = 0; i < 8; i++) {
+		CHECK(TouCAN_ring_pop(&ring, &frame));
+		CHECK(IsFrame(&frame, i));
+	}
+	CHECK(TouCAN_ring_pop(&ring, &frame) == FALSE);
+	TouCAN_ring_free(&ring);
+}
+
+// Head and tail are free running, so the ring keeps working once the counters wrap
+static void TestCounterWrap(void) {
+	TOUCAN_FRAME frames[4];
+	TOUCAN_FRAME frame;
+	UINT32 i;
+
+	CHECK(TouCAN_ring_init(&ring, 4));
+	ring.head = (LONG)0xFFFFFFFE;
+	ring.tail = (LONG)0xFFFFFFFE;
+
+	for (i = 0; i < 4; i++) {
+		MakeFrame(&frame, i);
+		CHECK(TouCAN_ring_push(&ring, &frame));
+	}
+	CHECK_EQUAL(4, TouCAN_ring_count(&ring));
+	CHECK_EQUAL(4, TouCAN_ring_drain(&ring, frames, 4));
+	for (i = 0; i < 4; i++) {
+		CHECK(IsFrame(&frames[i], i));
+	}
+	CHECK_EQUAL(0, TouCAN_ring_count(&ring));
+	TouCAN_ring_free(&ring);
+}
+
+int main(void) {
+	TestOverflow();
+	TestCounterWrap();
+	TestZeroLoss();
+	return TEST_RESULT();
+}
@@ -0,0 +1,245 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Simulated USB Test
+// Unit Description: Tests of the simulated adapter through the driver's protocol layer
+// Function: Checks that a session is reproducible from its seed, that packets respect the
+// coalescing limit, that the bus load, acceptance filter, state machine and loopback behave
+// like the firmware, and that injected faults are reported
+//
+
+#include "../inc/toucan_simusb.h"
+#include "../inc/toucan_usb.h"
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+static TOUCAN_SIM_USB sim;
+static TOUCAN_USB_DEVICE device;
+static TOUCAN_USB_BACKEND usb;
+static TOUCAN_BACKEND backend;
+
+static BOOL Start(const TOUCAN_SIM_CONFIG *config, UINT32 options) {
+	TouCAN_simusb_device(&device, &sim, config);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	return (TouCAN_open(&backend) == TWOCAN_RESULT_SUCCESS) && (TouCAN_init(options)) && (TouCAN_start()) &&
+		(TouCAN_read_open(TOUCAN_DEFAULT_READ_QUEUE_DEPTH, TOUCAN_DEFAULT_READ_BUFFER_SIZE));
+}
+
+static void Stop(void) {
+	TouCAN_read_close();
+	TouCAN_stop();
+	TouCAN_close();
+}
+
+// Summary of a session, folded into a hash so two sessions can be compared
+typedef struct _SESSION {
+	UINT32	hash;
+	UINT32	frames;
+	UINT32	failed;
+	UINT32	malformed;
+	UINT32	largestPacket;
+} SESSION;
+
+static void Fold(SESSION *session, UINT32 value) {
+	session->hash = (session->hash ^ value) * 16777619;
+}
+
+static void Read(SESSION *session, UINT32 reads) {
+	TOUCAN_FRAME frames[TOUCAN_MAX_READ_BATCH];
+	TOUCAN_TRANSFER_RESULT result;
+	UINT32 count;
+
+	memset(session, 0, sizeof(SESSION));
+	session->hash = 2166136261u;
+
+	for (UINT32 n = 0; n < reads; n++) {
+		result = TouCAN_read_batch(10, frames, TOUCAN_MAX_READ_BATCH, &count);
+		Fold(session, (UINT32)result);
+		if (result == TOUCAN_TRANSFER_FAILED) {
+			session->failed++;
+		}
+		if (result == TOUCAN_TRANSFER_MALFORMED) {
+			session->malformed++;
+		}
+		if (count > session->largestPacket) {
+			session->largestPacket = count;
+		}
+		for (UINT32 i = 0; i < count; i++) {
+			Fold(session, frames[i].id);
+			Fold(session, frames[i].timestamp);
+			Fold(session, frames[i].data[0] | ((UINT32)frames[i].data[7] << 8));
+		}
+		session->frames += count;
+	}
+}
+
+// The same configuration always produces the same session, another seed another one
+static void TestDeterministic(void) {
+	TOUCAN_SIM_CONFIG config;
+	SESSION first;
+	SESSION second;
+	SESSION other;
+
+	memset(&config, 0, sizeof(config));
+	config.seed = 7;
+	config.busLoad = 60;
+	config.burstFrames = 10;
+	config.burstPeriod = 100000;
+	config.maxCoalesce = 2;
+	config.drift = 50;
+	config.transferErrorRate = 5000;
+	config.malformedRate = 5000;
+
+	CHECK(Start(&config, 0));
+	Read(&first, 5000);
+	Stop();
+	CHECK(Start(&config, 0));
+	Read(&second, 5000);
+	Stop();
+	config.seed = 8;
+	CHECK(Start(&config, 0));
+	Read(&other, 5000);
+	Stop();
+
+	CHECK_EQUAL(first.hash, second.hash);
+	CHECK_EQUAL(first.frames, second.frames);
+	CHECK(first.hash != other.hash);
+
+	// Packets never carry more records than the coalescing limit, and the injected faults happen
+	CHECK(first.frames > 0);
+	CHECK_EQUAL(2, first.largestPacket);
+	CHECK(first.failed > 0);
+	CHECK(first.malformed > 0);
+	printf("simusb: %u frames, %u failed and %u malformed packets\n", first.frames, first.failed, first.malformed);
+}
+
+// The background traffic occupies the configured share of the bus
+static void TestBusLoad(void) {
+	TOUCAN_SIM_CONFIG config;
+	TOUCAN_SIM_STATISTICS statistics;
+	SESSION session;
+	LONGLONG elapsed;
+	UINT32 expected;
+
+	memset(&config, 0, sizeof(config));
+	config.seed = 3;
+	config.busLoad = 50;
+
+	CHECK(Start(&config, 0));
+	Read(&session, 20000);
+	elapsed = TouCAN_simusb_now(&sim);
+	TouCAN_simusb_statistics(&sim, &statistics);
+	Stop();
+
+	// Frames at 50 % of the bus, each taking TOUCAN_SIM_FRAME_OVERHEAD plus 64 data bits
+	expected = (UINT32)((elapsed * TOUCAN_SIM_DEFAULT_BITRATE / 2) / ((TOUCAN_SIM_FRAME_OVERHEAD + 64) * (LONGLONG)1000000));
+	CHECK(statistics.generated > (expected * 9) / 10);
+	CHECK(statistics.generated < (expected * 11) / 10);
+	CHECK_EQUAL(statistics.received, session.frames);
+	CHECK_EQUAL(0, statistics.overruns);
+}
+
+// Only frames passing the list and mask reach the host, the rest are counted as filtered
+static void TestFilter(void) {
+	static const UINT32 ids[] = { TOUCAN_PDU2_ID(2, 127250, 0x23), TOUCAN_PDU2_ID(2, 129025, 0x23) };
+	TOUCAN_SIM_CONFIG config;
+	TOUCAN_SIM_STATISTICS statistics;
+	TOUCAN_FRAME frames[TOUCAN_MAX_READ_BATCH];
+	UINT32 count;
+	UINT32 received = 0;
+	UINT32 wrong = 0;
+
+	memset(&config, 0, sizeof(config));
+	config.seed = 5;
+	config.busLoad = 40;
+	config.ids = ids;
+	config.idCount = 2;
+
+	CHECK(Start(&config, 0));
+	CHECK(TouCAN_set_filter_ext_list_mask(FILTER_VALUE, ids[0], 0x1FFFFFFF));
+	for (UINT32 n = 0; n < 2000; n++) {
+		if (TouCAN_read_batch(10, frames, TOUCAN_MAX_READ_BATCH, &count) == TOUCAN_TRANSFER_COMPLETE) {
+			for (UINT32 i = 0; i < count; i++) {
+				wrong += (frames[i].id != ids[0]) ? 1 : 0;
+			}
+			received += count;
+		}
+	}
+	TouCAN_simusb_statistics(&sim, &statistics);
+	Stop();
+
+	CHECK(received > 0);
+	CHECK_EQUAL(0, wrong);
+	CHECK(statistics.filtered > 0);
+}
+
+// Requests out of order fail like the firmware's, loopback returns transmitted frames
+static void TestStateAndLoopback(void) {
+	TOUCAN_SIM_CONFIG config;
+	TOUCAN_FRAME frame;
+	TOUCAN_FRAME frames[TOUCAN_MAX_READ_BATCH];
+	UINT32 written;
+	UINT32 count = 0;
+	UINT8 state;
+
+	memset(&config, 0, sizeof(config));
+	TouCAN_simusb_device(&device, &sim, &config);
+	TouCAN_usb_backend(&backend, &usb, &device);
+	CHECK_EQUAL(TWOCAN_RESULT_SUCCESS, TouCAN_open(&backend));
+	CHECK(TouCAN_start() == FALSE);
+	CHECK(TouCAN_stop() == FALSE);
+	CHECK(TouCAN_init(TouCAN_ENABLE_LOOPBACK_MODE));
+	CHECK(TouCAN_init(0));
+	CHECK(TouCAN_init(TouCAN_ENABLE_LOOPBACK_MODE));
+	CHECK(TouCAN_start());
+	CHECK(TouCAN_init(0) == FALSE);
+	CHECK(TouCAN_get_interface_state(&state));
+	CHECK_EQUAL(HAL_CAN_STATE_LISTENING, state);
+	CHECK(TouCAN_read_open(TOUCAN_DEFAULT_READ_QUEUE_DEPTH, TOUCAN_DEFAULT_READ_BUFFER_SIZE));
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = TOUCAN_PDU2_ID(3, 130306, 0x42);
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = 8;
+	memset(frame.data, 0x5A, 8);
+	CHECK(TouCAN_write_batch(&frame, 1, &written));
+	CHECK_EQUAL(1, written);
+
+	for (UINT32 n = 0; (n < 10) && (count == 0); n++) {
+		TouCAN_read_batch(10, frames, TOUCAN_MAX_READ_BATCH, &count);
+	}
+	CHECK_EQUAL(1, count);
+	CHECK_EQUAL(frame.id, frames[0].id);
+	CHECK(memcmp(frame.data, frames[0].data, 8) == 0);
+	Stop();
+}
+
+int main(void) {
+	TestDeterministic();
+	TestBusLoad();
+	TestFilter();
+	TestStateAndLoopback();
+	return TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN SocketCAN Test
+// Unit Description: Tests of the SocketCAN transport backend
+// Function: Checks the interface name handling, and when a virtual CAN interface is present,
+// sends frames through the backend in loopback mode and reads them back, all of them and then
+// only those passing two acceptance filters
+//
+
+#include "../inc/toucan_socketcan.h"
+#include "../inc/toucan_header.h"
+#include "../inc/toucan_protocol.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Virtual interface used for the loopback test, create it with
+// ip link add dev vcan0 type vcan && ip link set up vcan0
+#define TEST_SOCKETCAN_INTERFACE "vcan0"
+
+static TOUCAN_SOCKETCAN socketcan;
+static TOUCAN_BACKEND backend;
+
+// Names that do not fit an ifreq are refused rather than truncated
+static void TestInterfaceName(void) {
+	TouCAN_socketcan_backend(&backend, &socketcan, NULL);
+	CHECK(strcmp(socketcan.interfaceName, TOUCAN_SOCKETCAN_DEFAULT_INTERFACE) == 0);
+	CHECK_EQUAL(-1, socketcan.socket);
+
+	TouCAN_socketcan_backend(&backend, &socketcan, "vcan15");
+	CHECK(strcmp(socketcan.interfaceName, "vcan15") == 0);
+
+	TouCAN_socketcan_backend(&backend, &socketcan, "abcdefghijklmno");
+	CHECK(strcmp(socketcan.interfaceName, "abcdefghijklmno") == 0);
+
+	TouCAN_socketcan_backend(&backend, &socketcan, "abcdefghijklmnop");
+	CHECK_EQUAL(0, strlen(socketcan.interfaceName));
+	CHECK(backend.Open(backend.context) != TWOCAN_RESULT_SUCCESS);
+	CHECK_EQUAL(-1, socketcan.socket);
+}
+
+// Frames written in loopback mode come back through ReadBatch with their contents intact
+static void TestLoopback(void) {
+	TOUCAN_FRAME sent[3];
+	TOUCAN_FRAME received[TOUCAN_MAX_READ_BATCH];
+	UINT32 written = 0;
+	UINT32 total = 0;
+	UINT32 count;
+
+	TouCAN_socketcan_backend(&backend, &socketcan, TEST_SOCKETCAN_INTERFACE);
+	if (backend.Open(backend.context) != TWOCAN_RESULT_SUCCESS) {
+		printf("socketcan: %s not available, loopback test skipped\n", TEST_SOCKETCAN_INTERFACE);
+		return;
+	}
+
+	CHECK(TouCAN_backend_init(&backend, TouCAN_ENABLE_LOOPBACK_MODE));
+	CHECK(TouCAN_backend_start(&backend));
+	CHECK(backend.ReadOpen(backend.context, 0, 0));
+
+	memset(sent, 0, sizeof(sent));
+	for (UINT32 i = 0; i < 3; i++) {
+		sent[i].id = TOUCAN_PDU2_ID(2, 127250, 0x10 + i);
+		sent[i].flags = TOUCAN_FRAME_EXTENDED;
+		sent[i].length = (UINT8)(6 + i);
+		memset(sent[i].data, 0x40 + i, sent[i].length);
+	}
+	CHECK(backend.WriteBatch(backend.context, sent, 3, &written));
+	CHECK_EQUAL(3, written);
+
+	for (UINT32 attempt = 0; (attempt < 10) && (total < 3); attempt++) {
+		if (backend.ReadBatch(backend.context, 100, &received[total], TOUCAN_MAX_READ_BATCH - total, &count) == TOUCAN_TRANSFER_COMPLETE) {
+			total += count;
+		}
+	}
+	CHECK_EQUAL(3, total);
+	for (UINT32 i = 0; (i < total) && (i < 3); i++) {
+		CHECK_EQUAL(sent[i].id, received[i].id);
+		CHECK_EQUAL(sent[i].length, received[i].length);
+		CHECK(memcmp(sent[i].data, received[i].data, sent[i].length) == 0);
+	}
+
+	// Each list / mask adds a filter to those already set, a reject all clears them
+	CHECK(TouCAN_backend_set_filter_ext_list_mask(&backend, FILTER_REJECT_ALL, 0, 0));
+	CHECK(TouCAN_backend_set_filter_ext_list_mask(&backend, FILTER_VALUE, sent[0].id, 0x1FFFFFFF));
+	CHECK(TouCAN_backend_set_filter_ext_list_mask(&backend, FILTER_VALUE, sent[2].id, 0x1FFFFFFF));
+	CHECK_EQUAL(2, socketcan.filterCount);
+	CHECK(backend.WriteBatch(backend.context, sent, 3, &written));
+
+	total = 0;
+	for (UINT32 attempt = 0; (attempt < 5) && (total < 3); attempt++) {
+		if (backend.ReadBatch(backend.context, 100, &received[total], TOUCAN_MAX_READ_BATCH - total, &count) == TOUCAN_TRANSFER_COMPLETE) {
+			total += count;
+		}
+	}
+	CHECK_EQUAL(2, total);
+	CHECK_EQUAL(sent[0].id, received[0].id);
+	CHECK_EQUAL(sent[2].id, received[1].id);
+	CHECK_EQUAL(0, socketcan.malformed);
+
+	backend.ReadClose(backend.context);
+	TouCAN_backend_stop(&backend);
+	backend.Close(backend.context);
+}
+
+int main(void) {
+	TestInterfaceName();
+	TestLoopback();
+	return TEST_RESULT();
+}
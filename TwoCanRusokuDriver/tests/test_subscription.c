@@ -0,0 +1,155 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Subscription Test
+// Unit Description: Tests of PGN subscriptions compiled into the adapter's acceptance filters
+// Function: Checks the banks of lists that fit the adapter, the greedy merge of lists that do not,
+// and the post filter discarding the frames a merged bank lets through
+//
+
+#include "../inc/toucan_subscription.h"
+#include "../Common/inc/twocanerror.h"
+#include "toucan_test.h"
+
+// Identifier bits of the PGN, without the priority
+#define TEST_PGN_MASK 0x03FFFF00
+
+// Frame from a source, to the global address for a PDU1 PGN
+static UINT32 Id(UINT32 pgn, UINT32 source) {
+	return TouCAN_header_is_pdu1(pgn) ? TOUCAN_PDU1_ID(6, pgn, TOUCAN_GLOBAL_ADDRESS, source) : TOUCAN_PDU2_ID(2, pgn, source);
+}
+
+// Number of banks passing a frame
+static UINT32 Passes(const TOUCAN_SUBSCRIPTION *subscription, UINT32 id) {
+	UINT32 passes = 0;
+
+	for (UINT32 i = 0; i < subscription->banks; i++) {
+		if (((id ^ subscription->bank[i].id) & subscription->bank[i].mask) == 0) {
+			passes++;
+		}
+	}
+	return passes;
+}
+
+// A list the adapter's filters hold is compiled one bank per distinct subscription
+static void TestExact(void) {
+	const UINT32 pgns[] = { 127250, 59904, 129025, 127250 };
+	const UINT8 sources[] = { TOUCAN_ANY_SOURCE, TOUCAN_ANY_SOURCE, 0x23, TOUCAN_ANY_SOURCE };
+	TOUCAN_SUBSCRIPTION subscription;
+
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, sources, 4, 4));
+	CHECK_EQUAL(3, subscription.count);
+	CHECK_EQUAL(3, subscription.banks);
+	CHECK(subscription.exact);
+
+	CHECK_EQUAL(127250U << 8, subscription.bank[0].id);
+	CHECK_EQUAL(TEST_PGN_MASK, subscription.bank[0].mask);
+
+	// A PDU1 PGN matches whatever the destination, a source address is matched when given
+	CHECK_EQUAL(TEST_PGN_MASK & ~0xFF00U, subscription.bank[1].mask);
+	CHECK_EQUAL(1, Passes(&subscription, TOUCAN_PDU1_ID(6, 59904, 0x10, 0x24)));
+	CHECK_EQUAL(TEST_PGN_MASK | 0xFF, subscription.bank[2].mask);
+	CHECK_EQUAL(1, Passes(&subscription, Id(129025, 0x23)));
+	CHECK_EQUAL(0, Passes(&subscription, Id(129025, 0x24)));
+
+	// The priority takes no part
+	CHECK_EQUAL(1, Passes(&subscription, TOUCAN_PDU2_ID(7, 127250, 0x01)));
+	CHECK(TouCAN_subscription_match(&subscription, TOUCAN_PDU2_ID(7, 127250, 0x01)));
+	CHECK(TouCAN_subscription_match(&subscription, Id(127251, 0x01)) == FALSE);
+}
+
+// Too many subscriptions, the two banks whose merge keeps the most bits significant merge first
+static void TestGreedyMerge(void) {
+	const UINT32 pgns[] = { 127250, 129025, 127251, 130306 };
+	TOUCAN_SUBSCRIPTION subscription;
+	BOOL found = FALSE;
+
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, 4, 3));
+	CHECK_EQUAL(4, subscription.count);
+	CHECK_EQUAL(3, subscription.banks);
+	CHECK(subscription.exact == FALSE);
+
+	// 127250 and 127251 differ in one bit, the merged bank leaves only that bit out
+	for (UINT32 i = 0; i < subscription.banks; i++) {
+		if ((subscription.bank[i].id == (127250U << 8)) && (subscription.bank[i].mask == (TEST_PGN_MASK & ~0x100U))) {
+			found = TRUE;
+		}
+	}
+	CHECK(found);
+
+	// Merged down to one bank, every subscription still passes
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, 4, 1));
+	CHECK_EQUAL(1, subscription.banks);
+	for (UINT32 i = 0; i < 4; i++) {
+		CHECK_EQUAL(1, Passes(&subscription, Id(pgns[i], 0x42)));
+	}
+}
+
+// Frames a merged bank passes but nothing subscribed to are discarded by the post filter
+static void TestPostFilter(void) {
+	const UINT32 pgns[] = { 127250, 127253 };
+	TOUCAN_SUBSCRIPTION subscription;
+
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, 2, 1));
+	CHECK(subscription.exact == FALSE);
+	CHECK_EQUAL(TEST_PGN_MASK & ~0x700U, subscription.bank[0].mask);
+
+	CHECK_EQUAL(1, Passes(&subscription, Id(127251, 0x01)));
+	CHECK(TouCAN_subscription_match(&subscription, Id(127251, 0x01)) == FALSE);
+	CHECK(TouCAN_subscription_match(&subscription, Id(127250, 0x01)));
+	CHECK(TouCAN_subscription_match(&subscription, Id(127253, 0x01)));
+	CHECK_EQUAL(0, Passes(&subscription, Id(127258, 0x01)));
+
+	// Nothing subscribed, everything passes
+	CHECK(TouCAN_subscription_compile(&subscription, NULL, NULL, 0, 1));
+	CHECK_EQUAL(0, subscription.banks);
+	CHECK(TouCAN_subscription_match(&subscription, Id(127251, 0x01)));
+}
+
+static void TestInvalid(void) {
+	UINT32 pgns[TOUCAN_MAX_SUBSCRIPTIONS + 1];
+	TOUCAN_SUBSCRIPTION subscription;
+
+	for (UINT32 i = 0; i <= TOUCAN_MAX_SUBSCRIPTIONS; i++) {
+		pgns[i] = 126976 + i;
+	}
+
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, TOUCAN_MAX_SUBSCRIPTIONS + 1, 1) == FALSE);
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, 1, 0) == FALSE);
+	pgns[0] = TOUCAN_MAX_PGN + 1;
+	CHECK(TouCAN_subscription_compile(&subscription, pgns, NULL, 1, 1) == FALSE);
+
+	// The most subscriptions, merged into the banks of a SocketCAN adapter
+	CHECK(TouCAN_subscription_compile(&subscription, &pgns[1], NULL, TOUCAN_MAX_SUBSCRIPTIONS, 16));
+	CHECK_EQUAL(16, subscription.banks);
+	for (UINT32 i = 1; i <= TOUCAN_MAX_SUBSCRIPTIONS; i++) {
+		CHECK(Passes(&subscription, Id(pgns[i], 0x01)) > 0);
+		CHECK(TouCAN_subscription_match(&subscription, Id(pgns[i], 0x01)));
+	}
+}
+
+int main(void) {
+	TestExact();
+	TestGreedyMerge();
+	TestPostFilter();
+	TestInvalid();
+	return TEST_RESULT();
+}
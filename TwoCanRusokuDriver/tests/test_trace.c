@@ -0,0 +1,153 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Trace Test
+// Unit Description: Tests of the binary event trace
+// Function: Records events from several threads, each on a ring of its own, and checks they
+// are drained, formatted and dumped in time order, and that a full ring drops rather than blocks
+//
+
+#include "../inc/toucan_trace.h"
+#include "toucan_test.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_THREADS 4
+#define TEST_EVENTS 100
+#define TEST_TRACE_PATH "test_trace.txt"
+
+static TOUCAN_TRACE_RECORD records[TOUCAN_TRACE_MAX_THREADS * TOUCAN_TRACE_RING_DEPTH];
+
+static void *RecordThread(void *argument) {
+	UINT32 thread = (UINT32)(size_t)argument;
+
+	for (UINT32 i = 0; i < TEST_EVENTS; i++) {
+		TouCAN_trace_record(TOUCAN_TRACE_LEVEL_INFO, TOUCAN_TRACE_PACKET, thread, i);
+	}
+	TouCAN_trace_release();
+	return NULL;
+}
+
+// Events come back with their arguments, in order within each thread
+static void TestThreads(void) {
+	pthread_t threads[TEST_THREADS];
+	UINT32 next[TEST_THREADS] = { 0 };
+	UINT32 count;
+
+	for (UINT32 t = 0; t < TEST_THREADS; t++) {
+		CHECK(pthread_create(&threads[t], NULL, RecordThread, (void *)(size_t)t) == 0);
+	}
+	for (UINT32 t = 0; t < TEST_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	count = TouCAN_trace_drain(records, TOUCAN_TRACE_MAX_THREADS * TOUCAN_TRACE_RING_DEPTH);
+	CHECK_EQUAL(TEST_THREADS * TEST_EVENTS, count);
+	for (UINT32 i = 0; i < count; i++) {
+		CHECK_EQUAL(TOUCAN_TRACE_PACKET, records[i].event);
+		if (records[i].args[0] < TEST_THREADS) {
+			CHECK_EQUAL(next[records[i].args[0]], records[i].args[1]);
+			next[records[i].args[0]]++;
+		}
+	}
+	CHECK_EQUAL(0, TouCAN_trace_drain(records, 1));
+}
+
+// A full ring drops further events until it is drained
+static void TestFull(void) {
+	UINT32 recorded;
+	UINT32 dropped;
+	UINT32 count;
+
+	for (UINT32 i = 0; i < TOUCAN_TRACE_RING_DEPTH + 10; i++) {
+		TouCAN_trace_record(TOUCAN_TRACE_LEVEL_DEBUG, TOUCAN_TRACE_MALFORMED_PACKET, i, 0);
+	}
+
+	TouCAN_trace_statistics(&recorded, &dropped);
+	CHECK_EQUAL((TEST_THREADS * TEST_EVENTS) + TOUCAN_TRACE_RING_DEPTH, recorded);
+	CHECK_EQUAL(10, dropped);
+
+	count = TouCAN_trace_drain(records, TOUCAN_TRACE_MAX_THREADS * TOUCAN_TRACE_RING_DEPTH);
+	CHECK_EQUAL(TOUCAN_TRACE_RING_DEPTH, count);
+	CHECK_EQUAL(TOUCAN_TRACE_RING_DEPTH - 1, records[count - 1].args[0]);
+	TouCAN_trace_release();
+}
+
+static void TestFormat(void) {
+	TOUCAN_TRACE_RECORD record;
+	char text[128];
+	UINT32 length;
+
+	memset(&record, 0, sizeof(record));
+	record.time = 1500000000;
+	record.thread = 3;
+	record.event = TOUCAN_TRACE_BUS_CONDITION;
+	record.level = TOUCAN_TRACE_LEVEL_WARNING;
+	record.args[0] = 2;
+	record.args[1] = 0x40;
+
+	length = TouCAN_trace_format(&record, text, sizeof(text));
+	CHECK(length > 0);
+	CHECK_EQUAL(strlen(text), length);
+	CHECK(strstr(text, "1.500000 3 WARNING Bus condition: 2 (error code 0x00000040)") != NULL);
+
+	// A line that does not fit is not truncated
+	CHECK_EQUAL(0, TouCAN_trace_format(&record, text, 16));
+}
+
+// The dump is in time order across threads
+static void TestDump(void) {
+	pthread_t thread;
+	FILE *file;
+	char line[256];
+	double previous = 0.0;
+	double time;
+	UINT32 lines = 0;
+
+	CHECK(pthread_create(&thread, NULL, RecordThread, (void *)(size_t)0) == 0);
+	pthread_join(thread, NULL);
+	RecordThread((void *)(size_t)1);
+
+	CHECK(TouCAN_trace_dump(TEST_TRACE_PATH));
+	file = fopen(TEST_TRACE_PATH, "r");
+	CHECK(file != NULL);
+	if (file != NULL) {
+		while (fgets(line, sizeof(line), file) != NULL) {
+			CHECK(sscanf(line, "%lf", &time) == 1);
+			CHECK(time >= previous);
+			previous = time;
+			lines++;
+		}
+		fclose(file);
+	}
+	CHECK_EQUAL(2 * TEST_EVENTS, lines);
+	remove(TEST_TRACE_PATH);
+}
+
+int main(void) {
+	TestThreads();
+	TestFull();
+	TestFormat();
+	TestDump();
+	return TEST_RESULT();
+}
@@ -0,0 +1,131 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+//
+// Unit: TouCAN Transmit Queue Test
+// Unit Description: Tests of the priority lanes drained by the writer thread
+// Function: Checks the transmit order, the signalling of an empty queue and the count of
+// frames waiting in the urgent lanes the writer thread checks before holding a transfer back
+//
+
+#include "../inc/toucan_txqueue.h"
+#include "toucan_test.h"
+
+#include <string.h>
+
+static TOUCAN_TX_QUEUE queue;
+
+static TOUCAN_FRAME Frame(UINT32 priority, UINT8 sequence) {
+	TOUCAN_FRAME frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = (priority << 26) | 0x00EF00 | sequence;
+	frame.flags = TOUCAN_FRAME_EXTENDED;
+	frame.length = 1;
+	frame.data[0] = sequence;
+	return frame;
+}
+
+// Frames leave most urgent priority first and in order within a priority
+static void TestOrder(void) {
+	TOUCAN_FRAME frames[8];
+	TOUCAN_FRAME frame;
+	BOOL wasEmpty;
+
+	CHECK(TouCAN_txqueue_init(&queue, 16));
+
+	frame = Frame(6, 1);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	CHECK(wasEmpty);
+	frame = Frame(6, 2);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	CHECK(wasEmpty == FALSE);
+	frame = Frame(2, 3);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	frame = Frame(0, 4);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+
+	CHECK_EQUAL(4, TouCAN_txqueue_pop(&queue, frames, 8));
+	CHECK_EQUAL(4, frames[0].data[0]);
+	CHECK_EQUAL(3, frames[1].data[0]);
+	CHECK_EQUAL(1, frames[2].data[0]);
+	CHECK_EQUAL(2, frames[3].data[0]);
+
+	// Drained, so the next frame signals the writer thread again
+	frame = Frame(6, 5);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	CHECK(wasEmpty);
+	CHECK_EQUAL(1, TouCAN_txqueue_pop(&queue, frames, 8));
+
+	TouCAN_txqueue_free(&queue);
+}
+
+// Only frames in the counted lanes are reported as waiting
+static void TestWaiting(void) {
+	TOUCAN_FRAME frames[8];
+	TOUCAN_FRAME frame;
+	BOOL wasEmpty;
+
+	CHECK(TouCAN_txqueue_init(&queue, 16));
+	CHECK_EQUAL(0, TouCAN_txqueue_waiting(&queue, TOUCAN_TX_LANES));
+
+	frame = Frame(3, 1);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	CHECK_EQUAL(0, TouCAN_txqueue_waiting(&queue, 3));
+	CHECK_EQUAL(1, TouCAN_txqueue_waiting(&queue, 4));
+
+	frame = Frame(2, 2);
+	CHECK(TouCAN_txqueue_push(&queue, &frame, &wasEmpty));
+	CHECK(wasEmpty == FALSE);
+	CHECK_EQUAL(1, TouCAN_txqueue_waiting(&queue, 3));
+	CHECK_EQUAL(2, TouCAN_txqueue_waiting(&queue, 100));
+
+	CHECK_EQUAL(1, TouCAN_txqueue_pop(&queue, frames, 1));
+	CHECK_EQUAL(2, frames[0].data[0]);
+	CHECK_EQUAL(0, TouCAN_txqueue_waiting(&queue, 3));
+	CHECK_EQUAL(1, TouCAN_txqueue_waiting(&queue, TOUCAN_TX_LANES));
+
+	TouCAN_txqueue_free(&queue);
+}
+
+// A full lane refuses the whole batch and counts the drops against its priority
+static void TestFullLane(void) {
+	TOUCAN_FRAME frames[8];
+	BOOL wasEmpty;
+
+	CHECK(TouCAN_txqueue_init(&queue, 4));
+	for (UINT8 i = 0; i < 8; i++) {
+		frames[i] = Frame(5, i);
+	}
+	CHECK(TouCAN_txqueue_push_batch(&queue, frames, 4, &wasEmpty));
+	CHECK(TouCAN_txqueue_push_batch(&queue, &frames[4], 2, &wasEmpty) == FALSE);
+	CHECK_EQUAL(2, queue.drops);
+	CHECK_EQUAL(2, queue.laneDrops[5]);
+	CHECK_EQUAL(4, TouCAN_txqueue_pop(&queue, frames, 8));
+
+	TouCAN_txqueue_free(&queue);
+}
+
+int main(void) {
+	TestOrder();
+	TestWaiting();
+	TestFullLane();
+	return TEST_RESULT();
+}
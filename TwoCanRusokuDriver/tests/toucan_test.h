@@ -0,0 +1,57 @@
+// Copyright(C) 2018 by Steven Adler
+// Copyright(C) 2021 Gediminas Simanskis, gediminas@rusoku.com
+//
+// This file is part of TwoCan, a plugin for OpenCPN.
+//
+// TwoCan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// TwoCan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with TwoCan. If not, see <https://www.gnu.org/licenses/>.
+//
+// NMEA2000 is a registered Trademark of the National Marine Electronics Association
+
+#ifndef _TWOCAN_TOUCAN_TEST
+#define _TWOCAN_TOUCAN_TEST
+
+#include <stdio.h>
+#include <time.h>
+
+// Minimal test harness shared by the programs in this directory.
+// A failed check is reported with its location and counted, main returns the count.
+
+static int testFailures = 0;
+
+#define CHECK(condition) do { \
+	if (!(condition)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+		testFailures++; \
+	} \
+} while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+	long long _expected = (long long)(expected); \
+	long long _actual = (long long)(actual); \
+	if (_expected != _actual) { \
+		fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, _actual, _expected); \
+		testFailures++; \
+	} \
+} while (0)
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)
+
+// Wall clock in microseconds, for the benchmarks
+static __inline long long TestNow(void) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return ((long long)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+#endif